@@ -27,7 +27,16 @@ FDB_HOST_IP=$(dig +short ${FDB_HOST})
 
 echo "docker:docker@${FDB_HOST_IP}:${FDB_PORT}" > fdb.cluster
 
-./build/bin/fdbdoc -l 127.0.0.1:27000 -d test -VV > test.out 2> test.err &
+# Either instance may be the TTL monitor, so both run it every second for the TTL tests
+TTL_KNOBS="--knob_ttl_monitor_interval 1 --knob_ttl_monitor_lease_time 5"
+
+./build/bin/fdbdoc -l 127.0.0.1:27000 -d test -VV --knob_connection_max_read_pipeline_depth 4 ${TTL_KNOBS} \
+    > test.out 2> test.err &
+
+# A second instance with one request slot, for the admission control tests
+./build/bin/fdbdoc -l 127.0.0.1:27001 -d test -VV --knob_admission_max_in_flight 1 --knob_admission_max_queue_length 1 \
+    --knob_admission_max_queue_time 2 ${TTL_KNOBS} > test-admission.out 2> test-admission.err &
+export DOCLAYER_ADMISSION_PORT=27001
 
 cd test/correctness/
 python document-correctness.py --doclayer-port 27000 unit doclayer mm
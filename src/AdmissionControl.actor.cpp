@@ -0,0 +1,116 @@
+/*
+ * AdmissionControl.actor.cpp
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "AdmissionControl.h"
+#include "DocLayer.h"
+#include "Knobs.h"
+
+AdmissionController::AdmissionController()
+    : inFlight(0), queues((int)AdmissionPriority::COUNT), waiting((int)AdmissionPriority::COUNT, 0) {}
+
+bool AdmissionController::anyQueued() {
+	for (int n : waiting) {
+		if (n > 0)
+			return true;
+	}
+	return false;
+}
+
+ACTOR static Future<Void> waitForAdmission(AdmissionController* self, AdmissionPriority priority, double deadline) {
+	state Reference<AdmissionController::Waiter> waiter(new AdmissionController::Waiter());
+	state double startTime = now();
+	state bool expires = deadline > 0 && deadline < startTime + DOCLAYER_KNOBS->ADMISSION_MAX_QUEUE_TIME;
+	state double maxQueueTime =
+	    expires ? std::max(deadline - startTime, 0.0) : DOCLAYER_KNOBS->ADMISSION_MAX_QUEUE_TIME;
+	auto& queue = self->queues[(int)priority];
+
+	if (self->waiting[(int)priority] >= DOCLAYER_KNOBS->ADMISSION_MAX_QUEUE_LENGTH) {
+		DocumentLayer::metricReporter->captureMeter("admissionRejected", 1);
+		throw server_overloaded();
+	}
+	queue.push_back(waiter);
+	DocumentLayer::metricReporter->captureGauge("admissionQueued", ++self->waiting[(int)priority]);
+
+	try {
+		choose {
+			when(Void _ = wait(waiter->admitted.getFuture())) {}
+			when(Void _ = wait(delay(maxQueueTime))) {
+				DocumentLayer::metricReporter->captureMeter("admissionRejected", 1);
+				TraceEvent(SevWarn, "BD_admissionRejected")
+				    .detail("priority", (int)priority)
+				    .detail("expired", expires)
+				    .suppressFor(1.0);
+				if (expires)
+					throw max_time_ms_expired();
+				throw server_overloaded();
+			}
+		}
+	} catch (Error& e) {
+		// release() skips abandoned waiters. If we were handed a slot just as we gave up, pass it on.
+		waiter->abandoned = true;
+		if (waiter->admitted.isSet())
+			self->release();
+		else
+			self->waiting[(int)priority]--;
+		throw;
+	}
+
+	DocumentLayer::metricReporter->captureTime("admissionQueueTime_us", (int64_t)((now() - startTime) * 1e6));
+	return Void();
+}
+
+Future<Void> AdmissionController::admit(AdmissionPriority priority, double deadline) {
+	if (DOCLAYER_KNOBS->ADMISSION_MAX_IN_FLIGHT <= 0)
+		return Void();
+	if (inFlight < DOCLAYER_KNOBS->ADMISSION_MAX_IN_FLIGHT && !anyQueued()) {
+		inFlight++;
+		return Void();
+	}
+	return waitForAdmission(this, priority, deadline);
+}
+
+void AdmissionController::release() {
+	if (DOCLAYER_KNOBS->ADMISSION_MAX_IN_FLIGHT <= 0)
+		return;
+	// Hand the slot directly to the first live waiter in priority order, so inFlight doesn't change.
+	for (int i = 0; i < queues.size(); i++) {
+		while (!queues[i].empty()) {
+			Reference<Waiter> waiter = queues[i].front();
+			queues[i].pop_front();
+			if (!waiter->abandoned) {
+				waiting[i]--;
+				waiter->admitted.send(Void());
+				return;
+			}
+		}
+	}
+	inFlight--;
+}
+
+ACTOR static void releaseWhenActor(Reference<AdmissionController> self, Future<Void> done) {
+	Void _ = wait(ready(done));
+	self->release();
+}
+
+void AdmissionController::releaseWhen(Future<Void> done) {
+	if (DOCLAYER_KNOBS->ADMISSION_MAX_IN_FLIGHT <= 0)
+		return;
+	releaseWhenActor(Reference<AdmissionController>::addRef(this), done);
+}
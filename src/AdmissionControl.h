@@ -0,0 +1,69 @@
+/*
+ * AdmissionControl.h
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _ADMISSION_CONTROL_H_
+#define _ADMISSION_CONTROL_H_
+
+#pragma once
+
+#include "flow/flow.h"
+
+/**
+ * Queues are served strictly in this order, so that an overloaded server can still be administered and reads are not
+ * starved by bulk writes or index builds.
+ */
+enum class AdmissionPriority { ADMIN = 0, READ, WRITE, INDEX_BUILD, COUNT };
+
+/**
+ * Process-wide limit on the number of requests being worked on at once. Requests beyond the limit wait in a queue per
+ * priority, and are rejected with server_overloaded if they can't start within ADMISSION_MAX_QUEUE_TIME, or if the
+ * queue is already ADMISSION_MAX_QUEUE_LENGTH long. A request whose own deadline passes while it is queued is rejected
+ * with max_time_ms_expired instead.
+ *
+ * Admission control is disabled if ADMISSION_MAX_IN_FLIGHT is 0.
+ */
+struct AdmissionController : ReferenceCounted<AdmissionController>, NonCopyable {
+	AdmissionController();
+
+	/**
+	 * Returns when the caller may start its request, or throws server_overloaded or max_time_ms_expired. The deadline
+	 * is an absolute time, 0 for none. Every successful admit() must be matched by a call to release(), or use
+	 * releaseWhen().
+	 */
+	Future<Void> admit(AdmissionPriority priority, double deadline = 0.0);
+	void release();
+	void releaseWhen(Future<Void> done);
+
+	int inFlight;
+
+	struct Waiter : ReferenceCounted<Waiter> {
+		Promise<Void> admitted;
+		bool abandoned = false;
+	};
+	std::vector<Deque<Reference<Waiter>>> queues;
+	// Waiters in each queue that haven't given up. Abandoned ones stay in the queue until release() reaches them, but
+	// don't count towards ADMISSION_MAX_QUEUE_LENGTH.
+	std::vector<int> waiting;
+
+private:
+	bool anyQueued();
+};
+
+#endif /* _ADMISSION_CONTROL_H_ */
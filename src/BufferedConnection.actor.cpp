@@ -19,28 +19,106 @@
  */
 
 #include "BufferedConnection.h"
+#include "Knobs.h"
 
 #include "flow/Net2Packet.h"
 
 #define BC_BLOCK_SIZE 4096
 
+static BufferedConnectionStats bcStats;
+
 struct BCBlock : FastAllocated<BCBlock> /*See below, NonCopyable */ {
+	enum { SMALL_SIZE = BC_BLOCK_SIZE };
+
 	Arena arena;
-	enum { DATA_SIZE = BC_BLOCK_SIZE - sizeof(Arena) };
-	uint8_t data[DATA_SIZE];
-	BCBlock() { static_assert(sizeof(BCBlock) == BC_BLOCK_SIZE, "BCBlock size mismatch"); }
+	uint8_t* data;
+	int capacity;
+	// Number of stream bytes this block holds once it has been filled. Equal to capacity, unless the tail of the
+	// block was moved into a larger block by relocate().
+	int limit;
+
+	static BCBlock* allocate(int count);
+	static void release(BCBlock* block);
+
 	// This is copied from NonCopyable, because MSVC doesn't implement properly "Empty Base Class Optimization"
 	// for more details take a look here :
 	// http://stackoverflow.com/questions/12701469/why-empty-base-class-optimization-is-not-working
 	BCBlock(const BCBlock&) = delete;
 	BCBlock& operator=(const BCBlock&) = delete;
+
+private:
+	BCBlock(uint8_t* data, int capacity) : data(data), capacity(capacity), limit(capacity) {}
+	~BCBlock() = default;
+};
+
+/**
+ * Large blocks are sized in powers of two so that the buffer of a large message can be reused for the next message
+ * of similar size instead of going back to malloc.
+ */
+struct BCLargeBlockPool {
+	std::map<int, std::vector<uint8_t*>> freeBuffers;
+
+	static int sizeClass(int count) {
+		int c = BCBlock::SMALL_SIZE * 2;
+		while (c < count && c < DOCLAYER_KNOBS->BUFFERED_CONNECTION_MAX_POOLED_BLOCK_SIZE)
+			c <<= 1;
+		return std::max(c, count);
+	}
+
+	uint8_t* get(int capacity) {
+		auto& buffers = freeBuffers[capacity];
+		if (buffers.empty()) {
+			bcStats.largeBlocksAllocated++;
+			return new uint8_t[capacity];
+		}
+		uint8_t* buf = buffers.back();
+		buffers.pop_back();
+		bcStats.largeBlocksReused++;
+		bcStats.largeBlocksPooled--;
+		return buf;
+	}
+
+	void put(uint8_t* buf, int capacity) {
+		auto& buffers = freeBuffers[capacity];
+		if (capacity > DOCLAYER_KNOBS->BUFFERED_CONNECTION_MAX_POOLED_BLOCK_SIZE ||
+		    buffers.size() >= DOCLAYER_KNOBS->BUFFERED_CONNECTION_POOLED_BLOCKS_PER_SIZE) {
+			delete[] buf;
+			return;
+		}
+		buffers.push_back(buf);
+		bcStats.largeBlocksPooled++;
+	}
 };
 
+static BCLargeBlockPool largeBlockPool;
+
+BCBlock* BCBlock::allocate(int count) {
+	if (count <= SMALL_SIZE) {
+		bcStats.smallBlocksAllocated++;
+		return new BCBlock((uint8_t*)FastAllocator<BC_BLOCK_SIZE>::allocate(), SMALL_SIZE);
+	}
+	int capacity = BCLargeBlockPool::sizeClass(count);
+	return new BCBlock(largeBlockPool.get(capacity), capacity);
+}
+
+void BCBlock::release(BCBlock* block) {
+	if (block->capacity == SMALL_SIZE)
+		FastAllocator<BC_BLOCK_SIZE>::release(block->data);
+	else
+		largeBlockPool.put(block->data, block->capacity);
+	delete block;
+}
+
 struct BufferedConnectionData {
 	explicit BufferedConnectionData(Reference<IConnection> connection);
 	~BufferedConnectionData() {
 		conn.cancel();
 		connection->close();
+		// Blocks are in one list or the other, never both
+		for (BCBlock* block : deadlist)
+			BCBlock::release(block);
+		for (BCBlock* block : buffer)
+			BCBlock::release(block);
 	}
 
 	Reference<IConnection> connection;
@@ -58,25 +136,73 @@ struct BufferedConnectionData {
 	UnsentPacketQueue unsent;
 
 	void copyInto(uint8_t* buf, int count);
+	bool fitsContiguously(int count);
+	void relocate(int count);
 };
 
+/**
+ * Returns true if count bytes starting at the current read position can end up in a single block, so that
+ * peekExact() will not need to reassemble them. Messages up to a small block in size are always considered to fit,
+ * since reassembling those is cheap.
+ */
+bool BufferedConnectionData::fitsContiguously(int count) {
+	if (count <= BCBlock::SMALL_SIZE)
+		return true;
+	if (buffer.size() != 1)
+		return false;
+	return buffer_begin_offset + count <= buffer.front()->capacity;
+}
+
+/**
+ * Moves the buffered bytes into a single block big enough to hold count bytes, so the rest of the message is read
+ * directly into its final place. Only called when everything buffered belongs to the pending message, which keeps the
+ * copy to at most the read-ahead that arrived together with the header.
+ */
+void BufferedConnectionData::relocate(int count) {
+	ASSERT(count > total_bytes.get());
+
+	BCBlock* block = BCBlock::allocate(count);
+	copyInto(block->data, total_bytes.get());
+	bcStats.bytesRelocated += total_bytes.get();
+
+	// The old blocks go on the deadlist rather than being freed, since results of earlier peeks (e.g. the message
+	// header) may still point into them. Their limits are shrunk to the bytes that were actually advanced over, so
+	// that pop() accounting is unaffected.
+	bool first = true;
+	for (BCBlock* b : buffer) {
+		b->limit = first ? buffer_begin_offset : 0;
+		first = false;
+		deadlist.push_back(b);
+	}
+	buffer.clear();
+
+	buffer.push_back(block);
+	buffer_begin_offset = 0;
+	buffer_end_offset = total_bytes.get();
+}
+
 ACTOR Future<Void> reader(BufferedConnectionData* self) {
 	loop {
 		loop {
 			Void _ = wait(self->connection->onReadable());
 			Void _ = wait(delay(0, TaskReadSocket));
 
-			int to_read = self->desired_bytes.get() + BCBlock::DATA_SIZE - self->total_bytes.get();
+			int to_read = self->desired_bytes.get() + BCBlock::SMALL_SIZE - self->total_bytes.get();
 			if (to_read <= 0)
 				break;
 
-			if (self->buffer_end_offset == BCBlock::DATA_SIZE || self->buffer.empty()) {
+			if (self->desired_bytes.get() > self->total_bytes.get() &&
+			    !self->fitsContiguously(self->desired_bytes.get())) {
+				// A message header announced more than fits in the current block. Read the rest of it straight into
+				// a right-sized block instead of reassembling it later.
+				self->relocate(self->desired_bytes.get());
+			} else if (self->buffer.empty() || self->buffer_end_offset == self->buffer.back()->capacity) {
 				// Last block is full, add one
-				self->buffer.push_back(new BCBlock());
+				self->buffer.push_back(BCBlock::allocate(BCBlock::SMALL_SIZE));
 				self->buffer_end_offset = 0;
 			}
 
-			to_read = std::min(to_read, BCBlock::DATA_SIZE - self->buffer_end_offset);
+			to_read = std::min(to_read, self->buffer.back()->capacity - self->buffer_end_offset);
 
 			uint8_t* buf = self->buffer.back()->data + self->buffer_end_offset;
 
@@ -89,7 +215,6 @@ ACTOR Future<Void> reader(BufferedConnectionData* self) {
 		Void _ = wait(self->desired_bytes.onChange());
 	}
 }
-
 ACTOR Future<Void> writer(BufferedConnectionData* self) {
 	loop {
 		Void _ = wait(self->on_data_write.onTrigger());
@@ -145,16 +270,16 @@ StringRef BufferedConnection::peekSome(int count, int offset) {
 	int block_offset = self->buffer_begin_offset;
 
 	while (offset) {
-		int advance = std::min(offset, BCBlock::DATA_SIZE - block_offset);
+		int advance = std::min(offset, (*it)->limit - block_offset);
 		offset -= advance;
 		block_offset += advance;
-		if (block_offset == BCBlock::DATA_SIZE) {
+		if (block_offset == (*it)->limit) {
 			block_offset = 0;
 			++it;
 		}
 	}
 
-	return {(*it)->data + block_offset, std::min(count, BCBlock::DATA_SIZE - block_offset)};
+	return {(*it)->data + block_offset, std::min(count, (*it)->limit - block_offset)};
 }
 
 void BufferedConnectionData::copyInto(uint8_t* buf, int count) {
@@ -166,7 +291,7 @@ void BufferedConnectionData::copyInto(uint8_t* buf, int count) {
 	int remaining = count;
 
 	while (remaining) {
-		int to_copy = std::min(BCBlock::DATA_SIZE - offset, remaining);
+		int to_copy = std::min((*it)->limit - offset, remaining);
 		memcpy(ptr, (*it)->data + offset, to_copy);
 		++it;
 		offset = 0;
@@ -178,18 +303,18 @@ void BufferedConnectionData::copyInto(uint8_t* buf, int count) {
 StringRef BufferedConnection::peekExact(int count) {
 	ASSERT(count <= self->total_bytes.get());
 
-	if (self->buffer_begin_offset + count <= BCBlock::DATA_SIZE) {
+	if (self->buffer_begin_offset + count <= self->buffer.front()->limit) {
 		/* requested byte range is in a single block */
 		return {self->buffer.front()->data + self->buffer_begin_offset, count};
 	} else {
 		/* find the _last_ block containing data for this range */
-		int remaining = count - (BCBlock::DATA_SIZE - self->buffer_begin_offset);
-
-		auto it = ++(self->buffer.begin());
+		auto it = self->buffer.begin();
+		int remaining = count - ((*it)->limit - self->buffer_begin_offset);
 
-		while (remaining > BCBlock::DATA_SIZE) {
+		++it;
+		while (remaining > (*it)->limit) {
+			remaining -= (*it)->limit;
 			++it;
-			remaining -= BCBlock::DATA_SIZE;
 		}
 
 		/* allocate memory in the arena of the last block from
@@ -199,6 +324,7 @@ StringRef BufferedConnection::peekExact(int count) {
 		auto* buf = new ((*it)->arena) uint8_t[count];
 
 		self->copyInto(buf, count);
+		bcStats.bytesReassembled += count;
 
 		return {buf, count};
 	}
@@ -208,13 +334,13 @@ void BufferedConnection::advance(int count) {
 	ASSERT(count <= self->total_bytes.get());
 
 	while (count) {
-		int to_remove = std::min(count, BCBlock::DATA_SIZE - self->buffer_begin_offset);
+		int to_remove = std::min(count, self->buffer.front()->limit - self->buffer_begin_offset);
 
 		self->desired_bytes.set(self->desired_bytes.get() - to_remove);
 		self->total_bytes.set(self->total_bytes.get() - to_remove);
 
 		self->buffer_begin_offset += to_remove;
-		if (self->buffer_begin_offset == BCBlock::DATA_SIZE) {
+		if (self->buffer_begin_offset == self->buffer.front()->limit) {
 			self->deadlist.push_back(self->buffer.front());
 			self->buffer.pop_front();
 			self->buffer_begin_offset = 0;
@@ -225,12 +351,14 @@ void BufferedConnection::advance(int count) {
 }
 
 void BufferedConnection::pop(int count) {
-	while (count) {
-		int to_remove = std::min(count, BCBlock::DATA_SIZE - self->deadlist_begin_offset);
+	while (count || (!self->deadlist.empty() && self->deadlist.front()->limit == self->deadlist_begin_offset)) {
+		// Bytes that have been advanced over but not yet popped may still be in the first block of the buffer
+		BCBlock* block = self->deadlist.empty() ? self->buffer.front() : self->deadlist.front();
+		int to_remove = std::min(count, block->limit - self->deadlist_begin_offset);
 
 		self->deadlist_begin_offset += to_remove;
-		if (self->deadlist_begin_offset == BCBlock::DATA_SIZE) {
-			delete self->deadlist.front();
+		if (self->deadlist_begin_offset == block->limit && !self->deadlist.empty()) {
+			BCBlock::release(self->deadlist.front());
 			self->deadlist.pop_front();
 			self->deadlist_begin_offset = 0;
 		}
@@ -315,3 +443,7 @@ int BufferedConnection::bytesAvailable() {
 NetworkAddress BufferedConnection::getPeerAddress() {
 	return self->connection->getPeerAddress();
 }
+
+const BufferedConnectionStats& BufferedConnection::getStats() {
+	return bcStats;
+}
@@ -26,6 +26,18 @@
 #include "flow/flow.h"
 #include "flow/network.h"
 
+/**
+ * Process-wide receive buffer statistics, shared by all BufferedConnections.
+ */
+struct BufferedConnectionStats {
+	int64_t smallBlocksAllocated = 0;
+	int64_t largeBlocksAllocated = 0;
+	int64_t largeBlocksReused = 0;
+	int64_t largeBlocksPooled = 0; // large blocks currently sitting idle in the pool
+	int64_t bytesRelocated = 0;    // bytes moved into a large block when a message outgrew the block it started in
+	int64_t bytesReassembled = 0;  // bytes copied by peekExact() to make a message spanning blocks contiguous
+};
+
 struct BufferedConnection : ReferenceCounted<BufferedConnection> {
 	explicit BufferedConnection(Reference<IConnection> connection);
 	~BufferedConnection();
@@ -53,6 +65,10 @@ struct BufferedConnection : ReferenceCounted<BufferedConnection> {
 	 * Returns exactly count bytes. The returned memory is guaranteed to be
 	 * valid until the next call to pop() or read().
 	 *
+	 * Messages announced through onBytesAvailable() are read into a single
+	 * right-sized block, so this normally doesn't copy. Only small ranges
+	 * that straddle two blocks are reassembled.
+	 *
 	 * NOTE: count MUST BE no greater than bytesAvailable()
 	 */
 	StringRef peekExact(int count);
@@ -105,6 +121,11 @@ struct BufferedConnection : ReferenceCounted<BufferedConnection> {
 	 */
 	NetworkAddress getPeerAddress();
 
+	/**
+	 * Returns receive buffer statistics aggregated over all connections.
+	 */
+	static const BufferedConnectionStats& getStats();
+
 private:
 	struct BufferedConnectionData* self;
 };
@@ -0,0 +1,155 @@
+/*
+ * ChangeLog.actor.cpp
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ChangeLog.h"
+#include "DocumentError.h"
+#include "ExtUtil.actor.h"
+#include "Knobs.h"
+#include "QLPlan.h"
+
+using namespace FDB;
+
+// Versionstamps are an 8 byte big endian commit version and a 2 byte batch order
+static const int VERSIONSTAMP_SIZE = 10;
+
+Key changeLogMutationKey(KeyRef prefix, uint32_t sequence) {
+	std::string k = prefix.toString();
+	k.append(VERSIONSTAMP_SIZE, '\0');
+	for (int shift = 24; shift >= 0; shift -= 8)
+		k.push_back((char)((sequence >> shift) & 0xff));
+	// SET_VERSIONSTAMPED_KEY takes the placeholder's offset from the last two bytes, little endian
+	uint16_t offset = (uint16_t)prefix.size();
+	k.push_back((char)(offset & 0xff));
+	k.push_back((char)(offset >> 8));
+	return Key(KeyRef(k));
+}
+
+Value changeLogEntry(StringRef encodedId, bool removed) {
+	bson::BSONObj entry = BSON("op" << (removed ? "delete" : "write") << "documentKey"
+	                                << DataValue::decode_key_part(encodedId).wrap("_id"));
+	return Value(StringRef((const uint8_t*)entry.objdata(), entry.objsize()));
+}
+
+Optional<Standalone<StringRef>> parseResumeToken(bson::BSONObj const& obj, const char* field) {
+	bson::BSONElement elem = obj.getField(field);
+	if (elem.eoo() || elem.isNull())
+		return Optional<Standalone<StringRef>>();
+	if (elem.type() == bson::BSONType::Object)
+		elem = elem.Obj().getField("_id");
+	if (elem.type() != bson::BSONType::BinData)
+		throw generic_invalid_parameter();
+	int len = 0;
+	const char* data = elem.binData(len);
+	if (len != CHANGE_LOG_TOKEN_SIZE)
+		throw generic_invalid_parameter();
+	return Standalone<StringRef>(StringRef((const uint8_t*)data, len));
+}
+
+// A token that sorts after every change committed at or before `version`
+static Standalone<StringRef> tokenAfterVersion(Version version) {
+	std::string token;
+	for (int shift = 56; shift >= 0; shift -= 8)
+		token.push_back((char)((version >> shift) & 0xff));
+	token.append(CHANGE_LOG_TOKEN_SIZE - token.size(), '\xff');
+	return Standalone<StringRef>(StringRef(token));
+}
+
+static bson::BSONObj changeEvent(KeyValueRef kv, int prefixSize) {
+	StringRef token = kv.key.substr(prefixSize);
+	bson::BSONObjBuilder bob;
+	bob.appendBinData("_id", token.size(), bson::BinDataGeneral, (const char*)token.begin());
+	bob.appendElements(bson::BSONObj((const char*)kv.value.begin()));
+	return bob.obj();
+}
+
+ACTOR Future<ChangeBatch> readChanges(Reference<DatabaseContext> database,
+                                      Reference<UnboundCollectionContext> cx,
+                                      Optional<Standalone<StringRef>> resumeAfter,
+                                      int limit,
+                                      double maxAwaitTime) {
+	state double endTime = now() + maxAwaitTime;
+	state Key prefix = cx->getChangeLogPrefix();
+	state Reference<DocTransaction> tr;
+
+	loop {
+		tr = NonIsolatedPlan::newTransaction(database);
+		try {
+			if (!resumeAfter.present()) {
+				Version v = wait(tr->tr->getReadVersion());
+				resumeAfter = tokenAfterVersion(v);
+			}
+			state Key begin = keyAfter(KeyRef(prefix.toString() + resumeAfter.get().toString()));
+			state FDBStandalone<RangeResultRef> rr =
+			    wait(tr->tr->getRange(KeyRangeRef(begin, strinc(prefix)), limit));
+
+			if (!rr.empty() || now() >= endTime) {
+				ChangeBatch batch;
+				for (const auto& kv : rr)
+					batch.events.push_back(changeEvent(kv, prefix.size()));
+				batch.resumeToken =
+				    rr.empty() ? resumeAfter.get() : Standalone<StringRef>(rr.back().key.substr(prefix.size()));
+				return batch;
+			}
+
+			// Every logged write also bumps the change counter, so a watch on it fires when there is more to read
+			state Future<Void> changed = tr->tr->watch(cx->getChangesKey());
+			Void _ = wait(tr->tr->commit());
+			choose {
+				when(Void _ = wait(changed)) {}
+				when(Void _ = wait(delay(std::max(endTime - now(), 0.0)))) {}
+			}
+		} catch (Error& e) {
+			Void _ = wait(tr->tr->onError(e));
+		}
+	}
+}
+
+ACTOR static Future<Void> doTailChanges(PlanCheckpoint* checkpoint,
+                                        PromiseStream<Reference<ScanReturnedContext>> output,
+                                        Reference<DatabaseContext> database,
+                                        Reference<UnboundCollectionContext> cx,
+                                        Optional<Standalone<StringRef>> resumeAfter) {
+	state PlanCheckpoint::FlowControlLock* flowControlLock = checkpoint->getDocumentFinishedLock();
+	try {
+		loop {
+			state ChangeBatch batch = wait(readChanges(database, cx, resumeAfter, DOCLAYER_KNOBS->CHANGE_LOG_READ_BATCH,
+			                                           DOCLAYER_KNOBS->CHANGE_LOG_WATCH_TIMEOUT));
+			state int i = 0;
+			for (; i < batch.events.size(); i++) {
+				Void _ = wait(flowControlLock->take());
+				output.send(ref(new ScanReturnedContext(ref(new BsonContext(batch.events[i], false)), -1, Key())));
+			}
+			resumeAfter = batch.resumeToken;
+		}
+	} catch (Error& e) {
+		if (e.code() != error_code_actor_cancelled)
+			output.sendError(e);
+		throw;
+	}
+}
+
+FutureStream<Reference<ScanReturnedContext>> tailChanges(PlanCheckpoint* checkpoint,
+                                                         Reference<DatabaseContext> database,
+                                                         Reference<UnboundCollectionContext> cx,
+                                                         Optional<Standalone<StringRef>> resumeAfter) {
+	PromiseStream<Reference<ScanReturnedContext>> events;
+	checkpoint->addOperation(doTailChanges(checkpoint, events, database, cx, resumeAfter), events);
+	return events.getFuture();
+}
@@ -0,0 +1,72 @@
+/*
+ * ChangeLog.h
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CHANGE_LOG_H_
+#define _CHANGE_LOG_H_
+
+#pragma once
+
+#include "QLContext.h"
+
+/*
+ * A collection created (or re-created) with {changeLog: true} records every committed document write in a change log
+ * kept in its metadata subspace. Entries are keyed by the writing transaction's versionstamp followed by a 4 byte
+ * sequence number, so they sort in commit order, and are written without reads so they never cause conflicts.
+ *
+ * Readers see each entry as a change event:
+ *     {_id: <resume token>, op: "write" | "delete", documentKey: {_id: ...}}
+ * where the resume token is the 14 byte suffix of the entry's key. Passing an event's token as `resumeAfter` to the
+ * watch command or to a tailable query continues with the next event.
+ */
+
+enum { CHANGE_LOG_TOKEN_SIZE = 14 };
+
+// Key to write with SET_VERSIONSTAMPED_KEY for the change log entry numbered `sequence` within a transaction.
+FDB::Key changeLogMutationKey(FDB::KeyRef prefix, uint32_t sequence);
+FDB::Value changeLogEntry(StringRef encodedId, bool removed);
+
+// Reads a resume token from obj[field], which may be the token itself or a whole change event.
+Optional<Standalone<StringRef>> parseResumeToken(bson::BSONObj const& obj, const char* field);
+
+struct ChangeBatch {
+	std::vector<bson::BSONObj> events;
+	Standalone<StringRef> resumeToken; // Token of the last event, or where the next read should start if none
+};
+
+/**
+ * Returns up to `limit` change events after `resumeAfter`, or after the present if it's absent. If there are none yet,
+ * waits up to `maxAwaitTime` seconds for a write to the collection, using an FDB watch on its change counter.
+ */
+Future<ChangeBatch> readChanges(Reference<FDB::DatabaseContext> const& database,
+                                Reference<UnboundCollectionContext> const& cx,
+                                Optional<Standalone<StringRef>> const& resumeAfter,
+                                int const& limit,
+                                double const& maxAwaitTime);
+
+/**
+ * Endless stream of change events, for tailable cursors. The stream is registered with `checkpoint` and honors its
+ * flow control lock, so Cursor::pluck() stops it like any other plan.
+ */
+FutureStream<Reference<ScanReturnedContext>> tailChanges(struct PlanCheckpoint* checkpoint,
+                                                         Reference<FDB::DatabaseContext> database,
+                                                         Reference<UnboundCollectionContext> cx,
+                                                         Optional<Standalone<StringRef>> resumeAfter);
+
+#endif /* _CHANGE_LOG_H_ */
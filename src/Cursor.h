@@ -33,6 +33,8 @@ struct Cursor : ReferenceCounted<Cursor>, NonCopyable {
 	int32_t returned;
 	std::map<int64_t, Reference<Cursor>>* siblings;
 	time_t expiry;
+	bool tailable = false; // Reads a change log and stays open after running out of documents
+	bool awaitData = false; // A tailable cursor that waits a while for more documents before replying
 
 	Cursor(FutureStream<Reference<ScanReturnedContext>> docs, Reference<PlanCheckpoint> checkpoint)
 	    : docs(docs), checkpoint(checkpoint), returned(0) {
@@ -40,6 +40,7 @@
 #include "ExtMsg.h"
 #include "IMetric.h"
 #include "StatusService.h"
+#include "TTLMonitor.h"
 
 #include "flow/SystemMonitor.h"
 
@@ -140,23 +141,80 @@ ACTOR Future<Void> wrapError(Future<Void> actorThatCouldThrow) {
 	return Void();
 }
 
-Future<Void> processRequest(Reference<ExtConnection> ec,
-                            ExtMsgHeader* header,
-                            const uint8_t* body,
-                            Promise<Void> finished) {
+Reference<ExtMsg> parseRequest(ExtMsgHeader* header, const uint8_t* body, Promise<Void> finished) {
 	try {
 		Reference<ExtMsg> msg = ExtMsg::create(header, body, finished);
 		if (verboseLogging)
 			TraceEvent("BD_processRequest").detail("Message", msg->toString());
 		if (verboseConsoleOutput)
 			fprintf(stderr, "C -> S: %s\n\n", msg->toString().c_str());
-		return msg->run(ec);
+		return msg;
 	} catch (Error& e) {
 		TraceEvent(SevWarnAlways, "BD_processRequest").detail("errorUnknownOpCode", header->opCode);
+		return Reference<ExtMsg>();
+	}
+}
+
+ACTOR Future<Void> runPipelinedRequest(Reference<ExtConnection> ec, Reference<ExtMsg> msg, Reference<FlowLock> lock) {
+	try {
+		Void _ = wait(msg->run(ec));
+		lock->release();
 		return Void();
+	} catch (...) {
+		lock->release();
+		throw;
 	}
 }
 
+/**
+ * Runs one request. Requests that are safe to pipeline are started concurrently with the ones before them, up to
+ * CONNECTION_MAX_READ_PIPELINE_DEPTH at a time. Anything else first waits for all pipelined requests to finish, so
+ * writes and commands (getLastError in particular) observe the same ordering as if everything had run serially.
+ * Replies still go out in request order, see ExtConnection::orderReplies().
+ *
+ * Every request also has to get past the process-wide admission controller, which may turn it away with
+ * server_overloaded, or with max_time_ms_expired if the request's own deadline passes first.
+ */
+ACTOR Future<Void> processRequest(Reference<ExtConnection> ec,
+                                  Reference<ExtMsg> msg,
+                                  Future<Void> finished,
+                                  Reference<FlowLock> readPipeline,
+                                  ActorCollection* pipelinedReads) {
+	state bool pipelined;
+	state Optional<Error> rejected;
+
+	if (!msg)
+		return Void();
+
+	pipelined = DOCLAYER_KNOBS->CONNECTION_MAX_READ_PIPELINE_DEPTH > 1 && msg->isPipelinable(ec);
+	if (!pipelined) {
+		Void _ = wait(readPipeline->take(TaskDefaultYield, DOCLAYER_KNOBS->CONNECTION_MAX_READ_PIPELINE_DEPTH));
+		readPipeline->release(DOCLAYER_KNOBS->CONNECTION_MAX_READ_PIPELINE_DEPTH);
+	}
+
+	try {
+		Void _ = wait(ec->docLayer->admission->admit(msg->priority(), msg->deadline()));
+	} catch (Error& e) {
+		if (e.code() != error_code_server_overloaded && e.code() != error_code_max_time_ms_expired)
+			throw;
+		rejected = e;
+	}
+	if (rejected.present()) {
+		Void _ = wait(msg->reject(ec, rejected.get()));
+		return Void();
+	}
+	// The slot is held until the message is disposed of, which for writes is well after run() returns
+	ec->docLayer->admission->releaseWhen(finished);
+
+	if (pipelined) {
+		Void _ = wait(readPipeline->take());
+		pipelinedReads->add(runPipelinedRequest(ec, msg, readPipeline));
+	} else {
+		Void _ = wait(msg->run(ec));
+	}
+	return Void();
+}
+
 ACTOR Future<Void> popDisposedMessages(Reference<BufferedConnection> bc,
                                        FutureStream<std::pair<int, Future<Void>>> msg_size_inuse) {
 	loop {
@@ -177,7 +235,10 @@ ACTOR Future<Void> extServerConnection(Reference<DocumentLayer> docLayer,
 
 	state Reference<ExtConnection> ec = Reference<ExtConnection>(new ExtConnection(docLayer, bc, connectionId));
 	state PromiseStream<std::pair<int, Future<Void>>> msg_size_inuse;
-	state Future<Void> onError = ec->bc->onClosed() || popDisposedMessages(bc, msg_size_inuse.getFuture());
+	state Reference<FlowLock> readPipeline(new FlowLock(DOCLAYER_KNOBS->CONNECTION_MAX_READ_PIPELINE_DEPTH));
+	state ActorCollection pipelinedReads(false);
+	state Future<Void> onError =
+	    ec->bc->onClosed() || popDisposedMessages(bc, msg_size_inuse.getFuture()) || pipelinedReads.getResult();
 
 	DocumentLayer::metricReporter->captureGauge("activeConnections", ++docLayer->nrConnections);
 	try {
@@ -210,8 +271,9 @@ ACTOR Future<Void> extServerConnection(Reference<DocumentLayer> docLayer,
 					   for everything at and below processRequest to assume that
 					   body - header == sizeof(ExtMsgHeader) */
 					ec->updateMaxReceivedRequestID(header->requestID);
-					Void _ = wait(
-					    processRequest(ec, (ExtMsgHeader*)sr.begin(), sr.begin() + sizeof(ExtMsgHeader), finished));
+					Reference<ExtMsg> msg =
+					    parseRequest((ExtMsgHeader*)sr.begin(), sr.begin() + sizeof(ExtMsgHeader), finished);
+					Void _ = wait(processRequest(ec, msg, finished.getFuture(), readPipeline, &pipelinedReads));
 
 					ec->bc->advance(header->messageLength);
 					msg_size_inuse.send(std::make_pair(header->messageLength, finished.getFuture()));
@@ -235,9 +297,17 @@ ACTOR void extServer(Reference<DocumentLayer> docLayer, NetworkAddress addr) {
 
 		loop choose {
 			when(Reference<IConnection> conn = wait(listener->accept())) {
-				Reference<BufferedConnection> bc(new BufferedConnection(conn));
-				connections.add(extServerConnection(docLayer, bc, nextConnectionId));
-				nextConnectionId++;
+				if (DOCLAYER_KNOBS->MAX_CONNECTIONS > 0 && docLayer->nrConnections >= DOCLAYER_KNOBS->MAX_CONNECTIONS) {
+					TraceEvent(SevWarn, "BD_connectionRejected")
+					    .detail("activeConnections", docLayer->nrConnections)
+					    .suppressFor(1.0);
+					DocumentLayer::metricReporter->captureMeter("connectionsRejected", 1);
+					conn->close();
+				} else {
+					Reference<BufferedConnection> bc(new BufferedConnection(conn));
+					connections.add(extServerConnection(docLayer, bc, nextConnectionId));
+					nextConnectionId++;
+				}
 			}
 			when(Void _ = wait(connections.getResult())) { ASSERT(false); }
 		}
@@ -536,6 +606,7 @@ ACTOR void setup(NetworkAddress na,
 			}
 		}
 		statusUpdateActor(FDB_DOC_VT_PACKAGE_NAME, toIPString(na.ip), na.port, docLayer, timer() * 1000);
+		docLayer->backgroundTasks.add(wrapError(ttlMonitor(docLayer)));
 		extServer(docLayer, na);
 
 		if (!unitTestPattern.empty())
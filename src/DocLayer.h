@@ -29,10 +29,12 @@
 #include "flow/ActorCollection.h"
 #include "flow/flow.h"
 
+#include "AdmissionControl.h"
 #include "Cursor.h"
 #include "IMetric.h"
 #include "Knobs.h"
 #include "MetadataManager.h"
+#include "QueryCache.h"
 
 struct ConnectionOptions {
 	bool pipelineCompatMode;
@@ -51,13 +53,17 @@ struct DocumentLayer : ReferenceCounted<DocumentLayer>, NonCopyable {
 	      database(database),
 	      backgroundTasks(false),
 	      rootDirectory(rootDirectory),
-	      mm(new MetadataManager(this)) {}
+	      mm(new MetadataManager(this)),
+	      admission(new AdmissionController()),
+	      queryCache(new QueryCache()) {}
 
 	Reference<FDB::DatabaseContext> database;
 	Reference<MetadataManager> mm;
 	ConnectionOptions defaultConnectionOptions;
 	ActorCollection backgroundTasks;
 	Reference<DirectorySubspace> rootDirectory;
+	Reference<AdmissionController> admission;
+	Reference<QueryCache> queryCache;
 	static IMetricReporter* metricReporter;
 
 	// Stats
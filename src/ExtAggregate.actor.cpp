@@ -0,0 +1,638 @@
+/*
+ * ExtAggregate.actor.cpp
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * MongoDB is a registered trademark of MongoDB, Inc.
+ */
+
+#include "bson.h"
+#include "ordering.h"
+
+#include "DocumentError.h"
+#include "ExtAggregate.h"
+#include "ExtMsg.h"
+#include "Knobs.h"
+#include "QLPlan.h"
+#include "QLProjection.h"
+
+Reference<IPredicate> queryToPredicate(bson::BSONObj const& query, bool toplevel);
+Reference<Plan> planProjection(Reference<Plan> plan,
+                               bson::BSONObj const& selector,
+                               Optional<bson::BSONObj> const& ordering);
+
+// Orders BSON values the way queries compare them, so 1 and 1.0 are the same group key
+struct BsonValueLess {
+	bool operator()(bson::BSONObj const& lhs, bson::BSONObj const& rhs) const {
+		return lhs.woCompare(rhs, bson::BSONObj(), false) < 0;
+	}
+};
+
+/**
+ * Appends the value of the aggregation expression `expr`, evaluated against `doc`, to `bob` as `name`. An expression is
+ * a field reference ("$a.b"), an object of expressions or a literal. Nothing is appended for a missing field.
+ */
+static void appendExpression(bson::BSONObjBuilder& bob,
+                             std::string const& name,
+                             bson::BSONElement const& expr,
+                             bson::BSONObj const& doc) {
+	if (expr.type() == bson::BSONType::String && expr.valuestr()[0] == '$') {
+		bson::BSONElement value = doc.getFieldDotted(expr.valuestr() + 1);
+		if (!value.eoo())
+			bob.appendAs(value, name);
+	} else if (expr.type() == bson::BSONType::Object) {
+		bson::BSONObj fields = expr.Obj();
+		if (!fields.isEmpty() && fields.firstElementFieldName()[0] == '$')
+			throw unsupported_aggregation_operator();
+		bson::BSONObjBuilder sub(bob.subobjStart(name));
+		for (auto i = fields.begin(); i.more();) {
+			auto el = i.next();
+			appendExpression(sub, el.fieldName(), el, doc);
+		}
+		sub.done();
+	} else {
+		bob.appendAs(expr, name);
+	}
+}
+
+// The value of `expr` against `doc` as {"": value}, or an empty object if it's missing
+static bson::BSONObj evaluateExpression(bson::BSONElement const& expr, bson::BSONObj const& doc) {
+	bson::BSONObjBuilder bob;
+	appendExpression(bob, "", expr, doc);
+	return bob.obj();
+}
+
+static bool isNumberOrBool(bson::BSONElement const& el) {
+	return el.isNumber() || el.type() == bson::BSONType::Bool;
+}
+
+static int64_t stageCount(bson::BSONElement const& el) {
+	if (!el.isNumber() || el.numberLong() < 0)
+		throw generic_invalid_parameter();
+	return el.numberLong();
+}
+
+struct AggregationStage : ReferenceCounted<AggregationStage> {
+	bson::BSONObj spec; // The stage as given in the pipeline
+
+	explicit AggregationStage(bson::BSONObj const& spec) : spec(spec) {}
+	virtual ~AggregationStage() = default;
+
+	// Passes one document through the stage, appending whatever it lets out to `out`
+	virtual Future<Void> process(bson::BSONObj const& doc, std::vector<bson::BSONObj>* out) = 0;
+
+	// Called once the input is exhausted, for stages that hold documents back
+	virtual void finish(std::vector<bson::BSONObj>* out) {}
+
+	// True once the stage won't let any more documents out
+	virtual bool done() const { return false; }
+};
+
+struct MatchStage : AggregationStage {
+	Reference<IPredicate> predicate;
+
+	explicit MatchStage(bson::BSONObj const& spec)
+	    : AggregationStage(spec), predicate(queryToPredicate(spec.firstElement().Obj(), true)->simplify()) {}
+
+	Future<Void> process(bson::BSONObj const& doc, std::vector<bson::BSONObj>* out) override {
+		bson::BSONObj d = doc;
+		return map(predicate->evaluate(ref(new BsonContext(doc, false))), [d, out](bool keep) {
+			if (keep)
+				out->push_back(d);
+			return Void();
+		});
+	}
+};
+
+// A $project of inclusions and exclusions only, which projects like find does
+struct ProjectStage : AggregationStage {
+	Reference<Projection> projection;
+
+	explicit ProjectStage(bson::BSONObj const& spec)
+	    : AggregationStage(spec), projection(parseProjection(spec.firstElement().Obj())) {}
+
+	Future<Void> process(bson::BSONObj const& doc, std::vector<bson::BSONObj>* out) override {
+		return map(projectDocument(ref(new BsonContext(doc, false)), projection, Optional<bson::BSONObj>()),
+		           [out](bson::BSONObj projected) {
+			           out->push_back(projected);
+			           return Void();
+		           });
+	}
+};
+
+// A $project that computes fields: {total: "$amount", region: {name: "$city"}, _id: 0}
+struct ComputedProjectStage : AggregationStage {
+	bson::BSONObj fields;
+	bool includeId;
+
+	explicit ComputedProjectStage(bson::BSONObj const& spec)
+	    : AggregationStage(spec), fields(spec.firstElement().Obj()), includeId(true) {
+		for (auto i = fields.begin(); i.more();) {
+			auto el = i.next();
+			if (strchr(el.fieldName(), '.'))
+				throw invalid_projection();
+			if (!strcmp(el.fieldName(), "_id")) {
+				includeId = false;
+				if (isNumberOrBool(el))
+					includeId = el.trueValue();
+			} else if (isNumberOrBool(el) && !el.trueValue()) {
+				// Only _id may be excluded alongside computed fields
+				throw invalid_projection();
+			}
+		}
+	}
+
+	Future<Void> process(bson::BSONObj const& doc, std::vector<bson::BSONObj>* out) override {
+		bson::BSONObjBuilder bob;
+		if (includeId) {
+			bson::BSONElement id = doc.getField("_id");
+			if (!id.eoo())
+				bob.append(id);
+		}
+		for (auto i = fields.begin(); i.more();) {
+			auto el = i.next();
+			if (isNumberOrBool(el)) {
+				bson::BSONElement value = doc.getField(el.fieldName());
+				if (strcmp(el.fieldName(), "_id") && !value.eoo())
+					bob.append(value);
+			} else {
+				appendExpression(bob, el.fieldName(), el, doc);
+			}
+		}
+		out->push_back(bob.obj());
+		return Void();
+	}
+};
+
+struct SkipStage : AggregationStage {
+	int64_t skip;
+
+	explicit SkipStage(bson::BSONObj const& spec) : AggregationStage(spec), skip(stageCount(spec.firstElement())) {}
+
+	Future<Void> process(bson::BSONObj const& doc, std::vector<bson::BSONObj>* out) override {
+		if (skip > 0)
+			skip--;
+		else
+			out->push_back(doc);
+		return Void();
+	}
+};
+
+struct LimitStage : AggregationStage {
+	int64_t remaining;
+
+	explicit LimitStage(bson::BSONObj const& spec)
+	    : AggregationStage(spec), remaining(stageCount(spec.firstElement())) {
+		if (remaining == 0)
+			throw generic_invalid_parameter();
+	}
+
+	Future<Void> process(bson::BSONObj const& doc, std::vector<bson::BSONObj>* out) override {
+		if (remaining > 0) {
+			out->push_back(doc);
+			remaining--;
+		}
+		return Void();
+	}
+
+	bool done() const override { return remaining == 0; }
+};
+
+/**
+ * Sorts its whole input, or with `limit` set keeps only the first `limit` documents in sort order. Those are found by
+ * letting the buffer grow to twice the limit and then cutting it back with a partial sort, so each document is
+ * compared a constant number of times on average.
+ */
+struct SortStage : AggregationStage {
+	typedef std::pair<bson::BSONObj, bson::BSONObj> KeyAndDocument;
+
+	bson::BSONObj orderObj;
+	bson::Ordering ordering;
+	int64_t limit; // 0 for none
+	std::vector<KeyAndDocument> buffer;
+	int64_t memory;
+
+	SortStage(bson::BSONObj const& spec, int64_t limit)
+	    : AggregationStage(spec),
+	      orderObj(spec.firstElement().Obj()),
+	      ordering(bson::Ordering::make(orderObj)),
+	      limit(limit),
+	      memory(0) {
+		if (orderObj.isEmpty())
+			throw bad_sort_specifier();
+		for (auto i = orderObj.begin(); i.more();) {
+			auto el = i.next();
+			if (!el.isNumber() || (el.numberInt() != 1 && el.numberInt() != -1))
+				throw bad_sort_specifier();
+		}
+	}
+
+	bool operator()(KeyAndDocument const& lhs, KeyAndDocument const& rhs) const {
+		return lhs.first.woCompare(rhs.first, ordering, false) < 0;
+	}
+
+	Future<Void> process(bson::BSONObj const& doc, std::vector<bson::BSONObj>* out) override {
+		bson::BSONObj key = doc.extractFields(orderObj, true);
+		memory += key.objsize() + doc.objsize();
+		buffer.emplace_back(key, doc);
+		if (limit && buffer.size() >= 2 * (size_t)limit)
+			trim();
+		if (memory > DOCLAYER_KNOBS->AGGREGATE_MAX_STAGE_MEMORY)
+			throw aggregation_memory_limit();
+		return Void();
+	}
+
+	void finish(std::vector<bson::BSONObj>* out) override {
+		if (limit && buffer.size() > (size_t)limit)
+			trim();
+		std::stable_sort(buffer.begin(), buffer.end(), std::cref(*this));
+		for (auto const& kd : buffer)
+			out->push_back(kd.second);
+		buffer.clear();
+	}
+
+private:
+	void trim() {
+		std::nth_element(buffer.begin(), buffer.begin() + limit, buffer.end(), std::cref(*this));
+		buffer.resize(limit);
+		memory = 0;
+		for (auto const& kd : buffer)
+			memory += kd.first.objsize() + kd.second.objsize();
+	}
+};
+
+/**
+ * Hash aggregation for $group: each input document updates the accumulators of the group its _id expression selects,
+ * and the groups are let out once the input is exhausted.
+ */
+struct GroupStage : AggregationStage {
+	enum Op { SUM, AVG, MIN, MAX, FIRST, LAST, PUSH, ADD_TO_SET };
+
+	struct Accumulator {
+		std::string field;
+		Op op;
+		bson::BSONElement argument;
+	};
+
+	struct AccumulatorValue {
+		int64_t count = 0; // Numbers summed for $sum and $avg, values seen for $first
+		long long longSum = 0;
+		double doubleSum = 0;
+		bool sawLong = false;
+		bool sawDouble = false;
+		bson::BSONObj value; // For $min, $max, $first and $last, as {"": value}
+		std::vector<bson::BSONObj> values; // For $push
+		std::set<bson::BSONObj, BsonValueLess> valueSet; // For $addToSet
+	};
+
+	bson::BSONElement idExpression;
+	std::vector<Accumulator> accumulators;
+	std::map<bson::BSONObj, std::vector<AccumulatorValue>, BsonValueLess> groups;
+	int64_t memory;
+
+	explicit GroupStage(bson::BSONObj const& spec) : AggregationStage(spec), memory(0) {
+		static const std::map<std::string, Op> ops = {
+			{ "$sum", SUM },     { "$avg", AVG },   { "$min", MIN },   { "$max", MAX },
+			{ "$first", FIRST }, { "$last", LAST }, { "$push", PUSH }, { "$addToSet", ADD_TO_SET }
+		};
+
+		bson::BSONObj fields = spec.firstElement().Obj();
+		idExpression = fields.getField("_id");
+		if (idExpression.eoo())
+			throw generic_invalid_parameter();
+		for (auto i = fields.begin(); i.more();) {
+			auto el = i.next();
+			if (!strcmp(el.fieldName(), "_id"))
+				continue;
+			if (strchr(el.fieldName(), '.') || el.type() != bson::BSONType::Object || el.Obj().nFields() != 1)
+				throw generic_invalid_parameter();
+			auto op = ops.find(el.Obj().firstElementFieldName());
+			if (op == ops.end())
+				throw unsupported_aggregation_operator();
+			accumulators.push_back(Accumulator{ el.fieldName(), op->second, el.Obj().firstElement() });
+		}
+	}
+
+	Future<Void> process(bson::BSONObj const& doc, std::vector<bson::BSONObj>* out) override {
+		bson::BSONObj key = evaluateExpression(idExpression, doc);
+		if (key.isEmpty())
+			key = BSON("" << bson::BSONNULL);
+
+		auto group = groups.find(key);
+		if (group == groups.end()) {
+			group = groups.emplace(key, std::vector<AccumulatorValue>(accumulators.size())).first;
+			memory += key.objsize() + accumulators.size() * sizeof(AccumulatorValue);
+		}
+		for (int i = 0; i < accumulators.size(); i++)
+			accumulate(accumulators[i].op, group->second[i], evaluateExpression(accumulators[i].argument, doc));
+
+		if (memory > DOCLAYER_KNOBS->AGGREGATE_MAX_STAGE_MEMORY)
+			throw aggregation_memory_limit();
+		return Void();
+	}
+
+	void finish(std::vector<bson::BSONObj>* out) override {
+		for (auto const& group : groups) {
+			bson::BSONObjBuilder bob;
+			bob.appendAs(group.first.firstElement(), "_id");
+			for (int i = 0; i < accumulators.size(); i++)
+				appendResult(bob, accumulators[i], group.second[i]);
+			out->push_back(bob.obj());
+		}
+		groups.clear();
+	}
+
+private:
+	void accumulate(Op op, AccumulatorValue& acc, bson::BSONObj const& value) {
+		bson::BSONElement el = value.firstElement();
+		switch (op) {
+		case SUM:
+		case AVG:
+			if (el.isNumber()) {
+				acc.count++;
+				acc.sawDouble |= el.type() == bson::BSONType::NumberDouble;
+				acc.sawLong |= el.type() == bson::BSONType::NumberLong;
+				acc.longSum += el.numberLong();
+				acc.doubleSum += el.numberDouble();
+			}
+			break;
+		case MIN:
+		case MAX:
+			if (!el.eoo() && !el.isNull()) {
+				int cmp = acc.value.isEmpty() ? 0 : el.woCompare(acc.value.firstElement(), false);
+				if (acc.value.isEmpty() || (op == MIN ? cmp < 0 : cmp > 0))
+					acc.value = value.getOwned();
+			}
+			break;
+		case FIRST:
+			if (acc.count++ == 0)
+				acc.value = value.getOwned();
+			break;
+		case LAST:
+			acc.value = value.getOwned();
+			break;
+		case PUSH:
+			if (!el.eoo()) {
+				acc.values.push_back(value.getOwned());
+				memory += value.objsize();
+			}
+			break;
+		case ADD_TO_SET:
+			if (!el.eoo() && acc.valueSet.insert(value.getOwned()).second)
+				memory += value.objsize();
+			break;
+		}
+	}
+
+	static void appendResult(bson::BSONObjBuilder& bob, Accumulator const& accumulator, AccumulatorValue const& acc) {
+		const std::string& field = accumulator.field;
+		switch (accumulator.op) {
+		case SUM:
+			if (acc.sawDouble)
+				bob.append(field, acc.doubleSum);
+			else if (acc.sawLong || acc.longSum != (int)acc.longSum)
+				bob.append(field, acc.longSum);
+			else
+				bob.append(field, (int)acc.longSum);
+			break;
+		case AVG:
+			if (acc.count)
+				bob.append(field, acc.doubleSum / acc.count);
+			else
+				bob.appendNull(field);
+			break;
+		case MIN:
+		case MAX:
+		case FIRST:
+		case LAST:
+			if (acc.value.isEmpty())
+				bob.appendNull(field);
+			else
+				bob.appendAs(acc.value.firstElement(), field);
+			break;
+		case PUSH:
+		case ADD_TO_SET: {
+			bson::BSONArrayBuilder arr;
+			if (accumulator.op == PUSH) {
+				for (auto const& v : acc.values)
+					arr.append(v.firstElement());
+			} else {
+				for (auto const& v : acc.valueSet)
+					arr.append(v.firstElement());
+			}
+			bob.appendArray(field, arr.arr());
+			break;
+		}
+		}
+	}
+};
+
+static std::string stageName(bson::BSONObj const& spec) {
+	return spec.firstElementFieldName();
+}
+
+static bool isPureProjection(bson::BSONObj const& spec) {
+	for (auto i = spec.firstElement().Obj().begin(); i.more();) {
+		if (!isNumberOrBool(i.next()))
+			return false;
+	}
+	return true;
+}
+
+struct AggregationPlan {
+	Reference<Plan> plan; // Scans the collection for the first in-memory stage
+	std::vector<Reference<AggregationStage>> stages;
+};
+
+static AggregationPlan planAggregation(Reference<ExtConnection> ec,
+                                       Reference<UnboundCollectionContext> cx,
+                                       bson::BSONObj const& pipeline) {
+	std::vector<bson::BSONObj> specs;
+	for (auto i = pipeline.begin(); i.more();) {
+		auto el = i.next();
+		if (el.type() != bson::BSONType::Object || el.Obj().nFields() != 1 ||
+		    el.Obj().firstElementFieldName()[0] != '$')
+			throw generic_invalid_parameter();
+		bson::BSONObj spec = el.Obj();
+		std::string name = stageName(spec);
+		if ((name == "$match" || name == "$project" || name == "$group" || name == "$sort") &&
+		    spec.firstElement().type() != bson::BSONType::Object)
+			throw generic_invalid_parameter();
+		specs.push_back(spec);
+	}
+
+	// Leading $match stages become the query, so they can be answered from an index
+	int next = 0;
+	bson::BSONArrayBuilder matches;
+	int matchCount = 0;
+	for (; next < specs.size() && stageName(specs[next]) == "$match"; next++, matchCount++)
+		matches.append(specs[next].firstElement().Obj());
+	bson::BSONObj query =
+	    matchCount == 0 ? bson::BSONObj()
+	                    : matchCount == 1 ? specs[0].firstElement().Obj() : BSON("$and" << matches.arr());
+
+	// Then a $skip, and a $project reading only some of each document's fields
+	int64_t skip = 0;
+	Optional<bson::BSONObj> projection;
+	for (; next < specs.size(); next++) {
+		std::string name = stageName(specs[next]);
+		if (name == "$skip")
+			skip += stageCount(specs[next].firstElement());
+		else if (name == "$project" && !projection.present() && isPureProjection(specs[next]))
+			projection = specs[next].firstElement().Obj();
+		else
+			break;
+	}
+
+	AggregationPlan ap;
+	ap.plan = planQuery(cx, query);
+	if (skip)
+		ap.plan = ref(new SkipPlan(skip, ap.plan));
+	ap.plan = planProjection(ap.plan, projection.present() ? projection.get() : bson::BSONObj(),
+	                         Optional<bson::BSONObj>());
+	ap.plan = ec->wrapOperationPlan(ap.plan, true, cx);
+
+	for (; next < specs.size(); next++) {
+		bson::BSONObj const& spec = specs[next];
+		std::string name = stageName(spec);
+		if (name == "$match") {
+			ap.stages.push_back(ref(new MatchStage(spec)));
+		} else if (name == "$project") {
+			if (isPureProjection(spec))
+				ap.stages.push_back(ref(new ProjectStage(spec)));
+			else
+				ap.stages.push_back(ref(new ComputedProjectStage(spec)));
+		} else if (name == "$group") {
+			ap.stages.push_back(ref(new GroupStage(spec)));
+		} else if (name == "$sort") {
+			// Only the first skip + limit documents in sort order can make it past a following $skip and $limit
+			int64_t limit = 0;
+			int after = next + 1;
+			int64_t skipAfter = 0;
+			if (after < specs.size() && stageName(specs[after]) == "$skip")
+				skipAfter = stageCount(specs[after++].firstElement());
+			if (after < specs.size() && stageName(specs[after]) == "$limit")
+				limit = skipAfter + stageCount(specs[after].firstElement());
+			ap.stages.push_back(ref(new SortStage(spec, limit)));
+		} else if (name == "$skip") {
+			ap.stages.push_back(ref(new SkipStage(spec)));
+		} else if (name == "$limit") {
+			ap.stages.push_back(ref(new LimitStage(spec)));
+		} else {
+			throw unsupported_aggregation_operator();
+		}
+	}
+
+	return ap;
+}
+
+static bool anyStageDone(std::vector<Reference<AggregationStage>> const& stages) {
+	for (auto const& stage : stages) {
+		if (stage->done())
+			return true;
+	}
+	return false;
+}
+
+// Passes `input` through stages[first...], adding what comes out of the last stage to `results`
+ACTOR static Future<Void> pushThroughStages(std::vector<Reference<AggregationStage>>* stages,
+                                            int first,
+                                            std::vector<bson::BSONObj> input,
+                                            std::vector<bson::BSONObj>* results) {
+	state std::vector<bson::BSONObj> output;
+	state int i = first;
+	state int j;
+	for (; i < stages->size() && !input.empty(); i++) {
+		output.clear();
+		for (j = 0; j < input.size() && !(*stages)[i]->done(); j++)
+			Void _ = wait((*stages)[i]->process(input[j], &output));
+		std::swap(input, output);
+	}
+	for (auto& doc : input)
+		results->push_back(std::move(doc));
+	return Void();
+}
+
+// Adds the size of the results after the first `*counted` to `*bytes`, failing the aggregation once they are more than
+// a reply can return
+static void countResultBytes(std::vector<bson::BSONObj> const& results, int* counted, int64_t* bytes) {
+	for (; *counted < results.size(); (*counted)++) {
+		*bytes += results[*counted].objsize();
+		if (*bytes > DOCLAYER_KNOBS->MAX_RETURNABLE_DATA_SIZE)
+			throw aggregation_result_too_large();
+	}
+}
+
+ACTOR Future<std::vector<bson::BSONObj>> runAggregation(Reference<ExtConnection> ec,
+                                                        Reference<UnboundCollectionContext> cx,
+                                                        Reference<DocTransaction> tr,
+                                                        bson::BSONObj pipeline,
+                                                        double deadline) {
+	state AggregationPlan ap = planAggregation(ec, cx, pipeline);
+	state std::vector<bson::BSONObj> results;
+	state Reference<PlanCheckpoint> checkpoint(new PlanCheckpoint);
+	checkpoint->setDeadline(deadline);
+	state PlanCheckpoint::FlowControlLock* flowControlLock = checkpoint->getDocumentFinishedLock();
+	state FutureStream<Reference<ScanReturnedContext>> docs = ap.plan->execute(checkpoint.getPtr(), tr);
+	state Future<Void> expired = checkpoint->onDeadline();
+	state Reference<ScanReturnedContext> doc;
+	state bson::BSONObj obj;
+	state int counted = 0;
+	state int64_t resultBytes = 0;
+
+	try {
+		// Stop scanning as soon as a $limit is satisfied, since nothing more can get past it
+		while (!anyStageDone(ap.stages)) {
+			choose {
+				when(Reference<ScanReturnedContext> next = waitNext(docs)) { doc = next; }
+				when(Void _ = wait(expired)) { throw max_time_ms_expired(); }
+			}
+			DataValue dv = wait(doc->toDataValue());
+			obj = dv.getPackedObject().getOwned();
+			Void _ = wait(pushThroughStages(&ap.stages, 0, { obj }, &results));
+			countResultBytes(results, &counted, &resultBytes);
+			flowControlLock->release();
+		}
+	} catch (Error& e) {
+		if (e.code() != error_code_end_of_stream) {
+			checkpoint->stop();
+			throw;
+		}
+	}
+	checkpoint->stop();
+
+	state int i = 0;
+	for (; i < ap.stages.size(); i++) {
+		state std::vector<bson::BSONObj> held;
+		ap.stages[i]->finish(&held);
+		Void _ = wait(pushThroughStages(&ap.stages, i + 1, held, &results));
+		countResultBytes(results, &counted, &resultBytes);
+	}
+
+	return results;
+}
+
+bson::BSONArray explainAggregation(Reference<ExtConnection> ec,
+                                   Reference<UnboundCollectionContext> cx,
+                                   bson::BSONObj const& pipeline) {
+	AggregationPlan ap = planAggregation(ec, cx, pipeline);
+	bson::BSONArrayBuilder stages;
+	stages.append(BSON("$cursor" << BSON("plan" << ap.plan->describe())));
+	for (auto const& stage : ap.stages)
+		stages.append(stage->spec);
+	return stages.arr();
+}
@@ -0,0 +1,61 @@
+/*
+ * ExtAggregate.h
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * MongoDB is a registered trademark of MongoDB, Inc.
+ */
+
+#ifndef _EXT_AGGREGATE_H_
+#define _EXT_AGGREGATE_H_
+
+#pragma once
+
+#include "QLContext.h"
+
+/*
+ * Aggregation pipelines, for the aggregate command. The pipeline's leading $match stages are merged into one query and
+ * planned by planQuery(), so they use indexes like a find would. A $skip or an inclusion/exclusion $project right after
+ * them is pushed into the plan as well. The remaining stages run in memory, one document at a time:
+ *
+ *     $match    any query, evaluated against the document
+ *     $project  inclusion, exclusion, field references ("$a.b") and literals
+ *     $group    _id from a field reference, an object of them or a constant, with the accumulators $sum, $avg, $min,
+ *               $max, $first, $last, $push and $addToSet
+ *     $sort     a top-K sort when a $limit follows (optionally after a $skip), a full sort otherwise
+ *     $skip, $limit
+ *
+ * Once a $limit has passed all the documents it will, the scan feeding the pipeline stops. $group and $sort hold their
+ * state in memory, and fail the aggregation with aggregation_memory_limit once it reaches AGGREGATE_MAX_STAGE_MEMORY
+ * bytes.
+ */
+
+// Runs `pipeline` (an array of stages) over the collection of `cx` and returns the documents it produces. They are all
+// returned in one reply, so it fails with aggregation_result_too_large, and stops scanning, as soon as they add up to
+// more than MAX_RETURNABLE_DATA_SIZE bytes.
+Future<std::vector<bson::BSONObj>> runAggregation(Reference<struct ExtConnection> const& ec,
+                                                  Reference<UnboundCollectionContext> const& cx,
+                                                  Reference<DocTransaction> const& tr,
+                                                  bson::BSONObj const& pipeline,
+                                                  double const& deadline);
+
+// Returns the stages `pipeline` would run, the first being the pushed down query plan as {$cursor: {...}}.
+bson::BSONArray explainAggregation(Reference<struct ExtConnection> ec,
+                                   Reference<UnboundCollectionContext> cx,
+                                   bson::BSONObj const& pipeline);
+
+#endif /* _EXT_AGGREGATE_H_ */
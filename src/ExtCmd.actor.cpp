@@ -23,6 +23,8 @@
 #include "bson.h"
 #include "ordering.h"
 
+#include "ChangeLog.h"
+#include "ExtAggregate.h"
 #include "ExtCmd.h"
 #include "ExtMsg.h"
 #include "ExtUtil.actor.h"
@@ -265,7 +267,29 @@ struct ServerStatusCmd {
 		// reply->addDocument( bob.obj() );
 
 		// reply->addDocument( BSON( "opcounters" << BSON( "query" << queries ) << "ok" << 1 ) );
-		reply->addDocument(BSON("ok" << 1.0));
+		const BufferedConnectionStats& bcStats = BufferedConnection::getStats();
+		Reference<QueryCache> queryCache = nmc->docLayer->queryCache;
+		reply->addDocument(BSON(
+		    // clang-format off
+			"receiveBuffers" << BSON(
+				"smallBlocksAllocated" << (long long)bcStats.smallBlocksAllocated <<
+				"largeBlocksAllocated" << (long long)bcStats.largeBlocksAllocated <<
+				"largeBlocksReused" << (long long)bcStats.largeBlocksReused <<
+				"largeBlocksPooled" << (long long)bcStats.largeBlocksPooled <<
+				"bytesRelocated" << (long long)bcStats.bytesRelocated <<
+				"bytesReassembled" << (long long)bcStats.bytesReassembled) <<
+			"queryCache" << BSON(
+				"enabled" << queryCache->enabled() <<
+				"bytes" << (long long)queryCache->bytes <<
+				"entries" << (long long)queryCache->size() <<
+				"hits" << (long long)queryCache->stats.hits <<
+				"misses" << (long long)queryCache->stats.misses <<
+				"stale" << (long long)queryCache->stats.stale <<
+				"inserts" << (long long)queryCache->stats.inserts <<
+				"evictions" << (long long)queryCache->stats.evictions) <<
+			"ok" << 1.0
+		    // clang-format on
+		    ));
 
 		return reply;
 	}
@@ -407,22 +431,36 @@ ACTOR static Future<Reference<ExtMsgReply>> getStreamCount(Reference<ExtConnecti
                                                            Reference<ExtMsgQuery> query,
                                                            Reference<ExtMsgReply> reply) {
 	try {
+		state double deadline = getRequestDeadline(query->query, true);
 		state Reference<DocTransaction> dtr = ec->getOperationTransaction();
-		Reference<UnboundCollectionContext> cx = wait(getCollectionContextForCommand(ec, query, dtr, true));
-		Reference<Plan> plan = planQuery(cx, query->query.getObjectField("query"));
-		plan = ec->wrapOperationPlan(plan, true, cx);
-
-		// fprintf(stderr, "Plan: %s\n", plan->describe().toString().c_str());
+		state Reference<UnboundCollectionContext> cx = wait(getCollectionContextForCommand(ec, query, dtr, true));
+		state bson::BSONObj selector = query->query.getObjectField("query");
 
 		// Rather than use a SkipPlan, we subtract "skipped" documents from the final count (and add them to any limit)
 		state int64_t skip = query->query.hasField("skip") ? query->query.getField("skip").numberLong() : 0;
-		state int64_t limitPlusSkip = query->query.hasField("limit")
-		                                  ? skip + query->query.getField("limit").numberLong()
-		                                  : std::numeric_limits<int64_t>::max();
-		int64_t count = wait(executeUntilCompletionTransactionally(
-		    plan, dtr)); // SOMEDAY: We can optimize this by only counting the first limitPlusSkip documents
+		// As in MongoDB, a limit of 0 is no limit, and a negative one counts the same as a positive one
+		state int64_t limit =
+		    query->query.hasField("limit") ? std::abs(query->query.getField("limit").numberLong()) : 0;
+		state int64_t limitPlusSkip = limit != 0 ? skip + limit : std::numeric_limits<int64_t>::max();
+		state int64_t count;
+
+		if (selector.isEmpty() && cx->statsTracked) {
+			// The maintained document count answers an unfiltered count without scanning the collection
+			int64_t documents = wait(cx->bindCollectionContext(dtr)->getDocumentCount());
+			count = documents;
+		} else {
+			Reference<Plan> plan = planQuery(cx, selector);
+			plan = ec->wrapOperationPlan(plan, true, cx);
 
-		reply->addDocument(BSON("n" << (double)std::max<int64_t>(count - skip, 0) << "ok" << 1.0));
+			// fprintf(stderr, "Plan: %s\n", plan->describe().toString().c_str());
+
+			// SOMEDAY: We can optimize this by only counting the first limitPlusSkip documents
+			int64_t documents = wait(executeUntilCompletionTransactionally(plan, dtr, deadline));
+			count = documents;
+		}
+
+		reply->addDocument(
+		    BSON("n" << (double)std::max<int64_t>(std::min(count, limitPlusSkip) - skip, 0) << "ok" << 1.0));
 		return reply;
 	} catch (Error& e) {
 		reply->addDocument(BSON("$err" << e.what() << "code" << e.code() << "ok" << 1.0));
@@ -446,6 +484,7 @@ ACTOR static Future<Reference<ExtMsgReply>> doFindAndModify(Reference<ExtConnect
                                                             Reference<ExtMsgQuery> query,
                                                             Reference<ExtMsgReply> reply) {
 	try {
+		state double deadline = getRequestDeadline(query->query, true);
 		state bool issort = query->query.hasField("sort");
 		state bool isremove = query->query.hasField("remove") && query->query.getField("remove").trueValue();
 		state bool isnew = query->query.hasField("new") && query->query.getField("new").trueValue() && !(isremove);
@@ -505,7 +544,7 @@ ACTOR static Future<Reference<ExtMsgReply>> doFindAndModify(Reference<ExtConnect
 			                                 ec->docLayer->database, ec->mm));
 
 		state std::pair<int64_t, Reference<ScanReturnedContext>> pair =
-		    wait(executeUntilCompletionAndReturnLastTransactionally(plan, tr));
+		    wait(executeUntilCompletionAndReturnLastTransactionally(plan, tr, deadline));
 		state int64_t i = pair.first;
 		state bool returnedUpserted = i && pair.second->scanId() == -1;
 
@@ -733,23 +772,91 @@ struct BuildInfoCmd {
 };
 REGISTER_CMD(BuildInfoCmd, "buildinfo");
 
-ACTOR static Future<Reference<ExtMsgReply>> listDatabases(Reference<DocTransaction> tr,
-                                                          Reference<ExtMsgReply> reply,
-                                                          Reference<DirectorySubspace> rootDirectory) {
-	state bson::BSONObjBuilder bob;
-	state bson::BSONArrayBuilder bab;
-	state std::string dbName;
-	state Standalone<VectorRef<StringRef>> dbs = wait(rootDirectory->list(tr->tr));
+struct CollectionStats {
+	int64_t count = 0;
+	int64_t size = 0;
+	int nindexes = 0;
+};
+
+// Reads the stats a collection's writes maintain (see CollectionContext::getDocumentCount()), without scanning it. A
+// collection that doesn't exist is empty, and isn't created by asking.
+ACTOR static Future<CollectionStats> readCollectionStats(Reference<DocTransaction> tr,
+                                                         Reference<MetadataManager> mm,
+                                                         Namespace ns) {
+	bool exists = wait(mm->docLayer->rootDirectory->exists(tr->tr, {StringRef(ns.first), StringRef(ns.second)}));
+	if (!exists)
+		return CollectionStats();
+
+	state Reference<UnboundCollectionContext> unbound = wait(mm->getUnboundCollectionContext(tr, ns));
+	state Reference<CollectionContext> cx = unbound->bindCollectionContext(tr);
+	state Future<int64_t> size = cx->getDataSize();
+	state CollectionStats stats;
+	int64_t count = wait(cx->getDocumentCount());
+	stats.count = count;
+	int64_t sizeBytes = wait(size);
+	stats.size = sizeBytes;
+	stats.nindexes = (int)unbound->knownIndexes.size() + 1; // And the _id index
+	return stats;
+}
+
+struct DatabaseStats {
+	int collections = 0;
+	CollectionStats totals;
+};
+
+// Sums the stats of every collection in the database, reading them in parallel
+ACTOR static Future<DatabaseStats> readDatabaseStats(Reference<DocTransaction> tr,
+                                                     Reference<MetadataManager> mm,
+                                                     Reference<DirectorySubspace> rootDirectory,
+                                                     std::string dbName) {
+	state Standalone<VectorRef<StringRef>> collections;
+	try {
+		Standalone<VectorRef<StringRef>> names = wait(rootDirectory->list(tr->tr, {StringRef(dbName)}));
+		collections = names;
+	} catch (Error& e) {
+		if (e.code() != error_code_directory_does_not_exist)
+			throw;
+		return DatabaseStats();
+	}
+
+	std::vector<Future<CollectionStats>> fstats;
+	for (const auto& collection : collections) {
+		// system.indexes is metadata, and doesn't have stats of its own
+		if (!collection.startsWith(LiteralStringRef("system.")))
+			fstats.push_back(readCollectionStats(tr, mm, std::make_pair(dbName, collection.toString())));
+	}
+	std::vector<CollectionStats> stats = wait(getAll(fstats));
+
+	DatabaseStats dbStats;
+	dbStats.collections = collections.size();
+	for (const auto& s : stats) {
+		dbStats.totals.count += s.count;
+		dbStats.totals.size += s.size;
+		dbStats.totals.nindexes += s.nindexes;
+	}
+	return dbStats;
+}
 
-	for (auto db : dbs) {
-		dbName = db.toString();
-		Standalone<VectorRef<StringRef>> colls = wait(rootDirectory->list(tr->tr, {db}));
-		bool empty = colls.empty();
-		bab.append(BSON("name" << dbName << "sizeOnDisk" << (empty ? 0 : 1000000) << "empty" << empty));
+ACTOR static Future<Reference<ExtMsgReply>> listDatabases(Reference<ExtConnection> ec, Reference<ExtMsgReply> reply) {
+	state Reference<DocTransaction> tr = ec->getOperationTransaction();
+	state Standalone<VectorRef<StringRef>> dbs = wait(ec->docLayer->rootDirectory->list(tr->tr));
+
+	std::vector<Future<DatabaseStats>> fstats;
+	for (const auto& db : dbs)
+		fstats.push_back(readDatabaseStats(tr, ec->mm, ec->docLayer->rootDirectory, db.toString()));
+	std::vector<DatabaseStats> stats = wait(getAll(fstats));
+
+	bson::BSONObjBuilder bob;
+	bson::BSONArrayBuilder bab;
+	int64_t totalSize = 0;
+	for (int i = 0; i < dbs.size(); i++) {
+		bab.append(BSON("name" << dbs[i].toString() << "sizeOnDisk" << (long long)stats[i].totals.size << "empty"
+		                       << (stats[i].collections == 0)));
+		totalSize += stats[i].totals.size;
 	}
 
 	bob.appendArray("databases", bab.arr());
-	bob.append("totalSize", -1);
+	bob.append("totalSize", (long long)totalSize);
 	bob.append("ok", 1.0);
 	reply->addDocument(bob.obj());
 
@@ -761,7 +868,7 @@ struct ListDatabasesCmd {
 	static Future<Reference<ExtMsgReply>> call(Reference<ExtConnection> ec,
 	                                           Reference<ExtMsgQuery> query,
 	                                           Reference<ExtMsgReply> reply) {
-		return listDatabases(ec->getOperationTransaction(), reply, ec->docLayer->rootDirectory);
+		return listDatabases(ec, reply);
 	}
 };
 REGISTER_CMD(ListDatabasesCmd, "listdatabases");
@@ -769,17 +876,18 @@ REGISTER_CMD(ListDatabasesCmd, "listdatabases");
 ACTOR static Future<Reference<ExtMsgReply>> getDBStats(Reference<ExtConnection> ec,
                                                        Reference<ExtMsgQuery> query,
                                                        Reference<ExtMsgReply> reply) {
-	state Reference<DocTransaction> tr = ec->getOperationTransaction();
-	state Standalone<VectorRef<StringRef>> collections =
-	    wait(ec->docLayer->rootDirectory->list(tr->tr, {StringRef(query->ns.first)}));
-	state Reference<UnboundCollectionContext> cx = wait(ec->mm->indexesCollection(tr, query->ns.first));
-	state int64_t indexes = wait(executeUntilCompletionTransactionally(ref(new TableScanPlan(cx)), tr));
-	reply->addDocument(BSON("db" << query->ns.first << "collections" << collections.size() << "indexes"
-	                             << (int)(indexes + collections.size()) << "ok" << 1.0));
+	DatabaseStats stats = wait(readDatabaseStats(ec->getOperationTransaction(), ec->mm, ec->docLayer->rootDirectory,
+	                                             query->ns.first));
+	// Documents are stored uncompressed, and FDB has no estimate of the space a range takes on disk
+	reply->addDocument(BSON("db" << query->ns.first << "collections" << stats.collections << "objects"
+	                             << (long long)stats.totals.count << "avgObjSize"
+	                             << (stats.totals.count ? (double)stats.totals.size / stats.totals.count : 0.0)
+	                             << "dataSize" << (long long)stats.totals.size << "storageSize"
+	                             << (long long)stats.totals.size << "indexes" << stats.totals.nindexes << "ok"
+	                             << 1.0));
 	return reply;
 }
 
-// FIXME: Add more to this command
 struct DBStatsCmd {
 	static const char* name;
 	static Future<Reference<ExtMsgReply>> call(Reference<ExtConnection> ec,
@@ -790,15 +898,14 @@ struct DBStatsCmd {
 };
 REGISTER_CMD(DBStatsCmd, "dbstats");
 
-// FIXME: Add more here too
 ACTOR static Future<Reference<ExtMsgReply>> getCollectionStats(Reference<ExtConnection> ec,
                                                                Reference<ExtMsgQuery> query,
                                                                Reference<ExtMsgReply> reply) {
-	state Reference<DocTransaction> tr = ec->getOperationTransaction();
-	state Reference<Plan> plan = wait(getIndexesForCollectionPlan(query->ns, tr, ec->mm));
-	state int64_t indexesCount = wait(executeUntilCompletionTransactionally(plan, tr));
-	reply->addDocument(
-	    BSON("ns" << query->ns.first + "." + query->ns.second << "nindexes" << (int)indexesCount + 1 << "ok" << 1.0));
+	CollectionStats stats = wait(readCollectionStats(ec->getOperationTransaction(), ec->mm, query->ns));
+	reply->addDocument(BSON("ns" << query->ns.first + "." + query->ns.second << "count" << (long long)stats.count
+	                             << "size" << (long long)stats.size << "avgObjSize"
+	                             << (stats.count ? (double)stats.size / stats.count : 0.0) << "storageSize"
+	                             << (long long)stats.size << "nindexes" << stats.nindexes << "ok" << 1.0));
 	return reply;
 }
 
@@ -813,10 +920,137 @@ struct CollectionStatsCmd {
 };
 REGISTER_CMD(CollectionStatsCmd, "collstats");
 
+// Counts the documents a plan returns and sums their sizes, as the collection stats count them
+ACTOR static Future<std::pair<int64_t, int64_t>> scanDocumentStats(Reference<Plan> plan, Reference<DocTransaction> tr) {
+	state Reference<PlanCheckpoint> checkpoint(new PlanCheckpoint);
+	state FutureStream<Reference<ScanReturnedContext>> docs = plan->execute(checkpoint.getPtr(), tr);
+	state PlanCheckpoint::FlowControlLock* flowControlLock = checkpoint->getDocumentFinishedLock();
+	state int64_t documents = 0;
+	state int64_t bytes = 0;
+	try {
+		loop {
+			state Reference<ScanReturnedContext> doc = waitNext(docs);
+			Optional<int64_t> size = wait(getStoredDocumentSize(doc));
+			documents++;
+			bytes += size.present() ? size.get() : 0;
+			flowControlLock->release();
+		}
+	} catch (Error& e) {
+		if (e.code() != error_code_end_of_stream)
+			throw;
+	}
+	checkpoint->stop();
+	return std::make_pair(documents, bytes);
+}
+
+struct ValidateResult {
+	bool statsTracked = false;
+	int64_t oldCount = 0;
+	std::pair<int64_t, int64_t> stats;
+	int nIndexes = 0;
+};
+
+// Recounts the collection and resets its stats in the same transaction, so that they describe one read version and
+// any write to the collection since then makes the transaction conflict rather than leave the stats off
+ACTOR static Future<ValidateResult> Internal_doValidate(Reference<DocTransaction> tr,
+                                                        Namespace ns,
+                                                        Reference<MetadataManager> mm) {
+	state Reference<UnboundCollectionContext> unbound = wait(mm->getUnboundCollectionContext(tr, ns));
+	state ValidateResult result;
+	result.statsTracked = unbound->statsTracked;
+	result.nIndexes = (int)unbound->knownIndexes.size() + 1; // And the _id index
+	int64_t oldCount = wait(unbound->bindCollectionContext(tr)->getDocumentCount());
+	result.oldCount = oldCount;
+	std::pair<int64_t, int64_t> stats = wait(scanDocumentStats(ref(new TableScanPlan(unbound)), tr));
+	result.stats = stats;
+	unbound->bindCollectionContext(tr)->resetDocumentStats(stats.first, stats.second);
+	return result;
+}
+
+/**
+ * Recounts a collection's documents and their sizes, and resets its stats (see CollectionContext::getDocumentCount())
+ * to the result, so that unfiltered counts can use them from then on. The scan and the reset are one transaction, so
+ * a collection too big to scan within FDB's transaction time limit fails to validate and keeps its stats as they were.
+ */
+ACTOR static Future<Reference<ExtMsgReply>> doValidate(Reference<ExtConnection> ec,
+                                                       Reference<ExtMsgQuery> query,
+                                                       Reference<ExtMsgReply> reply) {
+	try {
+		state ValidateResult result;
+		if (ec->explicitTransaction) {
+			ValidateResult validated = wait(Internal_doValidate(ec->tr, query->ns, ec->mm));
+			result = validated;
+		} else {
+			ValidateResult validated = wait(runRYWTransaction(
+			    ec->docLayer->database,
+			    [this](Reference<DocTransaction> tr) { return Internal_doValidate(tr, query->ns, ec->mm); },
+			    ec->options.retryLimit, ec->options.timeout));
+			result = validated;
+		}
+
+		bson::BSONArrayBuilder warnings;
+		if (!result.statsTracked || result.oldCount != result.stats.first)
+			warnings.append("document count was " + std::to_string(result.oldCount) + ", corrected to " +
+			                std::to_string(result.stats.first));
+		reply->addDocument(BSON("ns" << query->ns.first + "." + query->ns.second << "nrecords"
+		                             << (long long)result.stats.first << "nIndexes" << result.nIndexes
+		                             << "valid" << true << "warnings" << warnings.arr() << "errors"
+		                             << bson::BSONArrayBuilder().arr() << "ok" << 1.0));
+		return reply;
+	} catch (Error& e) {
+		reply->addDocument(BSON("ok" << 0.0 << "errmsg" << e.what() << "code" << e.code()));
+		return reply;
+	}
+}
+
+struct ValidateCmd {
+	static const char* name;
+	static Future<Reference<ExtMsgReply>> call(Reference<ExtConnection> ec,
+	                                           Reference<ExtMsgQuery> query,
+	                                           Reference<ExtMsgReply> reply) {
+		query->ns.second = query->query.getField("validate").String();
+		return doValidate(ec, query, reply);
+	}
+};
+REGISTER_CMD(ValidateCmd, "validate");
+
 ACTOR static Future<Void> Internal_doCreateCollection(Reference<DocTransaction> tr,
                                                       Reference<ExtMsgQuery> query,
                                                       Reference<MetadataManager> mm) {
 	state Reference<UnboundCollectionContext> unbound = wait(mm->getUnboundCollectionContext(tr, query->ns));
+
+	// {changeLog: true} starts recording writes to the collection in its change log, and false stops and discards it
+	if (query->query.hasField("changeLog")) {
+		bool changeLog = query->query.getField("changeLog").trueValue();
+		if (changeLog != unbound->changeLogEnabled) {
+			if (changeLog) {
+				tr->tr->set(unbound->getChangeLogOptionKey(), StringRef());
+			} else {
+				Key prefix = unbound->getChangeLogPrefix();
+				tr->tr->clear(unbound->getChangeLogOptionKey());
+				tr->tr->clear(FDB::KeyRangeRef(prefix, strinc(prefix)));
+			}
+			unbound->bindCollectionContext(tr)->bumpMetadataVersion();
+		}
+	}
+
+	// {idPolicy: "scrambled"} spreads the ids generated for this collection over its key range, and "objectId" goes
+	// back to plain ObjectIds, see CollectionContext::generateId()
+	if (query->query.hasField("idPolicy")) {
+		bson::BSONElement policyEl = query->query.getField("idPolicy");
+		if (policyEl.type() != bson::BSONType::String ||
+		    (policyEl.str() != "objectId" && policyEl.str() != "scrambled"))
+			throw generic_invalid_parameter();
+		auto policy = policyEl.str() == "scrambled" ? UnboundCollectionContext::SCRAMBLED_OBJECT_ID
+		                                            : UnboundCollectionContext::OBJECT_ID;
+		if (policy != unbound->idPolicy) {
+			if (policy == UnboundCollectionContext::SCRAMBLED_OBJECT_ID)
+				tr->tr->set(unbound->getIdPolicyKey(), LiteralStringRef("scrambled"));
+			else
+				tr->tr->clear(unbound->getIdPolicyKey());
+			unbound->bindCollectionContext(tr)->bumpMetadataVersion();
+		}
+	}
 	return Void();
 }
 
@@ -1018,7 +1252,7 @@ struct AvailableQueryOptionsCmd {
 	static Future<Reference<ExtMsgReply>> call(Reference<ExtConnection> ec,
 	                                           Reference<ExtMsgQuery> query,
 	                                           Reference<ExtMsgReply> reply) {
-		unsigned int opts = EXHAUST;
+		unsigned int opts = EXHAUST | TAILABLE_CURSOR | AWAIT_DATA;
 		reply->addDocument(BSON("ok" << 1.0 << "options" << opts));
 		return reply;
 	}
@@ -1072,14 +1306,29 @@ ACTOR static Future<Reference<ExtMsgReply>> insertAndReply(Reference<ExtConnecti
 		throw wire_protocol_mismatch();
 	}
 
-	state std::list<bson::BSONObj> docs;
-	for (auto& bsonElement : msg->query.getField("documents").Array()) {
-		docs.push_back(bsonElement.Obj());
+	state std::vector<bson::BSONObj> docs;
+	bson::BSONObj documents = msg->query.getField("documents").Obj();
+	docs.reserve(documents.nFields());
+	for (bson::BSONObjIterator i = documents.begin(); i.more();) {
+		docs.push_back(i.next().Obj());
 	}
 
 	try {
 		WriteCmdResult ret = wait(doInsertCmd(msg->ns, &docs, nmc));
-		reply->addDocument(BSON("ok" << 1 << "n" << (long long)ret.n));
+		bson::BSONObjBuilder replyBuilder;
+		replyBuilder << "ok" << 1 << "n" << (long long)ret.n;
+		// Lets clients that leave the _id out learn the ids of their documents, like "upserted" does for updates
+		if (!ret.generatedIds.empty()) {
+			bson::BSONArrayBuilder idsBuilder;
+			for (const auto& generated : ret.generatedIds) {
+				bson::BSONObjBuilder builder;
+				builder << "index" << generated.first;
+				builder.appendElements(DataValue::decode_key_part(generated.second).wrap("_id"));
+				idsBuilder << builder.done();
+			}
+			replyBuilder << "insertedIds" << idsBuilder.arr();
+		}
+		reply->addDocument(replyBuilder.obj());
 	} catch (Error& e) {
 		// all or nothing. If we see any error, we assume all inserts have failed. All inserts are going under
 		// one FDB transaction.
@@ -1126,7 +1375,8 @@ ACTOR static Future<Reference<ExtMsgReply>> deleteAndReply(Reference<ExtConnecti
 		deleteQueries.push_back(cmd);
 	}
 
-	WriteCmdResult ret = wait(doDeleteCmd(msg->ns, ordered, &deleteQueries, nmc));
+	double deadline = getRequestDeadline(msg->query, true);
+	WriteCmdResult ret = wait(doDeleteCmd(msg->ns, ordered, &deleteQueries, nmc, deadline));
 
 	if (ret.writeErrors.empty()) {
 		reply->addDocument(BSON("ok" << 1 << "n" << (long long)ret.n));
@@ -1184,7 +1434,8 @@ ACTOR static Future<Reference<ExtMsgReply>> updateAndReply(Reference<ExtConnecti
 		                  bsonCmdO.hasField("multi") && bsonCmdO.getField("multi").Bool());
 	}
 
-	WriteCmdResult ret = wait(doUpdateCmd(msg->ns, ordered, &cmds, nmc));
+	double deadline = getRequestDeadline(msg->query, true);
+	WriteCmdResult ret = wait(doUpdateCmd(msg->ns, ordered, &cmds, nmc, deadline));
 
 	bson::BSONObjBuilder replyBuilder;
 	replyBuilder << "ok" << 1 << "n" << (long long)ret.n << "nModified" << (long long)ret.nModified;
@@ -1329,6 +1580,7 @@ ACTOR static Future<Reference<ExtMsgReply>> getStreamDistinct(Reference<ExtConne
 	state int filtered = 0;
 
 	try {
+		state double deadline = getRequestDeadline(query->query, true);
 		state Reference<DocTransaction> dtr = ec->getOperationTransaction();
 		Reference<UnboundCollectionContext> cx = wait(getCollectionContextForCommand(ec, query, dtr, true));
 
@@ -1343,6 +1595,7 @@ ACTOR static Future<Reference<ExtMsgReply>> getStreamDistinct(Reference<ExtConne
 		state Reference<IPredicate> predicate = any_predicate(keyValue, distinctPredicate);
 
 		state Reference<PlanCheckpoint> checkpoint(new PlanCheckpoint);
+		checkpoint->setDeadline(deadline);
 		state PlanCheckpoint::FlowControlLock* flowControlLock = checkpoint->getDocumentFinishedLock();
 		state FutureStream<Reference<ScanReturnedContext>> queryResults = qrPlan->execute(checkpoint.getPtr(), dtr);
 		state PromiseStream<Reference<ScanReturnedContext>> filteredResults;
@@ -1395,3 +1648,105 @@ struct GetDistinctCmd {
 	}
 };
 REGISTER_CMD(GetDistinctCmd, "distinct");
+
+ACTOR static Future<Reference<ExtMsgReply>> doAggregate(Reference<ExtConnection> ec,
+                                                        Reference<ExtMsgQuery> query,
+                                                        Reference<ExtMsgReply> reply) {
+	try {
+		state double deadline = getRequestDeadline(query->query, true);
+		state Reference<DocTransaction> dtr = ec->getOperationTransaction();
+		state Reference<UnboundCollectionContext> cx = wait(getCollectionContextForCommand(ec, query, dtr, true));
+
+		bson::BSONElement pipelineEl = query->query.getField("pipeline");
+		if (pipelineEl.type() != bson::BSONType::Array)
+			throw generic_invalid_parameter();
+		state bson::BSONObj pipeline = pipelineEl.Obj();
+
+		if (query->query.getBoolField("explain")) {
+			reply->addDocument(BSON("stages" << explainAggregation(ec, cx, pipeline) << "ok" << 1.0));
+			return reply;
+		}
+
+		state std::vector<bson::BSONObj> results = wait(runAggregation(ec, cx, dtr, pipeline, deadline));
+
+		bson::BSONArrayBuilder resultArray;
+		for (const auto& doc : results)
+			resultArray.append(doc);
+
+		if (query->query.hasField("cursor")) {
+			reply->addDocument(BSON("cursor" << BSON("id" << (long long)0 << "ns"
+			                                              << query->ns.first + "." + query->ns.second << "firstBatch"
+			                                              << resultArray.arr())
+			                                 << "ok" << 1.0));
+		} else {
+			reply->addDocument(BSON("result" << resultArray.arr() << "ok" << 1.0));
+		}
+		return reply;
+	} catch (Error& e) {
+		reply->addDocument(BSON("$err" << e.what() << "code" << e.code() << "ok" << 1.0));
+		reply->setResponseFlags(2 /*0b0010*/);
+		return reply;
+	}
+}
+
+struct AggregateCmd {
+	static const char* name;
+	static Future<Reference<ExtMsgReply>> call(Reference<ExtConnection> ec,
+	                                           Reference<ExtMsgQuery> query,
+	                                           Reference<ExtMsgReply> reply) {
+		query->ns.second = query->query.getField("aggregate").String();
+		return doAggregate(ec, query, reply);
+	}
+};
+REGISTER_CMD(AggregateCmd, "aggregate");
+
+/**
+ * Returns the next batch of change events from a collection's change log (see ChangeLog.h), waiting up to
+ * maxAwaitTimeMS for one if there are none yet. Pass the returned resumeAfter token to the next call to continue.
+ */
+ACTOR static Future<Reference<ExtMsgReply>> doWatch(Reference<ExtConnection> ec,
+                                                    Reference<ExtMsgQuery> query,
+                                                    Reference<ExtMsgReply> reply) {
+	try {
+		state Reference<DocTransaction> dtr = ec->getOperationTransaction();
+		Reference<UnboundCollectionContext> cx = wait(getCollectionContextForCommand(ec, query, dtr));
+		if (!cx->changeLogEnabled)
+			throw change_log_not_enabled();
+
+		int batchSize = query->query.hasField("batchSize") ? query->query.getIntField("batchSize") : 101;
+		double maxAwaitTime = query->query.hasField("maxAwaitTimeMS")
+		                          ? query->query.getField("maxAwaitTimeMS").numberDouble() / 1000.0
+		                          : DOCLAYER_KNOBS->TAILABLE_AWAIT_DATA_TIMEOUT;
+		if (batchSize <= 0 || maxAwaitTime < 0)
+			throw generic_invalid_parameter();
+
+		state ChangeBatch batch = wait(readChanges(
+		    ec->docLayer->database, cx, parseResumeToken(query->query, "resumeAfter"), batchSize, maxAwaitTime));
+
+		bson::BSONArrayBuilder events;
+		for (const auto& event : batch.events)
+			events.append(event);
+		bson::BSONObjBuilder bob;
+		bob.appendArray("events", events.arr());
+		bob.appendBinData("resumeAfter", batch.resumeToken.size(), bson::BinDataGeneral,
+		                  (const char*)batch.resumeToken.begin());
+		bob.append("ok", 1.0);
+		reply->addDocument(bob.obj());
+		return reply;
+	} catch (Error& e) {
+		reply->addDocument(BSON("$err" << e.what() << "code" << e.code() << "ok" << 1.0));
+		reply->setResponseFlags(2 /*0b0010*/);
+		return reply;
+	}
+}
+
+struct WatchCmd {
+	static const char* name;
+	static Future<Reference<ExtMsgReply>> call(Reference<ExtConnection> ec,
+	                                           Reference<ExtMsgQuery> query,
+	                                           Reference<ExtMsgReply> reply) {
+		query->ns.second = query->query.getField("watch").String();
+		return doWatch(ec, query, reply);
+	}
+};
+REGISTER_CMD(WatchCmd, "watch");
@@ -23,10 +23,12 @@
 #include "Ext.h"
 #include "ExtMsg.h"
 
+#include "ChangeLog.h"
 #include "Cursor.h"
 #include "ExtCmd.h"
 #include "ExtOperator.h"
 #include "ExtUtil.actor.h"
+#include "GeoSearch.h"
 #include "MetadataManager.h"
 
 #include "QLOperations.h"
@@ -34,6 +36,7 @@
 #include "QLPredicate.h"
 #include "QLProjection.h"
 #include "QLTypes.h"
+#include "QueryCache.h"
 
 #include "bson.h"
 #include "ordering.h"
@@ -42,6 +45,9 @@
 #include "flow/UnitTest.h"
 
 #include <string>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
 
 using namespace FDB;
 
@@ -54,10 +60,13 @@ REGISTER_MSG(ExtMsgDelete);
 REGISTER_MSG(ExtMsgKillCursors);
 
 // ns -> database.collection
-Namespace getDBCollectionPair(const char* ns, std::pair<std::string, std::string> errMsg) {
+// The error detail is only rendered when the namespace turns out to be malformed, since for queries it is the whole
+// query document and this is on the parse path of every message.
+template <class ErrDetailFn>
+Namespace getDBCollectionPair(const char* ns, const char* errKey, ErrDetailFn const& errDetail) {
 	const auto dotPtr = strchr(ns, '.');
 	if (dotPtr == nullptr) {
-		TraceEvent(SevWarn, "WireBadCollectionName").detail(errMsg.first, errMsg.second).suppressFor(1.0);
+		TraceEvent(SevWarn, "WireBadCollectionName").detail(errKey, errDetail()).suppressFor(1.0);
 		throw wire_protocol_mismatch();
 	}
 	return std::make_pair(std::string(ns, dotPtr - ns), std::string(dotPtr + 1));
@@ -83,10 +92,13 @@ void valueQueryToPredicates(bson::BSONObj const& value_query,
                             std::string const& path,
                             std::vector<Reference<IPredicate>>& out_terms) {
 	std::string regex_options; // hacky special handling of { $option, $regex }
+	Optional<bson::BSONElement> max_distance; // and of { $near, $maxDistance }
 	for (auto it = value_query.begin(); it.more();) {
 		auto sub = it.next();
 		if (std::string(sub.fieldName()) == "$options") {
 			regex_options = sub.String();
+		} else if (std::string(sub.fieldName()) == "$maxDistance") {
+			max_distance = sub;
 		} else {
 			out_terms.push_back(ExtValueOperator::toPredicate(sub.fieldName(), path, sub));
 		}
@@ -102,6 +114,20 @@ void valueQueryToPredicates(bson::BSONObj const& value_query,
 			}
 		}
 	}
+
+	// Likewise $maxDistance is the radius of a legacy $near or $nearSphere, which can't do without one
+	for (const auto& term : out_terms) {
+		if (auto pGeoPredicate = dynamic_cast<GeoPredicate*>(term.getPtr())) {
+			if (max_distance.present() && pGeoPredicate->needsMaxDistance) {
+				pGeoPredicate->setMaxDistance(max_distance.get());
+				max_distance = Optional<bson::BSONElement>();
+			}
+			if (pGeoPredicate->needsMaxDistance)
+				throw bad_geo_query();
+		}
+	}
+	if (max_distance.present())
+		throw bad_geo_query();
 }
 
 /**
@@ -113,6 +139,34 @@ Reference<IPredicate> valueQueryToPredicate(bson::BSONObj const& query, std::str
 	return ref(new AndPredicate(terms));
 }
 
+/**
+ * Converts {$text: {$search: "..."}} into a TextPredicate. Only English, case and diacritic insensitive searches are
+ * supported, see TextSearch.h, and like in MongoDB $text can't be nested in another operator.
+ */
+static Reference<IPredicate> textQueryToPredicate(bson::BSONElement const& el, bool toplevel) {
+	if (!toplevel || !el.isABSONObj())
+		throw generic_invalid_parameter();
+	bson::BSONObj textObj = el.Obj();
+	if (!textObj.hasField("$search") || !textObj.getField("$search").isString())
+		throw generic_invalid_parameter();
+	for (auto i = textObj.begin(); i.more();) {
+		auto option = i.next();
+		std::string name = option.fieldName();
+		if (name == "$search")
+			continue;
+		if (name == "$language" && option.isString() && option.str() == "english")
+			continue;
+		if ((name == "$caseSensitive" || name == "$diacriticSensitive") && option.isBoolean() && !option.Bool())
+			continue;
+		throw generic_invalid_parameter();
+	}
+	// A quoted phrase would otherwise be searched for as separate terms, matching documents MongoDB wouldn't
+	std::string search = textObj.getStringField("$search");
+	if (search.find('"') != std::string::npos)
+		throw unsupported_text_phrase();
+	return ref(new TextPredicate(search));
+}
+
 /**
  *  Converts a mongo-like query document (query in the above grammar) into a corresponding
  *  QL predicate.
@@ -125,6 +179,8 @@ Reference<IPredicate> queryToPredicate(bson::BSONObj const& query, bool toplevel
 
 		if (el.type() == bson::BSONType::RegEx) {
 			terms.push_back(re_predicate(el, el.fieldName()));
+		} else if (!strcmp(el.fieldName(), "$text")) {
+			terms.push_back(textQueryToPredicate(el, toplevel));
 		} else if (el.fieldName()[0] == '$') {
 			if (el.isABSONObj()) {
 				try {
@@ -152,12 +208,135 @@ Reference<IPredicate> queryToPredicate(bson::BSONObj const& query, bool toplevel
 	return Reference<IPredicate>(new AndPredicate(terms));
 }
 
+/**
+ * Returns the deadline for the request carrying this query or command object, for PlanCheckpoint::setDeadline().
+ * Commands send "maxTimeMS", and legacy queries send "$maxTimeMS" next to the filter when they wrap it in "$query" or
+ * "query". An unwrapped legacy query is just the filter, so a field by either name is matched against documents and
+ * isn't a limit. Requests without a limit get DEFAULT_MAX_TIME_MS. A limit of 0 means none.
+ */
+double getRequestDeadline(bson::BSONObj const& query, bool isCmd) {
+	int64_t maxTimeMS = DOCLAYER_KNOBS->DEFAULT_MAX_TIME_MS;
+	bson::BSONElement el;
+	if (isCmd)
+		el = query.getField("maxTimeMS");
+	else if (query.getField("$query").isABSONObj() || query.getField("query").isABSONObj())
+		el = query.getField("$maxTimeMS");
+	if (!el.eoo()) {
+		if (!el.isNumber() || el.numberLong() < 0)
+			throw generic_invalid_parameter();
+		maxTimeMS = el.numberLong();
+	}
+	return maxTimeMS > 0 ? now() + maxTimeMS / 1000.0 : 0.0;
+}
+
+struct PredicateBounds {
+	DataValue min;
+	bool minClosed;
+	DataValue max;
+	bool maxClosed;
+
+	bool contains(DataValue const& v) const {
+		int lo = min.compare(v), hi = v.compare(max);
+		return (lo < 0 || (lo == 0 && minClosed)) && (hi < 0 || (hi == 0 && maxClosed));
+	}
+	bool within(PredicateBounds const& other) const {
+		int lo = min.compare(other.min), hi = max.compare(other.max);
+		return (lo > 0 || (lo == 0 && (other.minClosed || !minClosed))) &&
+		       (hi < 0 || (hi == 0 && (other.maxClosed || !maxClosed)));
+	}
+};
+
+static Optional<PredicateBounds> predicateBounds(Reference<IPredicate> const& pred) {
+	if (pred->getTypeCode() == IPredicate::EQ) {
+		DataValue value = dynamic_cast<EqPredicate*>(pred.getPtr())->value;
+		return PredicateBounds{value, true, value, true};
+	}
+	if (pred->getTypeCode() == IPredicate::RANGE) {
+		auto range = dynamic_cast<RangePredicate*>(pred.getPtr());
+		return PredicateBounds{range->min_value, range->min_closed, range->max_value, range->max_closed};
+	}
+	return Optional<PredicateBounds>();
+}
+
+static std::vector<Reference<IPredicate>> conjuncts(Reference<IPredicate> const& pred) {
+	if (pred->getTypeCode() == IPredicate::AND)
+		return dynamic_cast<AndPredicate*>(pred.getPtr())->terms;
+	if (pred->getTypeCode() == IPredicate::ALL)
+		return std::vector<Reference<IPredicate>>();
+	return std::vector<Reference<IPredicate>>{pred};
+}
+
+/**
+ * Whether every document matching the query term `q` also matches the filter term `f`. This only recognizes a few
+ * cases, which cover the usual partial filters and sparse indexes: identical terms, an equality or range on a field
+ * within a range on the same field, any of those on a field whose filter is {$exists: true}, and a term implying one
+ * alternative of an $or.
+ */
+static bool termImplies(Reference<IPredicate> const& q, Reference<IPredicate> const& f) {
+	if (q->toString() == f->toString())
+		return true;
+	if (f->getTypeCode() == IPredicate::OR) {
+		auto& alternatives = dynamic_cast<OrPredicate*>(f.getPtr())->terms;
+		return std::any_of(alternatives.begin(), alternatives.end(),
+		                   [&q](Reference<IPredicate> const& alt) { return termImplies(q, alt); });
+	}
+	if (q->getTypeCode() != IPredicate::ANY || f->getTypeCode() != IPredicate::ANY)
+		return false;
+	auto qAny = dynamic_cast<AnyPredicate*>(q.getPtr());
+	auto fAny = dynamic_cast<AnyPredicate*>(f.getPtr());
+	if (qAny->expr->toString() != fAny->expr->toString())
+		return false;
+
+	Optional<PredicateBounds> qBounds = predicateBounds(qAny->pred);
+	if (!qBounds.present())
+		return false;
+	// A missing field only matches predicates that match null
+	if (fAny->pred->getTypeCode() == IPredicate::ALL)
+		return !qBounds.get().contains(DataValue::nullValue());
+	Optional<PredicateBounds> fBounds = predicateBounds(fAny->pred);
+	return fBounds.present() && qBounds.get().within(fBounds.get());
+}
+
+/**
+ * Whether the simplified `query` predicate implies the simplified `filter` predicate, so that an index on just the
+ * documents matching `filter` can answer it. Every term of the filter must be implied by some term of the query.
+ */
+static bool queryImpliesFilter(Reference<IPredicate> const& query, Reference<IPredicate> const& filter) {
+	std::vector<Reference<IPredicate>> queryTerms = conjuncts(query);
+	for (const auto& f : conjuncts(filter)) {
+		if (std::none_of(queryTerms.begin(), queryTerms.end(),
+		                 [&f](Reference<IPredicate> const& q) { return termImplies(q, f); }))
+			return false;
+	}
+	return true;
+}
+
 Reference<Plan> planQuery(Reference<UnboundCollectionContext> cx, bson::BSONObj const& query) {
 	auto predicate = queryToPredicate(query, true);
 	auto simplifiedPredicate = predicate->simplify();
 
+	// Partial and sparse indexes can only be planned for queries that imply their filter, so plan with a copy of the
+	// collection context that has the ones this query can use
+	Reference<UnboundCollectionContext> planCx = cx;
+	for (const auto& index : cx->partialIndexes) {
+		if (!queryImpliesFilter(simplifiedPredicate, index.filterPredicate()))
+			continue;
+		if (planCx.getPtr() == cx.getPtr())
+			planCx = Reference<UnboundCollectionContext>(new UnboundCollectionContext(*cx));
+		planCx->addPlannableIndex(index);
+	}
+
+	// A $text term can only be evaluated against the terms of the text index's fields
+	for (const auto& term : conjuncts(simplifiedPredicate)) {
+		if (term->getTypeCode() != IPredicate::TEXT)
+			continue;
+		if (!planCx->textIndex.present())
+			throw text_index_required();
+		dynamic_cast<TextPredicate*>(term.getPtr())->bind(planCx->textIndex.get());
+	}
+
 	Reference<Plan> plan = Reference<Plan>(
-	    FilterPlan::construct_filter_plan(cx, Reference<Plan>(new TableScanPlan(cx)), simplifiedPredicate));
+	    FilterPlan::construct_filter_plan(planCx, Reference<Plan>(new TableScanPlan(planCx)), simplifiedPredicate));
 	if (verboseConsoleOutput) {
 		fprintf(stderr, "parsed predicate: %s\n", predicate->toString().c_str());
 		fprintf(stderr, "   simplified to: %s\n\n", simplifiedPredicate->toString().c_str());
@@ -217,7 +396,7 @@ ExtMsgQuery::ExtMsgQuery(ExtMsgHeader* header, const uint8_t* body) : header(hea
 		ptr += returnFieldSelector.objsize();
 	}
 
-	ns = getDBCollectionPair(collName, std::make_pair("query", query.toString()));
+	ns = getDBCollectionPair(collName, "query", [this]() { return query.toString(); });
 	if (ns.second == "$cmd") {
 		isCmd = true;
 		// Mark it empty for now, command would be responsible for setting collection name later.
@@ -329,6 +508,11 @@ ACTOR static Future<int32_t> addDocumentsFromCursor(Reference<Cursor> cursor,
 	state int32_t returned = 0;
 	state int32_t returnedSize = 0;
 	state bool stop = false;
+	state Reference<ScanReturnedContext> doc;
+
+	// A tailable cursor never runs out of documents, so it replies with whatever has arrived when this fires
+	state Future<Void> batchTimeout =
+	    cursor->tailable ? delay(cursor->awaitData ? DOCLAYER_KNOBS->TAILABLE_AWAIT_DATA_TIMEOUT : 0.0) : Never();
 
 	state int32_t remaining = std::abs(numberToReturn);
 
@@ -338,7 +522,12 @@ ACTOR static Future<int32_t> addDocumentsFromCursor(Reference<Cursor> cursor,
 			if ((returned <= DOCLAYER_KNOBS->MAX_RETURNABLE_DOCUMENTS ||
 			     returnedSize <= DOCLAYER_KNOBS->DEFAULT_RETURNABLE_DATA_SIZE) &&
 			    returnedSize <= DOCLAYER_KNOBS->MAX_RETURNABLE_DATA_SIZE) {
-				Reference<ScanReturnedContext> doc = waitNext(cursor->docs);
+				choose {
+					when(Reference<ScanReturnedContext> next = waitNext(cursor->docs)) { doc = next; }
+					when(Void _ = wait(batchTimeout)) { throw success(); }
+				}
+				if (cursor->tailable && returned == 0)
+					batchTimeout = delay(0.0);
 				bson::BSONObj obj =
 				    doc->toDataValue()
 				        .get()
@@ -364,6 +553,10 @@ ACTOR static Future<int32_t> addDocumentsFromCursor(Reference<Cursor> cursor,
 				stop = false;
 				break;
 			}
+			if (e.code() == error_code_max_time_ms_expired) {
+				Cursor::pluck(cursor);
+				throw;
+			}
 			TraceEvent(SevError, "BD_runQuery2").detail("error", e.what());
 			throw;
 		}
@@ -378,6 +571,50 @@ ACTOR static Future<int32_t> addDocumentsFromCursor(Reference<Cursor> cursor,
 	return returned;
 }
 
+/**
+ * Caches the reply to a query if the collection's change counter still has the value it had before the query
+ * started, i.e. if no write to the collection was committed while the query ran.
+ */
+ACTOR static void cacheQueryResult(Reference<QueryCache> cache,
+                                   Reference<UnboundCollectionContext> cx,
+                                   Reference<DatabaseContext> database,
+                                   std::string key,
+                                   uint64_t changeCount,
+                                   std::vector<bson::BSONObj> documents) {
+	try {
+		state Reference<DocTransaction> tr = NonIsolatedPlan::newTransaction(database);
+		uint64_t changeCountAfter = wait(cx->bindCollectionContext(tr)->getChangeCount());
+		if (changeCountAfter == changeCount)
+			cache->insert(key, changeCount, std::move(documents));
+	} catch (Error& e) {
+		// Not caching the result is always safe
+	}
+}
+
+/**
+ * Opens a cursor over the change events of a collection with a change log (see ChangeLog.h). The only filter allowed is
+ * {resumeAfter: <token>}, which starts the cursor after the given event rather than at the present.
+ */
+static Reference<Cursor> openTailableCursor(Reference<ExtConnection> ec,
+                                            Reference<ExtMsgQuery> msg,
+                                            Reference<UnboundCollectionContext> cx,
+                                            bson::BSONObj const& queryObject) {
+	if (!cx->changeLogEnabled)
+		throw change_log_not_enabled();
+	for (auto i = queryObject.begin(); i.more();) {
+		if (strcmp(i.next().fieldName(), "resumeAfter") != 0)
+			throw generic_invalid_parameter();
+	}
+
+	Reference<PlanCheckpoint> checkpoint(new PlanCheckpoint);
+	Reference<Cursor> cursor(new Cursor(
+	    tailChanges(checkpoint.getPtr(), ec->docLayer->database, cx, parseResumeToken(queryObject, "resumeAfter")),
+	    checkpoint));
+	cursor->tailable = true;
+	cursor->awaitData = (msg->flags & AWAIT_DATA) != 0;
+	return cursor;
+}
+
 ACTOR static Future<Void> runQuery(Reference<ExtConnection> ec,
                                    Reference<ExtMsgQuery> msg,
                                    PromiseStream<Reference<ExtMsgReply>> replyStream) {
@@ -385,6 +622,7 @@ ACTOR static Future<Void> runQuery(Reference<ExtConnection> ec,
 	state Reference<ExtMsgReply> reply;
 	state Reference<Cursor> cursor;
 	state Reference<DocTransaction> dtr = ec->getOperationTransaction();
+	state double deadline = 0.0;
 	bool sorted = (msg->query.hasField("orderby") || msg->query.hasField("$orderby"));
 	state Optional<bson::BSONObj> ordering = sorted ? msg->query.hasField("orderby")
 	                                                      ? msg->query.getObjectField("orderby")
@@ -392,6 +630,8 @@ ACTOR static Future<Void> runQuery(Reference<ExtConnection> ec,
 	                                                : Optional<bson::BSONObj>();
 
 	try {
+		deadline = getRequestDeadline(msg->query, false);
+
 		// Return `listCollections()` if `ns` is like "name.system.namespaces"
 		if (msg->ns.second == namespaces) {
 			Reference<ExtMsgReply> collections = wait(listCollections(msg, dtr, ec->docLayer->rootDirectory));
@@ -402,37 +642,67 @@ ACTOR static Future<Void> runQuery(Reference<ExtConnection> ec,
 		state Reference<UnboundCollectionContext> cx = wait(ec->mm->getUnboundCollectionContext(dtr, msg->ns, true));
 
 		// The following is required by ambiguity in the wire protocol we are speaking
-		bson::BSONObj queryObject =
+		state bson::BSONObj queryObject =
 		    msg->query.hasField("query")
 		        ? msg->query.getObjectField("query")
 		        : msg->query.hasField("$query") ? msg->query.getObjectField("$query") : msg->query;
 
-		// Plan needs to be state in case we have a sort plan,
-		// which in turn holds a reference to the actor that does the sorting
-		state Reference<Plan> plan = planQuery(cx, queryObject);
-		if (!ordering.present() && msg->numberToSkip)
-			plan = ref(new SkipPlan(msg->numberToSkip, plan));
-		plan = planProjection(plan, msg->returnFieldSelector, ordering);
-		plan = ec->wrapOperationPlan(plan, true, cx);
-		if (ordering.present()) {
-			plan = ref(new SortPlan(plan, ordering.get()));
-			if (msg->numberToSkip)
-				plan = ref(new SkipPlan(msg->numberToSkip, plan));
+		// Only replies which close the cursor are cached, so exhaust and tailable queries are never cacheable.
+		state Reference<QueryCache> cache = ec->docLayer->queryCache;
+		state bool cacheable = cache->enabled() && !ec->explicitTransaction &&
+		                       !(msg->flags & (EXHAUST | TAILABLE_CURSOR)) && !msg->query.hasField("$explain");
+		state std::string cacheKey;
+		state uint64_t changeCount = 0;
+		if (cacheable) {
+			cacheKey = QueryCache::makeKey(cx->collectionDirectory->key(), queryObject, msg->returnFieldSelector,
+			                               ordering, msg->numberToSkip, msg->numberToReturn);
+			uint64_t c = wait(cx->bindCollectionContext(dtr)->getChangeCount());
+			changeCount = c;
+
+			Reference<QueryCache::Entry> hit = cache->lookup(cacheKey, changeCount);
+			if (hit) {
+				DocumentLayer::metricReporter->captureMeter("queryCacheHits", 1);
+				reply = Reference<ExtMsgReply>(new ExtMsgReply(msg->header, msg->query));
+				for (auto const& doc : hit->documents)
+					reply->addDocument(doc);
+				reply->addResponseFlag(8 /*0b1000*/);
+				replyStream.send(reply);
+				throw end_of_stream();
+			}
+			DocumentLayer::metricReporter->captureMeter("queryCacheMisses", 1);
 		}
 
-		// return query plan explanation if `$explain` detected
-		if (msg->query.hasField("$explain")) {
-			reply = Reference<ExtMsgReply>(new ExtMsgReply(msg->header, msg->query));
-			reply->addDocument(BSON("explanation" << plan->describe()));
-			replyStream.send(reply);
-			throw end_of_stream();
-		}
+		if (msg->flags & TAILABLE_CURSOR) {
+			cursor = Cursor::add(ec->cursors, openTailableCursor(ec, msg, cx, queryObject));
+		} else {
+			// Plan needs to be state in case we have a sort plan,
+			// which in turn holds a reference to the actor that does the sorting
+			state Reference<Plan> plan = planQuery(cx, queryObject);
+			if (!ordering.present() && msg->numberToSkip)
+				plan = ref(new SkipPlan(msg->numberToSkip, plan));
+			plan = planProjection(plan, msg->returnFieldSelector, ordering);
+			plan = ec->wrapOperationPlan(plan, true, cx);
+			if (ordering.present()) {
+				plan = ref(new SortPlan(plan, ordering.get()));
+				if (msg->numberToSkip)
+					plan = ref(new SkipPlan(msg->numberToSkip, plan));
+			}
 
-		Reference<PlanCheckpoint> outerCheckpoint(new PlanCheckpoint);
+			// return query plan explanation if `$explain` detected
+			if (msg->query.hasField("$explain")) {
+				reply = Reference<ExtMsgReply>(new ExtMsgReply(msg->header, msg->query));
+				reply->addDocument(BSON("explanation" << plan->describe()));
+				replyStream.send(reply);
+				throw end_of_stream();
+			}
 
-		// Add a new cursor to the server's cursor collection
-		cursor = Cursor::add(
-		    ec->cursors, Reference<Cursor>(new Cursor(plan->execute(outerCheckpoint.getPtr(), dtr), outerCheckpoint)));
+			Reference<PlanCheckpoint> outerCheckpoint(new PlanCheckpoint);
+			outerCheckpoint->setDeadline(deadline);
+
+			// Add a new cursor to the server's cursor collection
+			cursor = Cursor::add(ec->cursors, Reference<Cursor>(new Cursor(plan->execute(outerCheckpoint.getPtr(), dtr),
+			                                                               outerCheckpoint)));
+		}
 
 		state int replies = 0;
 		state bool exhaust = ((msg->flags & EXHAUST) != 0);
@@ -476,6 +746,9 @@ ACTOR static Future<Void> runQuery(Reference<ExtConnection> ec,
 
 			++replies;
 		}
+
+		if (cacheable && reply->replyHeader.cursorID == 0)
+			cacheQueryResult(cache, cx, ec->docLayer->database, cacheKey, changeCount, reply->documents);
 	} catch (Error& e) {
 		if (e.code() != error_code_end_of_stream) {
 			reply = Reference<ExtMsgReply>(new ExtMsgReply(msg->header, msg->query));
@@ -493,6 +766,8 @@ ACTOR static Future<Void> doRun(Reference<ExtMsgQuery> query, Reference<ExtConne
 	state PromiseStream<Reference<ExtMsgReply>> replyStream;
 	state Future<Void> x;
 	state uint64_t startTime = timer_int();
+	state Promise<Void> repliesWritten;
+	state Future<Void> previousRepliesWritten = ec->orderReplies(repliesWritten);
 
 	DocumentLayer::metricReporter->captureMeter("queryRate", 1);
 	if (query->isCmd) {
@@ -506,7 +781,8 @@ ACTOR static Future<Void> doRun(Reference<ExtMsgQuery> query, Reference<ExtConne
 	state FutureStream<Reference<ExtMsgReply>> replies = replyStream.getFuture();
 	loop {
 		try {
-			Reference<ExtMsgReply> reply = waitNext(replies);
+			state Reference<ExtMsgReply> reply = waitNext(replies);
+			Void _ = wait(previousRepliesWritten);
 			if (verboseLogging)
 				TraceEvent("BD_doRun").detail("Reply", reply->toString());
 			reply->write(ec);
@@ -516,6 +792,7 @@ ACTOR static Future<Void> doRun(Reference<ExtMsgQuery> query, Reference<ExtConne
 			throw e;
 		}
 	}
+	repliesWritten.send(Void());
 
 	DocumentLayer::metricReporter->captureTime("queryLatency_us", (timer_int() - startTime) / 1000);
 
@@ -530,6 +807,56 @@ Future<Void> ExtMsgQuery::run(Reference<ExtConnection> nmc) {
 	return doRun(Reference<ExtMsgQuery>::addRef(this), nmc);
 }
 
+AdmissionPriority ExtMsgQuery::priority() {
+	if (!isCmd)
+		return AdmissionPriority::READ;
+	std::string cmd = getFirstKey(query);
+	std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::tolower);
+	if (cmd == "insert" || cmd == "update" || cmd == "delete" || cmd == "findandmodify")
+		return AdmissionPriority::WRITE;
+	if (cmd == "createindexes")
+		return AdmissionPriority::INDEX_BUILD;
+	if (cmd == "count" || cmd == "distinct" || cmd == "aggregate" || cmd == "watch" || cmd == "listcollections" ||
+	    cmd == "listindexes")
+		return AdmissionPriority::READ;
+	return AdmissionPriority::ADMIN;
+}
+
+double ExtMsgQuery::deadline() {
+	try {
+		return getRequestDeadline(query, isCmd);
+	} catch (Error& e) {
+		// A malformed maxTimeMS is reported by run()
+		return 0.0;
+	}
+}
+
+ACTOR static Future<Void> doRejectQuery(Reference<ExtMsgQuery> query, Reference<ExtConnection> ec, Error e) {
+	state Promise<Void> repliesWritten;
+	Void _ = wait(ec->orderReplies(repliesWritten));
+
+	Reference<ExtMsgReply> reply(new ExtMsgReply(query->header, query->query));
+	if (query->isCmd)
+		reply->addDocument(BSON("errmsg" << e.what() << "code" << e.code() << "ok" << 0));
+	else
+		reply->addDocument(BSON("$err" << e.what() << "code" << e.code() << "ok" << 1.0));
+	reply->setResponseFlags(2 /*0b0010*/);
+	reply->write(ec);
+
+	repliesWritten.send(Void());
+	return Void();
+}
+
+Future<Void> ExtMsgQuery::reject(Reference<ExtConnection> ec, Error e) {
+	return doRejectQuery(Reference<ExtMsgQuery>::addRef(this), ec, e);
+}
+
+bool ExtMsgQuery::isPipelinable(Reference<ExtConnection> ec) {
+	// Commands may write or depend on the outcome of earlier writes (getLastError), and exhaust queries generate
+	// server-initiated request ids, so only plain queries outside of explicit transactions qualify.
+	return !isCmd && !(flags & EXHAUST) && !ec->explicitTransaction;
+}
+
 ExtMsgReply::ExtMsgReply(ExtMsgHeader* header, const uint8_t* body) : header(nullptr) {
 	memcpy(&replyHeader, header, sizeof(ExtReplyHeader));
 
@@ -587,6 +914,15 @@ void ExtMsgReply::write(Reference<ExtConnection> nmc) {
 	}
 }
 
+/**
+ * Legacy write messages have no reply of their own, so a rejected write is recorded as the connection's last write
+ * result, to be reported by the next getLastError.
+ */
+ACTOR static Future<WriteResult> rejectedWrite(Future<Void> readyToWrite, Error e) {
+	Void _ = wait(readyToWrite);
+	throw e;
+}
+
 ExtMsgInsert::ExtMsgInsert(ExtMsgHeader* header, const uint8_t* body) : header(header) {
 	const uint8_t* ptr = body;
 	const uint8_t* eom = (const uint8_t*)header + header->messageLength;
@@ -596,12 +932,26 @@ ExtMsgInsert::ExtMsgInsert(ExtMsgHeader* header, const uint8_t* body) : header(h
 
 	const char* collName = (const char*)ptr;
 	ptr += strlen(collName) + 1;
-	ns = getDBCollectionPair(collName, std::make_pair("msgType", "OP_INSERT"));
+	ns = getDBCollectionPair(collName, "msgType", []() { return "OP_INSERT"; });
+
+	// Size the batch up front, so parsing does a single allocation no matter how many documents it holds. The
+	// documents themselves are views into the message buffer. The lengths have not been validated yet, so the count
+	// stops at the first one that is too short or runs past the end of the message; the loop below rejects it.
+	int count = 0;
+	for (const uint8_t* p = ptr; eom - p >= 5;) {
+		int32_t len = *(const int32_t*)p;
+		if (len < 5 || len > eom - p)
+			break;
+		count++;
+		p += len;
+	}
+	documents.reserve(count);
 
 	while (ptr < eom) {
-		bson::BSONObj doc = bson::BSONObj((const char*)ptr);
-		ptr += doc.objsize();
-		documents.push_back(doc);
+		if (eom - ptr < 5 || *(const int32_t*)ptr > eom - ptr)
+			throw wire_protocol_mismatch();
+		documents.emplace_back((const char*)ptr);
+		ptr += documents.back().objsize();
 	}
 
 	ASSERT(ptr == eom);
@@ -630,7 +980,7 @@ ACTOR Future<Reference<IReadWriteContext>> insertDocument(Reference<CollectionCo
 	state Reference<QueryContext> dcx;
 
 	if (!encodedIds.present()) {
-		encodedId = DataValue(bson::OID::gen()).encode_key_part();
+		encodedId = cx->generateId().encode_key_part();
 		valueEncodedId = encodedId;
 		idObj = Optional<bson::BSONObj>();
 		dcx = cx->cx->getSubContext(encodedId);
@@ -639,9 +989,11 @@ ACTOR Future<Reference<IReadWriteContext>> insertDocument(Reference<CollectionCo
 		valueEncodedId = encodedIds.get().valueEncoded;
 		idObj = encodedIds.get().objValue;
 		dcx = cx->cx->getSubContext(encodedId);
-		Optional<DataValue> existing = wait(dcx->get(DataValue("_id", DVTypeCode::STRING).encode_key_part()));
-		if (existing.present())
-			throw duplicated_key_field();
+		if (!encodedIds.get().generated) {
+			Optional<DataValue> existing = wait(dcx->get(DataValue("_id", DVTypeCode::STRING).encode_key_part()));
+			if (existing.present())
+				throw duplicated_key_field();
+		}
 	}
 
 	// FIXME: abstraction violation out of laziness
@@ -663,6 +1015,19 @@ ACTOR Future<Reference<IReadWriteContext>> insertDocument(Reference<CollectionCo
 	return dcx;
 }
 
+// Inserts a document under an id generated for an earlier attempt of the same insert. If that attempt's commit went
+// through after all, the document is there already and is left as it is, rather than written and counted again.
+ACTOR static Future<Reference<IReadWriteContext>> insertDocumentAgain(Reference<CollectionContext> cx,
+                                                                      bson::BSONObj d,
+                                                                      IdInfo encodedIds) {
+	state Reference<QueryContext> dcx = cx->cx->getSubContext(StringRef(encodedIds.keyEncoded));
+	Optional<DataValue> existing = wait(dcx->get(DataValue("_id", DVTypeCode::STRING).encode_key_part()));
+	if (existing.present())
+		return dcx;
+	Reference<IReadWriteContext> inserted = wait(insertDocument(cx, d, encodedIds));
+	return inserted;
+}
+
 struct ExtInsert : ConcreteInsertOp<ExtInsert> {
 	bson::BSONObj obj;
 	Optional<IdInfo> encodedIds;
@@ -671,7 +1036,15 @@ struct ExtInsert : ConcreteInsertOp<ExtInsert> {
 
 	std::string describe() override { return "Insert(" + obj.toString() + ")"; }
 
+	// A document without an _id gets one the first time it's inserted, and keeps it if the transaction is retried, so
+	// that the id reported to the client is the one committed. Only that first attempt can skip checking for the id.
 	Future<Reference<IReadWriteContext>> insert(Reference<CollectionContext> cx) override {
+		if (encodedIds.present() && encodedIds.get().generated)
+			return insertDocumentAgain(cx, obj, encodedIds.get());
+		if (!encodedIds.present()) {
+			std::string id = cx->generateId().encode_key_part().toString();
+			encodedIds = IdInfo(id, id, Optional<bson::BSONObj>(), true);
+		}
 		return insertDocument(cx, obj, encodedIds);
 	}
 };
@@ -729,6 +1102,14 @@ struct ExtIndexInsert : ConcreteInsertOp<ExtIndexInsert> {
 		dcx->set(DataValue("unique", DVTypeCode::STRING).encode_key_part(),
 		         self->indexObj.hasField("unique") ? DataValue(self->indexObj.getBoolField("unique")).encode_value()
 		                                           : DataValue(false).encode_value());
+		if (self->indexObj.hasField("expireAfterSeconds"))
+			dcx->set(DataValue("expireAfterSeconds", DVTypeCode::STRING).encode_key_part(),
+			         DataValue(self->indexObj.getField("expireAfterSeconds").Number()).encode_value());
+		if (self->indexObj.hasField("partialFilterExpression"))
+			dcx->set(DataValue("partialFilterExpression", DVTypeCode::STRING).encode_key_part(),
+			         DataValue(self->indexObj.getObjectField("partialFilterExpression")).encode_value());
+		if (self->indexObj.getField("sparse").trueValue())
+			dcx->set(DataValue("sparse", DVTypeCode::STRING).encode_key_part(), DataValue(true).encode_value());
 
 		if (idObj.present())
 			insertElementRecursive("_id", idObj.get(), dcx);
@@ -749,11 +1130,69 @@ ACTOR Future<WriteCmdResult> attemptIndexInsertion(bson::BSONObj indexObj,
 	if (!indexObj.hasField("name"))
 		throw no_index_name();
 
-	if (indexObj.getObjectField("key").nFields() == 1) {
+	// TTL indexes must be on a single field other than _id, see TTLMonitor.h
+	if (indexObj.hasField("expireAfterSeconds")) {
+		auto ttlEl = indexObj.getField("expireAfterSeconds");
+		bson::BSONObj keyObj = indexObj.getObjectField("key");
+		if (!ttlEl.isNumber() || ttlEl.Number() < 0 || keyObj.nFields() != 1 ||
+		    !strcmp(keyObj.firstElement().fieldName(), "_id"))
+			throw bad_index_specification();
+	}
+
+	// Partial indexes only hold documents matching partialFilterExpression, which must be a valid query
+	if (indexObj.hasField("partialFilterExpression")) {
+		if (!indexObj.getField("partialFilterExpression").isABSONObj())
+			throw bad_index_specification();
+		queryToPredicate(indexObj.getObjectField("partialFilterExpression"), true);
+	}
+
+	// Sparse indexes skip documents missing all the indexed fields, which already is a filter of its own
+	if (indexObj.hasField("sparse")) {
+		auto sparseEl = indexObj.getField("sparse");
+		if ((!sparseEl.isBoolean() && !sparseEl.isNumber()) ||
+		    (sparseEl.trueValue() && indexObj.hasField("partialFilterExpression")))
+			throw bad_index_specification();
+	}
+
+	// Text indexes hold the terms of all their fields' strings in one posting list per term, see TextSearch.h
+	int textKeys = 0;
+	for (bson::BSONObjIterator i = indexObj.getObjectField("key").begin(); i.more();) {
+		auto el = i.next();
+		if (el.isString() && el.str() == "text")
+			textKeys++;
+	}
+	if (indexObj.hasField("partialFilterExpression") &&
+	    indexObj.getObjectField("partialFilterExpression").hasField("$text"))
+		throw bad_index_specification();
+
+	if (textKeys > 0) {
+		if (textKeys != indexObj.getObjectField("key").nFields() || indexObj.getField("unique").trueValue() ||
+		    indexObj.hasField("expireAfterSeconds") || indexObj.hasField("partialFilterExpression"))
+			throw bad_index_specification();
+		if (indexObj.getObjectField("key").hasField("_id"))
+			throw bad_index_specification();
+	} else if (indexObj.getObjectField("key").nFields() == 1) {
 		auto keyEl = indexObj.getObjectField("key").firstElement();
-		if (!keyEl.isNumber() || !(keyEl.Number() == 1.0 || keyEl.Number() == -1.0)) {
-			(keyEl.isString() && keyEl.str() == "text") ? throw unsupported_index_type()
-			                                            : throw bad_index_specification();
+		if (keyEl.isString() && keyEl.str() == "hashed") {
+			// Hashed indexes only find equal values, so they can't enforce uniqueness, sort or find expired dates, see
+			// hashedIndexKeyPart()
+			if (!strcmp(keyEl.fieldName(), "_id"))
+				throw unsupported_index_type();
+			if (indexObj.getField("unique").trueValue() || indexObj.hasField("expireAfterSeconds"))
+				throw bad_index_specification();
+		} else if (keyEl.isString() && (keyEl.str() == "2dsphere" || keyEl.str() == "2d")) {
+			// Geo indexes hold the cells of the field's points, see GeoSearch.h
+			if (!strcmp(keyEl.fieldName(), "_id") || indexObj.getField("unique").trueValue() ||
+			    indexObj.hasField("expireAfterSeconds"))
+				throw bad_index_specification();
+		} else if (keyEl.isString() && (keyEl.str() == "folded" || keyEl.str() == "reversed")) {
+			// Case folded and reversed indexes only serve $regex queries, see foldedIndexKeyPart(). A unique folded
+			// index makes its field unique regardless of case.
+			if (!strcmp(keyEl.fieldName(), "_id") || indexObj.hasField("expireAfterSeconds") ||
+			    (keyEl.str() == "reversed" && indexObj.getField("unique").trueValue()))
+				throw bad_index_specification();
+		} else if (!keyEl.isNumber() || !(keyEl.Number() == 1.0 || keyEl.Number() == -1.0)) {
+			throw bad_index_specification();
 		}
 		if (!strcmp(keyEl.fieldName(), "_id")) {
 			return WriteCmdResult();
@@ -764,8 +1203,7 @@ ACTOR Future<WriteCmdResult> attemptIndexInsertion(bson::BSONObj indexObj,
 		for (bson::BSONObjIterator i = indexObj.getObjectField("key").begin(); i.more();) {
 			auto el = i.next();
 			if (!el.isNumber()) {
-				(el.isString() && el.str() == "text") ? throw unsupported_index_type()
-				                                      : throw bad_index_specification();
+				throw bad_index_specification();
 			}
 			if (!strcmp(el.fieldName(), "_id")) {
 				throw compound_id_index();
@@ -812,7 +1250,7 @@ ACTOR Future<WriteCmdResult> attemptIndexInsertion(bson::BSONObj indexObj,
 }
 
 ACTOR Future<WriteCmdResult> doInsertCmd(Namespace ns,
-                                         std::list<bson::BSONObj>* documents,
+                                         std::vector<bson::BSONObj>* documents,
                                          Reference<ExtConnection> ec) {
 	state Reference<DocTransaction> tr = ec->getOperationTransaction();
 
@@ -825,12 +1263,15 @@ ACTOR Future<WriteCmdResult> doInsertCmd(Namespace ns,
 		bson::BSONObj firstDoc = documents->front();
 
 		const char* collnsStr = firstDoc.getField("ns").String().c_str();
-		const auto collns = getDBCollectionPair(collnsStr, std::make_pair("msg", "Bad coll name in index insert"));
+		const auto collns =
+		    getDBCollectionPair(collnsStr, "msg", []() { return "Bad coll name in index insert"; });
 		WriteCmdResult result = wait(attemptIndexInsertion(firstDoc.getOwned(), ec, tr, collns));
 		return result;
 	}
 
+	state std::vector<Reference<ExtInsert>> ops;
 	std::vector<Reference<IInsertOp>> inserts;
+	inserts.reserve(documents->size());
 	std::set<std::string> ids;
 	for (const auto& d : *documents) {
 		const bson::BSONObj& obj = d;
@@ -840,12 +1281,19 @@ ACTOR Future<WriteCmdResult> doInsertCmd(Namespace ns,
 				throw duplicated_key_field();
 			}
 		}
-		inserts.push_back(Reference<IInsertOp>(new ExtInsert(obj, encodedIds)));
+		ops.push_back(ref(new ExtInsert(obj, encodedIds)));
+		inserts.push_back(Reference<IInsertOp>::addRef(ops.back().getPtr()));
 	}
 
 	Reference<Plan> plan = ec->isolatedWrapOperationPlan(ref(new InsertPlan(inserts, ec->mm, ns)));
 	int64_t i = wait(executeUntilCompletionTransactionally(plan, tr));
-	return WriteCmdResult(i);
+	WriteCmdResult result(i);
+	for (int j = 0; j < ops.size(); j++) {
+		const Optional<IdInfo>& id = ops[j]->encodedIds;
+		if (id.present() && id.get().generated)
+			result.generatedIds.push_back(std::make_pair(j, Standalone<StringRef>(StringRef(id.get().keyEncoded))));
+	}
+	return result;
 }
 
 ACTOR static Future<WriteResult> doInsertMsg(Future<Void> readyToWrite,
@@ -861,6 +1309,14 @@ Future<Void> ExtMsgInsert::run(Reference<ExtConnection> ec) {
 	                      documents.size());
 }
 
+AdmissionPriority ExtMsgInsert::priority() {
+	return ns.second == indexes_collection ? AdmissionPriority::INDEX_BUILD : AdmissionPriority::WRITE;
+}
+
+Future<Void> ExtMsgInsert::reject(Reference<ExtConnection> ec, Error e) {
+	return ec->afterWrite(rejectedWrite(ec->beforeWrite(), e));
+}
+
 ExtMsgUpdate::ExtMsgUpdate(ExtMsgHeader* header, const uint8_t* body) : header(header) {
 	const uint8_t* ptr = body;
 	const uint8_t* eom = (const uint8_t*)header + header->messageLength;
@@ -869,7 +1325,7 @@ ExtMsgUpdate::ExtMsgUpdate(ExtMsgHeader* header, const uint8_t* body) : header(h
 
 	const char* collName = (const char*)ptr;
 	ptr += strlen(collName) + 1;
-	ns = getDBCollectionPair(collName, std::make_pair("msgType", "OP_UPDATE"));
+	ns = getDBCollectionPair(collName, "msgType", []() { return "OP_UPDATE"; });
 
 	flags = *(int32_t*)ptr;
 	ptr += sizeof(int32_t);
@@ -1006,7 +1462,8 @@ ACTOR Future<Void> updateDocument(Reference<IReadWriteContext> cx,
 ACTOR Future<WriteCmdResult> doUpdateCmd(Namespace ns,
                                          bool ordered,
                                          std::vector<ExtUpdateCmd>* cmds,
-                                         Reference<ExtConnection> ec) {
+                                         Reference<ExtConnection> ec,
+                                         double deadline) {
 	state WriteCmdResult cmdResult;
 	state int idx;
 	for (idx = 0; idx < cmds->size(); idx++) {
@@ -1049,7 +1506,7 @@ ACTOR Future<WriteCmdResult> doUpdateCmd(Namespace ns,
 			plan = ec->wrapOperationPlan(plan, false, cx);
 
 			std::pair<int64_t, Reference<ScanReturnedContext>> pair =
-			    wait(executeUntilCompletionAndReturnLastTransactionally(plan, dtr));
+			    wait(executeUntilCompletionAndReturnLastTransactionally(plan, dtr, deadline));
 			cmdResult.n += pair.first;
 
 			if (cmd->upsert && pair.first == 1 && pair.second->scanId() == -1) {
@@ -1074,7 +1531,9 @@ ACTOR static Future<WriteResult> doUpdateMsg(Future<Void> readyToWrite,
 	Void _ = wait(readyToWrite);
 	state std::vector<ExtUpdateCmd> cmds;
 	cmds.emplace_back(msg->selector, msg->update, msg->upsert, msg->multi);
-	WriteCmdResult cmdResult = wait(doUpdateCmd(msg->ns, true, &cmds, ec));
+	// Legacy writes have no way to send maxTimeMS, so they get the default
+	double deadline = getRequestDeadline(bson::BSONObj(), true);
+	WriteCmdResult cmdResult = wait(doUpdateCmd(msg->ns, true, &cmds, ec, deadline));
 	if (cmdResult.writeErrors.empty()) {
 		return WriteResult(cmdResult, WriteType::UPDATE);
 	} else {
@@ -1086,6 +1545,10 @@ Future<Void> ExtMsgUpdate::run(Reference<ExtConnection> ec) {
 	return ec->afterWrite(doUpdateMsg(ec->beforeWrite(), Reference<ExtMsgUpdate>::addRef(this), ec));
 }
 
+Future<Void> ExtMsgUpdate::reject(Reference<ExtConnection> ec, Error e) {
+	return ec->afterWrite(rejectedWrite(ec->beforeWrite(), e));
+}
+
 ExtMsgGetMore::ExtMsgGetMore(ExtMsgHeader* header, const uint8_t* body) : header(header) {
 	const uint8_t* ptr = body;
 	const uint8_t* eom = (const uint8_t*)header + header->messageLength;
@@ -1094,7 +1557,7 @@ ExtMsgGetMore::ExtMsgGetMore(ExtMsgHeader* header, const uint8_t* body) : header
 
 	const char* collName = (const char*)ptr;
 	ptr += strlen(collName) + 1;
-	ns = getDBCollectionPair(collName, std::make_pair("msgType", "OP_GETMORE"));
+	ns = getDBCollectionPair(collName, "msgType", []() { return "OP_GETMORE"; });
 
 	numberToReturn = *(int32_t*)ptr;
 	ptr += sizeof(int32_t);
@@ -1115,10 +1578,19 @@ ACTOR static Future<Void> doGetMoreRun(Reference<ExtMsgGetMore> getMore, Referen
 	state Reference<Cursor> cursor = ec->cursors[getMore->cursorID];
 
 	if (cursor) {
-		int32_t returned = wait(addDocumentsFromCursor(cursor, reply, getMore->numberToReturn));
-		reply->replyHeader.startingFrom = cursor->returned - returned;
-		reply->addResponseFlag(8 /*0b1000*/);
-		cursor->refresh();
+		try {
+			int32_t returned = wait(addDocumentsFromCursor(cursor, reply, getMore->numberToReturn));
+			reply->replyHeader.startingFrom = cursor->returned - returned;
+			reply->addResponseFlag(8 /*0b1000*/);
+			cursor->refresh();
+		} catch (Error& e) {
+			// The cursor has already been removed, so report the error once and let the client move on
+			if (e.code() != error_code_max_time_ms_expired)
+				throw;
+			reply = Reference<ExtMsgReply>(new ExtMsgReply(getMore->header));
+			reply->addDocument(BSON("$err" << e.what() << "code" << e.code() << "ok" << 1.0));
+			reply->setResponseFlags(2 /*0b0010*/);
+		}
 	} else {
 		reply->addResponseFlag(1 /*0b0001*/);
 	}
@@ -1131,6 +1603,14 @@ Future<Void> ExtMsgGetMore::run(Reference<ExtConnection> ec) {
 	return doGetMoreRun(Reference<ExtMsgGetMore>::addRef(this), ec);
 }
 
+Future<Void> ExtMsgGetMore::reject(Reference<ExtConnection> ec, Error e) {
+	Reference<ExtMsgReply> reply(new ExtMsgReply(header));
+	reply->addDocument(BSON("$err" << e.what() << "code" << e.code() << "ok" << 1.0));
+	reply->setResponseFlags(2 /*0b0010*/);
+	reply->write(ec);
+	return Void();
+}
+
 ExtMsgDelete::ExtMsgDelete(ExtMsgHeader* header, const uint8_t* body) : header(header) {
 	const uint8_t* ptr = body;
 	const uint8_t* eom = (const uint8_t*)header + header->messageLength;
@@ -1139,7 +1619,7 @@ ExtMsgDelete::ExtMsgDelete(ExtMsgHeader* header, const uint8_t* body) : header(h
 
 	const char* collName = (const char*)ptr;
 	ptr += strlen(collName) + 1;
-	ns = getDBCollectionPair(collName, std::make_pair("msgType", "OP_DELETE"));
+	ns = getDBCollectionPair(collName, "msgType", []() { return "OP_DELETE"; });
 
 	flags = *(int32_t*)ptr;
 	ptr += sizeof(int32_t);
@@ -1171,7 +1651,8 @@ std::string ExtMsgDelete::toString() {
 ACTOR Future<WriteCmdResult> doDeleteCmd(Namespace ns,
                                          bool ordered,
                                          std::vector<bson::BSONObj>* selectors,
-                                         Reference<ExtConnection> ec) {
+                                         Reference<ExtConnection> ec,
+                                         double deadline) {
 	try {
 		state Reference<DocTransaction> dtr = ec->getOperationTransaction();
 		state Reference<UnboundCollectionContext> cx = wait(ec->mm->getUnboundCollectionContext(dtr, ns, false, true));
@@ -1188,7 +1669,7 @@ ACTOR Future<WriteCmdResult> doDeleteCmd(Namespace ns,
 				plan = ec->wrapOperationPlan(plan, false, cx);
 
 				// TODO: BM: <rdar://problem/40661843> DocLayer: Make bulk deletes efficient
-				int64_t deletedRecords = wait(executeUntilCompletionTransactionally(plan, dtr));
+				int64_t deletedRecords = wait(executeUntilCompletionTransactionally(plan, dtr, deadline));
 				nrDeletedRecords += deletedRecords;
 			} catch (Error& e) {
 				TraceEvent(SevError, "ExtMsgDeleteFailure").error(e);
@@ -1208,7 +1689,9 @@ ACTOR static Future<WriteResult> doDeleteMsg(Future<Void> readyToWrite,
                                              Reference<ExtMsgDelete> msg,
                                              Reference<ExtConnection> ec) {
 	Void _ = wait(readyToWrite);
-	WriteCmdResult cmdResult = wait(doDeleteCmd(msg->ns, true, &msg->selectors, ec));
+	// Legacy writes have no way to send maxTimeMS, so they get the default
+	double deadline = getRequestDeadline(bson::BSONObj(), true);
+	WriteCmdResult cmdResult = wait(doDeleteCmd(msg->ns, true, &msg->selectors, ec, deadline));
 	if (cmdResult.writeErrors.empty())
 		return WriteResult(cmdResult, WriteType::REMOVAL);
 	else
@@ -1219,6 +1702,10 @@ Future<Void> ExtMsgDelete::run(Reference<ExtConnection> ec) {
 	return ec->afterWrite(doDeleteMsg(ec->beforeWrite(), Reference<ExtMsgDelete>::addRef(this), ec));
 }
 
+Future<Void> ExtMsgDelete::reject(Reference<ExtConnection> ec, Error e) {
+	return ec->afterWrite(rejectedWrite(ec->beforeWrite(), e));
+}
+
 ExtMsgKillCursors::ExtMsgKillCursors(ExtMsgHeader* header, const uint8_t* body) : header(header) {
 	const uint8_t* ptr = body;
 	const uint8_t* eom = (const uint8_t*)header + header->messageLength;
@@ -1447,3 +1934,120 @@ $elemMatch : { _id: { $elemMatch : { $gte: 999, $lte : 111 } } } } }", "NONE()")
     }
 }
 */
+
+// An OP_INSERT batch is parsed into a vector sized by a single allocation, and a malformed document length stops the
+// size count instead of running it past the end of the message.
+TEST_CASE("/doclayer/ExtMsg/InsertBatchParsing") {
+	const int batchSize = 100;
+
+	bson::BSONObj doc = BSON("_id" << 1 << "name"
+	                               << "batched document"
+	                               << "n" << 12345);
+
+	std::string insertMsg(sizeof(ExtMsgHeader), '\0');
+	int32_t zero = 0;
+	insertMsg.append((const char*)&zero, sizeof(int32_t)); // flags
+	insertMsg.append("test.coll", strlen("test.coll") + 1);
+	for (int i = 0; i < batchSize; i++)
+		insertMsg.append(doc.objdata(), doc.objsize());
+	((ExtMsgHeader*)&insertMsg[0])->messageLength = insertMsg.size();
+	((ExtMsgHeader*)&insertMsg[0])->opCode = ExtMsgInsert::opcode;
+
+	ExtMsgHeader* header = (ExtMsgHeader*)&insertMsg[0];
+	ExtMsgInsert parsed(header, (const uint8_t*)header + sizeof(ExtMsgHeader));
+	ASSERT(parsed.documents.size() == batchSize);
+	ASSERT(parsed.documents.capacity() == batchSize);
+
+	// A zero length in the middle of the batch ends the count there; it must neither spin nor read past the end.
+	std::string badMsg = insertMsg;
+	int32_t* second = (int32_t*)&badMsg[sizeof(ExtMsgHeader) + sizeof(int32_t) + strlen("test.coll") + 1 +
+	                                    doc.objsize()];
+	*second = 0;
+	ExtMsgHeader* badHeader = (ExtMsgHeader*)&badMsg[0];
+	bool rejected = false;
+	try {
+		ExtMsgInsert bad(badHeader, (const uint8_t*)badHeader + sizeof(ExtMsgHeader));
+	} catch (Error& e) {
+		ASSERT(e.code() == error_code_wire_protocol_mismatch);
+		rejected = true;
+	}
+	ASSERT(rejected);
+
+	return Void();
+}
+
+#if defined(__GLIBC__) && __GLIBC__ == 2 && __GLIBC_MINOR__ < 34
+// Counts heap allocations through glibc's malloc hook, which is only installed while the benchmark below runs
+static void* (*savedMallocHook)(size_t, const void*);
+static int64_t mallocCount;
+
+static void* countingMallocHook(size_t size, const void* caller) {
+	__malloc_hook = savedMallocHook;
+	void* p = malloc(size);
+	mallocCount++;
+	__malloc_hook = countingMallocHook;
+	return p;
+}
+#define COUNTS_ALLOCATIONS 1
+#endif
+
+// Parses the same OP_QUERY and OP_INSERT messages repeatedly and reports the time and heap allocations per message,
+// to keep an eye on the cost of the request parsing path. Where allocations can be counted, an OP_INSERT must not
+// allocate for each document of its batch.
+TEST_CASE("/doclayer/ExtMsg/ParseBenchmark") {
+	const int iterations = 100000;
+	const int batchSize = 100;
+
+	bson::BSONObj query = BSON("a" << BSON("$gt" << 10) << "b"
+	                               << "some string"
+	                               << "c" << BSON_ARRAY(1 << 2 << 3));
+	bson::BSONObj doc = BSON("_id" << 1 << "name"
+	                               << "benchmark document"
+	                               << "n" << 12345);
+
+	std::string queryMsg(sizeof(ExtMsgHeader), '\0');
+	int32_t zero = 0;
+	queryMsg.append((const char*)&zero, sizeof(int32_t)); // flags
+	queryMsg.append("bench.coll", strlen("bench.coll") + 1);
+	queryMsg.append((const char*)&zero, sizeof(int32_t)); // numberToSkip
+	queryMsg.append((const char*)&zero, sizeof(int32_t)); // numberToReturn
+	queryMsg.append(query.objdata(), query.objsize());
+	((ExtMsgHeader*)&queryMsg[0])->messageLength = queryMsg.size();
+	((ExtMsgHeader*)&queryMsg[0])->opCode = ExtMsgQuery::opcode;
+
+	std::string insertMsg(sizeof(ExtMsgHeader), '\0');
+	insertMsg.append((const char*)&zero, sizeof(int32_t)); // flags
+	insertMsg.append("bench.coll", strlen("bench.coll") + 1);
+	for (int i = 0; i < batchSize; i++)
+		insertMsg.append(doc.objdata(), doc.objsize());
+	((ExtMsgHeader*)&insertMsg[0])->messageLength = insertMsg.size();
+	((ExtMsgHeader*)&insertMsg[0])->opCode = ExtMsgInsert::opcode;
+
+	for (auto msg : {&queryMsg, &insertMsg}) {
+		ExtMsgHeader* header = (ExtMsgHeader*)&(*msg)[0];
+#ifdef COUNTS_ALLOCATIONS
+		mallocCount = 0;
+		savedMallocHook = __malloc_hook;
+		__malloc_hook = countingMallocHook;
+#endif
+		double start = timer();
+		for (int i = 0; i < iterations; i++) {
+			Reference<ExtMsg> parsed =
+			    ExtMsg::create(header, (const uint8_t*)header + sizeof(ExtMsgHeader), Promise<Void>());
+		}
+		double elapsed = timer() - start;
+#ifdef COUNTS_ALLOCATIONS
+		__malloc_hook = savedMallocHook;
+		double allocations = (double)mallocCount / iterations;
+		printf("opcode %d (%d bytes): %.3f us, %.2f heap allocations per message\n", header->opCode,
+		       header->messageLength, elapsed * 1e6 / iterations, allocations);
+		if (msg == &insertMsg)
+			ASSERT(allocations < batchSize);
+#else
+		printf("opcode %d (%d bytes): %.3f us per message\n", header->opCode, header->messageLength,
+		       elapsed * 1e6 / iterations);
+#endif
+	}
+
+	return Void();
+}
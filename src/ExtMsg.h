@@ -56,6 +56,30 @@ struct ExtMsg : IDispatched<ExtMsg, int32_t, std::function<ExtMsg*(ExtMsgHeader*
 	virtual std::string toString() = 0;
 	virtual Future<Void> run(Reference<ExtConnection>) = 0;
 
+	/**
+	 * Whether this message may run concurrently with the messages received before it on the same connection.
+	 * Only true for messages that don't modify anything and whose replies are ordered by
+	 * ExtConnection::orderReplies().
+	 */
+	virtual bool isPipelinable(Reference<ExtConnection>) { return false; }
+
+	/**
+	 * Admission control queue this message waits in when the server is busy.
+	 */
+	virtual AdmissionPriority priority() { return AdmissionPriority::ADMIN; }
+
+	/**
+	 * Time by which the client gives up on this message (see getRequestDeadline()), or 0 if it doesn't. Admission
+	 * control won't keep the message queued past it.
+	 */
+	virtual double deadline() { return 0.0; }
+
+	/**
+	 * Called instead of run() when admission control turns the message away. Reports the error to the client the
+	 * same way a failure of the operation itself would be.
+	 */
+	virtual Future<Void> reject(Reference<ExtConnection>, Error) { return Void(); }
+
 	template <class ExtMsgType>
 	struct Factory {
 		static ExtMsg* create(ExtMsgHeader* header, const uint8_t* body) {
@@ -80,6 +104,10 @@ struct ExtMsgQuery : ExtMsg, FastAllocated<ExtMsgQuery> {
 
 	std::string toString() override;
 	Future<Void> run(Reference<ExtConnection>) override;
+	bool isPipelinable(Reference<ExtConnection>) override;
+	AdmissionPriority priority() override;
+	double deadline() override;
+	Future<Void> reject(Reference<ExtConnection>, Error) override;
 
 	std::string getDBName();
 
@@ -146,6 +174,8 @@ struct ExtMsgUpdate : ExtMsg, FastAllocated<ExtMsgUpdate> {
 
 	std::string toString() override;
 	Future<Void> run(Reference<ExtConnection>) override;
+	AdmissionPriority priority() override { return AdmissionPriority::WRITE; }
+	Future<Void> reject(Reference<ExtConnection>, Error) override;
 
 private:
 	ExtMsgUpdate(ExtMsgHeader*, const uint8_t*);
@@ -158,10 +188,12 @@ struct ExtMsgInsert : ExtMsg, FastAllocated<ExtMsgInsert> {
 	ExtMsgHeader* header;
 	int32_t flags;
 	Namespace ns;
-	std::list<bson::BSONObj> documents;
+	std::vector<bson::BSONObj> documents;
 
 	std::string toString() override;
 	Future<Void> run(Reference<ExtConnection>) override;
+	AdmissionPriority priority() override;
+	Future<Void> reject(Reference<ExtConnection>, Error) override;
 
 private:
 	ExtMsgInsert(ExtMsgHeader*, const uint8_t*);
@@ -178,6 +210,8 @@ struct ExtMsgGetMore : ExtMsg, FastAllocated<ExtMsgGetMore> {
 
 	std::string toString() override;
 	Future<Void> run(Reference<ExtConnection>) override;
+	AdmissionPriority priority() override { return AdmissionPriority::READ; }
+	Future<Void> reject(Reference<ExtConnection>, Error) override;
 
 private:
 	ExtMsgGetMore(ExtMsgHeader*, const uint8_t*);
@@ -194,6 +228,8 @@ struct ExtMsgDelete : ExtMsg, FastAllocated<ExtMsgDelete> {
 
 	std::string toString() override;
 	Future<Void> run(Reference<ExtConnection>) override;
+	AdmissionPriority priority() override { return AdmissionPriority::WRITE; }
+	Future<Void> reject(Reference<ExtConnection>, Error) override;
 
 private:
 	ExtMsgDelete(ExtMsgHeader*, const uint8_t*);
@@ -221,22 +257,25 @@ static const char* namespaces = "system.namespaces";
 static const char* indexes_collection = "system.indexes";
 
 Reference<Plan> planQuery(Reference<UnboundCollectionContext> cx, const bson::BSONObj& query);
+double getRequestDeadline(bson::BSONObj const& query, bool isCmd);
 std::vector<std::string> staticValidateUpdateObject(bson::BSONObj update, bool multi, bool upsert);
 Future<WriteCmdResult> attemptIndexInsertion(bson::BSONObj const& firstDoc,
                                              Reference<ExtConnection> const& ec,
                                              Reference<DocTransaction> const& tr,
                                              Namespace const& ns);
 Future<WriteCmdResult> doInsertCmd(Namespace const& ns,
-                                   std::list<bson::BSONObj>* const& documents,
+                                   std::vector<bson::BSONObj>* const& documents,
                                    Reference<ExtConnection> const& ec);
 Future<WriteCmdResult> doDeleteCmd(Namespace const& ns,
                                    bool const& ordered,
                                    std::vector<bson::BSONObj>* const& selectors,
-                                   Reference<ExtConnection> const& ec);
+                                   Reference<ExtConnection> const& ec,
+                                   double const& deadline);
 Future<WriteCmdResult> doUpdateCmd(Namespace const& ns,
                                    bool const& ordered,
                                    std::vector<ExtUpdateCmd>* const& updateCmds,
-                                   Reference<ExtConnection> const& ec);
+                                   Reference<ExtConnection> const& ec,
+                                   double const& deadline);
 
 // FIXME: these don't really belong here either
 Reference<IUpdateOp> operatorUpdate(bson::BSONObj const& msgUpdate);
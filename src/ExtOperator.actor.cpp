@@ -24,6 +24,7 @@
 #include "ExtMsg.h"
 #include "ExtOperator.h"
 #include "ExtUtil.actor.h"
+#include "GeoSearch.h"
 
 #include "ordering.h"
 
@@ -212,6 +213,40 @@ struct ExtValueOperatorRegEx {
 };
 REGISTER_VALUE_OPERATOR(ExtValueOperatorRegEx, "$regex");
 
+struct ExtValueOperatorGeoWithin {
+	static const char* name;
+	static Reference<IPredicate> toPredicate(std::string const& unencoded_path, bson::BSONElement const& element) {
+		if (unencoded_path.empty())
+			throw bad_geo_query();
+		return ref(new GeoPredicate(encodeMaybeDotted(unencoded_path), geoWithinRegion(element)));
+	}
+};
+REGISTER_VALUE_OPERATOR(ExtValueOperatorGeoWithin, "$geoWithin");
+
+struct ExtValueOperatorNear {
+	static const char* name;
+	static Reference<IPredicate> toPredicate(std::string const& unencoded_path, bson::BSONElement const& element) {
+		if (unencoded_path.empty())
+			throw bad_geo_query();
+		bool needsMaxDistance;
+		GeoRegion region = geoNearRegion(element, false, needsMaxDistance);
+		return ref(new GeoPredicate(encodeMaybeDotted(unencoded_path), region, needsMaxDistance));
+	}
+};
+REGISTER_VALUE_OPERATOR(ExtValueOperatorNear, "$near");
+
+struct ExtValueOperatorNearSphere {
+	static const char* name;
+	static Reference<IPredicate> toPredicate(std::string const& unencoded_path, bson::BSONElement const& element) {
+		if (unencoded_path.empty())
+			throw bad_geo_query();
+		bool needsMaxDistance;
+		GeoRegion region = geoNearRegion(element, true, needsMaxDistance);
+		return ref(new GeoPredicate(encodeMaybeDotted(unencoded_path), region, needsMaxDistance));
+	}
+};
+REGISTER_VALUE_OPERATOR(ExtValueOperatorNearSphere, "$nearSphere");
+
 struct ExtBoolOperatorAnd {
 	static const char* name;
 	static Reference<IPredicate> toPredicate(bson::BSONObj const& obj) {
@@ -111,3 +111,14 @@ Future<Void> ExtConnection::afterWrite(Future<WriteResult> writeResult, int rele
 		return currentWriteLocked;
 	}
 }
+
+/**
+ * Returns a future that is set once every request dispatched before this one has written its replies, at which point
+ * the caller may write its own. The caller must send to repliesWritten after its last reply; if it fails instead, the
+ * broken promise just lets the next request go ahead.
+ */
+Future<Void> ExtConnection::orderReplies(Promise<Void> repliesWritten) {
+	Future<Void> previous = ready(lastRepliesWritten);
+	lastRepliesWritten = repliesWritten.getFuture();
+	return previous;
+}
@@ -60,6 +60,12 @@ struct WriteCmdResult {
 	 */
 	std::vector<Standalone<StringRef>> upsertedOIDList;
 
+	/**
+	 * Only for Insert. Key encoded _id the layer generated for each document inserted without one, along with the
+	 * document's position in the request.
+	 */
+	std::vector<std::pair<int, Standalone<StringRef>>> generatedIds;
+
 	/**
 	 * Array of write errors. Each entry has fields - 'index', 'code' and 'errmsg'. 'index'
 	 * points to write command in the request. So, separate write error for each write failed.
@@ -116,6 +122,7 @@ struct ExtConnection : ReferenceCounted<ExtConnection>, NonCopyable {
 	void startHousekeeping();
 	Future<Void> beforeWrite(int desiredPermits = 1);
 	Future<Void> afterWrite(Future<WriteResult> result, int releasePermits = 1);
+	Future<Void> orderReplies(Promise<Void> repliesWritten);
 
 	// someday these next two should probably become private
 	bool explicitTransaction;
@@ -132,6 +139,7 @@ struct ExtConnection : ReferenceCounted<ExtConnection>, NonCopyable {
 	    : docLayer(docLayer),
 	      bc(bc),
 	      lastWrite(WriteResult()),
+	      lastRepliesWritten(Void()),
 	      explicitTransaction(false),
 	      trError(Void()),
 	      options(docLayer->defaultConnectionOptions),
@@ -164,6 +172,7 @@ struct ExtConnection : ReferenceCounted<ExtConnection>, NonCopyable {
 
 private:
 	Future<Void> currentWriteLocked;
+	Future<Void> lastRepliesWritten;
 	Reference<FlowLock> lock;
 	Future<Void> housekeeping;
 	int32_t maxReceivedRequestID;
@@ -43,9 +43,11 @@ struct IdInfo {
 	std::string keyEncoded;
 	std::string valueEncoded;
 	Optional<bson::BSONObj> objValue;
+	// The layer generated the id (see CollectionContext::generateId()), so no other document can have it yet
+	bool generated;
 
-	IdInfo(std::string keyEncoded, std::string valueEncoded, Optional<bson::BSONObj> objValue)
-	    : keyEncoded(keyEncoded), valueEncoded(valueEncoded), objValue(objValue) {}
+	IdInfo(std::string keyEncoded, std::string valueEncoded, Optional<bson::BSONObj> objValue, bool generated = false)
+	    : keyEncoded(keyEncoded), valueEncoded(valueEncoded), objValue(objValue), generated(generated) {}
 };
 
 /**
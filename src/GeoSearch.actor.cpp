@@ -0,0 +1,365 @@
+/*
+ * GeoSearch.actor.cpp
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * MongoDB is a registered trademark of MongoDB, Inc.
+ */
+
+#include "GeoSearch.h"
+#include "DocumentError.h"
+#include "ExtUtil.actor.h"
+#include "QLExpression.h"
+#include "QLProjection.h"
+
+#include <cmath>
+
+// The radius MongoDB converts $near distances in meters with
+static const double EARTH_RADIUS_METERS = 6378100.0;
+
+static const double DEGREES_PER_RADIAN = 180.0 / M_PI;
+
+static uint32_t quantize(double v, double lo, double range) {
+	int64_t q = (int64_t)std::floor((v - lo) / range * (1 << GEO_CELL_BITS));
+	return (uint32_t)std::max<int64_t>(0, std::min<int64_t>(q, (1 << GEO_CELL_BITS) - 1));
+}
+
+static uint32_t cellColumn(double lng, int level) {
+	return quantize(lng, -180.0, 360.0) >> (GEO_CELL_BITS - level);
+}
+
+static uint32_t cellRow(double lat, int level) {
+	return quantize(lat, -90.0, 180.0) >> (GEO_CELL_BITS - level);
+}
+
+// The cell number of column `x` and row `y` at `level`, with the bits of x ahead of those of y
+static int64_t interleave(uint32_t x, uint32_t y, int level) {
+	int64_t cell = 0;
+	for (int i = level - 1; i >= 0; i--)
+		cell = (cell << 2) | (((x >> i) & 1) << 1) | ((y >> i) & 1);
+	return cell;
+}
+
+int64_t geoCell(GeoPoint const& p) {
+	return interleave(cellColumn(p.lng, GEO_CELL_BITS), cellRow(p.lat, GEO_CELL_BITS), GEO_CELL_BITS);
+}
+
+std::string geoCellKeyPart(int64_t cell) {
+	return DataValue((long long)cell).encode_key_part();
+}
+
+// Great circle distance in radians
+static double sphereDistance(GeoPoint const& a, GeoPoint const& b) {
+	double lat1 = a.lat / DEGREES_PER_RADIAN, lat2 = b.lat / DEGREES_PER_RADIAN;
+	double dLat = lat2 - lat1, dLng = (b.lng - a.lng) / DEGREES_PER_RADIAN;
+	double h = std::sin(dLat / 2) * std::sin(dLat / 2) +
+	           std::cos(lat1) * std::cos(lat2) * std::sin(dLng / 2) * std::sin(dLng / 2);
+	return 2 * std::asin(std::min(1.0, std::sqrt(h)));
+}
+
+bool GeoRegion::contains(GeoPoint const& p) const {
+	switch (kind) {
+	case SPHERE_CIRCLE:
+		return sphereDistance(center, p) <= radius;
+	case PLANE_CIRCLE:
+		return std::hypot(p.lng - center.lng, p.lat - center.lat) <= radius;
+	case BOX:
+		return p.lng >= min.lng && p.lng <= max.lng && p.lat >= min.lat && p.lat <= max.lat;
+	case POLYGON: {
+		bool inside = false;
+		for (size_t i = 0, j = vertices.size() - 1; i < vertices.size(); j = i++) {
+			GeoPoint const& a = vertices[i];
+			GeoPoint const& b = vertices[j];
+			if ((a.lat > p.lat) != (b.lat > p.lat) &&
+			    p.lng < (b.lng - a.lng) * (p.lat - a.lat) / (b.lat - a.lat) + a.lng)
+				inside = !inside;
+		}
+		return inside;
+	}
+	}
+	return false;
+}
+
+std::vector<std::pair<int64_t, int64_t>> GeoRegion::covering() const {
+	bool wraps = min.lng > max.lng;
+	// Columns from the one of min.lng on, eastward. Ends that meet across the antimeridian cover every column.
+	auto columns = [&](int level) -> int64_t {
+		int64_t x0 = cellColumn(min.lng, level), x1 = cellColumn(max.lng, level);
+		if (!wraps)
+			return x1 - x0 + 1;
+		return x1 >= x0 ? (int64_t)1 << level : ((int64_t)1 << level) - x0 + x1 + 1;
+	};
+	auto rows = [&](int level) -> int64_t { return cellRow(max.lat, level) - cellRow(min.lat, level) + 1; };
+
+	int level = 0;
+	while (level < GEO_CELL_BITS && columns(level + 1) * rows(level + 1) <= DOCLAYER_KNOBS->GEO_MAX_COVERING_CELLS)
+		level++;
+
+	int shift = 2 * (GEO_CELL_BITS - level);
+	uint32_t x0 = cellColumn(min.lng, level);
+	std::vector<std::pair<int64_t, int64_t>> cells;
+	for (int64_t i = 0; i < columns(level); i++) {
+		for (uint32_t y = cellRow(min.lat, level); y <= cellRow(max.lat, level); y++) {
+			int64_t cell = interleave((uint32_t)((x0 + i) % ((int64_t)1 << level)), y, level);
+			cells.emplace_back(cell << shift, ((cell + 1) << shift) - 1);
+		}
+	}
+	std::sort(cells.begin(), cells.end());
+
+	// Neighboring cells are often consecutive in Z order, and then one index scan reads both
+	std::vector<std::pair<int64_t, int64_t>> ranges;
+	for (const auto& cell : cells) {
+		if (!ranges.empty() && ranges.back().second + 1 == cell.first)
+			ranges.back().second = cell.second;
+		else
+			ranges.push_back(cell);
+	}
+	return ranges;
+}
+
+std::string GeoRegion::toString() const {
+	switch (kind) {
+	case SPHERE_CIRCLE:
+		return format("SPHERE_CIRCLE([%g, %g], %g)", center.lng, center.lat, radius);
+	case PLANE_CIRCLE:
+		return format("PLANE_CIRCLE([%g, %g], %g)", center.lng, center.lat, radius);
+	case BOX:
+		return format("BOX([%g, %g], [%g, %g])", min.lng, min.lat, max.lng, max.lat);
+	case POLYGON: {
+		std::string s = "POLYGON(";
+		for (size_t i = 0; i < vertices.size(); i++)
+			s += format(i ? ", [%g, %g]" : "[%g, %g]", vertices[i].lng, vertices[i].lat);
+		return s + ")";
+	}
+	}
+	return "GEO_REGION()";
+}
+
+GeoRegion GeoRegion::sphereCircle(GeoPoint center, double radius) {
+	GeoRegion region;
+	region.kind = SPHERE_CIRCLE;
+	region.center = center;
+	region.radius = radius;
+	double dLat = radius * DEGREES_PER_RADIAN;
+	region.min.lat = std::max(-90.0, center.lat - dLat);
+	region.max.lat = std::min(90.0, center.lat + dLat);
+	region.min.lng = -180.0;
+	region.max.lng = 180.0;
+	// Near a pole the circle spans every longitude
+	if (center.lat + dLat < 90.0 && center.lat - dLat > -90.0) {
+		double s = std::sin(radius) / std::cos(center.lat / DEGREES_PER_RADIAN);
+		if (s < 1.0) {
+			double dLng = std::asin(s) * DEGREES_PER_RADIAN;
+			region.min.lng = center.lng - dLng < -180.0 ? center.lng - dLng + 360.0 : center.lng - dLng;
+			region.max.lng = center.lng + dLng > 180.0 ? center.lng + dLng - 360.0 : center.lng + dLng;
+		}
+	}
+	return region;
+}
+
+GeoRegion GeoRegion::planeCircle(GeoPoint center, double radius) {
+	GeoRegion region;
+	region.kind = PLANE_CIRCLE;
+	region.center = center;
+	region.radius = radius;
+	region.min = GeoPoint{std::max(-180.0, center.lng - radius), std::max(-90.0, center.lat - radius)};
+	region.max = GeoPoint{std::min(180.0, center.lng + radius), std::min(90.0, center.lat + radius)};
+	return region;
+}
+
+GeoRegion GeoRegion::box(GeoPoint corner1, GeoPoint corner2) {
+	GeoRegion region;
+	region.kind = BOX;
+	region.radius = 0;
+	region.min = GeoPoint{std::min(corner1.lng, corner2.lng), std::min(corner1.lat, corner2.lat)};
+	region.max = GeoPoint{std::max(corner1.lng, corner2.lng), std::max(corner1.lat, corner2.lat)};
+	region.center = GeoPoint{(region.min.lng + region.max.lng) / 2, (region.min.lat + region.max.lat) / 2};
+	return region;
+}
+
+GeoRegion GeoRegion::polygon(std::vector<GeoPoint> vertices) {
+	GeoRegion region;
+	region.kind = POLYGON;
+	region.radius = 0;
+	region.min = region.max = vertices[0];
+	for (const auto& v : vertices) {
+		region.min = GeoPoint{std::min(region.min.lng, v.lng), std::min(region.min.lat, v.lat)};
+		region.max = GeoPoint{std::max(region.max.lng, v.lng), std::max(region.max.lat, v.lat)};
+	}
+	region.center = GeoPoint{(region.min.lng + region.max.lng) / 2, (region.min.lat + region.max.lat) / 2};
+	region.vertices = std::move(vertices);
+	return region;
+}
+
+// A legacy coordinate pair or a GeoJSON point
+static Optional<GeoPoint> toGeoPoint(bson::BSONElement const& el) {
+	bson::BSONElement coordinates = el;
+	if (el.type() == bson::BSONType::Object) {
+		bson::BSONObj obj = el.Obj();
+		if (strcmp(obj.getStringField("type"), "Point"))
+			return Optional<GeoPoint>();
+		coordinates = obj.getField("coordinates");
+	}
+	if (coordinates.type() != bson::BSONType::Array)
+		return Optional<GeoPoint>();
+	std::vector<bson::BSONElement> pair = coordinates.Array();
+	if (pair.size() != 2 || !pair[0].isNumber() || !pair[1].isNumber())
+		return Optional<GeoPoint>();
+	GeoPoint p{pair[0].Number(), pair[1].Number()};
+	if (!(p.lng >= -180.0 && p.lng <= 180.0 && p.lat >= -90.0 && p.lat <= 90.0))
+		return Optional<GeoPoint>();
+	return p;
+}
+
+static GeoPoint parseGeoPoint(bson::BSONElement const& el) {
+	Optional<GeoPoint> p = toGeoPoint(el);
+	if (!p.present())
+		throw bad_geo_query();
+	return p.get();
+}
+
+static std::vector<GeoPoint> parseGeoPoints(bson::BSONElement const& el) {
+	if (el.type() != bson::BSONType::Array)
+		throw bad_geo_query();
+	std::vector<GeoPoint> points;
+	for (const auto& e : el.Array())
+		points.push_back(parseGeoPoint(e));
+	return points;
+}
+
+static double parseDistance(bson::BSONElement const& el) {
+	if (!el.isNumber() || !(el.Number() >= 0))
+		throw bad_geo_query();
+	return el.Number();
+}
+
+void addGeoPoints(DataValue const& value, std::vector<GeoPoint>& points) {
+	bson::BSONType type = value.getBSONType();
+	if (type != bson::BSONType::Array && type != bson::BSONType::Object)
+		return;
+	bson::BSONElement el = value.wrap("").firstElement();
+	Optional<GeoPoint> p = toGeoPoint(el);
+	if (p.present()) {
+		points.push_back(p.get());
+	} else if (type == bson::BSONType::Array) {
+		for (const auto& e : el.Array()) {
+			p = toGeoPoint(e);
+			if (p.present())
+				points.push_back(p.get());
+		}
+	}
+}
+
+ACTOR Future<std::vector<GeoPoint>> getGeoPoints(Reference<IReadContext> doc, std::string path) {
+	// Arrays at the end of the path are points, or lists of them, rather than values to match one by one
+	state Reference<IExpression> expr(new ExtPathExpression(StringRef(path), false, false));
+	std::vector<DataValue> values = wait(consumeAll(mapAsync(
+	    expr->evaluate(doc), [](Reference<IReadContext> valcx) { return getMaybeRecursive(valcx, StringRef()); })));
+	std::vector<GeoPoint> points;
+	for (const auto& v : values)
+		addGeoPoints(v, points);
+	return points;
+}
+
+GeoRegion geoWithinRegion(bson::BSONElement const& operand) {
+	if (!operand.isABSONObj() || operand.Obj().nFields() != 1)
+		throw bad_geo_query();
+	bson::BSONElement shape = operand.Obj().firstElement();
+	std::string name = shape.fieldName();
+
+	if (name == "$centerSphere" || name == "$center") {
+		if (shape.type() != bson::BSONType::Array || shape.Array().size() != 2)
+			throw bad_geo_query();
+		GeoPoint center = parseGeoPoint(shape.Array()[0]);
+		double radius = parseDistance(shape.Array()[1]);
+		return name == "$centerSphere" ? GeoRegion::sphereCircle(center, radius)
+		                               : GeoRegion::planeCircle(center, radius);
+	}
+	if (name == "$box") {
+		std::vector<GeoPoint> corners = parseGeoPoints(shape);
+		if (corners.size() != 2)
+			throw bad_geo_query();
+		return GeoRegion::box(corners[0], corners[1]);
+	}
+	if (name == "$polygon") {
+		std::vector<GeoPoint> vertices = parseGeoPoints(shape);
+		if (vertices.size() < 3)
+			throw bad_geo_query();
+		return GeoRegion::polygon(vertices);
+	}
+	if (name == "$geometry") {
+		// A GeoJSON polygon without holes, whose ring ends where it starts
+		if (!shape.isABSONObj() || strcmp(shape.Obj().getStringField("type"), "Polygon"))
+			throw bad_geo_query();
+		bson::BSONElement rings = shape.Obj().getField("coordinates");
+		if (rings.type() != bson::BSONType::Array || rings.Array().size() != 1)
+			throw bad_geo_query();
+		std::vector<GeoPoint> vertices = parseGeoPoints(rings.Array()[0]);
+		if (vertices.size() < 4 || vertices.front().lng != vertices.back().lng ||
+		    vertices.front().lat != vertices.back().lat)
+			throw bad_geo_query();
+		vertices.pop_back();
+		return GeoRegion::polygon(vertices);
+	}
+	throw bad_geo_query();
+}
+
+GeoRegion geoNearRegion(bson::BSONElement const& operand, bool spherical, bool& needsMaxDistance) {
+	needsMaxDistance = false;
+	if (operand.type() == bson::BSONType::Object && operand.Obj().hasField("$geometry")) {
+		// {$geometry: <GeoJSON point>, $maxDistance: <meters>}, always on the sphere
+		bson::BSONObj obj = operand.Obj();
+		if (obj.getField("$geometry").type() != bson::BSONType::Object || !obj.hasField("$maxDistance"))
+			throw bad_geo_query();
+		for (auto i = obj.begin(); i.more();) {
+			std::string name = i.next().fieldName();
+			if (name != "$geometry" && name != "$maxDistance")
+				throw bad_geo_query();
+		}
+		GeoPoint center = parseGeoPoint(obj.getField("$geometry"));
+		return GeoRegion::sphereCircle(center, parseDistance(obj.getField("$maxDistance")) / EARTH_RADIUS_METERS);
+	}
+
+	// [lng, lat], with $maxDistance in radians ($nearSphere) or degrees ($near) next to it
+	GeoPoint center = parseGeoPoint(operand);
+	needsMaxDistance = true;
+	return spherical ? GeoRegion::sphereCircle(center, 0) : GeoRegion::planeCircle(center, 0);
+}
+
+ACTOR static Future<bool> evaluateGeoPredicate(Reference<IReadContext> cx, Reference<GeoPredicate> self) {
+	std::vector<GeoPoint> points = wait(getGeoPoints(cx, self->path));
+	return std::any_of(points.begin(), points.end(), [self](GeoPoint const& p) { return self->region.contains(p); });
+}
+
+Future<bool> GeoPredicate::evaluate(Reference<IReadContext> const& context) {
+	if (needsMaxDistance)
+		throw bad_geo_query();
+	return evaluateGeoPredicate(context, Reference<GeoPredicate>::addRef(this));
+}
+
+std::string GeoPredicate::toString() {
+	return format("GEO(ExtPath(%s), %s)", FDB::printable(StringRef(path)).c_str(), region.toString().c_str());
+}
+
+void GeoPredicate::setMaxDistance(bson::BSONElement const& maxDistance) {
+	if (!needsMaxDistance)
+		throw bad_geo_query();
+	double radius = parseDistance(maxDistance);
+	region = region.kind == GeoRegion::SPHERE_CIRCLE ? GeoRegion::sphereCircle(region.center, radius)
+	                                                 : GeoRegion::planeCircle(region.center, radius);
+	needsMaxDistance = false;
+}
@@ -0,0 +1,124 @@
+/*
+ * GeoSearch.h
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * MongoDB is a registered trademark of MongoDB, Inc.
+ */
+
+#ifndef _GEO_SEARCH_H_
+#define _GEO_SEARCH_H_
+
+#pragma once
+
+#include "QLContext.h"
+#include "QLPredicate.h"
+
+/*
+ * Geo indexes ({field: "2dsphere"} or {field: "2d"}) hold an entry for each point of the field, keyed by the geohash
+ * cell of the point: its longitude and latitude quantized to GEO_CELL_BITS bits each and interleaved, most significant
+ * first, into one number. Nearby points mostly share a prefix of those bits, so a cell of any coarser level is a range
+ * of index keys. $geoWithin and $near queries are planned as a GeoScanPlan, a union of index scans over the few cells
+ * covering the queried region (see GeoRegion::covering()), whose documents are then checked against the region itself.
+ *
+ * Points are GeoJSON points ({type: "Point", coordinates: [lng, lat]}) or legacy coordinate pairs ([lng, lat]), and a
+ * field may hold an array of them.
+ */
+
+struct GeoPoint {
+	double lng;
+	double lat;
+};
+
+// A region of a $geoWithin or $near query
+struct GeoRegion {
+	enum Kind {
+		SPHERE_CIRCLE, // Within `radius` radians of `center` on the sphere: $centerSphere, $nearSphere, $geometry
+		PLANE_CIRCLE, // Within `radius` degrees of `center` on the flat lng/lat plane: $center, legacy $near
+		BOX, // Between the corners `min` and `max`: $box
+		POLYGON // Inside `vertices`, with straight edges on the lng/lat plane: $polygon, GeoJSON polygons
+	};
+
+	Kind kind;
+	GeoPoint center;
+	double radius;
+	GeoPoint min, max; // Bounding box of the region. min.lng > max.lng for one that crosses the antimeridian.
+	std::vector<GeoPoint> vertices;
+
+	bool contains(GeoPoint const& p) const;
+
+	// Inclusive ranges of geoCell() values, in order, that together hold every point of the region. They are the
+	// cells of the finest level at which at most GEO_MAX_COVERING_CELLS cells cover the bounding box.
+	std::vector<std::pair<int64_t, int64_t>> covering() const;
+
+	std::string toString() const;
+
+	static GeoRegion sphereCircle(GeoPoint center, double radius);
+	static GeoRegion planeCircle(GeoPoint center, double radius);
+	static GeoRegion box(GeoPoint corner1, GeoPoint corner2);
+	static GeoRegion polygon(std::vector<GeoPoint> vertices);
+};
+
+// Bits of longitude and of latitude in a cell number
+const int GEO_CELL_BITS = 26;
+
+// The cell of `p`, at the finest level
+int64_t geoCell(GeoPoint const& p);
+
+// The key part a geo index stores for `cell`
+std::string geoCellKeyPart(int64_t cell);
+
+// Adds the points `value` holds to `points`. Values that aren't points, or arrays of them, hold none.
+void addGeoPoints(DataValue const& value, std::vector<GeoPoint>& points);
+
+// The points at the (encoded) `path` of `doc`
+Future<std::vector<GeoPoint>> getGeoPoints(Reference<IReadContext> const& doc, std::string const& path);
+
+// The region of a $geoWithin operand, throws bad_geo_query if it isn't one
+GeoRegion geoWithinRegion(bson::BSONElement const& operand);
+
+/**
+ * The start of the region of a $near (`spherical` false) or $nearSphere operand, throws bad_geo_query if it isn't one.
+ * A legacy operand ([lng, lat]) gets its $maxDistance from a sibling operator, see GeoPredicate::setMaxDistance().
+ */
+GeoRegion geoNearRegion(bson::BSONElement const& operand, bool spherical, bool& needsMaxDistance);
+
+/**
+ * Matches documents with a point at `path` inside `region`. Unlike MongoDB, $near and $nearSphere are this predicate
+ * too, so they need a $maxDistance and don't sort their results by distance.
+ */
+struct GeoPredicate : IPredicate, ReferenceCounted<GeoPredicate>, FastAllocated<GeoPredicate> {
+	void addref() override { ReferenceCounted<GeoPredicate>::addref(); }
+	void delref() override { ReferenceCounted<GeoPredicate>::delref(); }
+
+	GeoPredicate(std::string const& path, GeoRegion const& region, bool needsMaxDistance = false)
+	    : path(path), region(region), needsMaxDistance(needsMaxDistance) {}
+	TypeCode getTypeCode() const override { return TypeCode::GEO; }
+
+	Future<bool> evaluate(Reference<IReadContext> const& context) override;
+	std::string toString() override;
+	bool wantsNulls() override { return false; }
+
+	// Sets the radius of a legacy $near or $nearSphere region from its sibling $maxDistance
+	void setMaxDistance(bson::BSONElement const& maxDistance);
+
+	std::string path; // Encoded
+	GeoRegion region;
+	bool needsMaxDistance;
+};
+
+#endif /* _GEO_SEARCH_H_ */
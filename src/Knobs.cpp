@@ -29,6 +29,9 @@ DocLayerKnobs::DocLayerKnobs(bool enable) {
 	init(MAX_PROJECTION_READ_RANGES, 10);
 	init(MULTI_MULTIKEY_INDEX_MAX, 1000);
 	init(CONNECTION_MAX_PIPELINE_DEPTH, 50);
+	init(CONNECTION_MAX_READ_PIPELINE_DEPTH, 1); // 1 runs reads serially
+	if (enable)
+		CONNECTION_MAX_READ_PIPELINE_DEPTH = 4;
 
 	init(FLOW_CONTROL_LOCK_PERMITS, 50);
 	if (enable)
@@ -44,6 +47,70 @@ DocLayerKnobs::DocLayerKnobs(bool enable) {
 	init(MAX_RETURNABLE_DATA_SIZE, (1 << 20) * 16);
 	init(CURSOR_EXPIRY, 60 * 10); /* seconds */
 	init(DEFAULT_RETURNABLE_DATA_SIZE, (1 << 20) * 4);
+
+	init(BUFFERED_CONNECTION_MAX_POOLED_BLOCK_SIZE, (1 << 20) * 16);
+	init(BUFFERED_CONNECTION_POOLED_BLOCKS_PER_SIZE, 4);
+	if (enable)
+		BUFFERED_CONNECTION_POOLED_BLOCKS_PER_SIZE = 0;
+
+	init(ADMISSION_MAX_IN_FLIGHT, 0); // 0 disables admission control
+	if (enable)
+		ADMISSION_MAX_IN_FLIGHT = 5;
+	init(ADMISSION_MAX_QUEUE_LENGTH, 10000);
+	init(ADMISSION_MAX_QUEUE_TIME, 5.0); /* seconds */
+	init(MAX_CONNECTIONS, 0); // 0 means unlimited
+	init(DEFAULT_MAX_TIME_MS, 0); // Used when a request has no maxTimeMS, 0 means no limit
+
+	init(QUERY_CACHE_MAX_BYTES, 0); // 0 disables the query result cache
+	if (enable)
+		QUERY_CACHE_MAX_BYTES = 1 << 16;
+	init(QUERY_CACHE_MAX_ENTRY_BYTES, 1 << 20);
+
+	init(CHANGE_LOG_READ_BATCH, 1000);
+	init(CHANGE_LOG_WATCH_TIMEOUT, 5.0); /* seconds */
+	init(TAILABLE_AWAIT_DATA_TIMEOUT, 1.0); /* seconds */
+
+	init(TTL_MONITOR_INTERVAL, 60.0); /* seconds */
+	if (enable)
+		TTL_MONITOR_INTERVAL = 1.0;
+	init(TTL_MONITOR_LEASE_TIME, 180.0); // Seconds an instance stays the TTL monitor without renewing, see ttlMonitor()
+	if (enable)
+		TTL_MONITOR_LEASE_TIME = 3.0;
+	init(TTL_DELETE_BATCH_SIZE, 200);
+	if (enable)
+		TTL_DELETE_BATCH_SIZE = 2;
+	init(TTL_MAX_BATCHES_PER_PASS, 100);
+	init(TTL_BATCH_DELAY_RATIO, 1.0); // Pause between batches, as a multiple of the last batch's latency
+
+	init(AGGREGATE_MAX_STAGE_MEMORY, (1 << 20) * 100); // Bytes a $group or $sort may hold
+	if (enable)
+		AGGREGATE_MAX_STAGE_MEMORY = 1 << 16;
+
+	init(GEO_MAX_COVERING_CELLS, 16); // Index ranges a geo query may scan, see GeoRegion::covering()
+	if (enable)
+		GEO_MAX_COVERING_CELLS = 4;
+
+	init(REGEX_CACHE_MAX_ENTRIES, 1000); // Compiled $regex patterns kept, 0 disables the cache
+	if (enable)
+		REGEX_CACHE_MAX_ENTRIES = 2;
+
+	init(INDEX_SCAN_DEDUP_MAX_DOCS, 10000); // Ids a multikey index scan remembers, beyond which it reads documents
+	if (enable)
+		INDEX_SCAN_DEDUP_MAX_DOCS = 2;
+
+	init(PLAN_RACE_TRIAL_RESULTS, 100); // Documents which win a race of candidate plans, see RacePlan
+	if (enable)
+		PLAN_RACE_TRIAL_RESULTS = 2;
+	init(PLAN_RACE_TRIAL_TIME, 0.1); // Seconds after which the candidate with the most documents wins
+	if (enable)
+		PLAN_RACE_TRIAL_TIME = 0.001;
+	init(PLAN_CACHE_MAX_ENTRIES, 1000); // Query shapes whose winning plan is kept, 0 races every query
+	if (enable)
+		PLAN_CACHE_MAX_ENTRIES = 2;
+
+	init(SKIP_SCAN_MAX_SEEKS, 1000); // Leading values a skip-scan seeks to before reading the rest of its range
+	if (enable)
+		SKIP_SCAN_MAX_SEEKS = 2;
 }
 
 bson::BSONObj DocLayerKnobs::dumpKnobs() const {
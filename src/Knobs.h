@@ -32,11 +32,37 @@ public:
 	int FLOW_CONTROL_LOCK_PERMITS;
 	int NONISOLATED_RW_INTERNAL_BUFFER_MAX;
 	int CONNECTION_MAX_PIPELINE_DEPTH;
+	int CONNECTION_MAX_READ_PIPELINE_DEPTH;
 	double NONISOLATED_INTERNAL_TIMEOUT;
 	int MAX_RETURNABLE_DOCUMENTS;
 	int MAX_RETURNABLE_DATA_SIZE;
 	int CURSOR_EXPIRY;
 	int DEFAULT_RETURNABLE_DATA_SIZE;
+	int BUFFERED_CONNECTION_MAX_POOLED_BLOCK_SIZE;
+	int BUFFERED_CONNECTION_POOLED_BLOCKS_PER_SIZE;
+	int ADMISSION_MAX_IN_FLIGHT;
+	int ADMISSION_MAX_QUEUE_LENGTH;
+	double ADMISSION_MAX_QUEUE_TIME;
+	int MAX_CONNECTIONS;
+	int DEFAULT_MAX_TIME_MS;
+	int QUERY_CACHE_MAX_BYTES;
+	int QUERY_CACHE_MAX_ENTRY_BYTES;
+	int CHANGE_LOG_READ_BATCH;
+	double CHANGE_LOG_WATCH_TIMEOUT;
+	double TAILABLE_AWAIT_DATA_TIMEOUT;
+	double TTL_MONITOR_INTERVAL;
+	double TTL_MONITOR_LEASE_TIME;
+	int TTL_DELETE_BATCH_SIZE;
+	int TTL_MAX_BATCHES_PER_PASS;
+	double TTL_BATCH_DELAY_RATIO;
+	int AGGREGATE_MAX_STAGE_MEMORY;
+	int GEO_MAX_COVERING_CELLS;
+	int REGEX_CACHE_MAX_ENTRIES;
+	int INDEX_SCAN_DEDUP_MAX_DOCS;
+	int PLAN_RACE_TRIAL_RESULTS;
+	double PLAN_RACE_TRIAL_TIME;
+	int PLAN_CACHE_MAX_ENTRIES;
+	int SKIP_SCAN_MAX_SEEKS;
 
 	explicit DocLayerKnobs(bool randomize = false);
 
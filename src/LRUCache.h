@@ -0,0 +1,92 @@
+/*
+ * LRUCache.h
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LRU_CACHE_H_
+#define _LRU_CACHE_H_
+
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * A map that remembers the order its entries were last used in, so the caches built on it can evict the least
+ * recently used ones. It has no limit of its own; each cache decides when to call popOldest().
+ */
+template <class K, class V>
+class LRUCache {
+public:
+	typedef std::pair<K, V> value_type;
+
+	// The value of `key`, which becomes the most recently used entry, or nullptr
+	V* get(K const& key) {
+		auto found = entries.find(key);
+		if (found == entries.end())
+			return nullptr;
+		lru.splice(lru.begin(), lru, found->second);
+		return &found->second->second;
+	}
+
+	// Sets the value of `key`, which becomes the most recently used entry
+	V& put(K const& key, V value) {
+		auto found = entries.find(key);
+		if (found != entries.end()) {
+			found->second->second = std::move(value);
+			lru.splice(lru.begin(), lru, found->second);
+			return found->second->second;
+		}
+		lru.emplace_front(key, std::move(value));
+		entries[key] = lru.begin();
+		return lru.front().second;
+	}
+
+	void erase(K const& key) {
+		auto found = entries.find(key);
+		if (found != entries.end()) {
+			lru.erase(found->second);
+			entries.erase(found);
+		}
+	}
+
+	// The least recently used entry, if there are any
+	value_type const& oldest() const { return lru.back(); }
+	void popOldest() {
+		entries.erase(lru.back().first);
+		lru.pop_back();
+	}
+
+	// Evicts least recently used entries until at most `maxEntries` are left
+	void trim(size_t maxEntries) {
+		while (entries.size() > maxEntries)
+			popOldest();
+	}
+
+	size_t size() const { return entries.size(); }
+	bool empty() const { return entries.empty(); }
+
+private:
+	typedef std::list<value_type> LRUList;
+	LRUList lru; // Most recently used first
+	std::unordered_map<K, typename LRUList::iterator> entries;
+};
+
+#endif /* _LRU_CACHE_H_ */
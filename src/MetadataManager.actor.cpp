@@ -70,9 +70,30 @@ IndexInfo MetadataManager::indexInfoFromObj(const bson::BSONObj& indexObj, Refer
 	std::vector<std::pair<std::string, int>> indexKeys;
 	indexKeys.reserve(keyObj.nFields());
 	bool isUniqueIndex = indexObj.hasField("unique") ? indexObj.getBoolField("unique") : false;
+	bool hashed = false;
+	bool text = false;
+	bool geo = false;
+	bool folded = false;
+	bool reversed = false;
 	for (auto i = keyObj.begin(); i.more();) {
 		auto e = i.next();
-		indexKeys.emplace_back(encodeMaybeDotted(e.fieldName()), (int)e.Number());
+		if (e.isString()) {
+			// {field: "hashed"}, {field: "2dsphere"}, {field: "folded"} or {field: "reversed"}, which
+			// attemptIndexInsertion() only allows for a single field, or {field: "text", ...}
+			if (e.str() == "text")
+				text = true;
+			else if (e.str() == "2dsphere" || e.str() == "2d")
+				geo = true;
+			else if (e.str() == "folded")
+				folded = true;
+			else if (e.str() == "reversed")
+				reversed = true;
+			else
+				hashed = true;
+			indexKeys.emplace_back(encodeMaybeDotted(e.fieldName()), 1);
+		} else {
+			indexKeys.emplace_back(encodeMaybeDotted(e.fieldName()), (int)e.Number());
+		}
 	}
 	if (verboseLogging) {
 		TraceEvent("BD_getAndAddIndexes").detail("AddingIndex", describeIndex(indexKeys));
@@ -80,12 +101,24 @@ IndexInfo MetadataManager::indexInfoFromObj(const bson::BSONObj& indexObj, Refer
 	if (verboseConsoleOutput) {
 		fprintf(stderr, "%s\n\n", describeIndex(indexKeys).c_str());
 	}
-	if (status == IndexInfo::IndexStatus::BUILDING) {
-		return IndexInfo(indexObj.getStringField("name"), indexKeys, cx, status,
-		                 UID::fromString(indexObj.getStringField("build id")), isUniqueIndex);
-	} else {
-		return IndexInfo(indexObj.getStringField("name"), indexKeys, cx, status, Optional<UID>(), isUniqueIndex);
-	}
+	IndexInfo index = (status == IndexInfo::IndexStatus::BUILDING)
+	                      ? IndexInfo(indexObj.getStringField("name"), indexKeys, cx, status,
+	                                  UID::fromString(indexObj.getStringField("build id")), isUniqueIndex)
+	                      : IndexInfo(indexObj.getStringField("name"), indexKeys, cx, status, Optional<UID>(),
+	                                  isUniqueIndex);
+	if (indexObj.hasField("expireAfterSeconds"))
+		index.expireAfterSeconds = indexObj.getField("expireAfterSeconds").Number();
+	// Text and geo indexes only have entries for documents with terms or points, so they ignore the sparse option
+	index.setFilter(indexObj.hasField("partialFilterExpression")
+	                    ? indexObj.getObjectField("partialFilterExpression").getOwned()
+	                    : Optional<bson::BSONObj>(),
+	                indexObj.getBoolField("sparse") && !text && !geo);
+	index.hashed = hashed;
+	index.text = text;
+	index.geo = geo;
+	index.folded = folded;
+	index.reversed = reversed;
+	return index;
 }
 
 ACTOR static Future<std::pair<Reference<UnboundCollectionContext>, uint64_t>>
@@ -109,6 +142,9 @@ constructContext(Namespace ns, Reference<DocTransaction> tr, DocumentLayer* docL
 		state Reference<DirectorySubspace> indexDirectory = wait(findexDirectory);
 		state Reference<UnboundCollectionContext> cx =
 		    Reference<UnboundCollectionContext>(new UnboundCollectionContext(collectionDirectory, metadataDirectory));
+		state Future<Optional<FDBStandalone<StringRef>>> fchangeLog = tr->tr->get(cx->getChangeLogOptionKey());
+		state Future<Optional<FDBStandalone<StringRef>>> fstatsTracked = tr->tr->get(cx->getStatsTrackedKey());
+		state Future<Optional<FDBStandalone<StringRef>>> fidPolicy = tr->tr->get(cx->getIdPolicyKey());
 
 		// Only include existing indexes into the context when it's NOT building a new index.
 		// When it's building a new index, it's unnecessary and inefficient to pass each recorded returned by a
@@ -119,17 +155,32 @@ constructContext(Namespace ns, Reference<DocTransaction> tr, DocumentLayer* docL
 			state Reference<Plan> indexesPlan = getIndexesForCollectionPlan(indexCx, ns);
 			std::vector<bson::BSONObj> allIndexes = wait(getIndexesTransactionally(indexesPlan, tr));
 
+			state std::vector<IndexInfo> indexes;
+			state std::vector<Future<bool>> multikey;
 			for (const auto& indexObj : allIndexes) {
 				IndexInfo index = MetadataManager::indexInfoFromObj(indexObj, cx);
 				if (index.status != IndexInfo::IndexStatus::INVALID) {
-					cx->addIndex(index);
+					indexes.push_back(index);
+					multikey.push_back(isMultikeyIndex(tr, index));
 				}
 			}
+			std::vector<bool> isMultikey = wait(getAll(multikey));
+			for (int i = 0; i < indexes.size(); i++) {
+				indexes[i].multikey = isMultikey[i];
+				cx->addIndex(indexes[i]);
+			}
 		}
 
 		// fprintf(stderr, "%s.%s Reading: Collection dir: %s Metadata dir:%s Caller:%s\n", dbName.c_str(),
 		// collectionName.c_str(), printable(collectionDirectory->key()).c_str(),
 		// printable(metadataDirectory->key()).c_str(), "");
+		Optional<FDBStandalone<StringRef>> changeLog = wait(fchangeLog);
+		cx->changeLogEnabled = changeLog.present();
+		Optional<FDBStandalone<StringRef>> statsTracked = wait(fstatsTracked);
+		cx->statsTracked = statsTracked.present();
+		Optional<FDBStandalone<StringRef>> idPolicy = wait(fidPolicy);
+		if (idPolicy.present() && idPolicy.get() == LiteralStringRef("scrambled"))
+			cx->idPolicy = UnboundCollectionContext::SCRAMBLED_OBJECT_ID;
 		uint64_t version = wait(fv);
 		return std::make_pair(cx, version);
 	} catch (Error& e) {
@@ -156,6 +207,12 @@ constructContext(Namespace ns, Reference<DocTransaction> tr, DocumentLayer* docL
 		// collectionName.c_str(), printable(tcollectionDirectory->key()).c_str(),
 		// printable(tmetadataDirectory->key()).c_str(), "");
 		tcx->bindCollectionContext(tr)->bumpMetadataVersion(); // We start at version 1.
+		// A new collection's document count and size are exact from the start. System collections aren't written
+		// through insertDocument, so theirs aren't maintained.
+		if (!startsWith(ns.second.c_str(), "system.")) {
+			tr->tr->set(tcx->getStatsTrackedKey(), StringRef());
+			tcx->statsTracked = true;
+		}
 
 		return std::make_pair(tcx, -1); // So we don't pollute the cache in case this transaction never commits
 	}
@@ -239,6 +296,8 @@ ACTOR static Future<Void> buildIndex_impl(bson::BSONObj indexObj,
 		info = MetadataManager::indexInfoFromObj(indexObj, mcx);
 		info.status = IndexInfo::IndexStatus::BUILDING;
 		info.buildId = build_id;
+		bool multikey = wait(isMultikeyIndex(tr, info));
+		info.multikey = multikey;
 		mcx->addIndex(info);
 
 		state Reference<Plan> buildingPlan = ec->wrapOperationPlan(
@@ -0,0 +1,46 @@
+/*
+ * PlanCache.cpp
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PlanCache.h"
+#include "Knobs.h"
+#include "LRUCache.h"
+
+namespace {
+
+LRUCache<std::string, std::string>& planCache() {
+	static LRUCache<std::string, std::string> cache;
+	return cache;
+}
+
+} // namespace
+
+Optional<std::string> getCachedPlan(std::string const& shape) {
+	std::string* winner = planCache().get(shape);
+	if (winner == nullptr)
+		return Optional<std::string>();
+	return *winner;
+}
+
+void setCachedPlan(std::string const& shape, std::string const& winner) {
+	if (DOCLAYER_KNOBS->PLAN_CACHE_MAX_ENTRIES <= 0)
+		return;
+	planCache().put(shape, winner);
+	planCache().trim((size_t)DOCLAYER_KNOBS->PLAN_CACHE_MAX_ENTRIES);
+}
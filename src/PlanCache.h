@@ -0,0 +1,37 @@
+/*
+ * PlanCache.h
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _PLAN_CACHE_H_
+#define _PLAN_CACHE_H_
+
+#pragma once
+
+#include "flow/flow.h"
+
+/**
+ * Which candidate plan won the race (see RacePlan) of each query shape, from a process-wide cache of the
+ * PLAN_CACHE_MAX_ENTRIES most recently used shapes, so later queries of a shape run the winner without racing again.
+ * Winners are the labels RacePlan gives its candidates.
+ */
+Optional<std::string> getCachedPlan(std::string const& shape);
+void setCachedPlan(std::string const& shape, std::string const& winner);
+
+#endif /* _PLAN_CACHE_H_ */
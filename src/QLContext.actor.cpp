@@ -20,15 +20,26 @@
 
 #include "ExtStructs.h"
 #include "ExtUtil.actor.h"
+#include "ChangeLog.h"
 #include "QLContext.h"
 #include "QLExpression.h"
+#include "QLPredicate.h"
 #include "QLProjection.h"
 #include "QLTypes.h"
+#include "GeoSearch.h"
+#include "TextSearch.h"
 
 #include "DocumentError.h"
 
+#include "flow/Hash3.h"
+#include "flow/UnitTest.h"
+
+#include <algorithm>
+
 using namespace FDB;
 
+Reference<IPredicate> queryToPredicate(bson::BSONObj const& query, bool toplevel);
+
 Future<DataValue> IReadContext::toDataValue() {
 	return getRecursiveKnownPresent(Reference<IReadContext>::addRef(this));
 }
@@ -98,8 +109,13 @@ static std::string getFDBKey(DataKey const& key, int extraReserveBytes = 0) {
 	return key.toString();
 }
 
+// Counters are 8 byte little endian integers, changed with atomic adds so that writers never conflict on them
+static void addToCounter(Reference<DocTransaction> tr, Key const& key, int64_t delta) {
+	tr->tr->atomicOp(key, StringRef((const uint8_t*)&delta, sizeof(delta)), FDB_MUTATION_TYPE_ADD);
+}
+
 ACTOR static Future<Optional<DataValue>> FDBPlugin_get(DataKey key, Reference<DocTransaction> tr) {
-	Optional<FDBStandalone<ValueRef>> v = wait(tr->tr->get(KeyRef(getFDBKey(key))));
+	Optional<FDBStandalone<ValueRef>> v = wait(tr->tr->get(KeyRef(getFDBKey(key)), tr->snapshotReads));
 	if (v.present()) {
 		return Optional<DataValue>(DataValue::decode_value(v.get()));
 	} else {
@@ -137,13 +153,14 @@ ACTOR static Future<Void> FDBPlugin_getDescendants(DataKey key,
 
 	try {
 		state GetRangeLimits limit(GetRangeLimits::ROW_LIMIT_UNLIMITED, 80000);
-		state Future<FDBStandalone<RangeResultRef>> nextRead = tr->tr->getRange(KeyRangeRef(begin, end), limit);
+		state Future<FDBStandalone<RangeResultRef>> nextRead =
+		    tr->tr->getRange(KeyRangeRef(begin, end), limit, tr->snapshotReads);
 		loop {
 			state FDBStandalone<RangeResultRef> rr = wait(nextRead);
 
 			if (rr.more) {
 				begin = keyAfter(rr.back().key).toString();
-				nextRead = tr->tr->getRange(KeyRangeRef(begin, end), limit);
+				nextRead = tr->tr->getRange(KeyRangeRef(begin, end), limit, tr->snapshotReads);
 			}
 
 			while (!rr.empty()) {
@@ -283,12 +300,74 @@ struct IndexPlugin : ITDoc {
 		next->clearDescendants(tr, key);
 	}
 
+	// Whether the document belongs in the index, i.e. matches its partialFilterExpression or has an indexed field if
+	// the index is sparse
+	Future<bool> includes(Reference<IReadContext> doc) {
+		return filter.isValid() ? filter->evaluate(doc) : Future<bool>(true);
+	}
+
+	// The key part the index stores for an indexed value
+	std::string indexKeyPart(DataValue const& v) { return info.keyPart(v); }
+
+	// Records that the index is multikey, once a document is about to get more than one entry in it
+	ACTOR static Future<Void> markMultikey(IndexPlugin* self, Reference<DocTransaction> tr) {
+		// Only the first such document of the transaction needs to look
+		self->multikey = true;
+		state FDB::Key key = self->info.multikeyKey();
+		bool already = wait(isMultikeyIndex(tr, self->info));
+		if (!already) {
+			tr->tr->set(key, DataValue(true).encode_value());
+			tr->tr->atomicOp(self->info.metadataVersionKey, LiteralStringRef("\x01\x00\x00\x00\x00\x00\x00\x00"),
+			                 FDB_MUTATION_TYPE_ADD);
+		}
+		return Void();
+	}
+
+	/**
+	 * Waits until no other document is checking or writing any of the unique index keys `keys` through this plugin,
+	 * then claims them until releaseKeys(), or until `released` is ready. Two documents written in one transaction
+	 * could otherwise both find a value free before either writes it; across transactions, the read conflict range of
+	 * the check does the same. Documents with different values don't wait for each other.
+	 */
+	ACTOR static Future<Void> claimKeys(IndexPlugin* self, std::vector<std::string> keys, Future<Void> released) {
+		state Future<Void> busy;
+		loop {
+			busy = Void();
+			for (const auto& key : keys) {
+				auto claim = self->pendingKeys.find(key);
+				if (claim != self->pendingKeys.end()) {
+					busy = claim->second;
+					break;
+				}
+			}
+			if (busy.isReady())
+				break;
+			try {
+				Void _ = wait(busy);
+			} catch (Error& e) {
+				// A claimant that failed leaves a broken promise, and its keys free
+				if (e.code() == error_code_actor_cancelled)
+					throw;
+			}
+		}
+		for (const auto& key : keys)
+			self->pendingKeys[key] = released;
+		return Void();
+	}
+
+	void releaseKeys(std::vector<std::string> const& keys) {
+		for (const auto& key : keys)
+			pendingKeys.erase(key);
+	}
+
 	DataKey collectionPath;
 	DataKey indexPath;
 	bool error_state;
 	bool multikey;
 	bool isUniqueIndex;
-	Optional<Reference<FlowLockHolder>> flowControlLock;
+	IndexInfo info;
+	std::map<std::string, Future<Void>> pendingKeys; // Unique index keys claimed by claimKeys()
+	Reference<IPredicate> filter;
 
 	IndexPlugin(DataKey collectionPath, IndexInfo indexInfo, Reference<ITDoc> next)
 	    : collectionPath(collectionPath),
@@ -297,9 +376,8 @@ struct IndexPlugin : ITDoc {
 	      error_state(false),
 	      multikey(indexInfo.multikey),
 	      isUniqueIndex(indexInfo.isUniqueIndex),
-	      flowControlLock(indexInfo.isUniqueIndex ? Optional<Reference<FlowLockHolder>>(
-	                                                    Reference<FlowLockHolder>(new FlowLockHolder(new FlowLock(1))))
-	                                              : Optional<Reference<FlowLockHolder>>()) {}
+	      info(indexInfo),
+	      filter(indexInfo.filterPredicate()) {}
 };
 
 struct CompoundIndexPlugin : IndexPlugin, ReferenceCounted<CompoundIndexPlugin>, FastAllocated<CompoundIndexPlugin> {
@@ -312,18 +390,24 @@ struct CompoundIndexPlugin : IndexPlugin, ReferenceCounted<CompoundIndexPlugin>,
 	                                             DataKey documentPath) {
 		state Reference<QueryContext> doc(new QueryContext(self->next, tr, documentPath));
 		state Future<Void> writes_finished = dd->writes_finished.getFuture();
+		state std::vector<std::string> claimed_keys;
+		state Promise<Void> released;
+		state bool claiming = false;
 
 		try {
 			// TraceEvent("BD_doIndexUpdateStart");
 
 			dd->snapshotLock.use();
 
+			state bool old_included = wait(self->includes(doc));
 			std::vector<Future<std::vector<DataValue>>> f_old_values;
-			for (const auto& expr : self->exprs) {
-				f_old_values.push_back(
-				    consumeAll(mapAsync(expr.first->evaluate(doc), [](Reference<IReadContext> valcx) {
-					    return getMaybeRecursive(valcx, StringRef());
-				    })));
+			if (old_included) {
+				for (const auto& expr : self->exprs) {
+					f_old_values.push_back(
+					    consumeAll(mapAsync(expr.first->evaluate(doc), [](Reference<IReadContext> valcx) {
+						    return getMaybeRecursive(valcx, StringRef());
+					    })));
+				}
 			}
 
 			state std::vector<std::vector<DataValue>> old_values = wait(getAll(f_old_values));
@@ -332,17 +416,22 @@ struct CompoundIndexPlugin : IndexPlugin, ReferenceCounted<CompoundIndexPlugin>,
 
 			Void _ = wait(writes_finished);
 
+			state bool new_included = wait(self->includes(doc));
 			std::vector<Future<std::vector<DataValue>>> f_new_values;
-			for (const auto& expr : self->exprs) {
-				f_new_values.push_back(
-				    consumeAll(mapAsync(expr.first->evaluate(doc), [](Reference<IReadContext> valcx) {
-					    return getMaybeRecursive(valcx, StringRef());
-				    })));
+			if (new_included) {
+				for (const auto& expr : self->exprs) {
+					f_new_values.push_back(
+					    consumeAll(mapAsync(expr.first->evaluate(doc), [](Reference<IReadContext> valcx) {
+						    return getMaybeRecursive(valcx, StringRef());
+					    })));
+				}
 			}
 
 			state std::vector<std::vector<DataValue>> new_values = wait(getAll(f_new_values));
 
-			int num_new_values = 1;
+			// A document outside a partial or sparse index's filter has no entries in it, rather than one for an empty
+			// product
+			int num_new_values = new_included ? 1 : 0;
 			for (const auto& v : new_values) {
 				num_new_values *= v.size();
 			}
@@ -351,18 +440,23 @@ struct CompoundIndexPlugin : IndexPlugin, ReferenceCounted<CompoundIndexPlugin>,
 				self->error_state = true;
 				throw multikey_index_cartesian_explosion();
 			}
+			if (num_new_values > 1 && !self->multikey)
+				Void _ = wait(markMultikey(self.getPtr(), tr));
 
 			state cartesian_product_iterator<DataValue, std::vector<DataValue>::iterator> nvv(new_values);
-			if (self->isUniqueIndex) {
+			if (self->isUniqueIndex && new_included) {
 				// for all new entries going to be written, before we clear the potentially existing old index entries,
 				// we need to make sure there is no existing unique index for that new value under path
 				// dbName+collectionName+"metadata"+"indices"+encodedIndexName+encodedValue
-				if (self->flowControlLock.present()) {
-					// When building the unique index, each record out of the table scan needs to wait for the previous
-					// one finished duplication detecting and index record writing. And thus the following section
-					// before the `lock.release()` call, needs to be protected using a mutex lock.
-					Void _ = wait(self->flowControlLock.get()->lock->take(1));
+				for (; nvv; ++nvv) {
+					DataKey claimed_key(self->indexPath);
+					for (int i = 0; i < nvv.size(); i++)
+						claimed_key.append(nvv[i].encode_key_part());
+					claimed_keys.push_back(claimed_key.toString());
 				}
+				nvv.reset();
+				Void _ = wait(claimKeys(self.getPtr(), claimed_keys, released.getFuture()));
+				claiming = true;
 				for (; nvv; ++nvv) {
 					DataKey potential_index_key(self->indexPath);
 					for (int i = 0; i < nvv.size(); i++)
@@ -394,7 +488,8 @@ struct CompoundIndexPlugin : IndexPlugin, ReferenceCounted<CompoundIndexPlugin>,
 				}
 			}
 			// clear all existing index entries
-			for (cartesian_product_iterator<DataValue, std::vector<DataValue>::iterator> ovv(old_values); ovv; ++ovv) {
+			for (cartesian_product_iterator<DataValue, std::vector<DataValue>::iterator> ovv(old_values);
+			     old_included && ovv; ++ovv) {
 				// fprintf(stderr, "Old value: %s\n", printable(StringRef(v.encode_key_part())).c_str());
 				DataKey old_key(self->indexPath);
 				for (int i = 0; i < ovv.size(); i++)
@@ -404,7 +499,7 @@ struct CompoundIndexPlugin : IndexPlugin, ReferenceCounted<CompoundIndexPlugin>,
 			}
 			// write the new/updated index entries
 			nvv.reset();
-			for (; nvv; ++nvv) {
+			for (; new_included && nvv; ++nvv) {
 				// fprintf(stderr, "New value: %s\n", printable(StringRef(v.encode_key_part())).c_str());
 				DataKey new_key(self->indexPath);
 				for (int i = 0; i < nvv.size(); i++)
@@ -413,11 +508,13 @@ struct CompoundIndexPlugin : IndexPlugin, ReferenceCounted<CompoundIndexPlugin>,
 				tr->tr->set(getFDBKey(new_key), StringRef());
 			}
 
-			if (self->flowControlLock.present()) {
-				self->flowControlLock.get()->lock->release(1);
+			if (claiming) {
+				self->releaseKeys(claimed_keys);
+				released.send(Void());
 			}
-
 		} catch (Error& e) {
+			if (claiming)
+				self->releaseKeys(claimed_keys);
 			TraceEvent(SevError, "BD_doIndexUpdate").detail("error", e.what());
 			throw;
 		}
@@ -459,38 +556,53 @@ struct SimpleIndexPlugin : IndexPlugin, ReferenceCounted<SimpleIndexPlugin>, Fas
 	                                             DataKey documentPath) {
 		state Reference<QueryContext> doc(new QueryContext(self->next, tr, documentPath));
 		state Future<Void> writes_finished = dd->writes_finished.getFuture();
+		state std::vector<std::string> claimed_keys;
+		state Promise<Void> released;
+		state bool claiming = false;
 		try {
 			// TraceEvent("BD_doIndexUpdateStart");
 
 			dd->snapshotLock.use();
 
-			state std::vector<DataValue> old_values =
-			    wait(consumeAll(mapAsync(self->expr->evaluate(doc), [](Reference<IReadContext> valcx) {
-				    return getMaybeRecursive(valcx, StringRef());
-			    })));
+			state bool old_included = wait(self->includes(doc));
+			state std::vector<DataValue> old_values;
+			if (old_included) {
+				std::vector<DataValue> values =
+				    wait(consumeAll(mapAsync(self->expr->evaluate(doc), [](Reference<IReadContext> valcx) {
+					    return getMaybeRecursive(valcx, StringRef());
+				    })));
+				old_values = values;
+			}
 
 			dd->snapshotLock.unuse();
 
 			Void _ = wait(writes_finished);
 
-			state std::vector<DataValue> new_values =
-			    wait(consumeAll(mapAsync(self->expr->evaluate(doc), [](Reference<IReadContext> valcx) {
-				    return getMaybeRecursive(valcx, StringRef());
-			    })));
+			state bool new_included = wait(self->includes(doc));
+			state std::vector<DataValue> new_values;
+			if (new_included) {
+				std::vector<DataValue> values =
+				    wait(consumeAll(mapAsync(self->expr->evaluate(doc), [](Reference<IReadContext> valcx) {
+					    return getMaybeRecursive(valcx, StringRef());
+				    })));
+				new_values = values;
+			}
+			if (new_values.size() > 1 && !self->multikey)
+				Void _ = wait(markMultikey(self.getPtr(), tr));
 			if (self->isUniqueIndex) {
 				// for all new entries going to be written, before we clear the potentially existing old index entries,
 				// we need to make sure there is no existing unique index for that new value under path
 				// dbName+collectionName+"metadata"+"indices"+encodedIndexName+encodedValue
-
-				if (self->flowControlLock.present()) {
-					// When building the unique index, each record out of the table scan needs to wait for the previous
-					// one finished duplication detecting and index record writing. And thus the following section
-					// before the `lock.release()` call, needs to be protected using a mutex lock.
-					Void _ = wait(self->flowControlLock.get()->lock->take(1));
+				for (const DataValue& v : new_values) {
+					DataKey claimed_key(self->indexPath);
+					claimed_key.append(self->indexKeyPart(v));
+					claimed_keys.push_back(claimed_key.toString());
 				}
+				Void _ = wait(claimKeys(self.getPtr(), claimed_keys, released.getFuture()));
+				claiming = true;
 				for (const DataValue& v : new_values) {
 					state DataKey potential_index_key(self->indexPath);
-					potential_index_key.append(v.encode_key_part());
+					potential_index_key.append(self->indexKeyPart(v));
 					std::vector<Standalone<FDB::KeyValueRef>> existing_index_entries =
 					    wait(consumeAll(self->getDescendants(tr, potential_index_key, LiteralStringRef("\x00"),
 					                                         LiteralStringRef("\xff"), Reference<FlowLockHolder>())));
@@ -522,20 +634,23 @@ struct SimpleIndexPlugin : IndexPlugin, ReferenceCounted<SimpleIndexPlugin>, Fas
 			for (DataValue& v : old_values) {
 				// fprintf(stderr, "Old value: %s\n", printable(StringRef(v.encode_key_part())).c_str());
 				DataKey old_key(self->indexPath);
-				old_key.append(v.encode_key_part()).append(documentPath[documentPath.size() - 1]);
+				old_key.append(self->indexKeyPart(v)).append(documentPath[documentPath.size() - 1]);
 				tr->tr->clear(getFDBKey(old_key));
 			}
 			// write the new/updated index entries
 			for (DataValue& v : new_values) {
 				// fprintf(stderr, "New value: %s\n", printable(StringRef(v.encode_key_part())).c_str());
 				DataKey new_key(self->indexPath);
-				new_key.append(v.encode_key_part()).append(documentPath[documentPath.size() - 1]);
+				new_key.append(self->indexKeyPart(v)).append(documentPath[documentPath.size() - 1]);
 				tr->tr->set(getFDBKey(new_key), StringRef());
 			}
-			if (self->flowControlLock.present()) {
-				self->flowControlLock.get()->lock->release(1);
+			if (claiming) {
+				self->releaseKeys(claimed_keys);
+				released.send(Void());
 			}
 		} catch (Error& e) {
+			if (claiming)
+				self->releaseKeys(claimed_keys);
 			TraceEvent(SevError, "BD_doIndexUpdate").detail("error", e.what());
 			throw;
 		}
@@ -551,6 +666,287 @@ struct SimpleIndexPlugin : IndexPlugin, ReferenceCounted<SimpleIndexPlugin>, Fas
 	Reference<IExpression> expr;
 };
 
+/**
+ * Maintains a text or geo index, which has an entry for each distinct term of the document: a word of the strings in
+ * its indexed fields (see TextSearch.h) or the cell of a point in its indexed field (see GeoSearch.h). Neither kind can
+ * be unique.
+ */
+struct TermIndexPlugin : IndexPlugin, ReferenceCounted<TermIndexPlugin>, FastAllocated<TermIndexPlugin> {
+	void addref() override { ReferenceCounted<TermIndexPlugin>::addref(); }
+	void delref() override { ReferenceCounted<TermIndexPlugin>::delref(); }
+
+	Future<Void> doIndexUpdate(Reference<DocTransaction> tr,
+	                           Reference<DocumentDeferred> dd,
+	                           DataKey documentPath) override {
+		return doIndexUpdateActor(Reference<TermIndexPlugin>::addRef(this), tr, dd, documentPath);
+	}
+
+	// The key parts of the document's terms
+	ACTOR static Future<std::set<std::string>> getTermKeyParts(Reference<TermIndexPlugin> self,
+	                                                          Reference<IReadContext> doc) {
+		state std::set<std::string> keyParts;
+		if (self->geo) {
+			std::vector<GeoPoint> points = wait(getGeoPoints(doc, self->paths[0]));
+			for (const auto& p : points)
+				keyParts.insert(geoCellKeyPart(geoCell(p)));
+		} else {
+			std::set<std::string> terms = wait(getTextTerms(doc, self->paths));
+			for (const auto& term : terms)
+				keyParts.insert(DataValue(term, DVTypeCode::STRING).encode_key_part());
+		}
+		return keyParts;
+	}
+
+	ACTOR static Future<Void> doIndexUpdateActor(Reference<TermIndexPlugin> self,
+	                                             Reference<DocTransaction> tr,
+	                                             Reference<DocumentDeferred> dd,
+	                                             DataKey documentPath) {
+		state Reference<QueryContext> doc(new QueryContext(self->next, tr, documentPath));
+		state Future<Void> writes_finished = dd->writes_finished.getFuture();
+		try {
+			dd->snapshotLock.use();
+
+			state bool old_included = wait(self->includes(doc));
+			state std::set<std::string> old_terms;
+			if (old_included) {
+				std::set<std::string> terms = wait(getTermKeyParts(self, doc));
+				old_terms = terms;
+			}
+
+			dd->snapshotLock.unuse();
+
+			Void _ = wait(writes_finished);
+
+			state bool new_included = wait(self->includes(doc));
+			state std::set<std::string> new_terms;
+			if (new_included) {
+				std::set<std::string> terms = wait(getTermKeyParts(self, doc));
+				new_terms = terms;
+			}
+
+			// Every new term is written, even one the document already had, since while the index is being built the
+			// old terms aren't in it yet
+			for (const auto& term : old_terms) {
+				if (!new_terms.count(term)) {
+					DataKey old_key(self->indexPath);
+					old_key.append(term).append(documentPath[documentPath.size() - 1]);
+					tr->tr->clear(getFDBKey(old_key));
+				}
+			}
+			for (const auto& term : new_terms) {
+				DataKey new_key(self->indexPath);
+				new_key.append(term).append(documentPath[documentPath.size() - 1]);
+				tr->tr->set(getFDBKey(new_key), StringRef());
+			}
+		} catch (Error& e) {
+			TraceEvent(SevError, "BD_doIndexUpdate").detail("error", e.what());
+			throw;
+		}
+
+		return Void();
+	}
+
+	std::string toString() override { return "TermIndexPlugin"; }
+
+	TermIndexPlugin(DataKey collectionPath, IndexInfo indexInfo, Reference<ITDoc> next)
+	    : IndexPlugin(collectionPath, indexInfo, next), geo(indexInfo.geo) {
+		for (const auto& key : indexInfo.indexKeys)
+			paths.push_back(key.first);
+	}
+
+	std::vector<std::string> paths;
+	bool geo;
+};
+
+/**
+ * Bumps the collection's change counter (see CollectionContext::getChangeCount()) once for each document written in a
+ * transaction, and if the collection has a change log, appends an entry for the document to it. Both are deferred with
+ * the document's own writes, and neither reads anything, so concurrent writers don't conflict on them and they only
+ * take effect if the write is committed.
+ *
+ * It also keeps the collection's stats (see CollectionContext::getDocumentCount()), by comparing each document written
+ * before and after the writes. A document created or deleted by the transaction is sized from the writes themselves;
+ * otherwise it is read, which for a document the transaction has just read to update or delete it is served from the
+ * transaction's cache.
+ */
+struct ChangeTrackingPlugin : ITDoc, ReferenceCounted<ChangeTrackingPlugin>, FastAllocated<ChangeTrackingPlugin> {
+	void addref() override { ReferenceCounted<ChangeTrackingPlugin>::addref(); }
+	void delref() override { ReferenceCounted<ChangeTrackingPlugin>::delref(); }
+
+	void set(Reference<DocTransaction> tr, DataKey key, ValueRef value) override {
+		auto change = trackChange(tr, key);
+		if (change.first.isValid()) {
+			auto& dd = change.first;
+			Optional<Optional<int64_t>> before = knownSize(dd);
+			if (isDocumentRoot(key)) {
+				// Only insertDocument() starts writing a document at its root, and only when it isn't there
+				if (change.second && !before.present()) {
+					before = Optional<int64_t>();
+					dd->writtenBytes = std::map<std::string, int64_t>();
+				}
+			} else if (dd->writtenBytes.present()) {
+				dd->writtenBytes.get()[key.toString()] = key.byteSize() - documentKeySize(key) + value.size();
+			}
+			dd->removed = false;
+			trackStats(tr, key, change, before);
+		}
+		next->set(tr, key, value);
+	}
+	void clearDescendants(Reference<DocTransaction> tr, DataKey key) override {
+		auto change = trackChange(tr, key);
+		if (change.first.isValid()) {
+			auto& dd = change.first;
+			Optional<Optional<int64_t>> before = knownSize(dd);
+			if (isDocumentRoot(key)) {
+				dd->writtenBytes = std::map<std::string, int64_t>();
+			} else if (dd->writtenBytes.present()) {
+				auto& written = dd->writtenBytes.get();
+				std::string prefix = key.toString();
+				auto it = written.upper_bound(prefix);
+				while (it != written.end() && StringRef(it->first).startsWith(StringRef(prefix)))
+					it = written.erase(it);
+			}
+			trackStats(tr, key, change, before);
+		}
+		next->clearDescendants(tr, key);
+	}
+	void clear(Reference<DocTransaction> tr, DataKey key) override {
+		auto change = trackChange(tr, key);
+		if (change.first.isValid()) {
+			auto& dd = change.first;
+			Optional<Optional<int64_t>> before = knownSize(dd);
+			if (isDocumentRoot(key)) {
+				dd->removed = true;
+				dd->writtenBytes = std::map<std::string, int64_t>();
+			} else if (dd->writtenBytes.present()) {
+				dd->writtenBytes.get().erase(key.toString());
+			}
+			trackStats(tr, key, change, before);
+		}
+		next->clear(tr, key);
+	}
+	std::string toString() override { return "ChangeTrackingPlugin"; }
+
+	ChangeTrackingPlugin(DataKey collectionPath,
+	                     Key changesKey,
+	                     Optional<Key> changeLogPrefix,
+	                     Optional<std::pair<Key, Key>> statsKeys,
+	                     Reference<ITDoc> next)
+	    : ITDoc(next),
+	      collectionPath(collectionPath),
+	      changesKey(changesKey),
+	      changeLogPrefix(changeLogPrefix),
+	      statsKeys(statsKeys) {}
+
+private:
+	bool isDocumentRoot(DataKey const& key) const { return key.size() == collectionPath.size() + 1; }
+	int documentKeySize(DataKey const& key) const { return key.keyPrefix(collectionPath.size() + 1).byteSize(); }
+
+	// The document's size (see getStoredDocumentSize()) if the transaction wrote all of it, so it needn't be read
+	static Optional<Optional<int64_t>> knownSize(Reference<DocumentDeferred> const& dd) {
+		if (!dd->writtenBytes.present())
+			return Optional<Optional<int64_t>>();
+		if (dd->removed)
+			return Optional<int64_t>();
+		int64_t bytes = 0;
+		for (const auto& written : dd->writtenBytes.get())
+			bytes += written.second;
+		return Optional<int64_t>(bytes);
+	}
+
+	// Starts comparing the document before and after the transaction's writes, the first time this plugin sees it
+	void trackStats(Reference<DocTransaction> tr,
+	                DataKey const& key,
+	                std::pair<Reference<DocumentDeferred>, bool> const& change,
+	                Optional<Optional<int64_t>> const& before) {
+		if (change.second && statsKeys.present())
+			change.first->index_update_actors.push_back(countChange(Reference<ChangeTrackingPlugin>::addRef(this),
+			                                                        tr, change.first,
+			                                                        key.keyPrefix(collectionPath.size() + 1), before));
+	}
+
+	// Like the index plugins, this sizes the document before the deferred writes are applied and again once they are
+	// done, unless the transaction wrote all of it
+	ACTOR static Future<Void> countChange(Reference<ChangeTrackingPlugin> self,
+	                                      Reference<DocTransaction> tr,
+	                                      Reference<DocumentDeferred> dd,
+	                                      DataKey documentPath,
+	                                      Optional<Optional<int64_t>> knownBefore) {
+		state Future<Void> writes_finished = dd->writes_finished.getFuture();
+		state Reference<IReadContext> doc(new QueryContext(self->next, tr, documentPath));
+		state Optional<int64_t> before;
+		state Optional<int64_t> after;
+
+		if (knownBefore.present()) {
+			before = knownBefore.get();
+		} else {
+			dd->snapshotLock.use();
+			try {
+				Optional<int64_t> size = wait(getStoredDocumentSize(doc));
+				before = size;
+			} catch (Error& e) {
+				dd->snapshotLock.unuse();
+				throw;
+			}
+			dd->snapshotLock.unuse();
+		}
+
+		Void _ = wait(writes_finished);
+
+		Optional<Optional<int64_t>> knownAfter = knownSize(dd);
+		if (knownAfter.present()) {
+			after = knownAfter.get();
+		} else {
+			Optional<int64_t> size = wait(getStoredDocumentSize(doc));
+			after = size;
+		}
+
+		int64_t documents = (after.present() ? 1 : 0) - (before.present() ? 1 : 0);
+		int64_t bytes = (after.present() ? after.get() : 0) - (before.present() ? before.get() : 0);
+		if (documents != 0)
+			addToCounter(tr, self->statsKeys.get().first, documents);
+		if (bytes != 0)
+			addToCounter(tr, self->statsKeys.get().second, bytes);
+		return Void();
+	}
+
+	// The document's deferred writes, and whether this is the first time this plugin sees them
+	std::pair<Reference<DocumentDeferred>, bool> trackChange(Reference<DocTransaction> tr, DataKey const& key) {
+		if (!key.startsWith(collectionPath) || key.size() <= collectionPath.size())
+			return std::make_pair(Reference<DocumentDeferred>(), false);
+		std::string documentPrefix = key.keyPrefix(collectionPath.size() + 1).toString();
+		auto info = tr->infos.find(documentPrefix);
+		if (info == tr->infos.end())
+			info = tr->infos.insert(std::make_pair(documentPrefix, Reference<DocumentDeferred>(new DocumentDeferred())))
+			           .first;
+		bool first = info->second->dirty.insert(this).second;
+		if (first) {
+			Key k = changesKey;
+			info->second->deferred.emplace_back([k](Reference<DocTransaction> tr) {
+				tr->tr->atomicOp(k, LiteralStringRef("\x01\x00\x00\x00\x00\x00\x00\x00"), FDB_MUTATION_TYPE_ADD);
+				return Void();
+			});
+			if (changeLogPrefix.present()) {
+				Key prefix = changeLogPrefix.get();
+				Standalone<StringRef> id = key[collectionPath.size()];
+				// Not a Reference, since the DocumentDeferred owns this function
+				DocumentDeferred* dd = info->second.getPtr();
+				info->second->deferred.emplace_back([prefix, id, dd](Reference<DocTransaction> tr) {
+					tr->tr->atomicOp(changeLogMutationKey(prefix, tr->changeLogSequence++),
+					                 changeLogEntry(id, dd->removed), FDB_MUTATION_TYPE_SET_VERSIONSTAMPED_KEY);
+					return Void();
+				});
+			}
+		}
+		return std::make_pair(info->second, first);
+	}
+
+	DataKey collectionPath;
+	Key changesKey;
+	Optional<Key> changeLogPrefix;
+	Optional<std::pair<Key, Key>> statsKeys; // Document count and data size counters, unless it's a system collection
+};
+
 struct QueryContextData {
 	explicit QueryContextData(Reference<DocTransaction> tr) : tr(tr) { layers = Reference<ITDoc>(new FDBPlugin()); }
 
@@ -590,7 +986,9 @@ QueryContext::QueryContext(class Reference<ITDoc> layers, Reference<DocTransacti
     : self(new QueryContextData(layers, tr, path)) {}
 
 void QueryContext::addIndex(IndexInfo index) {
-	if (index.indexKeys.size() == 1) {
+	if (index.text || index.geo) {
+		self->layers = Reference<ITDoc>(new TermIndexPlugin(self->prefix, index, self->layers));
+	} else if (index.indexKeys.size() == 1) {
 		self->layers = Reference<ITDoc>(new SimpleIndexPlugin(
 		    self->prefix, index,
 		    Reference<IExpression>(new ExtPathExpression(StringRef(index.indexKeys[0].first), true, true)),
@@ -607,6 +1005,17 @@ void QueryContext::addIndex(IndexInfo index) {
 	}
 }
 
+void QueryContext::addChangeTracking(Reference<UnboundCollectionContext> collection) {
+	// System collections aren't written through the same paths as user documents, and don't report stats
+	bool system = startsWith(collection->collectionName().c_str(), "system.");
+	self->layers = Reference<ITDoc>(new ChangeTrackingPlugin(
+	    self->prefix, collection->getChangesKey(),
+	    collection->changeLogEnabled ? Optional<Key>(collection->getChangeLogPrefix()) : Optional<Key>(),
+	    system ? Optional<std::pair<Key, Key>>()
+	           : std::make_pair(collection->getDocumentCountKey(), collection->getDataSizeKey()),
+	    self->layers));
+}
+
 Future<Optional<DataValue>> QueryContext::get(StringRef key) {
 	return self->get(key);
 }
@@ -672,15 +1081,42 @@ Reference<CollectionContext> UnboundCollectionContext::bindCollectionContext(Ref
 void UnboundCollectionContext::addIndex(IndexInfo info) {
 	knownIndexes.push_back(info);
 	if (info.status == IndexInfo::IndexStatus::READY) {
-		auto encodedFirstFieldname = DataValue(info.indexKeys[0].first, DVTypeCode::STRING).encode_key_part();
-		auto sim_iterator = simpleIndexMap.find(encodedFirstFieldname);
-		if (sim_iterator == simpleIndexMap.end()) {
-			std::set<IndexInfo, IndexComparator> iSet;
-			iSet.insert(info);
-			simpleIndexMap.insert(make_pair(encodedFirstFieldname, iSet));
-		} else {
-			sim_iterator->second.insert(info);
-		}
+		if (info.partialFilterExpression.present() || info.sparse)
+			partialIndexes.push_back(info);
+		else
+			addPlannableIndex(info);
+	}
+}
+
+void UnboundCollectionContext::addPlannableIndex(IndexInfo info) {
+	if (info.text) {
+		textIndex = info;
+		return;
+	}
+	auto encodedFirstFieldname = DataValue(info.indexKeys[0].first, DVTypeCode::STRING).encode_key_part();
+	if (info.hashed) {
+		hashedIndexMap[encodedFirstFieldname] = info;
+		return;
+	}
+	if (info.geo) {
+		geoIndexMap[encodedFirstFieldname] = info;
+		return;
+	}
+	if (info.folded) {
+		foldedIndexMap[encodedFirstFieldname] = info;
+		return;
+	}
+	if (info.reversed) {
+		reversedIndexMap[encodedFirstFieldname] = info;
+		return;
+	}
+	auto sim_iterator = simpleIndexMap.find(encodedFirstFieldname);
+	if (sim_iterator == simpleIndexMap.end()) {
+		std::set<IndexInfo, IndexComparator> iSet;
+		iSet.insert(info);
+		simpleIndexMap.insert(make_pair(encodedFirstFieldname, iSet));
+	} else {
+		sim_iterator->second.insert(info);
 	}
 }
 
@@ -724,11 +1160,97 @@ Optional<IndexInfo> UnboundCollectionContext::getCompoundIndex(IndexInfo prefix,
 	return Optional<IndexInfo>();
 }
 
+Optional<IndexInfo> UnboundCollectionContext::findIndex(std::map<std::string, IndexInfo> const& indexMap,
+                                                       StringRef encoded_index_key) {
+	if (bannedFieldNames.present() &&
+	    bannedFieldNames.get().find(DataValue::decode_key_part(encoded_index_key).getString()) !=
+	        bannedFieldNames.get().end())
+		return Optional<IndexInfo>();
+	auto index = indexMap.find(encoded_index_key.toString());
+	if (index == indexMap.end())
+		return Optional<IndexInfo>();
+	return index->second;
+}
+
+Optional<IndexInfo> UnboundCollectionContext::getHashedIndex(StringRef encoded_index_key) {
+	return findIndex(hashedIndexMap, encoded_index_key);
+}
+
+Optional<IndexInfo> UnboundCollectionContext::getGeoIndex(StringRef encoded_index_key) {
+	return findIndex(geoIndexMap, encoded_index_key);
+}
+
+Optional<IndexInfo> UnboundCollectionContext::getFoldedIndex(StringRef encoded_index_key) {
+	return findIndex(foldedIndexMap, encoded_index_key);
+}
+
+Optional<IndexInfo> UnboundCollectionContext::getReversedIndex(StringRef encoded_index_key) {
+	return findIndex(reversedIndexMap, encoded_index_key);
+}
+
+Optional<IndexInfo> UnboundCollectionContext::getSkipScanIndex(Optional<Standalone<StringRef>> encoded_first_index_key,
+                                                              StringRef encoded_second_index_key) {
+	if (bannedFieldNames.present() &&
+	    bannedFieldNames.get().find(DataValue::decode_key_part(encoded_second_index_key).getString()) !=
+	        bannedFieldNames.get().end())
+		return Optional<IndexInfo>();
+	for (const auto& indexes : simpleIndexMap) {
+		if (encoded_first_index_key.present() && indexes.first != encoded_first_index_key.get().toString())
+			continue;
+		// An update can't scan an index over a field it changes, whichever field that is
+		if (bannedFieldNames.present() &&
+		    bannedFieldNames.get().find(DataValue::decode_key_part(StringRef(indexes.first)).getString()) !=
+		        bannedFieldNames.get().end())
+			continue;
+		for (const auto& index : indexes.second) {
+			if (index.size() > 1 && !index.multikey &&
+			    DataValue(index.indexKeys[1].first, DVTypeCode::STRING).encode_key_part() == encoded_second_index_key)
+				return index;
+		}
+	}
+	return Optional<IndexInfo>();
+}
+
 Key UnboundCollectionContext::getVersionKey() {
 	return Key(
 	    KeyRef(metadataDirectory->key().toString() + DataValue("version", DVTypeCode::STRING).encode_key_part()));
 }
 
+Key UnboundCollectionContext::getChangesKey() {
+	return Key(
+	    KeyRef(metadataDirectory->key().toString() + DataValue("changes", DVTypeCode::STRING).encode_key_part()));
+}
+
+Key UnboundCollectionContext::getChangeLogOptionKey() {
+	return Key(KeyRef(metadataDirectory->key().toString() +
+	                  DataValue("changelog enabled", DVTypeCode::STRING).encode_key_part()));
+}
+
+Key UnboundCollectionContext::getChangeLogPrefix() {
+	return Key(
+	    KeyRef(metadataDirectory->key().toString() + DataValue("changelog", DVTypeCode::STRING).encode_key_part()));
+}
+
+Key UnboundCollectionContext::getDocumentCountKey() {
+	return Key(KeyRef(metadataDirectory->key().toString() +
+	                  DataValue("document count", DVTypeCode::STRING).encode_key_part()));
+}
+
+Key UnboundCollectionContext::getDataSizeKey() {
+	return Key(
+	    KeyRef(metadataDirectory->key().toString() + DataValue("data size", DVTypeCode::STRING).encode_key_part()));
+}
+
+Key UnboundCollectionContext::getStatsTrackedKey() {
+	return Key(
+	    KeyRef(metadataDirectory->key().toString() + DataValue("stats tracked", DVTypeCode::STRING).encode_key_part()));
+}
+
+Key UnboundCollectionContext::getIdPolicyKey() {
+	return Key(
+	    KeyRef(metadataDirectory->key().toString() + DataValue("id policy", DVTypeCode::STRING).encode_key_part()));
+}
+
 std::string UnboundCollectionContext::databaseName() {
 	return collectionDirectory->getPath()[1].toString();
 }
@@ -742,9 +1264,9 @@ void CollectionContext::bumpMetadataVersion() {
 	                                   FDB_MUTATION_TYPE_ADD);
 }
 
-Future<uint64_t> CollectionContext::getMetadataVersion() {
-	Future<Optional<FDBStandalone<StringRef>>> fov = cx->getTransaction()->tr->get(
-	    StringRef(unbound->getVersionKey())); // FIXME: Wow how many abstractions does this violate at once?
+static Future<uint64_t> getCounter(Reference<DocTransaction> tr, Key const& key) {
+	Future<Optional<FDBStandalone<StringRef>>> fov =
+	    tr->tr->get(StringRef(key)); // FIXME: Wow how many abstractions does this violate at once?
 	Future<uint64_t> ret = map(fov, [](Optional<FDBStandalone<StringRef>> ov) -> uint64_t {
 		if (!ov.present())
 			return 0;
@@ -754,6 +1276,46 @@ Future<uint64_t> CollectionContext::getMetadataVersion() {
 	return ret;
 }
 
+Future<uint64_t> CollectionContext::getMetadataVersion() {
+	return getCounter(cx->getTransaction(), unbound->getVersionKey());
+}
+
+Future<uint64_t> CollectionContext::getChangeCount() {
+	return getCounter(cx->getTransaction(), unbound->getChangesKey());
+}
+
+// Collections written before the stats were maintained can see more deletes than inserts
+static int64_t nonNegative(uint64_t counter) {
+	return std::max<int64_t>((int64_t)counter, 0);
+}
+
+Future<int64_t> CollectionContext::getDocumentCount() {
+	return map(getCounter(cx->getTransaction(), unbound->getDocumentCountKey()), nonNegative);
+}
+
+Future<int64_t> CollectionContext::getDataSize() {
+	return map(getCounter(cx->getTransaction(), unbound->getDataSizeKey()), nonNegative);
+}
+
+void CollectionContext::resetDocumentStats(int64_t documents, int64_t bytes) {
+	Reference<DocTransaction> tr = cx->getTransaction();
+	tr->tr->set(unbound->getDocumentCountKey(), StringRef((const uint8_t*)&documents, sizeof(documents)));
+	tr->tr->set(unbound->getDataSizeKey(), StringRef((const uint8_t*)&bytes, sizeof(bytes)));
+	if (!unbound->statsTracked) {
+		tr->tr->set(unbound->getStatsTrackedKey(), StringRef());
+		bumpMetadataVersion();
+	}
+}
+
+DataValue CollectionContext::generateId() {
+	bson::OID oid = bson::OID::gen();
+	if (unbound->idPolicy == UnboundCollectionContext::SCRAMBLED_OBJECT_ID) {
+		std::string hex = oid.str();
+		oid = bson::OID(hex.substr(22, 2) + hex.substr(20, 2) + hex.substr(18, 2) + hex.substr(0, 18));
+	}
+	return DataValue(oid);
+}
+
 Future<Standalone<StringRef>> IReadWriteContext::getValueEncodedId() {
 	return map(getMaybeRecursiveIfPresent(getSubContext(DataValue("_id", DVTypeCode::STRING).encode_key_part())),
 	           [](Optional<DataValue> odv) -> Standalone<StringRef> {
@@ -786,10 +1348,118 @@ IndexInfo::IndexInfo(std::string indexName,
                      IndexStatus status,
                      Optional<UID> buildId,
                      bool isUniqueIndex)
-    : indexName(indexName), indexKeys(indexKeys), status(status), buildId(buildId), isUniqueIndex(isUniqueIndex) {
+    : indexName(indexName),
+      indexKeys(indexKeys),
+      status(status),
+      buildId(buildId),
+      isUniqueIndex(isUniqueIndex),
+      sparse(false),
+      hashed(false),
+      text(false),
+      geo(false),
+      folded(false),
+      reversed(false) {
 	encodedIndexName = DataValue(indexName, DVTypeCode::STRING).encode_key_part();
 	indexCx = collectionCx->getIndexesContext()->getSubContext(encodedIndexName);
 	multikey = true;
+	metadataVersionKey = collectionCx->getVersionKey();
+}
+
+FDB::Key IndexInfo::multikeyKey() const {
+	return FDB::Key(indexCx->getPrefix().toString());
+}
+
+ACTOR Future<Optional<int64_t>> getStoredDocumentSize(Reference<IReadContext> doc) {
+	state Future<Optional<DataValue>> root = doc->get(StringRef());
+	state GenFutureStream<KeyValue> kvs = doc->getDescendants();
+	state int64_t bytes = 0;
+	try {
+		loop {
+			KeyValue kv = waitNext(kvs);
+			bytes += kv.key.size() + kv.value.size();
+		}
+	} catch (Error& e) {
+		if (e.code() != error_code_end_of_stream)
+			throw;
+	}
+	Optional<DataValue> present = wait(root);
+	return present.present() ? Optional<int64_t>(bytes) : Optional<int64_t>();
+}
+
+// Whether an index is multikey, given the value at its IndexInfo::multikeyKey(); one without a value predates the flag
+static bool decodeMultikeyFlag(Optional<StringRef> value) {
+	return !value.present() || DataValue::decode_value(value.get()).getBool();
+}
+
+Future<bool> isMultikeyIndex(Reference<DocTransaction> tr, IndexInfo const& index) {
+	return map(tr->tr->get(index.multikeyKey()), [](Optional<FDBStandalone<StringRef>> v) -> bool {
+		return decodeMultikeyFlag(v.present() ? Optional<StringRef>(v.get()) : Optional<StringRef>());
+	});
+}
+
+TEST_CASE("/doclayer/IndexInfo/MultikeyFlag") {
+	// Indexes created before the flag was recorded may have any number of entries per document
+	ASSERT(decodeMultikeyFlag(Optional<StringRef>()));
+
+	std::string notMultikey = DataValue(false).encode_value();
+	std::string multikey = DataValue(true).encode_value();
+	ASSERT(!decodeMultikeyFlag(StringRef(notMultikey)));
+	ASSERT(decodeMultikeyFlag(StringRef(multikey)));
+
+	return Void();
+}
+
+void IndexInfo::setFilter(Optional<bson::BSONObj> partialFilterExpression, bool sparse) {
+	this->partialFilterExpression = partialFilterExpression;
+	this->sparse = sparse;
+	filter = Reference<IPredicate>();
+
+	if (partialFilterExpression.present()) {
+		filter = queryToPredicate(partialFilterExpression.get(), true)->simplify();
+	} else if (sparse) {
+		// Same as {$or: [{<field>: {$exists: true}}, ...]}, so the planner can tell which queries imply it
+		std::vector<Reference<IPredicate>> exists;
+		for (const auto& key : indexKeys)
+			exists.push_back(ref(new AnyPredicate(ref(new ExtPathExpression(StringRef(key.first), true, false)),
+			                                      ref(new AllPredicate()))));
+		filter = Reference<IPredicate>(new OrPredicate(exists))->simplify();
+	}
+}
+
+std::string hashedIndexKeyPart(DataValue const& value) {
+	std::string encoded = value.encode_key_part();
+	uint32_t hi = 0, lo = 0;
+	hashlittle2(encoded.data(), encoded.size(), &hi, &lo);
+	return DataValue((long long)(((uint64_t)hi << 32) | lo)).encode_key_part();
+}
+
+std::string foldedIndexKeyPart(DataValue const& value) {
+	if (value.getSortType() != DVTypeCode::STRING)
+		return value.encode_key_part();
+	std::string s = value.getString();
+	for (char& c : s)
+		c = tolower((unsigned char)c);
+	return DataValue(s, DVTypeCode::STRING).encode_key_part();
+}
+
+std::string reversedIndexKeyPart(DataValue const& value) {
+	if (value.getSortType() != DVTypeCode::STRING)
+		return value.encode_key_part();
+	std::string s = value.getString();
+	if (!s.empty() && s.back() == '\n')
+		s.pop_back();
+	std::reverse(s.begin(), s.end());
+	return DataValue(s, DVTypeCode::STRING).encode_key_part();
+}
+
+std::string IndexInfo::keyPart(DataValue const& value) const {
+	if (hashed)
+		return hashedIndexKeyPart(value);
+	if (folded)
+		return foldedIndexKeyPart(value);
+	if (reversed)
+		return reversedIndexKeyPart(value);
+	return value.encode_key_part();
 }
 
 bool IndexInfo::hasPrefix(IndexInfo const& other) {
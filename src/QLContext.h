@@ -64,6 +64,10 @@ struct DocumentDeferred : ReferenceCounted<DocumentDeferred> {
 	std::vector<Future<Void>> index_update_actors;
 	std::set<struct ITDoc*> dirty;
 	std::vector<std::function<Future<Void>(Reference<struct DocTransaction>)>> deferred;
+	bool removed = false; // The document's root was cleared and it hasn't been written since
+	// Bytes of each key the transaction wrote below the document, for as long as those are all it holds: from when
+	// this transaction created, emptied or deleted it. Saves reading it back to size it, see ChangeTrackingPlugin.
+	Optional<std::map<std::string, int64_t>> writtenBytes;
 
 	Future<Void> commitChanges(Reference<DocTransaction> tr) {
 		return commitChanges(tr, Reference<DocumentDeferred>::addRef(this));
@@ -90,6 +94,13 @@ struct DocTransaction : ReferenceCounted<DocTransaction> {
 	void cancel_ongoing_index_reads();
 
 	std::map<std::string, Reference<DocumentDeferred>> infos;
+
+	// Orders the change log entries written by this transaction, which all share its versionstamp
+	uint32_t changeLogSequence = 0;
+
+	// Documents and index entries are read without adding read conflict ranges, as for the trial runs of a RacePlan,
+	// whose reads don't decide what the query returns
+	bool snapshotReads = false;
 };
 
 template <class T>
@@ -255,6 +266,7 @@ struct QueryContext : IReadWriteContext, ReferenceCounted<QueryContext>, FastAll
 	void clearRoot() override;
 	void clear(StringRef key) override;
 	void addIndex(struct IndexInfo index);
+	void addChangeTracking(Reference<struct UnboundCollectionContext> collection);
 	const DataKey getPrefix();
 
 	Future<Void> commitChanges() override;
@@ -355,8 +367,19 @@ struct IndexInfo {
 	std::vector<std::pair<std::string, int>> indexKeys;
 	IndexStatus status;
 	Optional<UID> buildId;
+	// Whether a document may have more than one entry in the index, e.g. for each element of an array. Scans of other
+	// indexes never find a document twice, so they aren't deduplicated. See isMultikeyIndex().
 	bool multikey;
+	FDB::Key metadataVersionKey; // Bumped once the index becomes multikey, so cached contexts see it
 	bool isUniqueIndex;
+	Optional<double> expireAfterSeconds; // Set for TTL indexes, see TTLMonitor.h
+	Optional<bson::BSONObj> partialFilterExpression; // Only documents matching this are indexed
+	bool sparse; // Documents missing all the indexed fields aren't indexed
+	bool hashed; // Keys are hashes of the indexed values, see hashedIndexKeyPart()
+	bool text; // Keys are the terms of the strings in the indexed fields, see TextSearch.h
+	bool geo; // Keys are the geohash cells of the points in the indexed field, see GeoSearch.h
+	bool folded; // Keys are the indexed strings lower cased, see foldedIndexKeyPart()
+	bool reversed; // Keys are the indexed strings backwards, see reversedIndexKeyPart()
 
 	IndexInfo(std::string indexName,
 	          std::vector<std::pair<std::string, int>> indexKeys,
@@ -364,20 +387,79 @@ struct IndexInfo {
 	          IndexStatus status,
 	          Optional<UID> buildId = Optional<UID>(),
 	          bool isUniqueIndex = false);
-	IndexInfo() : status(IndexStatus::INVALID) {}
+	IndexInfo()
+	    : status(IndexStatus::INVALID),
+	      sparse(false),
+	      hashed(false),
+	      text(false),
+	      geo(false),
+	      folded(false),
+	      reversed(false) {}
 	bool hasPrefix(IndexInfo const& other);
+	// The key part the index stores for an indexed value
+	std::string keyPart(DataValue const& value) const;
+	// The key recording whether the index is multikey: the root of its subspace, which holds no entry and is cleared
+	// with it when it is dropped
+	FDB::Key multikeyKey() const;
+	// Sets partialFilterExpression and sparse, and parses the filter they describe once for filterPredicate()
+	void setFilter(Optional<bson::BSONObj> partialFilterExpression, bool sparse);
+	// The predicate a document must match to be indexed, or an invalid reference if every document is
+	Reference<struct IPredicate> filterPredicate() const { return filter; }
 	int size() const { return static_cast<int>(indexKeys.size()); }
+
+private:
+	Reference<struct IPredicate> filter;
 };
 
+/**
+ * The key part a hashed index stores for `value` in place of its encoding: a 64 bit hash of the encoding, as a number.
+ * Entries for increasing values, like timestamps or counters, land all over the index rather than at its end, so
+ * inserts spread across storage servers. The index can then only find documents by equality, and its matches have to
+ * be filtered since hashes collide.
+ */
+std::string hashedIndexKeyPart(DataValue const& value);
+
+/**
+ * The key part a case folded index stores for `value`: strings are lower cased, so the index can find the strings a
+ * case insensitive $regex anchored at the start matches with a range scan. Only ASCII letters are folded, like PCRE
+ * does for patterns it doesn't treat as UTF-8. Other values are stored as they are.
+ */
+std::string foldedIndexKeyPart(DataValue const& value);
+
+/**
+ * The key part a reversed index stores for `value`: strings are reversed, byte by byte, so the index can find the
+ * strings a $regex anchored at the end matches with a range scan on their reversed suffix. A trailing newline is
+ * dropped first, since '$' also matches before one. Other values are stored as they are.
+ */
+std::string reversedIndexKeyPart(DataValue const& value);
+
+/**
+ * Whether `index` is multikey in `tr`. An index records it from when it is created, and its plugin updates it when a
+ * document first gets more than one entry. Indexes created before it was recorded are assumed to be multikey.
+ */
+Future<bool> isMultikeyIndex(Reference<DocTransaction> tr, IndexInfo const& index);
+
+/**
+ * Whether `doc` exists, and if so its size as the collection stats count it (see CollectionContext::getDataSize()): the
+ * bytes of the keys below the document and of their values.
+ */
+Future<Optional<int64_t>> getStoredDocumentSize(Reference<IReadContext> const& doc);
+
 struct IndexComparator {
 	bool operator()(const IndexInfo& lhs, const IndexInfo& rhs) { return lhs.indexKeys.size() < rhs.indexKeys.size(); }
 };
 
 struct UnboundCollectionContext : ReferenceCounted<UnboundCollectionContext>, FastAllocated<UnboundCollectionContext> {
+	// How _id values are made for documents inserted without one, see CollectionContext::generateId()
+	enum IdPolicy { OBJECT_ID = 0, SCRAMBLED_OBJECT_ID = 1 };
+
 	UnboundCollectionContext(Reference<DirectorySubspace> collectionDirectory,
 	                         Reference<DirectorySubspace> metadataDirectory)
 	    : collectionDirectory(collectionDirectory),
 	      metadataDirectory(metadataDirectory),
+	      changeLogEnabled(false),
+	      statsTracked(false),
+	      idPolicy(OBJECT_ID),
 	      bannedFieldNames(Optional<std::set<std::string>>()) {
 		cx = Reference<UnboundQueryContext>(new UnboundQueryContext())->getSubContext(collectionDirectory->key());
 	}
@@ -387,18 +469,44 @@ struct UnboundCollectionContext : ReferenceCounted<UnboundCollectionContext>, Fa
 	      metadataDirectory(other.metadataDirectory),
 	      simpleIndexMap(other.simpleIndexMap),
 	      knownIndexes(other.knownIndexes),
+	      partialIndexes(other.partialIndexes),
+	      hashedIndexMap(other.hashedIndexMap),
+	      geoIndexMap(other.geoIndexMap),
+	      foldedIndexMap(other.foldedIndexMap),
+	      reversedIndexMap(other.reversedIndexMap),
+	      textIndex(other.textIndex),
+	      changeLogEnabled(other.changeLogEnabled),
+	      statsTracked(other.statsTracked),
+	      idPolicy(other.idPolicy),
 	      cx(Reference<UnboundQueryContext>::addRef(other.cx.getPtr())),
 	      bannedFieldNames(other.bannedFieldNames) {}
 
 	Optional<IndexInfo> getSimpleIndex(StringRef simple_index_map_key);
 	Optional<IndexInfo> getCompoundIndex(IndexInfo prefix, StringRef encoded_next_index_key);
+	Optional<IndexInfo> getHashedIndex(StringRef encoded_index_key);
+	Optional<IndexInfo> getGeoIndex(StringRef encoded_index_key);
+	Optional<IndexInfo> getFoldedIndex(StringRef encoded_index_key);
+	Optional<IndexInfo> getReversedIndex(StringRef encoded_index_key);
+	// A compound index, not multikey, whose second field is `encoded_second_index_key`, and whose first field is
+	// `encoded_first_index_key` if that is given. See SkipScanPlan.
+	Optional<IndexInfo> getSkipScanIndex(Optional<Standalone<StringRef>> encoded_first_index_key,
+	                                     StringRef encoded_second_index_key);
 	void setBannedFieldNames(Optional<std::vector<std::string>> bannedFns) {
 		bannedFieldNames = bannedFns.present() ? std::set<std::string>(bannedFns.get().begin(), bannedFns.get().end())
 		                                       : Optional<std::set<std::string>>();
 	}
 	FDB::Key getVersionKey();
+	FDB::Key getChangesKey();
+	FDB::Key getChangeLogOptionKey();
+	FDB::Key getChangeLogPrefix();
+	FDB::Key getDocumentCountKey();
+	FDB::Key getDataSizeKey();
+	FDB::Key getStatsTrackedKey();
+	FDB::Key getIdPolicyKey();
 	Reference<struct CollectionContext> bindCollectionContext(Reference<DocTransaction> tr);
 	void addIndex(IndexInfo index);
+	// Lets the planner use a ready index, e.g. a partial index whose filter the query being planned implies
+	void addPlannableIndex(IndexInfo index);
 	Key getIndexesSubspace();
 	Reference<UnboundQueryContext> getIndexesContext(); // FIXME: Remove this method
 	void filterIndexesWithBannedFieldnames(std::vector<std::string> const& bannedFieldNames);
@@ -417,8 +525,38 @@ struct UnboundCollectionContext : ReferenceCounted<UnboundCollectionContext>, Fa
 	// include indexes that are still building
 	std::vector<IndexInfo> knownIndexes;
 
+	// Ready partial and sparse indexes. They aren't in simpleIndexMap, since they can only answer queries that imply
+	// their filter
+	std::vector<IndexInfo> partialIndexes;
+
+	// Ready hashed indexes, by encoded field name. They only answer equality, so they are kept apart from the indexes
+	// in simpleIndexMap
+	std::map<std::string, IndexInfo> hashedIndexMap;
+
+	// Ready geo indexes, by encoded field name
+	std::map<std::string, IndexInfo> geoIndexMap;
+
+	// Ready case folded and reversed indexes, by encoded field name. They only help $regex queries, so they are kept
+	// apart from the indexes in simpleIndexMap
+	std::map<std::string, IndexInfo> foldedIndexMap;
+	std::map<std::string, IndexInfo> reversedIndexMap;
+
+	// The ready text index. A collection has at most one, since $text doesn't name the index it searches
+	Optional<IndexInfo> textIndex;
+
+	// Whether writes to this collection are recorded in its change log (see ChangeLog.h)
+	bool changeLogEnabled;
+
+	// Whether the document count and size have been maintained since the collection was created or last validated,
+	// so that they are exact and can stand in for a scan
+	bool statsTracked;
+
+	IdPolicy idPolicy;
+
 private:
 	Optional<std::set<std::string>> bannedFieldNames;
+
+	Optional<IndexInfo> findIndex(std::map<std::string, IndexInfo> const& indexMap, StringRef encoded_index_key);
 };
 
 struct CollectionContext : ReferenceCounted<CollectionContext>, FastAllocated<CollectionContext> {
@@ -429,11 +567,36 @@ struct CollectionContext : ReferenceCounted<CollectionContext>, FastAllocated<Co
 		for (const auto& entry : unbound->knownIndexes) {
 			cx->addIndex(entry);
 		}
+		cx->addChangeTracking(unbound);
 	}
 
 	void bumpMetadataVersion();
 	Future<uint64_t> getMetadataVersion();
 
+	/**
+	 * Number of document writes committed to this collection. Unlike the metadata version, this is bumped by every
+	 * insert, update and delete, so it tells cached query results whether they are still current.
+	 */
+	Future<uint64_t> getChangeCount();
+
+	/**
+	 * Number of documents in this collection, and the bytes storing them (see getStoredDocumentSize()). Both are
+	 * counters the collection's writes maintain with atomic adds, so reading them is cheap and never conflicts with
+	 * writers.
+	 */
+	Future<int64_t> getDocumentCount();
+	Future<int64_t> getDataSize();
+	// Overwrites the counters with the results of a scan, and marks them exact from now on
+	void resetDocumentStats(int64_t documents, int64_t bytes);
+
+	/**
+	 * A new _id for a document inserted without one. By default it's an ObjectId, which starts with its creation time,
+	 * so concurrent inserts all go to the end of the collection's key range, on one storage team. Collections created
+	 * with {idPolicy: "scrambled"} get ObjectIds with the 3 byte counter moved to the front, least significant byte
+	 * first, so consecutive ids are spread over the whole range. Their _id order is then no longer creation order.
+	 */
+	DataValue generateId();
+
 private:
 	Reference<UnboundCollectionContext> unbound;
 };
@@ -23,11 +23,14 @@
 #include "DocumentError.h"
 #include "ExtStructs.h"
 #include "ExtUtil.actor.h"
+#include "PlanCache.h"
 #include "QLPlan.h"
 #include "QLProjection.h"
 
 #include "ordering.h"
 
+#include <unordered_set>
+
 using namespace FDB;
 
 /**
@@ -62,6 +65,13 @@ using namespace FDB;
  *  	- PlanCheckpoint::getDocumentFinishedLock()->release() each document that they discard
  */
 
+// `source`, with what it can check of `filter` from index keys if it is an index scan
+static Reference<Plan> withIndexKeyFilter(Reference<Plan> source, Reference<IPredicate> filter) {
+	if (source->getType() != PlanType::IndexScan)
+		return source;
+	return dynamic_cast<IndexScanPlan*>(source.getPtr())->withKeyFilter(filter);
+}
+
 Reference<Plan> FilterPlan::construct_filter_plan(Reference<UnboundCollectionContext> cx,
                                                   Reference<Plan> source,
                                                   Reference<IPredicate> filter) {
@@ -77,11 +87,16 @@ Reference<Plan> FilterPlan::construct_filter_plan(Reference<UnboundCollectionCon
 		}
 		return pdPlan.get();
 	}
-	return ref(new FilterPlan(cx, source, filter));
+	return ref(new FilterPlan(cx, withIndexKeyFilter(source, filter), filter));
 }
 
 Optional<Reference<Plan>> FilterPlan::push_down(Reference<UnboundCollectionContext> cx, Reference<IPredicate> query) {
-	return ref(new FilterPlan(cx, source, ref(new AndPredicate(filter, query))->simplify()));
+	// The source may still narrow itself, like an index scan for a range that isn't tight becoming a skip-scan
+	Optional<Reference<Plan>> pdSource = source->push_down(cx, query);
+	if (pdSource.present())
+		return ref(new FilterPlan(cx, withIndexKeyFilter(pdSource.get(), filter), filter));
+	Reference<IPredicate> combined = ref(new AndPredicate(filter, query))->simplify();
+	return ref(new FilterPlan(cx, withIndexKeyFilter(source, combined), combined));
 }
 
 static Optional<DataKey> toDataKey(Optional<DataValue> const& v) {
@@ -90,6 +105,110 @@ static Optional<DataKey> toDataKey(Optional<DataValue> const& v) {
 	return DataKey::decode_bytes(Standalone<StringRef>(v.get().encode_key_part()));
 }
 
+// A scan of the entries of `index` for strings whose key starts with `prefix`, whatever follows it
+static Reference<Plan> stringPrefixScan(Reference<UnboundCollectionContext> cx,
+                                        IndexInfo const& index,
+                                        std::string const& prefix) {
+	// Drop the terminator of the encoded string, leaving a prefix of the key of every string starting with `prefix`
+	std::string begin = DataValue(prefix, DVTypeCode::STRING).encode_key_part();
+	begin.pop_back();
+	// The scan ends at strinc(end), which is strinc(begin) too; an end that differs from begin just keeps it from
+	// being taken for a lookup of a single value
+	return ref(new IndexScanPlan(cx, index, begin, begin + "\xff"));
+}
+
+// A skip-scan of `index` for the range of `anyPred` in its second field, filtered by `query` unless that is tight
+static Reference<Plan> skipScan(Reference<UnboundCollectionContext> cx,
+                                IndexInfo const& index,
+                                Optional<std::string> begin,
+                                Optional<std::string> end,
+                                AnyPredicate* anyPred,
+                                Reference<IPredicate> query) {
+	Optional<DataValue> beginSuffix, endSuffix;
+	anyPred->pred->get_range(beginSuffix, endSuffix);
+	Reference<Plan> scan = ref(new SkipScanPlan(
+	    cx, index, begin, end, beginSuffix.present() ? beginSuffix.get().encode_key_part() : std::string(1, '\x00'),
+	    endSuffix.present() ? endSuffix.get().encode_key_part() : std::string(1, '\xff')));
+	if (anyPred->pred->range_is_tight())
+		return scan;
+	return FilterPlan::construct_filter_plan(cx, scan, query);
+}
+
+// A term of a conjunction without the values it compares with, so that queries differing only in those share a shape
+static std::string termShape(Reference<IPredicate> const& term) {
+	if (term->getTypeCode() == IPredicate::ANY) {
+		auto anyPred = dynamic_cast<AnyPredicate*>(term.getPtr());
+		return format("%d:", (int)anyPred->pred->getTypeCode()) + printable(anyPred->expr->get_index_key());
+	}
+	return format("%d", (int)term->getTypeCode());
+}
+
+/**
+ * The plan for `source` filtered by the conjunction of `terms`, with each term that `source` can push down being a
+ * candidate and the other terms filtering what it finds. Candidates are raced (see RacePlan) when there are several,
+ * unless one is for a $text term, which is always answered from the text index. `sourceShape` tells sources apart in
+ * the shape of the query.
+ */
+static Optional<Reference<Plan>> pushDownConjunction(Reference<UnboundCollectionContext> cx,
+                                                     Plan* source,
+                                                     std::string const& sourceShape,
+                                                     std::vector<Reference<IPredicate>> const& terms) {
+	std::vector<Reference<Plan>> plans;
+	std::vector<std::string> labels;
+	for (int i = 0; i < terms.size(); ++i) {
+		Reference<IPredicate> this_term = terms[i];
+		Optional<Reference<Plan>> pd = source->push_down(cx, this_term);
+		if (pd.present()) {
+			std::vector<Reference<IPredicate>> other_terms =
+			    std::vector<Reference<IPredicate>>(terms.begin(), terms.begin() + i);
+			other_terms.insert(other_terms.end(), terms.begin() + (i + 1), terms.end());
+			Reference<Plan> plan =
+			    FilterPlan::construct_filter_plan(cx, pd.get(), ref(new AndPredicate(other_terms))->simplify());
+			if (this_term->getTypeCode() == IPredicate::TEXT)
+				return plan;
+			plans.push_back(plan);
+			labels.push_back(termShape(this_term));
+		}
+	}
+	if (plans.empty())
+		return Optional<Reference<Plan>>();
+	if (plans.size() == 1)
+		return plans.front();
+
+	// The first candidate runs until a race has a winner for the shape, so their order must not depend on the order of
+	// the terms, which the shape leaves out. A skip-scan seeks once for each value of the leading field, so it comes
+	// after the other candidates, which are then in the order of their labels.
+	std::vector<std::pair<bool, std::string>> sortKeys;
+	std::vector<int> order;
+	for (int i = 0; i < plans.size(); i++) {
+		// Terms of the same shape are told apart by their values, which the description has
+		std::string description = labels[i] + "/" + plans[i]->describe().toString();
+		sortKeys.emplace_back(plans[i]->hasScanOfType(PlanType::SkipScan), description);
+		order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [&sortKeys](int a, int b) { return sortKeys[a] < sortKeys[b]; });
+	std::vector<Reference<Plan>> orderedPlans;
+	std::vector<std::string> orderedLabels;
+	for (int i : order) {
+		orderedPlans.push_back(plans[i]);
+		orderedLabels.push_back(labels[i]);
+	}
+
+	// Index builds and drops change which plans there are, so the indexes are part of the shape
+	std::string shape = printable(cx->collectionDirectory->key()) + "/" + sourceShape + "/";
+	for (const auto& index : cx->knownIndexes) {
+		if (index.status == IndexInfo::IndexStatus::READY)
+			shape += index.indexName + ",";
+	}
+	std::vector<std::string> termShapes;
+	for (const auto& term : terms)
+		termShapes.push_back(termShape(term));
+	std::sort(termShapes.begin(), termShapes.end());
+	for (const auto& term : termShapes)
+		shape += "/" + term;
+	return ref(new RacePlan(shape, orderedPlans, orderedLabels));
+}
+
 Optional<Reference<Plan>> TableScanPlan::push_down(Reference<UnboundCollectionContext> cx,
                                                    Reference<IPredicate> query) {
 	switch (query->getTypeCode()) {
@@ -125,6 +244,44 @@ Optional<Reference<Plan>> TableScanPlan::push_down(Reference<UnboundCollectionCo
 					}
 				}
 			}
+
+			// A hashed index can only look up a single value, and what it finds has to be filtered since hashes collide
+			Optional<IndexInfo> hIndex = cx->getHashedIndex(indexKey);
+			if (hIndex.present()) {
+				Optional<DataValue> begin, end;
+				anyPred->pred->get_range(begin, end);
+				if (begin.present() && end.present() && begin.get().compare(end.get()) == 0) {
+					std::string key = hashedIndexKeyPart(begin.get());
+					return FilterPlan::construct_filter_plan(cx, ref(new IndexScanPlan(cx, hIndex.get(), key, key)),
+					                                         query);
+				}
+			}
+
+			// A $regex anchored at the start with a literal prefix is a range of a case folded index, and one anchored
+			// at the end with a literal suffix a range of a reversed index. What the range holds still has to be
+			// matched against the pattern.
+			if (anyPred->pred->getTypeCode() == IPredicate::REGEX) {
+				auto regexPred = dynamic_cast<RegExPredicate*>(anyPred->pred.getPtr());
+				Optional<IndexInfo> fIndex = cx->getFoldedIndex(indexKey);
+				Optional<std::string> prefix = fIndex.present() ? regexPred->foldedPrefix() : Optional<std::string>();
+				if (prefix.present())
+					return FilterPlan::construct_filter_plan(cx, stringPrefixScan(cx, fIndex.get(), prefix.get()),
+					                                         query);
+				Optional<IndexInfo> rIndex = cx->getReversedIndex(indexKey);
+				Optional<std::string> suffix = rIndex.present() ? regexPred->reversedSuffix() : Optional<std::string>();
+				if (suffix.present())
+					return FilterPlan::construct_filter_plan(cx, stringPrefixScan(cx, rIndex.get(), suffix.get()),
+					                                         query);
+			}
+
+			// With no index on the field to scan, a compound index with it second can be skip-scanned instead
+			Optional<IndexInfo> sIndex = cx->getSkipScanIndex(Optional<Standalone<StringRef>>(), indexKey);
+			if (sIndex.present()) {
+				Optional<DataValue> begin, end;
+				anyPred->pred->get_range(begin, end);
+				if (begin.present() || end.present())
+					return skipScan(cx, sIndex.get(), Optional<std::string>(), Optional<std::string>(), anyPred, query);
+			}
 		}
 
 		return Optional<Reference<Plan>>();
@@ -151,30 +308,36 @@ Optional<Reference<Plan>> TableScanPlan::push_down(Reference<UnboundCollectionCo
 	}
 	case IPredicate::AND: {
 		std::vector<Reference<IPredicate>> terms = dynamic_cast<AndPredicate*>(query.getPtr())->terms;
-		std::vector<Reference<Plan>> plans;
-		for (int i = 0; i < terms.size(); ++i) {
-			Reference<IPredicate> this_term = terms[i];
-			Optional<Reference<Plan>> pd = push_down(cx, this_term);
-			if (pd.present()) {
-				std::vector<Reference<IPredicate>> other_terms =
-				    std::vector<Reference<IPredicate>>(terms.begin(), terms.begin() + i);
-				other_terms.insert(other_terms.end(), terms.begin() + (i + 1), terms.end());
-				plans.push_back(
-				    FilterPlan::construct_filter_plan(cx, pd.get(), ref(new AndPredicate(other_terms))->simplify()));
-				// SOMEDAY: Don't break here
-				break;
-			}
-		}
-		if (!plans.empty()) {
-			// SOMEDAY: return race(plans);
-			return Optional<Reference<Plan>>(plans.front());
-		} else {
-			return Optional<Reference<Plan>>();
-		}
+		// A $text term is always answered from the text index
+		std::stable_partition(terms.begin(), terms.end(), [](Reference<IPredicate> const& term) {
+			return term->getTypeCode() == IPredicate::TEXT;
+		});
+		return pushDownConjunction(cx, this, "table", terms);
 	}
 	case IPredicate::NONE: {
 		return ref(new EmptyPlan());
 	}
+	case IPredicate::GEO: {
+		auto geoPred = dynamic_cast<GeoPredicate*>(query.getPtr());
+		Optional<IndexInfo> gIndex = cx->getGeoIndex(
+		    Standalone<StringRef>(DataValue(geoPred->path, DVTypeCode::STRING).encode_key_part()));
+		if (!gIndex.present())
+			return Optional<Reference<Plan>>();
+		// GeoScanPlan checks its documents against the region, so there is nothing left to filter
+		return ref(new GeoScanPlan(cx, gIndex.get(), geoPred->path, geoPred->region));
+	}
+	case IPredicate::TEXT: {
+		auto textPred = dynamic_cast<TextPredicate*>(query.getPtr());
+		if (textPred->terms.empty())
+			return ref(new EmptyPlan());
+		if (!cx->textIndex.present())
+			return Optional<Reference<Plan>>();
+		Reference<Plan> scan = ref(new TextScanPlan(cx, cx->textIndex.get(), textPred->terms));
+		// Negated terms don't narrow the scan, they only filter what it finds
+		if (textPred->negatedTerms.empty())
+			return scan;
+		return FilterPlan::construct_filter_plan(cx, scan, query);
+	}
 	default:
 		return Optional<Reference<Plan>>();
 	}
@@ -197,7 +360,8 @@ static inline std::string strAppend(std::string& lhs, StringRef const& rhs) {
 
 Optional<Reference<Plan>> IndexScanPlan::push_down(Reference<UnboundCollectionContext> cx,
                                                    Reference<IPredicate> query) {
-	if (single_key()) {
+	// Keys of a hashed, geo, folded or reversed index don't sort by value, so no compound index can extend it
+	if (single_key() && !index.hashed && !index.geo && !index.folded && !index.reversed) {
 		switch (query->getTypeCode()) {
 		case IPredicate::ANY: {
 			auto anyPred = dynamic_cast<AnyPredicate*>(query.getPtr());
@@ -230,27 +394,33 @@ Optional<Reference<Plan>> IndexScanPlan::push_down(Reference<UnboundCollectionCo
 		}
 		case IPredicate::AND: {
 			std::vector<Reference<IPredicate>> terms = dynamic_cast<AndPredicate*>(query.getPtr())->terms;
-			std::vector<Reference<Plan>> plans;
-			for (int i = 0; i < terms.size(); ++i) {
-				Reference<IPredicate> this_term = terms[i];
-				Optional<Reference<Plan>> pd = push_down(cx, this_term);
-				if (pd.present()) {
-					std::vector<Reference<IPredicate>> other_terms =
-					    std::vector<Reference<IPredicate>>(terms.begin(), terms.begin() + i);
-					other_terms.insert(other_terms.end(), terms.begin() + i + 1, terms.end());
-					plans.push_back(FilterPlan::construct_filter_plan(cx, pd.get(),
-					                                                  ref(new AndPredicate(other_terms))->simplify()));
-					// SOMEDAY: Don't break here
-					break;
-				}
-			}
-			if (!plans.empty()) {
-				// SOMEDAY: return race(plans);
-				return plans.front();
-			} else {
-				return Optional<Reference<Plan>>();
+			return pushDownConjunction(cx, this, index.indexName, terms);
+		}
+		default:
+			return Optional<Reference<Plan>>();
+		}
+	} else if (!index.hashed && !index.geo && !index.folded && !index.reversed && leading_range()) {
+		// A range of the first field can't be extended, but a compound index with the same first field can be
+		// skip-scanned for the range and a term on its second
+		switch (query->getTypeCode()) {
+		case IPredicate::ANY: {
+			auto anyPred = dynamic_cast<AnyPredicate*>(query.getPtr());
+			Standalone<StringRef> indexKey =
+			    Standalone<StringRef>(DataValue(anyPred->expr->get_index_key(), DVTypeCode::STRING).encode_key_part());
+			Standalone<StringRef> firstKey =
+			    Standalone<StringRef>(DataValue(index.indexKeys[0].first, DVTypeCode::STRING).encode_key_part());
+			Optional<IndexInfo> sIndex = cx->getSkipScanIndex(firstKey, indexKey);
+			if (sIndex.present()) {
+				Optional<DataValue> beginSuffix, endSuffix;
+				anyPred->pred->get_range(beginSuffix, endSuffix);
+				if (beginSuffix.present() || endSuffix.present())
+					return skipScan(cx, sIndex.get(), begin, end, anyPred, query);
 			}
-			break;
+			return Optional<Reference<Plan>>();
+		}
+		case IPredicate::AND: {
+			std::vector<Reference<IPredicate>> terms = dynamic_cast<AndPredicate*>(query.getPtr())->terms;
+			return pushDownConjunction(cx, this, index.indexName, terms);
 		}
 		default:
 			return Optional<Reference<Plan>>();
@@ -260,6 +430,77 @@ Optional<Reference<Plan>> IndexScanPlan::push_down(Reference<UnboundCollectionCo
 	}
 }
 
+bson::BSONObj IndexScanPlan::describe() {
+	std::string bound_begin = begin.present() ? FDB::printable(begin.get()) : "-inf";
+	std::string bound_end = end.present() ? FDB::printable(end.get()) : "+inf";
+	bson::BSONObjBuilder bob;
+	bob.append("type", "index scan");
+	bob.append("index name", index.indexName);
+	bob.append("bounds", BSON("begin" << bound_begin << "end" << bound_end));
+	if (!keyTerms.empty()) {
+		bson::BSONArrayBuilder keyFilter;
+		for (const auto& term : keyTerms)
+			keyFilter << FDB::printable(index.indexKeys[term.first].first) + " " + term.second->toString();
+		bob.append("key filter", keyFilter.arr());
+	}
+	return bob.obj();
+}
+
+// Whether `value` is neither an array nor an object, which a multikey or array field could be compared with
+static bool isScalar(DataValue const& value) {
+	DVTypeCode type = value.getSortType();
+	return type != DVTypeCode::ARRAY && type != DVTypeCode::OBJECT && type != DVTypeCode::PACKED_ARRAY &&
+	       type != DVTypeCode::PACKED_OBJECT;
+}
+
+Reference<Plan> IndexScanPlan::withKeyFilter(Reference<IPredicate> filter) {
+	// Keys of a multikey index are elements of arrays, and those of other special indexes aren't the values at all
+	if (index.multikey || index.hashed || index.geo || index.text || index.folded || index.reversed)
+		return Reference<Plan>::addRef(this);
+
+	std::vector<Reference<IPredicate>> terms;
+	if (filter->getTypeCode() == IPredicate::AND)
+		terms = dynamic_cast<AndPredicate*>(filter.getPtr())->terms;
+	else
+		terms.push_back(filter);
+
+	std::vector<std::pair<int, Reference<IPredicate>>> checked;
+	for (const auto& term : terms) {
+		if (term->getTypeCode() != IPredicate::ANY)
+			continue;
+		auto anyPred = dynamic_cast<AnyPredicate*>(term.getPtr());
+		Reference<IPredicate> pred = anyPred->pred;
+		if (pred->getTypeCode() == IPredicate::EQ) {
+			if (!isScalar(dynamic_cast<EqPredicate*>(pred.getPtr())->value))
+				continue;
+		} else if (pred->getTypeCode() == IPredicate::RANGE) {
+			auto range = dynamic_cast<RangePredicate*>(pred.getPtr());
+			if (!isScalar(range->min_value) || !isScalar(range->max_value))
+				continue;
+		} else {
+			continue;
+		}
+		for (int i = 0; i < index.size(); i++) {
+			if (anyPred->expr->get_index_key() == StringRef(index.indexKeys[i].first)) {
+				checked.emplace_back(i, pred);
+				break;
+			}
+		}
+	}
+
+	if (checked.empty() && keyTerms.empty())
+		return Reference<Plan>::addRef(this);
+	Reference<IndexScanPlan> scan(new IndexScanPlan(cx, index, begin, end));
+	scan->keyTerms = checked;
+	return scan;
+}
+
+bool IndexScanPlan::leading_range() {
+	// Bounds extended into further fields hold more than the one encoded value
+	return (!begin.present() || DataKey::decode_item(StringRef(begin.get()), 0).size() == begin.get().size()) &&
+	       (!end.present() || DataKey::decode_item(StringRef(end.get()), 0).size() == end.get().size());
+}
+
 ACTOR static Future<Void> doFilter(PlanCheckpoint* checkpoint,
                                    FutureStream<Reference<ScanReturnedContext>> input,
                                    PromiseStream<Reference<ScanReturnedContext>> output,
@@ -321,12 +562,38 @@ FutureStream<Reference<ScanReturnedContext>> FilterPlan::execute(PlanCheckpoint*
 	return output.getFuture();
 }
 
+// Whether the key part `part` can be of a document matching `term`. Values that aren't scalars, or are null, which
+// also stands for a missing field, are left for the document to decide.
+static bool keyPartMatches(StringRef part, Reference<IPredicate> const& term) {
+	DataValue value = DataValue::decode_key_part(part);
+	DVTypeCode type = value.getSortType();
+	if (type == DVTypeCode::ARRAY || type == DVTypeCode::OBJECT || type == DVTypeCode::PACKED_ARRAY ||
+	    type == DVTypeCode::PACKED_OBJECT || type == DVTypeCode::NULL_ELEMENT)
+		return true;
+	if (term->getTypeCode() == IPredicate::EQ)
+		return value.compare(dynamic_cast<EqPredicate*>(term.getPtr())->value) == 0;
+	auto range = dynamic_cast<RangePredicate*>(term.getPtr());
+	if (value.compare(range->min_value) <= (range->min_closed ? -1 : 0))
+		return false;
+	return value.compare(range->max_value) < (range->max_closed ? 1 : 0);
+}
+
+// Whether the index entry `key` can be for a document matching each of `keyTerms`, see IndexScanPlan::withKeyFilter()
+static bool keyMatches(StringRef key, std::vector<std::pair<int, Reference<IPredicate>>> const& keyTerms) {
+	for (const auto& term : keyTerms) {
+		if (!keyPartMatches(DataKey::decode_item(key, term.first), term.second))
+			return false;
+	}
+	return true;
+}
+
 ACTOR static Future<Void> toDocInfo(PlanCheckpoint* checkpoint,
                                     Reference<IReadWriteContext> base,
                                     int scanID,
                                     GenFutureStream<KeyValue> index_keys,
                                     PromiseStream<Reference<ScanReturnedContext>> dis,
-                                    Reference<FlowLockHolder> inputLock) {
+                                    Reference<FlowLockHolder> inputLock,
+                                    std::vector<std::pair<int, Reference<IPredicate>>> keyTerms) {
 	// Each key has a document ID as its last entry
 	state Key lastKey;
 	state PlanCheckpoint::FlowControlLock* outputLock = checkpoint->getDocumentFinishedLock();
@@ -334,6 +601,10 @@ ACTOR static Future<Void> toDocInfo(PlanCheckpoint* checkpoint,
 		loop {
 			state KeyValue kv = waitNext(index_keys);
 			inputLock->lock->release();
+			if (!keyMatches(kv.key, keyTerms)) {
+				lastKey = Key(kv.key, kv.arena());
+				continue;
+			}
 			Void _ = wait(outputLock->take());
 			lastKey = Key(kv.key, kv.arena());
 			// fprintf(stderr, "lastkey: %s\n", printable(lastKey).c_str());
@@ -354,86 +625,54 @@ ACTOR static Future<Void> toDocInfo(PlanCheckpoint* checkpoint,
 	}
 }
 
-ACTOR static Future<bool> simpleWouldBeLast(Reference<ScanReturnedContext> doc,
-                                            std::vector<Reference<IExpression>> expr,
-                                            FDB::Key indexUpperBound) {
-	std::vector<DataValue> old_values = wait(consumeAll(mapAsync(
-	    expr[0]->evaluate(doc), [](Reference<IReadContext> valcx) { return getMaybeRecursive(valcx, StringRef()); })));
-	if (old_values.size() == 1)
-		return true;
-	else {
-		std::vector<std::string> old_key_parts;
-		old_key_parts.reserve(old_values.size());
-		for (auto dv : old_values)
-			old_key_parts.push_back(dv.encode_key_part());
-		std::sort(old_key_parts.begin(), old_key_parts.end());
-		std::string last;
-		for (auto s = old_key_parts.rbegin(); !(s == old_key_parts.rend()); ++s) {
-			if (*s < indexUpperBound) {
-				last = *s;
-				break;
-			}
-		}
-		// fprintf(stderr, "SWBL last: %s\n", printable(last).c_str());
-		// fprintf(stderr, "SWBL scankey: %s\n", printable(doc->scanKey()).c_str());
-		// fprintf(stderr, "SWBL upperBound: %s\n", printable(indexUpperBound).c_str());
-		if (doc->scanKey().startsWith(last))
-			return true;
-	}
-	return false;
-}
-
-ACTOR static Future<bool> compoundWouldBeLast(Reference<ScanReturnedContext> doc,
-                                              std::vector<Reference<IExpression>> exprs,
-                                              FDB::Key indexUpperBound) {
-	std::vector<Future<std::vector<DataValue>>> f_old_values;
+// Whether the entry `doc` was found by is the first of its document at or after `indexLowerBound`
+ACTOR static Future<bool> isFirstIndexEntry(Reference<ScanReturnedContext> doc,
+                                            IndexInfo index,
+                                            std::vector<Reference<IExpression>> exprs,
+                                            FDB::Key indexLowerBound) {
+	std::vector<Future<std::vector<DataValue>>> f_values;
 	for (const auto& expr : exprs) {
-		f_old_values.push_back(consumeAll(mapAsync(
+		f_values.push_back(consumeAll(mapAsync(
 		    expr->evaluate(doc), [](Reference<IReadContext> valcx) { return getMaybeRecursive(valcx, StringRef()); })));
 	}
-	state std::vector<std::vector<DataValue>> old_values = wait(getAll(f_old_values));
+	state std::vector<std::vector<DataValue>> values = wait(getAll(f_values));
 
-	int old_values_size = 1;
-	for (const auto& v : old_values) {
-		old_values_size *= v.size();
+	int values_size = 1;
+	for (const auto& v : values) {
+		values_size *= v.size();
 	}
-
-	if (old_values_size == 1)
+	if (values_size == 1)
 		return true;
-	else {
-		std::vector<std::string> old_key_parts;
-		old_key_parts.reserve(old_values_size);
-		for (cartesian_product_iterator<DataValue, std::vector<DataValue>::iterator> vv(old_values); vv; ++vv) {
-			std::string buildingKey;
-			for (int i = 0; i < vv.size(); i++)
-				buildingKey.append(vv[i].encode_key_part());
-			old_key_parts.push_back(buildingKey);
-		}
-		std::sort(old_key_parts.begin(), old_key_parts.end());
-		std::string last;
-		for (auto s = old_key_parts.rbegin(); !(s == old_key_parts.rend()); ++s) {
-			if (*s < indexUpperBound) {
-				last = *s;
-				break;
-			}
-		}
-		// fprintf(stderr, "CWBL last: %s\n", printable(last).c_str());
-		// fprintf(stderr, "CWBL scankey: %s\n", printable(doc->scanKey()).c_str());
-		// fprintf(stderr, "CWBL upperBound: %s\n", printable(indexUpperBound).c_str());
-		if (doc->scanKey().startsWith(last))
-			return true;
+
+	std::vector<std::string> key_parts;
+	key_parts.reserve(values_size);
+	for (cartesian_product_iterator<DataValue, std::vector<DataValue>::iterator> vv(values); vv; ++vv) {
+		std::string buildingKey;
+		for (int i = 0; i < vv.size(); i++)
+			buildingKey.append(index.keyPart(vv[i]));
+		key_parts.push_back(buildingKey);
 	}
-	return false;
+	std::sort(key_parts.begin(), key_parts.end());
+	auto first = std::lower_bound(key_parts.begin(), key_parts.end(), indexLowerBound.toString());
+	return first != key_parts.end() && doc->scanKey().startsWith(StringRef(*first));
 }
 
+/**
+ * Passes on each document of a multikey index scan once, at its first entry in the scan's bounds. The ids of the first
+ * INDEX_SCAN_DEDUP_MAX_DOCS documents are remembered, so their later entries are dropped without reading them. Other
+ * documents are read to tell whether an entry is their first, as are all documents when the scan resumes from a
+ * checkpoint (`resumed`), since some were passed on before it.
+ */
 ACTOR static Future<Void> deduplicateIndexStream(PlanCheckpoint* checkpoint,
                                                  IndexInfo self,
-                                                 FDB::Key indexUpperBound,
+                                                 FDB::Key indexLowerBound,
+                                                 bool resumed,
                                                  FutureStream<Reference<ScanReturnedContext>> dis,
                                                  PromiseStream<Reference<ScanReturnedContext>> filtered) {
 	state Deque<std::pair<Reference<ScanReturnedContext>, Future<bool>>> futures;
 	state std::pair<Reference<ScanReturnedContext>, Future<bool>> p;
 	state std::vector<Reference<IExpression>> exprs;
+	state std::unordered_set<std::string> seen;
 	for (auto k : self.indexKeys)
 		exprs.push_back(Reference<IExpression>(new ExtPathExpression(StringRef(k.first), true, true)));
 	state PlanCheckpoint::FlowControlLock* flowControlLock = checkpoint->getDocumentFinishedLock();
@@ -442,9 +681,17 @@ ACTOR static Future<Void> deduplicateIndexStream(PlanCheckpoint* checkpoint,
 			try {
 				choose {
 					when(Reference<ScanReturnedContext> nextInput = waitNext(dis)) {
-						futures.push_back(std::pair<Reference<ScanReturnedContext>, Future<bool>>(
-						    nextInput, (self.size() == 1 ? simpleWouldBeLast : compoundWouldBeLast)(nextInput, exprs,
-						                                                                            indexUpperBound)));
+						std::string id = DataKey::decode_item_rev(nextInput->scanKey(), 0).toString();
+						Future<bool> first;
+						if (seen.count(id))
+							first = Future<bool>(false);
+						else if (!resumed && seen.size() < (size_t)DOCLAYER_KNOBS->INDEX_SCAN_DEDUP_MAX_DOCS)
+							first = Future<bool>(true);
+						else
+							first = isFirstIndexEntry(nextInput, self, exprs, indexLowerBound);
+						if (seen.size() < (size_t)DOCLAYER_KNOBS->INDEX_SCAN_DEDUP_MAX_DOCS)
+							seen.insert(id);
+						futures.push_back(std::pair<Reference<ScanReturnedContext>, Future<bool>>(nextInput, first));
 					}
 					when(bool pass = wait(futures.empty() ? Never() : futures.front().second)) {
 						if (pass)
@@ -498,17 +745,341 @@ FutureStream<Reference<ScanReturnedContext>> IndexScanPlan::execute(PlanCheckpoi
 	                                            checkpoint->getBounds(scanID).end));
 	Reference<FlowLockHolder> flowControlLock(new FlowLockHolder(new FlowLock(1)));
 	GenFutureStream<KeyValue> kvs = index_cx->getDescendants(lowerBound, upperBound, flowControlLock);
-	checkpoint->addOperation(kvs.actor && toDocInfo(checkpoint, bcx->cx, scanID, kvs, p, flowControlLock), p);
+	checkpoint->addOperation(
+	    kvs.actor && toDocInfo(checkpoint, bcx->cx, scanID, kvs, p, flowControlLock, keyTerms), p);
 
-	if (begin.present() && end.present() && begin.get() == end.get() && index.size() == 1) {
+	// A geo index's documents are deduplicated by GeoScanPlan instead
+	if ((begin.present() && end.present() && begin.get() == end.get() && index.size() == 1) || index.geo ||
+	    !index.multikey) {
 		return p.getFuture();
 	} else {
+		FDB::Key scanBegin = begin.present() ? begin.get() : LiteralStringRef("\x00");
 		PromiseStream<Reference<ScanReturnedContext>> p2;
-		checkpoint->addOperation(deduplicateIndexStream(checkpoint, index, upperBound, p.getFuture(), p2), p2);
+		checkpoint->addOperation(
+		    deduplicateIndexStream(checkpoint, index, scanBegin, lowerBound > scanBegin, p.getFuture(), p2), p2);
 		return p2.getFuture();
 	}
 }
 
+// Whether the index entry `key` is in the range of the fields after the first that its own first field has
+static bool inSkipScanRange(StringRef key, std::string const& beginSuffix, std::string const& endSuffix) {
+	std::string leading = DataKey::decode_item(key, 0).toString();
+	return !(key < StringRef(leading + beginSuffix)) && key < strinc(StringRef(leading + endSuffix));
+}
+
+ACTOR static Future<Void> doSkipScan(PlanCheckpoint* checkpoint,
+                                     Reference<DocTransaction> tr,
+                                     Reference<IReadWriteContext> base,
+                                     int scanID,
+                                     std::string prefix,
+                                     Key lowerBound,
+                                     Key upperBound,
+                                     std::string beginSuffix,
+                                     std::string endSuffix,
+                                     PromiseStream<Reference<ScanReturnedContext>> output) {
+	state PlanCheckpoint::FlowControlLock* outputLock = checkpoint->getDocumentFinishedLock();
+	state Key resume = lowerBound; // The scan is done with every entry before it
+	state Key next;
+	state Key rangeBegin;
+	state Key rangeEnd;
+	state int seeks = 0;
+	state FDBStandalone<RangeResultRef> entries;
+	state int i;
+	state Key key;
+	try {
+		while (resume < upperBound) {
+			if (seeks < DOCLAYER_KNOBS->SKIP_SCAN_MAX_SEEKS) {
+				// The first entry at or after `resume` has the next value of the first field
+				FDBStandalone<RangeResultRef> first =
+				    wait(tr->tr->getRange(KeyRangeRef(strAppend(prefix, resume), strAppend(prefix, upperBound)), 1,
+				                          tr->snapshotReads));
+				if (first.empty())
+					break;
+				seeks++;
+				std::string leading = DataKey::decode_item(first[0].key.substr(prefix.size()), 0).toString();
+				rangeBegin = std::max(resume, Key(leading + beginSuffix));
+				rangeEnd = std::min(upperBound, strinc(StringRef(leading + endSuffix)));
+				next = std::min(upperBound, strinc(StringRef(leading)));
+			} else {
+				rangeBegin = resume;
+				rangeEnd = upperBound;
+				next = upperBound;
+			}
+
+			while (rangeBegin < rangeEnd) {
+				FDBStandalone<RangeResultRef> rr =
+				    wait(tr->tr->getRange(KeyRangeRef(strAppend(prefix, rangeBegin), strAppend(prefix, rangeEnd)),
+				                          GetRangeLimits(GetRangeLimits::ROW_LIMIT_UNLIMITED, 80000),
+				                          tr->snapshotReads));
+				entries = rr;
+				for (i = 0; i < entries.size(); i++) {
+					key = entries[i].key.substr(prefix.size());
+					if (inSkipScanRange(key, beginSuffix, endSuffix)) {
+						Void _ = wait(outputLock->take());
+						Standalone<StringRef> id = DataKey::decode_item_rev(key, 0);
+						output.send(Reference<ScanReturnedContext>(
+						    new ScanReturnedContext(base->getSubContext(id), scanID, key)));
+					}
+					resume = keyAfter(key);
+				}
+				if (!entries.more)
+					break;
+				rangeBegin = resume;
+			}
+			resume = next;
+		}
+		throw end_of_stream();
+	} catch (Error& e) {
+		if (e.code() == error_code_actor_cancelled) {
+			if (checkpoint->splitBoundWanted())
+				checkpoint->splitBound(scanID) = resume;
+			throw;
+		}
+		output.sendError(e);
+		throw;
+	}
+}
+
+FutureStream<Reference<ScanReturnedContext>> SkipScanPlan::execute(PlanCheckpoint* checkpoint,
+                                                                   Reference<DocTransaction> tr) {
+	Reference<CollectionContext> bcx = cx->bindCollectionContext(tr);
+	int scanID = checkpoint->addScan();
+	PromiseStream<Reference<ScanReturnedContext>> p;
+	FDB::Key lowerBound =
+	    std::max(begin.present() ? begin.get() : LiteralStringRef("\x00"), checkpoint->getBounds(scanID).begin);
+	FDB::Key upperBound =
+	    std::max<FDB::Key>(lowerBound, std::min(end.present() ? strinc(end.get()) : LiteralStringRef("\xff"),
+	                                            checkpoint->getBounds(scanID).end));
+	checkpoint->addOperation(doSkipScan(checkpoint, tr, bcx->cx, scanID, index.indexCx->getPrefix().toString(),
+	                                    lowerBound, upperBound, beginSuffix, endSuffix, p),
+	                         p);
+	return p.getFuture();
+}
+
+TextScanPlan::TextScanPlan(Reference<UnboundCollectionContext> cx, IndexInfo index, std::set<std::string> const& terms)
+    : cx(cx), index(index), terms(terms.begin(), terms.end()) {
+	std::stable_sort(this->terms.begin(), this->terms.end(),
+	                 [](std::string const& a, std::string const& b) { return a.size() > b.size(); });
+}
+
+bson::BSONObj TextScanPlan::describe() {
+	bson::BSONArrayBuilder termsBuilder;
+	for (const auto& term : terms)
+		termsBuilder << term;
+	return BSON(
+	    // clang-format off
+		"type" << "text scan" <<
+		"index name" << index.indexName <<
+		"terms" << termsBuilder.arr()
+	    // clang-format on
+	);
+}
+
+// Whether the text index at `indexPath` has entries for the document `documentId` under each of the encoded `terms`
+ACTOR static Future<bool> hasTextIndexEntries(Reference<DocTransaction> tr,
+                                              DataKey indexPath,
+                                              std::vector<std::string> terms,
+                                              Standalone<StringRef> documentId) {
+	std::vector<Future<Optional<FDBStandalone<StringRef>>>> entries;
+	for (const auto& term : terms) {
+		DataKey entry(indexPath);
+		entry.append(StringRef(term)).append(documentId);
+		entries.push_back(tr->tr->get(KeyRef(entry.toString())));
+	}
+	std::vector<Optional<FDBStandalone<StringRef>>> found = wait(getAll(entries));
+	return std::all_of(found.begin(), found.end(),
+	                   [](Optional<FDBStandalone<StringRef>> const& entry) { return entry.present(); });
+}
+
+ACTOR static Future<Void> doTextIntersect(PlanCheckpoint* checkpoint,
+                                          FutureStream<Reference<ScanReturnedContext>> input,
+                                          PromiseStream<Reference<ScanReturnedContext>> output,
+                                          Reference<DocTransaction> tr,
+                                          DataKey indexPath,
+                                          std::vector<std::string> terms) {
+	state Deque<std::pair<Reference<ScanReturnedContext>, Future<bool>>> futures;
+	state std::pair<Reference<ScanReturnedContext>, Future<bool>> p;
+	state PlanCheckpoint::FlowControlLock* flowControlLock = checkpoint->getDocumentFinishedLock();
+	try {
+		loop {
+			try {
+				choose {
+					when(Reference<ScanReturnedContext> nextInput = waitNext(input)) {
+						// The scan key is the key of the document's entry in the scanned posting list
+						Key scanKey = nextInput->scanKey();
+						Standalone<StringRef> documentId(DataKey::decode_item_rev(scanKey, 0), scanKey.arena());
+						futures.push_back(std::pair<Reference<ScanReturnedContext>, Future<bool>>(
+						    nextInput, hasTextIndexEntries(tr, indexPath, terms, documentId)));
+					}
+					when(bool pass = wait(futures.empty() ? Never() : futures.front().second)) {
+						if (pass)
+							output.send(futures.front().first);
+						else
+							flowControlLock->release();
+						futures.pop_front();
+					}
+				}
+			} catch (Error& e) {
+				if (e.code() == error_code_end_of_stream)
+					break;
+				else
+					throw;
+			}
+		}
+
+		while (!futures.empty()) {
+			p = futures.front();
+			bool pass = wait(p.second);
+			if (pass)
+				output.send(p.first);
+			else
+				flowControlLock->release();
+			futures.pop_front();
+		}
+
+		throw end_of_stream();
+	} catch (Error& e) {
+		if (e.code() == error_code_actor_cancelled) {
+			if (checkpoint->splitBoundWanted()) {
+				for (int i = futures.size() - 1; i >= 0; i--)
+					checkpoint->splitBound(futures[i].first->scanId()) = futures[i].first->scanKey();
+			}
+		} else
+			output.sendError(e);
+		throw;
+	}
+}
+
+FutureStream<Reference<ScanReturnedContext>> TextScanPlan::execute(PlanCheckpoint* checkpoint,
+                                                                   Reference<DocTransaction> tr) {
+	Reference<QueryContext> index_cx = index.indexCx->bindQueryContext(tr);
+	Reference<CollectionContext> bcx = cx->bindCollectionContext(tr);
+	int scanID = checkpoint->addScan();
+	std::vector<std::string> encodedTerms;
+	for (const auto& term : terms)
+		encodedTerms.push_back(DataValue(term, DVTypeCode::STRING).encode_key_part());
+
+	// Each document has one entry per term, so the posting list of the first term lists it at most once
+	PromiseStream<Reference<ScanReturnedContext>> p;
+	FDB::Key lowerBound = std::max<FDB::Key>(StringRef(encodedTerms[0]), checkpoint->getBounds(scanID).begin);
+	FDB::Key upperBound = std::max<FDB::Key>(
+	    lowerBound, std::min<FDB::Key>(strinc(StringRef(encodedTerms[0])), checkpoint->getBounds(scanID).end));
+	Reference<FlowLockHolder> flowControlLock(new FlowLockHolder(new FlowLock(1)));
+	GenFutureStream<KeyValue> kvs = index_cx->getDescendants(lowerBound, upperBound, flowControlLock);
+	checkpoint->addOperation(kvs.actor && toDocInfo(checkpoint, bcx->cx, scanID, kvs, p, flowControlLock,
+	                                                     std::vector<std::pair<int, Reference<IPredicate>>>()),
+	                         p);
+	if (encodedTerms.size() == 1)
+		return p.getFuture();
+
+	PromiseStream<Reference<ScanReturnedContext>> p2;
+	encodedTerms.erase(encodedTerms.begin());
+	checkpoint->addOperation(
+	    doTextIntersect(checkpoint, p.getFuture(), p2, tr, index.indexCx->getPrefix(), encodedTerms), p2);
+	return p2.getFuture();
+}
+
+GeoScanPlan::GeoScanPlan(Reference<UnboundCollectionContext> cx, IndexInfo index, std::string path, GeoRegion region)
+    : index(index), path(path), region(region) {
+	for (const auto& range : region.covering()) {
+		Reference<Plan> scan =
+		    ref(new IndexScanPlan(cx, index, geoCellKeyPart(range.first), geoCellKeyPart(range.second)));
+		source = source.isValid() ? ref(new UnionPlan(source, scan)) : scan;
+	}
+}
+
+bson::BSONObj GeoScanPlan::describe() {
+	return BSON(
+	    // clang-format off
+		"type" << "geo scan" <<
+		"index name" << index.indexName <<
+		"region" << region.toString() <<
+		"source_plan" << source->describe()
+	    // clang-format on
+	);
+}
+
+/**
+ * Whether the index entry of `scanKey` is the one `doc` should be passed on from: the entry of the lowest cell holding
+ * one of the document's points inside `region`. Every such cell is covered by the scans, so each matching document is
+ * passed on exactly once, and the others not at all.
+ */
+ACTOR static Future<bool> isFirstGeoMatch(Reference<IReadContext> doc,
+                                          Key scanKey,
+                                          std::string path,
+                                          GeoRegion region) {
+	std::vector<GeoPoint> points = wait(getGeoPoints(doc, path));
+	Optional<int64_t> first;
+	for (const auto& p : points) {
+		if (region.contains(p) && (!first.present() || geoCell(p) < first.get()))
+			first = geoCell(p);
+	}
+	// An index key is the cell and then the document id
+	return first.present() && DataKey::decode_item_rev(scanKey, 1) == StringRef(geoCellKeyPart(first.get()));
+}
+
+ACTOR static Future<Void> doGeoFilter(PlanCheckpoint* checkpoint,
+                                      FutureStream<Reference<ScanReturnedContext>> input,
+                                      PromiseStream<Reference<ScanReturnedContext>> output,
+                                      std::string path,
+                                      GeoRegion region) {
+	state Deque<std::pair<Reference<ScanReturnedContext>, Future<bool>>> futures;
+	state std::pair<Reference<ScanReturnedContext>, Future<bool>> p;
+	state PlanCheckpoint::FlowControlLock* flowControlLock = checkpoint->getDocumentFinishedLock();
+	try {
+		loop {
+			try {
+				choose {
+					when(Reference<ScanReturnedContext> nextInput = waitNext(input)) {
+						futures.push_back(std::pair<Reference<ScanReturnedContext>, Future<bool>>(
+						    nextInput, isFirstGeoMatch(nextInput, nextInput->scanKey(), path, region)));
+					}
+					when(bool pass = wait(futures.empty() ? Never() : futures.front().second)) {
+						if (pass)
+							output.send(futures.front().first);
+						else
+							flowControlLock->release();
+						futures.pop_front();
+					}
+				}
+			} catch (Error& e) {
+				if (e.code() == error_code_end_of_stream)
+					break;
+				else
+					throw;
+			}
+		}
+
+		while (!futures.empty()) {
+			p = futures.front();
+			bool pass = wait(p.second);
+			if (pass)
+				output.send(p.first);
+			else
+				flowControlLock->release();
+			futures.pop_front();
+		}
+
+		throw end_of_stream();
+	} catch (Error& e) {
+		if (e.code() == error_code_actor_cancelled) {
+			if (checkpoint->splitBoundWanted()) {
+				for (int i = futures.size() - 1; i >= 0; i--)
+					checkpoint->splitBound(futures[i].first->scanId()) = futures[i].first->scanKey();
+			}
+		} else
+			output.sendError(e);
+		throw;
+	}
+}
+
+FutureStream<Reference<ScanReturnedContext>> GeoScanPlan::execute(PlanCheckpoint* checkpoint,
+                                                                  Reference<DocTransaction> tr) {
+	PromiseStream<Reference<ScanReturnedContext>> p;
+	checkpoint->addOperation(doGeoFilter(checkpoint, source->execute(checkpoint, tr), p, path, region), p);
+	return p.getFuture();
+}
+
 ACTOR static Future<Void> doSinglePKLookup(PlanCheckpoint* checkpoint,
                                            PromiseStream<Reference<ScanReturnedContext>> dis,
                                            Reference<CollectionContext> cx,
@@ -657,6 +1228,155 @@ FutureStream<Reference<ScanReturnedContext>> UnionPlan::execute(PlanCheckpoint*
 	return output.getFuture();
 }
 
+Optional<int> RacePlan::cachedChoice() {
+	Optional<std::string> winner = getCachedPlan(shape);
+	if (!winner.present())
+		return Optional<int>();
+	auto found = std::find(labels.begin(), labels.end(), winner.get());
+	// Candidates can differ between queries of a shape, e.g. as partial indexes imply their filters or not
+	if (found == labels.end())
+		return Optional<int>();
+	return found - labels.begin();
+}
+
+int RacePlan::choice() {
+	if (chosen.present())
+		return chosen.get();
+	Optional<int> cached = cachedChoice();
+	return cached.present() ? cached.get() : 0;
+}
+
+bson::BSONObj RacePlan::describe() {
+	// The chosen candidate first, so that it reads like any other plan
+	bson::BSONObjBuilder bob;
+	bob.appendElements(candidates[choice()]->describe());
+	bob.append("candidate plans", (int)candidates.size());
+	return bob.obj();
+}
+
+ACTOR static Future<Void> countTrialResults(FutureStream<Reference<ScanReturnedContext>> docs,
+                                            PlanCheckpoint::FlowControlLock* flowControlLock,
+                                            int* results) {
+	try {
+		loop {
+			Reference<ScanReturnedContext> doc = waitNext(docs);
+			flowControlLock->release();
+			if (++*results >= DOCLAYER_KNOBS->PLAN_RACE_TRIAL_RESULTS)
+				return Void();
+		}
+	} catch (Error& e) {
+		if (e.code() != error_code_end_of_stream)
+			throw;
+	}
+	return Void();
+}
+
+/**
+ * Runs every candidate of `self` for up to PLAN_RACE_TRIAL_TIME, each against a checkpoint of its own, and caches the
+ * first to finish or to find PLAN_RACE_TRIAL_RESULTS documents, or else the one that found the most, as the winner for
+ * its shape. Returns false if the trial ended without a winner.
+ *
+ * The candidates read at snapshot isolation, so that what the losers scan doesn't widen the conflict ranges of `tr`.
+ */
+ACTOR static Future<bool> raceCandidates(Reference<RacePlan> self, Reference<DocTransaction> tr, double deadline) {
+	state Reference<DocTransaction> trial = DocTransaction::create(tr->tr);
+	state std::vector<Reference<PlanCheckpoint>> checkpoints;
+	state std::vector<int> results(self->candidates.size(), 0);
+	state std::vector<Future<Void>> runs;
+	state int winner = -1;
+	trial->snapshotReads = true;
+	try {
+		for (int i = 0; i < self->candidates.size(); i++) {
+			checkpoints.push_back(Reference<PlanCheckpoint>(new PlanCheckpoint));
+			checkpoints[i]->setDeadline(deadline);
+			PlanCheckpoint::FlowControlLock* flowControlLock = checkpoints[i]->getDocumentFinishedLock();
+			runs.push_back(countTrialResults(self->candidates[i]->execute(checkpoints[i].getPtr(), trial),
+			                                 flowControlLock, &results[i]));
+		}
+
+		choose {
+			when(Void _ = wait(waitForAny(runs))) {}
+			when(Void _ = wait(delay(DOCLAYER_KNOBS->PLAN_RACE_TRIAL_TIME))) {}
+		}
+
+		for (int i = 0; i < runs.size() && winner < 0; i++) {
+			if (runs[i].isReady() && !runs[i].isError())
+				winner = i;
+		}
+		int most = *std::max_element(results.begin(), results.end());
+		for (int i = 0; i < results.size() && winner < 0; i++) {
+			if (most > 0 && results[i] == most)
+				winner = i;
+		}
+	} catch (Error& e) {
+		if (e.code() == error_code_actor_cancelled) {
+			for (const auto& checkpoint : checkpoints)
+				checkpoint->stop();
+			throw;
+		}
+		// A candidate that fails only loses the race; the chosen one reports the error itself if it hits it too
+		winner = -1;
+	}
+
+	runs.clear();
+	for (const auto& checkpoint : checkpoints)
+		checkpoint->stop();
+	if (winner < 0)
+		return false;
+
+	TraceEvent("BD_planRace")
+	    .detail("Shape", self->shape)
+	    .detail("Winner", self->labels[winner])
+	    .detail("Documents", results[winner]);
+	setCachedPlan(self->shape, self->labels[winner]);
+	return true;
+}
+
+ACTOR static Future<Void> doRace(Reference<RacePlan> self,
+                                 Reference<DocTransaction> tr,
+                                 double deadline,
+                                 FutureStream<Reference<ScanReturnedContext>> input,
+                                 PromiseStream<Reference<ScanReturnedContext>> output) {
+	state Future<bool> trial = raceCandidates(self, tr, deadline);
+	state bool decided = false;
+	try {
+		loop {
+			choose {
+				when(Reference<ScanReturnedContext> doc = waitNext(input)) { output.send(doc); }
+				when(bool winner = wait(trial)) {
+					decided = winner;
+					trial = Never();
+				}
+			}
+		}
+	} catch (Error& e) {
+		// The trial reads with the same transaction, so it must not outlive the plan
+		trial.cancel();
+		if (e.code() == error_code_actor_cancelled)
+			throw;
+		// The chosen candidate answered the whole query before the trial was over, which is good enough to keep it
+		if (e.code() == error_code_end_of_stream && !decided)
+			setCachedPlan(self->shape, self->labels[self->choice()]);
+		output.sendError(e);
+		throw;
+	}
+}
+
+FutureStream<Reference<ScanReturnedContext>> RacePlan::execute(PlanCheckpoint* checkpoint,
+                                                               Reference<DocTransaction> tr) {
+	bool decided = cachedChoice().present();
+	if (!chosen.present())
+		chosen = choice();
+	FutureStream<Reference<ScanReturnedContext>> docs = candidates[chosen.get()]->execute(checkpoint, tr);
+	if (decided)
+		return docs;
+
+	PromiseStream<Reference<ScanReturnedContext>> output;
+	checkpoint->addOperation(doRace(Reference<RacePlan>::addRef(this), tr, checkpoint->getDeadline(), docs, output),
+	                         output);
+	return output.getFuture();
+}
+
 FutureStream<Reference<ScanReturnedContext>> TableScanPlan::execute(PlanCheckpoint* checkpoint,
                                                                     Reference<DocTransaction> tr) {
 	Reference<CollectionContext> bcx = cx->bindCollectionContext(tr);
@@ -702,6 +1422,8 @@ ACTOR static Future<Void> doNonIsolatedRO(PlanCheckpoint* outerCheckpoint,
 	state int64_t nTransactions = 0;
 	state int64_t nResults = 0;
 	state PlanCheckpoint::FlowControlLock* outerLock = outerCheckpoint->getDocumentFinishedLock();
+	state Future<Void> deadline = outerCheckpoint->onDeadline();
+	innerCheckpoint->setDeadline(outerCheckpoint->getDeadline());
 	try {
 		state uint64_t metadataVersion = wait(cx->bindCollectionContext(dtr)->getMetadataVersion());
 		loop {
@@ -727,6 +1449,7 @@ ACTOR static Future<Void> doNonIsolatedRO(PlanCheckpoint* outerCheckpoint,
 					// if (oCount == 3) timeout = delay(0);
 				}
 				when(Void _ = wait(timeout)) { break; }
+				when(Void _ = wait(deadline)) { throw max_time_ms_expired(); }
 			}
 
 			ASSERT(!docs.isReady());
@@ -770,6 +1493,8 @@ ACTOR static Future<Void> doNonIsolatedRW(PlanCheckpoint* outerCheckpoint,
 	state Reference<PlanCheckpoint> innerCheckpoint(new PlanCheckpoint);
 	state PlanCheckpoint::FlowControlLock* outerLock = outerCheckpoint->getDocumentFinishedLock();
 	state int oCount = 0;
+	state Future<Void> deadline = outerCheckpoint->onDeadline();
+	innerCheckpoint->setDeadline(outerCheckpoint->getDeadline());
 	try {
 		state uint64_t metadataVersion = wait(cx->bindCollectionContext(dtr)->getMetadataVersion());
 		loop {
@@ -807,6 +1532,7 @@ ACTOR static Future<Void> doNonIsolatedRW(PlanCheckpoint* outerCheckpoint,
 								innerLock->release(1);
 							}
 							when(Void _ = wait(timeout)) { break; }
+							when(Void _ = wait(deadline)) { throw max_time_ms_expired(); }
 						}
 					}
 					ASSERT(!docs.isReady());
@@ -858,6 +1584,9 @@ ACTOR static Future<Void> doNonIsolatedRW(PlanCheckpoint* outerCheckpoint,
 					bufferedDocs.pop_front();
 				}
 			} catch (Error& e) {
+				// Documents committed by earlier transactions stay committed, but don't start another one
+				if (e.code() == error_code_max_time_ms_expired)
+					throw;
 				Void _ = wait(dtr->tr->onError(e));
 				finished = false;
 			}
@@ -906,10 +1635,12 @@ ACTOR static Future<Void> doRetry(Reference<Plan> subPlan,
 	state std::vector<Reference<ScanReturnedContext>> ret;
 	state FutureStream<Reference<ScanReturnedContext>> docs;
 	state PlanCheckpoint::FlowControlLock* outerLock = outerCheckpoint->getDocumentFinishedLock();
+	state Future<Void> deadline = outerCheckpoint->onDeadline();
 	try {
 		loop {
 			try {
 				state Reference<PlanCheckpoint> innerCheckpoint(new PlanCheckpoint);
+				innerCheckpoint->setDeadline(outerCheckpoint->getDeadline());
 				docs = subPlan->execute(innerCheckpoint.getPtr(), tr);
 				state PlanCheckpoint::FlowControlLock* innerLock = innerCheckpoint->getDocumentFinishedLock();
 				state Deque<std::pair<Reference<ScanReturnedContext>, Future<Void>>> committing;
@@ -925,6 +1656,7 @@ ACTOR static Future<Void> doRetry(Reference<Plan> subPlan,
 								committing.pop_front();
 								innerLock->release();
 							}
+							when(Void _ = wait(deadline)) { throw max_time_ms_expired(); }
 						}
 					}
 				} catch (Error& e) {
@@ -958,6 +1690,8 @@ ACTOR static Future<Void> doRetry(Reference<Plan> subPlan,
 					throw;
 				if (e.code() == error_code_end_of_stream)
 					throw;
+				if (e.code() == error_code_max_time_ms_expired)
+					throw;
 				Void _ = wait(tr->tr->onError(e));
 				tr = self->newTransaction(); // FIXME: keep dtr->tr if this is a retry
 			}
@@ -1168,6 +1902,8 @@ ACTOR static Future<Void> findAndModify(PlanCheckpoint* outerCheckpoint,
 	state int64_t nTransactions = 0;
 	state int64_t nResults = 0;
 	state PlanCheckpoint::FlowControlLock* outerLock = outerCheckpoint->getDocumentFinishedLock();
+	state Future<Void> deadline = outerCheckpoint->onDeadline();
+	innerCheckpoint->setDeadline(outerCheckpoint->getDeadline());
 	state Reference<ScanReturnedContext> firstDoc;
 	state bool any = false;
 	state bson::BSONObj proj;
@@ -1193,6 +1929,7 @@ ACTOR static Future<Void> findAndModify(PlanCheckpoint* outerCheckpoint,
 						break;
 					}
 					when(Void _ = wait(timeout)) { break; }
+					when(Void _ = wait(deadline)) { throw max_time_ms_expired(); }
 				}
 			} catch (Error& e) {
 				if (e.code() != error_code_end_of_stream)
@@ -1385,6 +2122,11 @@ FutureStream<Reference<ScanReturnedContext>> SkipPlan::execute(PlanCheckpoint* c
 	return docs.getFuture();
 }
 
+static bool isTextIndex(bson::BSONObj const& indexObj) {
+	bson::BSONElement first = indexObj.getObjectField("key").firstElement();
+	return first.isString() && first.str() == "text";
+}
+
 ACTOR static Future<Void> doIndexInsert(PlanCheckpoint* checkpoint,
                                         Reference<DocTransaction> tr,
                                         Reference<IInsertOp> indexInsert,
@@ -1404,6 +2146,10 @@ ACTOR static Future<Void> doIndexInsert(PlanCheckpoint* checkpoint,
 				if (indexObj.getObjectField("key").woCompare(existingindexObj.getObjectField("key")) == 0) {
 					throw index_already_exists();
 				}
+				// $text doesn't name the index it searches, so there can only be one
+				if (isTextIndex(indexObj) && isTextIndex(existingindexObj)) {
+					throw bad_index_specification();
+				}
 				if (strcmp(indexObj.getStringField("name"), existingindexObj.getStringField("name")) == 0) {
 					throw index_name_taken();
 				}
@@ -1416,6 +2162,10 @@ ACTOR static Future<Void> doIndexInsert(PlanCheckpoint* checkpoint,
 		}
 
 		Reference<IReadWriteContext> doc = wait(indexInsert->insert(unbound->bindCollectionContext(tr)));
+		// A new index has no entries yet, so it isn't multikey until its plugin finds a document that would make it
+		IndexInfo info = MetadataManager::indexInfoFromObj(indexObj, mcx);
+		if (!info.text && !info.geo)
+			tr->tr->set(info.multikeyKey(), DataValue(false).encode_value());
 		mcx->bindCollectionContext(tr)->bumpMetadataVersion();
 		output.send(ref(new ScanReturnedContext(doc, -1, Key())));
 		throw end_of_stream();
@@ -1495,22 +2245,35 @@ ACTOR static Future<Void> doSort(PlanCheckpoint* outerCheckpoint,
                                  PromiseStream<Reference<ScanReturnedContext>> output) {
 	state std::vector<bson::BSONObj> returnProjections;
 	state Reference<PlanCheckpoint> innerCheckpoint(new PlanCheckpoint);
+	innerCheckpoint->setDeadline(outerCheckpoint->getDeadline());
 	state FutureStream<Reference<ScanReturnedContext>> docs = subPlan->execute(innerCheckpoint.getPtr(), tr);
 	state PlanCheckpoint::FlowControlLock* outerLock = outerCheckpoint->getDocumentFinishedLock();
 	state PlanCheckpoint::FlowControlLock* innerLock = innerCheckpoint->getDocumentFinishedLock();
+	state Future<Void> deadline = outerCheckpoint->onDeadline();
 	loop {
 		try {
-			Reference<ScanReturnedContext> doc = waitNext(docs);
-			returnProjections.push_back(
-			    doc->toDataValue().get().getPackedObject().getOwned()); // Note that this call to get() is safe here but
-			                                                            // not in general, because we know that
-			                                                            // doc is wrapping a BsonContext, which means
-			                                                            // toDataValue() is synchronous.
-			innerLock->release();
+			choose {
+				when(Reference<ScanReturnedContext> doc = waitNext(docs)) {
+					returnProjections.push_back(
+					    doc->toDataValue().get().getPackedObject().getOwned()); // Note that this call to get() is safe
+					                                                            // here but not in general, because we
+					                                                            // know that doc is wrapping a
+					                                                            // BsonContext, which means
+					                                                            // toDataValue() is synchronous.
+					innerLock->release();
+				}
+				when(Void _ = wait(deadline)) { throw max_time_ms_expired(); }
+			}
 		} catch (Error& e) {
 			if (e.code() == error_code_end_of_stream) {
 				break;
 			}
+			if (e.code() == error_code_max_time_ms_expired) {
+				// Stop the scans feeding us now rather than when the cursor is finally destroyed
+				innerCheckpoint->stop();
+				output.sendError(e);
+				throw;
+			}
 			TraceEvent(SevError, "BD_runQuery2").detail("error", e.what());
 			throw;
 		}
@@ -1741,9 +2504,11 @@ bool BuildIndexPlan::wasMetadataChangeOkay(Reference<UnboundCollectionContext> n
 
 ACTOR Future<std::pair<int64_t, Reference<ScanReturnedContext>>> executeUntilCompletionAndReturnLastTransactionally(
     Reference<Plan> plan,
-    Reference<DocTransaction> tr) {
+    Reference<DocTransaction> tr,
+    double deadline) {
 	state int64_t count = 0;
 	state Reference<PlanCheckpoint> checkpoint(new PlanCheckpoint);
+	checkpoint->setDeadline(deadline);
 	state FutureStream<Reference<ScanReturnedContext>> stream = plan->execute(checkpoint.getPtr(), tr);
 	state PlanCheckpoint::FlowControlLock* flowControlLock = checkpoint->getDocumentFinishedLock();
 	state Reference<ScanReturnedContext> last;
@@ -1764,9 +2529,12 @@ ACTOR Future<std::pair<int64_t, Reference<ScanReturnedContext>>> executeUntilCom
 	return std::make_pair(count, last);
 }
 
-ACTOR Future<int64_t> executeUntilCompletionTransactionally(Reference<Plan> plan, Reference<DocTransaction> tr) {
+ACTOR Future<int64_t> executeUntilCompletionTransactionally(Reference<Plan> plan,
+                                                            Reference<DocTransaction> tr,
+                                                            double deadline) {
 	state int64_t count = 0;
 	state Reference<PlanCheckpoint> checkpoint(new PlanCheckpoint);
+	checkpoint->setDeadline(deadline);
 	state FutureStream<Reference<ScanReturnedContext>> stream = plan->execute(checkpoint.getPtr(), tr);
 	state PlanCheckpoint::FlowControlLock* flowControlLock = checkpoint->getDocumentFinishedLock();
 
@@ -1801,7 +2569,11 @@ Reference<Plan> flushChanges(Reference<Plan> subPlan) {
 // ******** PlanCheckpoint implementation **************
 
 PlanCheckpoint::PlanCheckpoint()
-    : boundsWanted(false), scansAdded(0), stateAdded(0), flowControlLock(DOCLAYER_KNOBS->FLOW_CONTROL_LOCK_PERMITS) {}
+    : boundsWanted(false),
+      scansAdded(0),
+      stateAdded(0),
+      deadline(0.0),
+      flowControlLock(DOCLAYER_KNOBS->FLOW_CONTROL_LOCK_PERMITS) {}
 
 /*
   Overview
@@ -1872,6 +2644,7 @@ Reference<PlanCheckpoint> PlanCheckpoint::stopAndCheckpoint() {
 	boundsWanted = false;
 
 	Reference<PlanCheckpoint> rest(new PlanCheckpoint);
+	rest->deadline = deadline;
 	rest->scans.resize(scans.size());
 	for (int i = 0; i < scans.size(); i++)
 		rest->scans[i].bounds = KeyRangeRef(scans[i].split, scans[i].bounds.end);
@@ -1938,6 +2711,12 @@ Future<Void> PlanCheckpoint::lastOpResult() {
 	return ops.back().actors;
 }
 
+Future<Void> PlanCheckpoint::onDeadline() {
+	if (deadline <= 0.0)
+		return Never();
+	return delay(std::max(deadline - now(), 0.0));
+}
+
 int64_t& PlanCheckpoint::getIntState(int64_t defaultValue) {
 	int s = stateAdded++;
 	if (s == states.size())
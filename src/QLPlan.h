@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include "GeoSearch.h"
 #include "MetadataManager.h"
 #include "QLContext.h"
 #include "QLOperations.h"
@@ -40,6 +41,20 @@ struct PlanCheckpoint : ReferenceCounted<PlanCheckpoint>, FastAllocated<PlanChec
 	 */
 	PlanCheckpoint(); // Unbounded
 
+	/**
+	 * Absolute time (as returned by now()) by which the request this checkpoint serves must finish, or 0 for none.
+	 * The checkpoint returned by stopAndCheckpoint() inherits it, and operations which run their subplans against
+	 * an inner checkpoint must copy it there.
+	 */
+	void setDeadline(double deadline) { this->deadline = deadline; }
+	double getDeadline() const { return deadline; }
+
+	/**
+	 * Becomes ready when the deadline passes, or never if there isn't one. Operations which may keep working
+	 * across transactions or buffer their input race this and throw max_time_ms_expired().
+	 */
+	Future<Void> onDeadline();
+
 	/**
 	 * Cancels all outstanding operations, and returns a new PlanCheckpoint bounded to the remainder of
 	 * this plan's original bounds.  Must not be called with any actor in the plan on the C++ call stack
@@ -119,6 +134,7 @@ private:
 	int scansAdded;
 	bool boundsWanted;
 	int stateAdded;
+	double deadline;
 };
 
 enum class PlanType : uint8_t {
@@ -140,7 +156,11 @@ enum class PlanType : uint8_t {
 	BuildIndex,
 	UpdateIndexStatus,
 	FlushChanges,
-	FindAndModify
+	FindAndModify,
+	TextScan,
+	GeoScan,
+	Race,
+	SkipScan
 };
 
 /**
@@ -248,32 +268,112 @@ struct IndexScanPlan : ConcretePlan<IndexScanPlan> {
 	              Optional<std::string> begin,
 	              Optional<std::string> end)
 	    : cx(cx), index(index), begin(begin), end(end) {}
+	bson::BSONObj describe() override;
+	FutureStream<Reference<ScanReturnedContext>> execute(PlanCheckpoint* checkpoint,
+	                                                     Reference<DocTransaction> tr) override;
+	PlanType getType() override { return PlanType::IndexScan; }
+	Optional<Reference<Plan>> push_down(Reference<UnboundCollectionContext> cx, Reference<IPredicate> query) override;
+
+	/**
+	 * This scan, dropping the entries whose key parts show that their document can't match `filter` before the
+	 * document is read. Only terms comparing an indexed field with a scalar value are checked, and only on indexes that
+	 * aren't multikey, where a field's key part is its value or the single element of it. Entries that pass still have
+	 * their documents filtered.
+	 */
+	Reference<Plan> withKeyFilter(Reference<IPredicate> filter);
+
+	bool single_key() { return begin.present() && end.present() && begin.get() == end.get(); }
+	// Whether the bounds are values of the first field of the index alone, rather than of a prefix of its fields
+	bool leading_range();
+
+private:
+	Reference<UnboundCollectionContext> cx;
+	Standalone<StringRef> index_name;
+	IndexInfo index;
+	Optional<std::string> begin;
+	Optional<std::string> end;
+	std::vector<std::pair<int, Reference<IPredicate>>> keyTerms; // Terms of withKeyFilter(), by the field they are on
+};
+
+/**
+ * Documents whose entries in a compound index are between `begin` and `end` in its first field, like an IndexScanPlan,
+ * and between `beginSuffix` and `endSuffix` in the fields after it. For each value of the first field in range, the
+ * scan reads the first entry at or after it, which tells the next value, and then just that value's entries in range,
+ * so a compound index answers a query on its second field with no, or only a range of, values for its first. After
+ * SKIP_SCAN_MAX_SEEKS values, it reads the rest of the range instead, still checking entries before their documents.
+ */
+struct SkipScanPlan : ConcretePlan<SkipScanPlan> {
+	SkipScanPlan(Reference<UnboundCollectionContext> cx,
+	             IndexInfo index,
+	             Optional<std::string> begin,
+	             Optional<std::string> end,
+	             std::string beginSuffix,
+	             std::string endSuffix)
+	    : cx(cx), index(index), begin(begin), end(end), beginSuffix(beginSuffix), endSuffix(endSuffix) {}
 	bson::BSONObj describe() override {
 		std::string bound_begin = begin.present() ? FDB::printable(begin.get()) : "-inf";
 		std::string bound_end = end.present() ? FDB::printable(end.get()) : "+inf";
 		return BSON(
 		    // clang-format off
-			"type" << "index scan" <<
+			"type" << "skip scan" <<
 			"index name" << index.indexName <<
 			"bounds" << BSON(
 				"begin" << bound_begin <<
-				"end" << bound_end)
+				"end" << bound_end) <<
+			"suffix bounds" << BSON(
+				"begin" << FDB::printable(beginSuffix) <<
+				"end" << FDB::printable(endSuffix))
 		    // clang-format on
 		);
 	}
 	FutureStream<Reference<ScanReturnedContext>> execute(PlanCheckpoint* checkpoint,
 	                                                     Reference<DocTransaction> tr) override;
-	PlanType getType() override { return PlanType::IndexScan; }
-	Optional<Reference<Plan>> push_down(Reference<UnboundCollectionContext> cx, Reference<IPredicate> query) override;
-
-	bool single_key() { return begin.present() && end.present() && begin.get() == end.get(); }
+	PlanType getType() override { return PlanType::SkipScan; }
 
 private:
 	Reference<UnboundCollectionContext> cx;
-	Standalone<StringRef> index_name;
 	IndexInfo index;
 	Optional<std::string> begin;
 	Optional<std::string> end;
+	std::string beginSuffix;
+	std::string endSuffix;
+};
+
+/**
+ * Documents containing all of `terms`, from a text index (see TextSearch.h). It scans the posting list of the longest
+ * term, likely the shortest list, and for each document on it looks up the entries of the other terms.
+ */
+struct TextScanPlan : ConcretePlan<TextScanPlan> {
+	TextScanPlan(Reference<UnboundCollectionContext> cx, IndexInfo index, std::set<std::string> const& terms);
+	bson::BSONObj describe() override;
+	FutureStream<Reference<ScanReturnedContext>> execute(PlanCheckpoint* checkpoint,
+	                                                     Reference<DocTransaction> tr) override;
+	PlanType getType() override { return PlanType::TextScan; }
+
+private:
+	Reference<UnboundCollectionContext> cx;
+	IndexInfo index;
+	std::vector<std::string> terms;
+};
+
+/**
+ * Documents with a point at `path` inside `region`, from a geo index (see GeoSearch.h). It unions scans of the index
+ * ranges covering the region, and passes on each document once, from the lowest cell holding one of its points that is
+ * inside the region.
+ */
+struct GeoScanPlan : ConcretePlan<GeoScanPlan> {
+	GeoScanPlan(Reference<UnboundCollectionContext> cx, IndexInfo index, std::string path, GeoRegion region);
+	bson::BSONObj describe() override;
+	FutureStream<Reference<ScanReturnedContext>> execute(PlanCheckpoint* checkpoint,
+	                                                     Reference<DocTransaction> tr) override;
+	PlanType getType() override { return PlanType::GeoScan; }
+	bool hasScanOfType(PlanType type) override { return type == PlanType::GeoScan || source->hasScanOfType(type); }
+
+private:
+	IndexInfo index;
+	std::string path;
+	GeoRegion region;
+	Reference<Plan> source;
 };
 
 struct PrimaryKeyLookupPlan : ConcretePlan<PrimaryKeyLookupPlan> {
@@ -320,6 +420,38 @@ private:
 	Reference<Plan> plan1, plan2;
 };
 
+/**
+ * A conjunction that more than one of its terms could be pushed down for, planned each way. Its documents always come
+ * from one candidate: the one which won the last race for the query's shape (see PlanCache), or the first if there
+ * has been none. Until a winner is known, every candidate is also tried for a while alongside it, in the same
+ * transaction but at snapshot isolation, and the one that finds the most documents (PLAN_RACE_TRIAL_RESULTS is
+ * enough) is remembered for later queries of the shape. Candidates are in the same order however the query orders
+ * its terms.
+ */
+struct RacePlan : ConcretePlan<RacePlan> {
+	RacePlan(std::string shape, std::vector<Reference<Plan>> candidates, std::vector<std::string> labels)
+	    : shape(shape), candidates(candidates), labels(labels) {}
+	bson::BSONObj describe() override;
+	FutureStream<Reference<ScanReturnedContext>> execute(PlanCheckpoint* checkpoint,
+	                                                     Reference<DocTransaction> tr) override;
+	PlanType getType() override { return PlanType::Race; }
+	bool hasScanOfType(PlanType type) override { return candidates[choice()]->hasScanOfType(type); }
+	bool wasMetadataChangeOkay(Reference<UnboundCollectionContext> cx) override {
+		return candidates[choice()]->wasMetadataChangeOkay(cx);
+	}
+
+	std::string shape; // The collection, its indexes and the fields and operators of the terms, but not their values
+	std::vector<Reference<Plan>> candidates;
+	std::vector<std::string> labels; // The term each candidate was pushed down for, as it appears in `shape`
+
+	// The candidate that produces the documents
+	int choice();
+	Optional<int> cachedChoice();
+
+private:
+	Optional<int> chosen; // Fixed by the first execution, so that a resumed one scans the same way
+};
+
 struct EmptyPlan : ConcretePlan<EmptyPlan> {
 	bson::BSONObj describe() override {
 		return BSON("type"
@@ -711,11 +843,15 @@ struct FlushChangesPlan : ConcretePlan<FlushChangesPlan> {
 Future<int64_t> executeUntilCompletion(Reference<Plan> plan);
 
 // Like executeUntilCompletion(), but uses the transaction you gave it.
-Future<int64_t> executeUntilCompletionTransactionally(const Reference<Plan>& plan, const Reference<DocTransaction>& tr);
+// The optional deadline is set on the checkpoint the plan runs under (see PlanCheckpoint::setDeadline()).
+Future<int64_t> executeUntilCompletionTransactionally(const Reference<Plan>& plan,
+                                                      const Reference<DocTransaction>& tr,
+                                                      double const& deadline = 0.0);
 // Like executeUntilCompletionTransactionally(), but also returns the last thing returned by the plan (if any).
 Future<std::pair<int64_t, Reference<ScanReturnedContext>>> executeUntilCompletionAndReturnLastTransactionally(
     const Reference<Plan>& plan,
-    const Reference<DocTransaction>& tr);
+    const Reference<DocTransaction>& tr,
+    double const& deadline = 0.0);
 
 Reference<Plan> deletePlan(Reference<Plan> subPlan, Reference<UnboundCollectionContext> cx, int64_t limit);
 Reference<Plan> flushChanges(Reference<Plan> subPlan);
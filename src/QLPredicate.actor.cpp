@@ -20,12 +20,16 @@
  * MongoDB is a registered trademark of MongoDB, Inc.
  */
 
+#include "DocumentError.h"
 #include "ExtUtil.actor.h"
 
 #include "QLExpression.h"
 #include "QLPredicate.h"
+#include "TextSearch.h"
 #include "flow/UnitTest.h"
 
+#include <sstream>
+
 ACTOR static Future<bool> evaluateAnyPredicate(Reference<IReadContext> cx,
                                                Reference<IExpression> expr,
                                                Reference<IPredicate> pred) {
@@ -434,8 +438,7 @@ Reference<RangePredicate> RangePredicate::intersect_with(Reference<RangePredicat
 	return ref(new RangePredicate(new_min_value, new_min_closed, new_max_value, new_max_closed));
 }
 
-RegExPredicate::RegExPredicate(const std::string& _pattern, const std::string& _options) {
-	re.reset(new pcrecpp::RE(_pattern));
+RegExPredicate::RegExPredicate(const std::string& _pattern, const std::string& _options) : pattern(_pattern) {
 	setOptions(_options);
 }
 
@@ -443,11 +446,10 @@ void RegExPredicate::calculateRange() {
 	max_limit = "";
 	min_limit = "";
 	// we do not support calculating ranges if 'm' and 'x' are specified
-	if (options.multiline() || options.extended())
+	if (flags & (PCRE_MULTILINE | PCRE_EXTENDED))
 		return;
 
 	// remove the special "^" if exist in regexPattern
-	const auto pattern = re->pattern();
 	// we don't want to calculate any limits if we don't have ^ or \A at the beginning of the pattern
 	const bool startChevron = (!pattern.empty() && pattern.at(0) == '^');
 	const bool startString = (pattern.size() > 1 && (pattern.at(0) == '\\' && pattern.at(1) == 'A'));
@@ -467,7 +469,7 @@ void RegExPredicate::calculateRange() {
 			max_limit = sValue;
 			min_limit = sValue;
 
-			if (options.caseless()) {
+			if (flags & PCRE_CASELESS) {
 				std::transform(max_limit.begin(), max_limit.end(), max_limit.begin(), ::tolower);
 				std::transform(min_limit.begin(), min_limit.end(), min_limit.begin(), ::toupper);
 			}
@@ -475,34 +477,82 @@ void RegExPredicate::calculateRange() {
 	}
 }
 
+// The literal text every match of `pattern` starts with, if it is anchored at the start with '^' or "\A"
+static std::string anchoredLiteralPrefix(std::string const& pattern) {
+	size_t start;
+	if (StringRef(pattern).startsWith(LiteralStringRef("^")))
+		start = 1;
+	else if (StringRef(pattern).startsWith(LiteralStringRef("\\A")))
+		start = 2;
+	else
+		return std::string();
+	const static std::string sSpecial = ".\\[]()*?+|${}^";
+	size_t end = start;
+	while (end < pattern.size() && sSpecial.find(pattern[end]) == std::string::npos)
+		end++;
+	// The last literal character is optional if a quantifier follows it
+	if (end < pattern.size() && end > start && (pattern[end] == '?' || pattern[end] == '*' || pattern[end] == '{'))
+		end--;
+	return pattern.substr(start, end - start);
+}
+
+Optional<std::string> RegExPredicate::foldedPrefix() {
+	if ((flags & (PCRE_MULTILINE | PCRE_EXTENDED)) || pattern.find('|') != std::string::npos)
+		return Optional<std::string>();
+	std::string prefix = anchoredLiteralPrefix(pattern);
+	if (prefix.empty())
+		return Optional<std::string>();
+	std::transform(prefix.begin(), prefix.end(), prefix.begin(), ::tolower);
+	return prefix;
+}
+
+Optional<std::string> RegExPredicate::reversedSuffix() {
+	// "(?i)" would make the rest of the pattern case insensitive
+	if ((flags & (PCRE_MULTILINE | PCRE_EXTENDED | PCRE_CASELESS)) || pattern.find('|') != std::string::npos ||
+	    pattern.find("(?") != std::string::npos)
+		return Optional<std::string>();
+	// Anchored at the end with an unescaped '$'
+	if (pattern.size() < 2 || pattern.back() != '$' || pattern[pattern.size() - 2] == '\\')
+		return Optional<std::string>();
+	const static std::string sSpecial = ".\\[]()*?+|${}^";
+	std::string suffix;
+	for (int i = (int)pattern.size() - 2; i >= 0; i--) {
+		// An escaped character, like the 'd' of "\d", doesn't stand for itself
+		if (sSpecial.find(pattern[i]) != std::string::npos || (i > 0 && pattern[i - 1] == '\\'))
+			break;
+		suffix += pattern[i];
+	}
+	if (suffix.empty())
+		return Optional<std::string>();
+	return suffix;
+}
+
 void RegExPredicate::setOptions(const std::string& _options) {
 	// According to http://docs.mongodb.org/manual/reference/operator/query/regex/
 	// Options can be only "i", "x", "m" and "s"
-	options = pcrecpp::RE_Options();
-	options.set_caseless(_options.find('i') != std::string::npos);
-	options.set_multiline(_options.find('m') != std::string::npos);
-	options.set_extended(_options.find('x') != std::string::npos);
-	options.set_dotall(_options.find('s') != std::string::npos);
-
-	const auto& pattern = re->pattern();
-	re.reset(new pcrecpp::RE(pattern, options));
+	flags = regexFlags(_options);
+	re.reset();
 
 	// we need to recalculate this after each change of options
 	calculateRange();
 }
 
 Future<bool> RegExPredicate::evaluate(const Reference<IReadContext>& context) {
+	// Compiled here rather than when parsed, since $options may still change the flags then
+	if (!re)
+		re = getCompiledRegex(pattern, flags);
+	std::shared_ptr<CompiledRegex> compiled = re;
 	Future<DataValue> fdv = getMaybeRecursive(context, StringRef());
-	return map(fdv, [this](DataValue dv) {
+	return map(fdv, [compiled](DataValue dv) {
 		if (dv.getBSONType() == bson::BSONType::String) {
-			return re->PartialMatch(dv.getString());
+			return compiled->partialMatch(StringRef(dv.getString()));
 		}
 		return false;
 	});
 }
 
 std::string RegExPredicate::toString() {
-	return format("REGEX(matching '%s')", re ? re->pattern().c_str() : "Regex not specified");
+	return format("REGEX(matching '%s')", pattern.c_str());
 }
 
 void RegExPredicate::get_range(Optional<DataValue>& min, Optional<DataValue>& max) {
@@ -520,6 +570,52 @@ bool RegExPredicate::range_is_tight() {
 	return false;
 }
 
+TextPredicate::TextPredicate(std::string const& search) {
+	std::istringstream words(search);
+	std::string word;
+	while (words >> word) {
+		if (word.size() > 1 && word[0] == '-')
+			addTextTerms(word.substr(1), negatedTerms);
+		else
+			addTextTerms(word, terms);
+	}
+}
+
+ACTOR static Future<bool> evaluateTextPredicate(Reference<IReadContext> cx, Reference<TextPredicate> self) {
+	std::set<std::string> found = wait(getTextTerms(cx, self->paths));
+	for (const auto& term : self->negatedTerms) {
+		if (found.count(term))
+			return false;
+	}
+	for (const auto& term : self->terms) {
+		if (!found.count(term))
+			return false;
+	}
+	// Like MongoDB, a search with nothing but negated terms matches nothing
+	return !self->terms.empty();
+}
+
+Future<bool> TextPredicate::evaluate(const Reference<IReadContext>& context) {
+	if (paths.empty())
+		throw text_index_required();
+	return evaluateTextPredicate(context, Reference<TextPredicate>::addRef(this));
+}
+
+std::string TextPredicate::toString() {
+	std::string s = "TEXT(";
+	for (const auto& term : terms)
+		s += (s.size() > 5 ? " " : "") + term;
+	for (const auto& term : negatedTerms)
+		s += (s.size() > 5 ? " -" : "-") + term;
+	return s + ")";
+}
+
+void TextPredicate::bind(IndexInfo const& textIndex) {
+	paths.clear();
+	for (const auto& key : textIndex.indexKeys)
+		paths.push_back(key.first);
+}
+
 // Distinct Predicate
 DistinctPredicate::DistinctPredicate(const std::string& fieldName) : _fieldName(fieldName) {}
 
@@ -28,7 +28,7 @@
 #include "QLContext.h"
 #include "QLExpression.h"
 #include "QLTypes.h"
-#include "pcrecpp.h" // needed for pcrecpp::RE_Options
+#include "RegexCache.h"
 
 struct IPredicate {
 	virtual void addref() = 0;
@@ -51,7 +51,9 @@ struct IPredicate {
 		LITERAL_SUBOBJECT_MATCH,
 		IS_OBJECT,
 		REGEX,
-		DISTINCT
+		DISTINCT,
+		TEXT,
+		GEO
 	};
 
 	struct SimplifyAndContext {
@@ -328,16 +330,49 @@ struct RegExPredicate : IPredicate, ReferenceCounted<RegExPredicate>, FastAlloca
 
 	virtual void setOptions(const std::string& _options);
 
+	// The literal text, lower cased, that every string the pattern matches starts with, for a scan of a case folded
+	// index (see foldedIndexKeyPart()). Present for patterns anchored at the start, whatever their case sensitivity.
+	Optional<std::string> foldedPrefix();
+
+	// The literal text, reversed, that every string the pattern matches ends with, for a scan of a reversed index (see
+	// reversedIndexKeyPart()). Present for case sensitive patterns anchored at the end with '$'.
+	Optional<std::string> reversedSuffix();
+
 private:
 	void calculateRange();
 
 private:
-	pcrecpp::RE_Options options;
-	std::shared_ptr<pcrecpp::RE> re;
+	std::string pattern;
+	int flags;
+	std::shared_ptr<CompiledRegex> re; // From getCompiledRegex() once the predicate is first evaluated
 	std::string min_limit;
 	std::string max_limit;
 };
 
+/**
+ * TextPredicate matches the documents of a $text query, see TextSearch.h: those with every one of `terms` and none of
+ * `negatedTerms` in the fields of the collection's text index. It can only be evaluated once planQuery() has bound it
+ * to that index.
+ */
+struct TextPredicate : IPredicate, ReferenceCounted<TextPredicate>, FastAllocated<TextPredicate> {
+	void addref() override { ReferenceCounted<TextPredicate>::addref(); }
+	void delref() override { ReferenceCounted<TextPredicate>::delref(); }
+
+	// Words of `search` prefixed with '-' are negated
+	explicit TextPredicate(std::string const& search);
+	TypeCode getTypeCode() const override { return TypeCode::TEXT; }
+
+	Future<bool> evaluate(Reference<IReadContext> const& context) override;
+	std::string toString() override;
+	bool wantsNulls() override { return false; }
+
+	void bind(IndexInfo const& textIndex);
+
+	std::set<std::string> terms;
+	std::set<std::string> negatedTerms;
+	std::vector<std::string> paths; // Fields of the text index, empty until bound
+};
+
 // Distinct Predicate
 struct DistinctPredicate : IPredicate, ReferenceCounted<DistinctPredicate>, FastAllocated<DistinctPredicate> {
 	void addref() override { ReferenceCounted<DistinctPredicate>::addref(); }
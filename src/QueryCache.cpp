@@ -0,0 +1,104 @@
+/*
+ * QueryCache.cpp
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "QueryCache.h"
+#include "DocLayer.h"
+#include "Knobs.h"
+
+bool QueryCache::enabled() const {
+	return DOCLAYER_KNOBS->QUERY_CACHE_MAX_BYTES > 0;
+}
+
+std::string QueryCache::makeKey(StringRef collectionPrefix,
+                                bson::BSONObj const& filter,
+                                bson::BSONObj const& projection,
+                                Optional<bson::BSONObj> const& ordering,
+                                int32_t numberToSkip,
+                                int32_t numberToReturn) {
+	std::vector<bson::BSONElement> fields;
+	for (auto i = filter.begin(); i.more();)
+		fields.push_back(i.next());
+	std::stable_sort(fields.begin(), fields.end(), [](bson::BSONElement const& a, bson::BSONElement const& b) {
+		return strcmp(a.fieldName(), b.fieldName()) < 0;
+	});
+	bson::BSONObjBuilder normalized;
+	for (auto const& f : fields)
+		normalized.append(f);
+
+	bson::BSONObjBuilder bob;
+	bob << "q" << normalized.obj() << "p" << projection << "s" << numberToSkip << "n" << numberToReturn;
+	if (ordering.present())
+		bob << "o" << ordering.get();
+	bson::BSONObj keyObj = bob.obj();
+
+	std::string key;
+	key.reserve(collectionPrefix.size() + keyObj.objsize());
+	key.append((const char*)collectionPrefix.begin(), collectionPrefix.size());
+	key.append(keyObj.objdata(), keyObj.objsize());
+	return key;
+}
+
+Reference<QueryCache::Entry> QueryCache::lookup(std::string const& key, uint64_t changeCount) {
+	Reference<Entry>* found = entries.get(key);
+	if (found == nullptr) {
+		stats.misses++;
+		return Reference<Entry>();
+	}
+	if ((*found)->changeCount != changeCount) {
+		stats.stale++;
+		stats.misses++;
+		erase(key, *found);
+		return Reference<Entry>();
+	}
+	stats.hits++;
+	return *found;
+}
+
+void QueryCache::insert(std::string const& key, uint64_t changeCount, std::vector<bson::BSONObj> documents) {
+	Reference<Entry> entry(new Entry());
+	entry->changeCount = changeCount;
+	entry->bytes = key.size();
+	for (auto const& doc : documents)
+		entry->bytes += doc.objsize();
+	if (entry->bytes > DOCLAYER_KNOBS->QUERY_CACHE_MAX_ENTRY_BYTES ||
+	    entry->bytes > DOCLAYER_KNOBS->QUERY_CACHE_MAX_BYTES)
+		return;
+	entry->documents = std::move(documents);
+
+	Reference<Entry>* found = entries.get(key);
+	if (found != nullptr)
+		erase(key, *found);
+
+	entries.put(key, entry);
+	bytes += entry->bytes;
+	stats.inserts++;
+
+	while (bytes > DOCLAYER_KNOBS->QUERY_CACHE_MAX_BYTES) {
+		bytes -= entries.oldest().second->bytes;
+		entries.popOldest();
+		stats.evictions++;
+	}
+	DocumentLayer::metricReporter->captureGauge("queryCacheBytes", bytes);
+}
+
+void QueryCache::erase(std::string const& key, Reference<Entry> const& entry) {
+	bytes -= entry->bytes;
+	entries.erase(key);
+}
@@ -0,0 +1,86 @@
+/*
+ * QueryCache.h
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _QUERY_CACHE_H_
+#define _QUERY_CACHE_H_
+
+#pragma once
+
+#include "bson.h"
+#include "flow/flow.h"
+#include "LRUCache.h"
+
+struct QueryCacheStats {
+	int64_t hits = 0;
+	int64_t misses = 0;
+	int64_t stale = 0;
+	int64_t inserts = 0;
+	int64_t evictions = 0;
+};
+
+/**
+ * Process-wide cache of complete query replies, shared by all connections.
+ *
+ * Entries are keyed by makeKey(), and remember the value of the collection's change counter (see
+ * CollectionContext::getChangeCount()) that was read before the query started and again after it finished. An entry
+ * is only served while the counter still has that value, so any committed write to the collection retires it.
+ *
+ * Entries are evicted least recently used first once the cache holds more than QUERY_CACHE_MAX_BYTES of documents.
+ * The cache is disabled if QUERY_CACHE_MAX_BYTES is 0.
+ */
+struct QueryCache : ReferenceCounted<QueryCache>, NonCopyable {
+	struct Entry : ReferenceCounted<Entry> {
+		uint64_t changeCount;
+		std::vector<bson::BSONObj> documents;
+		int64_t bytes;
+	};
+
+	bool enabled() const;
+
+	/**
+	 * Builds the cache key for a query. `collectionPrefix` is the collection's directory prefix, so a dropped and
+	 * recreated collection never matches the entries of its predecessor. Top level filter fields are sorted, since
+	 * their order doesn't change the result.
+	 */
+	static std::string makeKey(StringRef collectionPrefix,
+	                           bson::BSONObj const& filter,
+	                           bson::BSONObj const& projection,
+	                           Optional<bson::BSONObj> const& ordering,
+	                           int32_t numberToSkip,
+	                           int32_t numberToReturn);
+
+	/**
+	 * Returns the entry for `key` if its change count is `changeCount`, or a null reference. Stale entries are
+	 * dropped.
+	 */
+	Reference<Entry> lookup(std::string const& key, uint64_t changeCount);
+	void insert(std::string const& key, uint64_t changeCount, std::vector<bson::BSONObj> documents);
+	size_t size() const { return entries.size(); }
+
+	int64_t bytes = 0;
+	QueryCacheStats stats;
+
+private:
+	LRUCache<std::string, Reference<Entry>> entries;
+
+	void erase(std::string const& key, Reference<Entry> const& entry);
+};
+
+#endif /* _QUERY_CACHE_H_ */
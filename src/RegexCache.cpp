@@ -0,0 +1,193 @@
+/*
+ * RegexCache.cpp
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RegexCache.h"
+#include "Knobs.h"
+#include "LRUCache.h"
+#include "flow/UnitTest.h"
+
+#include <string.h>
+
+int regexFlags(std::string const& options) {
+	int flags = 0;
+	if (options.find('i') != std::string::npos)
+		flags |= PCRE_CASELESS;
+	if (options.find('m') != std::string::npos)
+		flags |= PCRE_MULTILINE;
+	if (options.find('x') != std::string::npos)
+		flags |= PCRE_EXTENDED;
+	if (options.find('s') != std::string::npos)
+		flags |= PCRE_DOTALL;
+	return flags;
+}
+
+// The text `pattern` matches if it matches nothing but a literal text, with escaped punctuation standing for itself
+static Optional<std::string> literalText(std::string const& pattern, bool extended) {
+	std::string text;
+	for (size_t i = 0; i < pattern.size(); i++) {
+		unsigned char c = pattern[i];
+		if (c == '\\') {
+			// Escaped letters and digits are classes, assertions or back references
+			unsigned char next = i + 1 < pattern.size() ? pattern[i + 1] : 0;
+			if (next == 0 || isalnum(next) || next >= 0x80)
+				return Optional<std::string>();
+			text += pattern[++i];
+		} else if (c == 0 || strchr("^$.[]|()?*+{}", c) || (extended && (isspace(c) || c == '#'))) {
+			return Optional<std::string>();
+		} else {
+			text += c;
+		}
+	}
+	return text;
+}
+
+CompiledRegex::CompiledRegex(std::string const& pattern, int flags)
+    : patternText(pattern), anchored(false), re(nullptr), extra(nullptr) {
+	if (!(flags & PCRE_CASELESS)) {
+		bool extended = flags & PCRE_EXTENDED;
+		// With 'm', '^' also matches after each newline
+		if (!(flags & PCRE_MULTILINE) &&
+		    (StringRef(pattern).startsWith(LiteralStringRef("^")) ||
+		     StringRef(pattern).startsWith(LiteralStringRef("\\A")))) {
+			literal = literalText(pattern.substr(pattern[0] == '^' ? 1 : 2), extended);
+			anchored = literal.present();
+		} else {
+			literal = literalText(pattern, extended);
+		}
+		if (literal.present())
+			return;
+	}
+
+	const char* error;
+	int errorOffset;
+	re = pcre_compile(pattern.c_str(), flags, &error, &errorOffset, nullptr);
+	if (re == nullptr) {
+		TraceEvent(SevWarn, "BD_regexCompileFailed").detail("pattern", pattern).detail("error", error);
+		return;
+	}
+	extra = pcre_study(re, PCRE_STUDY_JIT_COMPILE, &error);
+}
+
+CompiledRegex::~CompiledRegex() {
+	if (extra != nullptr)
+		pcre_free_study(extra);
+	if (re != nullptr)
+		pcre_free(re);
+}
+
+bool CompiledRegex::partialMatch(StringRef s) const {
+	if (literal.present()) {
+		StringRef text(literal.get());
+		if (anchored)
+			return s.startsWith(text);
+		return text.size() == 0 || memmem(s.begin(), s.size(), text.begin(), text.size()) != nullptr;
+	}
+	if (re == nullptr)
+		return false;
+	return pcre_exec(re, extra, (const char*)s.begin(), s.size(), 0, 0, nullptr, 0) >= 0;
+}
+
+std::shared_ptr<CompiledRegex> getCompiledRegex(std::string const& pattern, int flags) {
+	static LRUCache<std::string, std::shared_ptr<CompiledRegex>> cache;
+
+	std::string key = format("%d/", flags) + pattern;
+	std::shared_ptr<CompiledRegex>* found = cache.get(key);
+	if (found != nullptr)
+		return *found;
+
+	auto compiled = std::make_shared<CompiledRegex>(pattern, flags);
+	if (DOCLAYER_KNOBS->REGEX_CACHE_MAX_ENTRIES <= 0)
+		return compiled;
+	cache.put(key, compiled);
+	cache.trim((size_t)DOCLAYER_KNOBS->REGEX_CACHE_MAX_ENTRIES);
+	return compiled;
+}
+
+// Whether PCRE itself finds `pattern` in `s`, for checking the literal fast paths against
+static bool pcrePartialMatch(std::string const& pattern, int flags, std::string const& s) {
+	const char* error;
+	int errorOffset;
+	pcre* re = pcre_compile(pattern.c_str(), flags, &error, &errorOffset, nullptr);
+	if (re == nullptr)
+		return false;
+	bool matched = pcre_exec(re, nullptr, s.data(), s.size(), 0, 0, nullptr, 0) >= 0;
+	pcre_free(re);
+	return matched;
+}
+
+TEST_CASE("/doclayer/RegexCache/LiteralFastPaths") {
+	const char* subjects[] = { "",    "example.com", "exampleXcom", "www.example.com", "line\nexample.com", "a b",
+		                       "ab",  "a#b",         "a",           "a-b(c)",          "EXAMPLE.COM" };
+	struct Case {
+		const char* pattern;
+		const char* options;
+	};
+	const Case cases[] = {
+		// Literals, with escaped punctuation standing for itself
+		{ "", "" },
+		{ "example", "" },
+		{ "example\\.com", "" },
+		{ "example.com", "" },
+		{ "a\\-b\\(c\\)", "" },
+		{ "\\\\", "" },
+		// Anchored at the start of the subject, unless 'm' lets '^' match after a newline too
+		{ "^", "" },
+		{ "^example", "" },
+		{ "^example\\.com", "" },
+		{ "^example", "m" },
+		{ "\\Aexample", "" },
+		{ "\\Aexample", "m" },
+		{ "^example$", "" },
+		// With 'x' unescaped whitespace and '#' comments aren't literal, but escaped ones are
+		{ "a b", "" },
+		{ "a b", "x" },
+		{ "a\\ b", "x" },
+		{ "a#b", "" },
+		{ "a#b", "x" },
+		{ "a\\#b", "x" },
+		{ "^a b", "x" },
+		// Escaped letters and digits, and case insensitive patterns, always go to PCRE
+		{ "\\d", "" },
+		{ "\\bexample", "" },
+		{ "example", "i" },
+		{ "^example", "i" },
+		// Patterns that don't compile match nothing
+		{ "(", "" },
+		{ "[a", "" },
+		{ "a\\", "" },
+		{ "^(", "" },
+	};
+
+	for (const auto& c : cases) {
+		int flags = regexFlags(c.options);
+		CompiledRegex compiled(c.pattern, flags);
+		std::shared_ptr<CompiledRegex> cached = getCompiledRegex(c.pattern, flags);
+		for (const char* subject : subjects) {
+			std::string s(subject);
+			bool expected = pcrePartialMatch(c.pattern, flags, s);
+			if (compiled.partialMatch(StringRef(s)) != expected || cached->partialMatch(StringRef(s)) != expected) {
+				fprintf(stderr, "/%s/%s on \"%s\": PCRE says %d\n", c.pattern, c.options, subject, expected);
+				ASSERT(false);
+			}
+		}
+	}
+
+	return Void();
+}
@@ -0,0 +1,63 @@
+/*
+ * RegexCache.h
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _REGEX_CACHE_H_
+#define _REGEX_CACHE_H_
+
+#pragma once
+
+#include "flow/flow.h"
+#include "pcre.h"
+
+#include <memory>
+
+// The $regex options that change how a pattern matches ('i', 'm', 'x' and 's'), as PCRE compile flags
+int regexFlags(std::string const& options);
+
+/**
+ * A $regex pattern compiled with the given flags. Patterns that only match a literal string, possibly escaped, like
+ * "example\.com", and case sensitive ones anchored with '^' at the start, are matched with memmem() and a prefix
+ * comparison and never enter PCRE. Others are compiled and studied, which JIT compiles them if PCRE was built with JIT
+ * support. A pattern that doesn't compile matches nothing.
+ */
+struct CompiledRegex : NonCopyable {
+	CompiledRegex(std::string const& pattern, int flags);
+	~CompiledRegex();
+
+	// Whether the pattern matches somewhere in `s`
+	bool partialMatch(StringRef s) const;
+
+	std::string const& pattern() const { return patternText; }
+
+private:
+	std::string patternText;
+	Optional<std::string> literal;
+	bool anchored; // `literal` only matches at the start
+	pcre* re;
+	pcre_extra* extra;
+};
+
+/**
+ * Returns the compiled form of `pattern` with `flags`, from a process-wide cache of the REGEX_CACHE_MAX_ENTRIES most
+ * recently used ones, so queries sent over and over don't compile their patterns each time.
+ */
+std::shared_ptr<CompiledRegex> getCompiledRegex(std::string const& pattern, int flags);
+
+#endif /* _REGEX_CACHE_H_ */
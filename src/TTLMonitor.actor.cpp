@@ -0,0 +1,205 @@
+/*
+ * TTLMonitor.actor.cpp
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bindings/flow/Tuple.h"
+
+#include "TTLMonitor.h"
+#include "DocLayer.h"
+#include "ExtMsg.h"
+#include "ExtUtil.actor.h"
+#include "QLPlan.h"
+
+struct TTLIndex {
+	Namespace ns;
+	std::string field;
+	double expireAfterSeconds;
+};
+
+/**
+ * Takes or renews the lease that makes this instance the only one running the TTL monitor, and returns whether it holds
+ * it. The lease is a key in the root directory holding its owner and the time it runs out; another instance can only
+ * take it over once it has run out, so a live owner keeps it by renewing it more often than TTL_MONITOR_LEASE_TIME.
+ */
+ACTOR static Future<bool> acquireTTLLease(Reference<DocumentLayer> docLayer, std::string owner) {
+	state FDB::Key leaseKey = docLayer->rootDirectory->pack(LiteralStringRef("ttlMonitorLease"));
+	state Reference<DocTransaction> tr = NonIsolatedPlan::newTransaction(docLayer->database);
+
+	loop {
+		try {
+			Optional<FDB::FDBStandalone<StringRef>> lease = wait(tr->tr->get(leaseKey));
+			int64_t nowMs = (int64_t)(timer() * 1000);
+			if (lease.present()) {
+				FDB::Tuple current = FDB::Tuple::unpack(lease.get());
+				if (current.getString(0) != StringRef(owner) && current.getInt(1) > nowMs)
+					return false;
+			}
+			FDB::Tuple renewed;
+			renewed.append(owner, true).append(nowMs + (int64_t)(DOCLAYER_KNOBS->TTL_MONITOR_LEASE_TIME * 1000));
+			tr->tr->set(leaseKey, renewed.pack());
+			Void _ = wait(tr->tr->commit());
+			return true;
+		} catch (Error& e) {
+			Void _ = wait(tr->tr->onError(e));
+		}
+	}
+}
+
+ACTOR static Future<Void> findDatabaseTTLIndexes(Reference<DocumentLayer> docLayer,
+                                                 std::string dbName,
+                                                 std::vector<TTLIndex>* ttlIndexes) {
+	state Reference<DocTransaction> tr = NonIsolatedPlan::newTransaction(docLayer->database);
+	state size_t found = ttlIndexes->size();
+
+	loop {
+		try {
+			ttlIndexes->resize(found);
+			Reference<UnboundCollectionContext> indexesCollection = wait(docLayer->mm->indexesCollection(tr, dbName));
+			std::vector<bson::BSONObj> indexes =
+			    wait(getIndexesTransactionally(ref(new TableScanPlan(indexesCollection)), tr));
+
+			for (const auto& indexObj : indexes) {
+				if (!indexObj.hasField("expireAfterSeconds") || strcmp(indexObj.getStringField("status"), "ready"))
+					continue;
+				std::string ns = indexObj.getStringField("ns");
+				size_t dot = ns.find('.');
+				if (dot == std::string::npos)
+					continue;
+				TTLIndex ttlIndex;
+				ttlIndex.ns = std::make_pair(ns.substr(0, dot), ns.substr(dot + 1));
+				ttlIndex.field = indexObj.getObjectField("key").firstElement().fieldName();
+				ttlIndex.expireAfterSeconds = indexObj.getField("expireAfterSeconds").Number();
+				ttlIndexes->push_back(ttlIndex);
+			}
+			return Void();
+		} catch (Error& e) {
+			Void _ = wait(tr->tr->onError(e));
+		}
+	}
+}
+
+/**
+ * Reads the ready TTL indexes of every database, one transaction per database so that the pass doesn't depend on the
+ * whole catalog being readable within a single transaction's lifetime.
+ */
+ACTOR static Future<std::vector<TTLIndex>> findTTLIndexes(Reference<DocumentLayer> docLayer) {
+	state Reference<DocTransaction> tr = NonIsolatedPlan::newTransaction(docLayer->database);
+	state Standalone<VectorRef<StringRef>> dbs;
+	state std::vector<TTLIndex> ttlIndexes;
+
+	loop {
+		try {
+			Standalone<VectorRef<StringRef>> _dbs = wait(docLayer->rootDirectory->list(tr->tr));
+			dbs = _dbs;
+			break;
+		} catch (Error& e) {
+			Void _ = wait(tr->tr->onError(e));
+		}
+	}
+
+	state int i = 0;
+	for (; i < dbs.size(); i++)
+		Void _ = wait(findDatabaseTTLIndexes(docLayer, dbs[i].toString(), &ttlIndexes));
+	return ttlIndexes;
+}
+
+/**
+ * Deletes documents that expired through `ttlIndex`, one batch per transaction. Returns the number of documents
+ * deleted, and whether it stopped at TTL_MAX_BATCHES_PER_PASS with expired documents left over.
+ */
+ACTOR static Future<std::pair<int64_t, bool>> expireDocuments(Reference<DocumentLayer> docLayer, TTLIndex ttlIndex) {
+	state bson::BSONObj expired =
+	    BSON(ttlIndex.field << BSON("$lt" << bson::Date_t((timer() - ttlIndex.expireAfterSeconds) * 1000)));
+	state int64_t deleted = 0;
+	state int batches = 0;
+
+	for (; batches < DOCLAYER_KNOBS->TTL_MAX_BATCHES_PER_PASS; batches++) {
+		state double startTime = now();
+		state Reference<DocTransaction> tr = NonIsolatedPlan::newTransaction(docLayer->database);
+		Reference<UnboundCollectionContext> cx = wait(docLayer->mm->getUnboundCollectionContext(tr, ttlIndex.ns));
+
+		// The planner turns the $lt on the indexed field into a range read of the TTL index
+		Reference<Plan> plan = deletePlan(planQuery(cx, expired), cx, DOCLAYER_KNOBS->TTL_DELETE_BATCH_SIZE);
+		plan = Reference<Plan>(new RetryPlan(plan, docLayer->defaultConnectionOptions.timeout,
+		                                     docLayer->defaultConnectionOptions.retryLimit, docLayer->database));
+		state int64_t batchDeleted = wait(executeUntilCompletionTransactionally(plan, tr));
+
+		deleted += batchDeleted;
+		DocumentLayer::metricReporter->captureMeter("ttlDeletes", batchDeleted);
+		if (batchDeleted < DOCLAYER_KNOBS->TTL_DELETE_BATCH_SIZE)
+			return std::make_pair(deleted, false);
+
+		Void _ = wait(delay((now() - startTime) * DOCLAYER_KNOBS->TTL_BATCH_DELAY_RATIO));
+	}
+
+	return std::make_pair(deleted, true);
+}
+
+ACTOR Future<Void> ttlMonitor(Reference<DocumentLayer> docLayer) {
+	state std::string owner = g_nondeterministic_random->randomUniqueID().toString();
+
+	loop {
+		Void _ = wait(delay(DOCLAYER_KNOBS->TTL_MONITOR_INTERVAL));
+
+		state double startTime = now();
+		state int64_t deleted = 0;
+		state int backlogged = 0;
+		try {
+			bool leader = wait(acquireTTLLease(docLayer, owner));
+			if (!leader)
+				continue;
+
+			state std::vector<TTLIndex> ttlIndexes = wait(findTTLIndexes(docLayer));
+			state int i = 0;
+			for (; i < ttlIndexes.size(); i++) {
+				try {
+					// Renew the lease as the pass goes, and leave the rest of it to the new owner if it was lost
+					bool stillLeader = wait(acquireTTLLease(docLayer, owner));
+					if (!stillLeader)
+						break;
+
+					std::pair<int64_t, bool> result = wait(expireDocuments(docLayer, ttlIndexes[i]));
+					deleted += result.first;
+					if (result.second)
+						backlogged++;
+				} catch (Error& e) {
+					if (e.code() == error_code_actor_cancelled)
+						throw;
+					// Carry on with the other indexes, this one gets another chance next pass
+					TraceEvent(SevWarn, "BD_ttlExpiryFailed")
+					    .detail("ns", ttlIndexes[i].ns.first + "." + ttlIndexes[i].ns.second)
+					    .detail("field", ttlIndexes[i].field)
+					    .error(e);
+				}
+			}
+		} catch (Error& e) {
+			if (e.code() == error_code_actor_cancelled)
+				throw;
+			TraceEvent(SevWarn, "BD_ttlMonitorFailed").error(e);
+		}
+
+		// Indexes that still had expired documents when their pass ended
+		DocumentLayer::metricReporter->captureGauge("ttlBacklog", backlogged);
+		if (deleted > 0 || backlogged > 0)
+			TraceEvent("BD_ttlPass")
+			    .detail("deleted", deleted)
+			    .detail("backlogged", backlogged)
+			    .detail("duration", now() - startTime);
+	}
+}
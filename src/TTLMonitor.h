@@ -0,0 +1,44 @@
+/*
+ * TTLMonitor.h
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _TTL_MONITOR_H_
+#define _TTL_MONITOR_H_
+
+#pragma once
+
+#include "flow/flow.h"
+
+/**
+ * Background worker that deletes expired documents from collections with TTL indexes, i.e. indexes on a single field
+ * created with {expireAfterSeconds: n}. A document expires n seconds after the date in its indexed field; documents
+ * without a date there never expire.
+ *
+ * Every instance runs the monitor, but only the one holding the lease in the root directory does any work, so expired
+ * documents are not deleted by several instances at once. The lease is renewed throughout a pass, and is taken over by
+ * another instance if its owner doesn't renew it for TTL_MONITOR_LEASE_TIME seconds.
+ *
+ * Every TTL_MONITOR_INTERVAL seconds the monitor finds the ready TTL indexes of every database and deletes the expired
+ * documents of each through the index, TTL_DELETE_BATCH_SIZE documents per transaction and at most
+ * TTL_MAX_BATCHES_PER_PASS transactions per index. After each batch it pauses for TTL_BATCH_DELAY_RATIO times the
+ * batch's latency, so it slows down along with the cluster.
+ */
+Future<Void> ttlMonitor(Reference<struct DocumentLayer> const& docLayer);
+
+#endif /* _TTL_MONITOR_H_ */
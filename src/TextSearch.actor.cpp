@@ -0,0 +1,121 @@
+/*
+ * TextSearch.actor.cpp
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * MongoDB is a registered trademark of MongoDB, Inc.
+ */
+
+#include "TextSearch.h"
+#include "ExtUtil.actor.h"
+#include "QLExpression.h"
+#include "QLProjection.h"
+
+// Longer runs, like encoded binary data, are cut to this many bytes so their index keys stay small
+static const size_t MAX_TERM_LENGTH = 64;
+
+static const std::set<std::string> stopWords = {
+    "a", "an", "and", "are", "as", "at", "be", "but", "by", "for",
+    "from", "has", "have", "he", "her", "his", "i", "in", "is", "it",
+    "its", "not", "of", "on", "or", "she", "that", "the", "their", "they",
+    "this", "to", "was", "were", "will", "with", "you"};
+
+static bool isWordByte(unsigned char c) {
+	return isalnum(c) || c >= 0x80;
+}
+
+static bool isVowel(char c) {
+	return c == 'a' || c == 'e' || c == 'i' || c == 'o' || c == 'u';
+}
+
+static bool hasVowel(std::string const& word, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		if (isVowel(word[i]))
+			return true;
+	}
+	return false;
+}
+
+static bool endsWith(std::string const& word, const char* suffix) {
+	size_t n = strlen(suffix);
+	return word.size() >= n && word.compare(word.size() - n, n, suffix) == 0;
+}
+
+// The first steps of Porter's stemmer: plurals, then "-ed" and "-ing", then a final "y"
+static std::string stem(std::string word) {
+	if (word.size() <= 3)
+		return word;
+
+	if (endsWith(word, "sses") || endsWith(word, "ies"))
+		word.resize(word.size() - 2);
+	else if (endsWith(word, "s") && !endsWith(word, "ss") && !endsWith(word, "us"))
+		word.pop_back();
+
+	for (const char* suffix : {"ing", "ed"}) {
+		size_t rest = word.size() - strlen(suffix);
+		if (endsWith(word, suffix) && rest >= 2 && hasVowel(word, rest)) {
+			word.resize(rest);
+			// "hopping" and "hopped" are "hop"
+			char last = word.back();
+			if (word[rest - 2] == last && !isVowel(last) && last != 'l' && last != 's' && last != 'z')
+				word.pop_back();
+			break;
+		}
+	}
+
+	if (word.size() > 2 && word.back() == 'y' && hasVowel(word, word.size() - 1))
+		word.back() = 'i';
+
+	return word;
+}
+
+void addTextTerms(std::string const& text, std::set<std::string>& terms) {
+	size_t i = 0;
+	while (i < text.size()) {
+		while (i < text.size() && !isWordByte(text[i]))
+			i++;
+		std::string word;
+		while (i < text.size() && isWordByte(text[i])) {
+			unsigned char c = text[i++];
+			word.push_back(c < 0x80 ? tolower(c) : c);
+		}
+		if (word.empty() || stopWords.count(word))
+			continue;
+		word = stem(word);
+		if (word.size() > MAX_TERM_LENGTH)
+			word.resize(MAX_TERM_LENGTH);
+		terms.insert(word);
+	}
+}
+
+ACTOR Future<std::set<std::string>> getTextTerms(Reference<IReadContext> doc, std::vector<std::string> paths) {
+	state std::set<std::string> terms;
+	state Reference<IExpression> expr;
+	state int i = 0;
+	for (; i < paths.size(); i++) {
+		expr = Reference<IExpression>(new ExtPathExpression(StringRef(paths[i]), true, true));
+		std::vector<DataValue> values =
+		    wait(consumeAll(mapAsync(expr->evaluate(doc), [](Reference<IReadContext> valcx) {
+			    return getMaybeRecursive(valcx, StringRef());
+		    })));
+		for (const auto& v : values) {
+			if (v.getBSONType() == bson::BSONType::String)
+				addTextTerms(v.getString(), terms);
+		}
+	}
+	return terms;
+}
@@ -0,0 +1,48 @@
+/*
+ * TextSearch.h
+ *
+ * This source file is part of the FoundationDB open source project
+ *
+ * Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * MongoDB is a registered trademark of MongoDB, Inc.
+ */
+
+#ifndef _TEXT_SEARCH_H_
+#define _TEXT_SEARCH_H_
+
+#pragma once
+
+#include "QLContext.h"
+
+/*
+ * Text indexes ({field: "text", ...}) hold an entry for each term of the strings in their fields, keyed by the term and
+ * then the document id, so the entries of a term are the posting list of the documents containing it. A $text query
+ * ({$text: {$search: "..."}}) matches the documents containing every term of its search string and none of the words
+ * prefixed with '-'. planQuery() answers it by scanning the posting list of one term and looking up the entries of the
+ * others for each document on it, see TextScanPlan.
+ *
+ * A term is a lower cased run of letters and digits, other than a common English stop word, reduced to a stem by
+ * stripping plural and verb endings, so that "Running" and "runs" both become "run". Bytes outside ASCII count as
+ * letters, which keeps UTF-8 words whole but doesn't fold their case.
+ */
+
+// Adds the terms of `text` to `terms`
+void addTextTerms(std::string const& text, std::set<std::string>& terms);
+
+// The terms of the strings at `paths` of `doc`, including strings in arrays. Paths are encoded like index keys.
+Future<std::set<std::string>> getTextTerms(Reference<IReadContext> const& doc, std::vector<std::string> const& paths);
+
+#endif /* _TEXT_SEARCH_H_ */
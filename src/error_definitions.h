@@ -22,6 +22,8 @@
 
 #ifdef DOCLAYER_ERROR
 
+DOCLAYER_ERROR(max_time_ms_expired, 50, "operation exceeded time limit");
+
 DOCLAYER_ERROR(invalid_bitwise_update, 9016, "Unknown or invalid $bit operation");
 
 DOCLAYER_ERROR(invalid_bitwise_applicand, 10138, "$bit cannot update a value of non-integral type");
@@ -83,6 +85,16 @@ DOCLAYER_ERROR(update_operator_empty_parameter,
 DOCLAYER_ERROR(wire_protocol_mismatch, 29966, "Wire protocol mismatch. Bad message received.");
 DOCLAYER_ERROR(no_index_name, 29967, "No index name specified");
 DOCLAYER_ERROR(unsupported_index_type, 29969, "Document Layer does not support this index type, yet.");
+DOCLAYER_ERROR(server_overloaded, 29970, "Server is overloaded. The operation was not started and may be retried.");
+DOCLAYER_ERROR(change_log_not_enabled, 29971, "Collection has no change log. Create it with changeLog: true.");
+DOCLAYER_ERROR(unsupported_aggregation_operator,
+               29972,
+               "Document Layer does not support this aggregation stage or operator.");
+DOCLAYER_ERROR(aggregation_memory_limit, 29973, "Aggregation exceeded its memory limit.");
+DOCLAYER_ERROR(text_index_required, 29974, "A $text query needs a text index on the collection.");
+DOCLAYER_ERROR(bad_geo_query, 29975, "Invalid geospatial query operand.");
+DOCLAYER_ERROR(aggregation_result_too_large, 29976, "Aggregation result exceeds the maximum reply size.");
+DOCLAYER_ERROR(unsupported_text_phrase, 29977, "Document Layer does not support $text phrase searches.");
 
 DOCLAYER_ERROR(no_transaction_in_progress, 29980, "No transaction in progress.");
 DOCLAYER_ERROR(no_symbol_type, 29981, "The Document Layer does not support the deprecated BSON `symbol` type.");
@@ -0,0 +1,183 @@
+#
+# admission_control_tests.py
+#
+# This source file is part of the FoundationDB open source project
+#
+# Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# MongoDB is a registered trademark of MongoDB, Inc.
+#
+
+
+import os
+import threading
+import time
+
+from pymongo import MongoClient
+from pymongo.errors import OperationFailure
+import util
+
+# These tests need a Doc Layer of their own, started with the knobs below, since they keep its only slot busy.
+# run-tests.bash starts one and sets DOCLAYER_ADMISSION_PORT to its port; without it the tests are skipped.
+#
+#   --knob_admission_max_in_flight 1 --knob_admission_max_queue_length 1 --knob_admission_max_queue_time 2
+ADMISSION_PORT = int(os.environ.get('DOCLAYER_ADMISSION_PORT', '0'))
+MAX_QUEUE_TIME = 2.0
+
+SERVER_OVERLOADED = 29970
+MAX_TIME_MS_EXPIRED = 50
+
+# How long the request holding the slot waits for change events that never come
+HOLD_SECONDS = 5.0
+
+
+def _clients(collection, n):
+    host = collection.database.client.address[0]
+    clients = [MongoClient(host, ADMISSION_PORT) for _ in range(n)]
+    # Connect while there are free slots, since the handshake has to be admitted too
+    for c in clients:
+        c.admin.command('ping')
+    return clients
+
+
+def _collection(client, collection):
+    return client[collection.database.name][collection.name]
+
+
+def _hold_slot(client, collection):
+    """Starts a request that keeps the server's only slot for HOLD_SECONDS, and returns its thread."""
+    db = client[collection.database.name]
+    thread = threading.Thread(
+        target=lambda: db.command('watch', collection.name, maxAwaitTimeMS=int(HOLD_SECONDS * 1000)))
+    thread.start()
+    time.sleep(0.3)
+    return thread
+
+
+def _find(client, collection, results, name, max_time_ms=None):
+    start = time.time()
+    try:
+        cursor = _collection(client, collection).find()
+        if max_time_ms is not None:
+            cursor = cursor.max_time_ms(max_time_ms)
+        list(cursor)
+        results[name] = (None, time.time() - start)
+    except OperationFailure as e:
+        results[name] = (e.code, time.time() - start)
+
+
+def _in_background(*args, **kwargs):
+    thread = threading.Thread(target=_find, args=args, kwargs=kwargs)
+    thread.start()
+    time.sleep(0.2)
+    return thread
+
+
+def _setup(collection):
+    client = MongoClient(collection.database.client.address[0], ADMISSION_PORT)
+    try:
+        client[collection.database.name].drop_collection(collection.name)
+        client[collection.database.name].command('create', collection.name, changeLog=True)
+        _collection(client, collection).insert_one({'_id': 1})
+    finally:
+        client.close()
+
+
+def test_full_queue_is_rejected_as_overloaded(collection):
+    test_name = "test_full_queue_is_rejected_as_overloaded"
+    if not ADMISSION_PORT:
+        print "{} skipped, DOCLAYER_ADMISSION_PORT isn't set".format(test_name)
+        return True
+    _setup(collection)
+    holder, queued, rejected, after = _clients(collection, 4)
+    results = {}
+    try:
+        hold = _hold_slot(holder, collection)
+        # Takes the one place in the read queue, and gives up after MAX_QUEUE_TIME since the slot is still held
+        waiting = _in_background(queued, collection, results, 'queued')
+        _find(rejected, collection, results, 'rejected')
+        waiting.join()
+        hold.join()
+        _find(after, collection, results, 'after')
+    finally:
+        for c in [holder, queued, rejected, after]:
+            c.close()
+
+    code, seconds = results['rejected']
+    if code != SERVER_OVERLOADED or seconds > 1.0:
+        print "{} a read over the queue length returned {} after {}s".format(test_name, code, seconds)
+        return False
+    code, seconds = results['queued']
+    if code != SERVER_OVERLOADED or seconds < MAX_QUEUE_TIME - 0.5 or seconds > HOLD_SECONDS:
+        print "{} a queued read returned {} after {}s".format(test_name, code, seconds)
+        return False
+    if results['after'][0] is not None:
+        print "{} a read after the slot was freed returned {}".format(test_name, results['after'][0])
+        return False
+
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_queued_request_expires(collection):
+    test_name = "test_queued_request_expires"
+    if not ADMISSION_PORT:
+        print "{} skipped, DOCLAYER_ADMISSION_PORT isn't set".format(test_name)
+        return True
+    _setup(collection)
+    holder, queued, after = _clients(collection, 3)
+    results = {}
+    try:
+        hold = _hold_slot(holder, collection)
+        # Its maxTimeMS runs out while it waits, well before MAX_QUEUE_TIME would turn it away
+        _find(queued, collection, results, 'first', max_time_ms=500)
+        # The expired request gave up its place in the queue, so the next one is queued rather than turned away
+        _find(queued, collection, results, 'second', max_time_ms=500)
+        hold.join()
+        _find(after, collection, results, 'after')
+    finally:
+        for c in [holder, queued, after]:
+            c.close()
+
+    for name in ['first', 'second']:
+        code, seconds = results[name]
+        if code != MAX_TIME_MS_EXPIRED or seconds < 0.4 or seconds > MAX_QUEUE_TIME:
+            print "{} the {} queued read with maxTimeMS 500 returned {} after {}s".format(
+                test_name, name, code, seconds)
+            return False
+    if results['after'][0] is not None:
+        print "{} a read after the slot was freed returned {}".format(test_name, results['after'][0])
+        return False
+
+    print "{} is OK".format(test_name)
+    return True
+
+
+tests = [locals()[attr] for attr in dir() if attr.startswith("test_")]
+
+#### `test_all()` is needed by the testing framework
+
+
+def test_all(collection1, collection2):
+    print "Admission control tests only use first collection specified"
+    okay = True
+    tmp_db = collection1.database.client["admission_control_tests_tmp_db"]
+    for t in tests:
+        okay = t(tmp_db["admission_control_tests_tmp_collection"]) and okay
+        if okay:
+            print util.alert("PASS", "okgreen")
+        else:
+            print util.alert("FAIL", "fail")
+    return okay
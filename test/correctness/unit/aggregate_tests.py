@@ -0,0 +1,146 @@
+#
+# aggregate_tests.py
+#
+# This source file is part of the FoundationDB open source project
+#
+# Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# MongoDB is a registered trademark of MongoDB, Inc.
+#
+
+import pymongo
+from pymongo.errors import OperationFailure
+import util
+from unit.planner_tests import Predicates
+
+# Big enough that a few hundred of them pass the 16 MB a reply can return
+PAD = 'x' * 60000
+
+
+def _setup(collection, n=30):
+    collection.insert_many([{'_id': i, 'k': i % 3, 'v': i} for i in range(n)])
+
+
+def test_group(collection):
+    test_name = "test_group"
+    _setup(collection)
+    result = list(
+        collection.aggregate([{
+            '$group': {
+                '_id': '$k',
+                'total': {
+                    '$sum': '$v'
+                },
+                'n': {
+                    '$sum': 1
+                },
+                'low': {
+                    '$min': '$v'
+                }
+            }
+        }]))
+    expected = [{'_id': k, 'total': sum(range(k, 30, 3)), 'n': 10, 'low': k} for k in range(3)]
+    if sorted(result) != sorted(expected):
+        print "{} returned {}, expected {}".format(test_name, result, expected)
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_match_sort_skip_limit(collection):
+    test_name = "test_match_sort_skip_limit"
+    _setup(collection)
+    result = [
+        doc['_id'] for doc in collection.aggregate([{
+            '$match': {
+                'k': 1
+            }
+        }, {
+            '$sort': {
+                'v': -1
+            }
+        }, {
+            '$skip': 1
+        }, {
+            '$limit': 3
+        }])
+    ]
+    if result != [25, 22, 19]:
+        print "{} returned {}, expected [25, 22, 19]".format(test_name, result)
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_match_uses_index(collection):
+    test_name = "test_match_uses_index"
+    _setup(collection)
+    collection.create_index([('k', pymongo.ASCENDING)], name='k')
+    pipeline = [{'$match': {'k': 2}}, {'$project': {'v': 1}}]
+    explanation = collection.database.command('aggregate', collection.name, pipeline=pipeline, explain=True)
+    plan = explanation['stages'][0]['$cursor']['plan']
+    if not Predicates.only_index_named('k', plan):
+        print "{} leading $match didn't use the index: {}".format(test_name, plan)
+        return False
+    result = sorted(doc['v'] for doc in collection.aggregate(pipeline))
+    if result != range(2, 30, 3):
+        print "{} returned {}".format(test_name, result)
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_result_under_reply_limit(collection):
+    test_name = "test_result_under_reply_limit"
+    _setup(collection, 200)
+    result = list(collection.aggregate([{'$project': {'pad': PAD}}]))
+    if len(result) != 200:
+        print "{} returned {} documents, expected 200".format(test_name, len(result))
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_result_over_reply_limit(collection):
+    test_name = "test_result_over_reply_limit"
+    _setup(collection, 400)
+    try:
+        list(collection.aggregate([{'$project': {'pad': PAD}}]))
+    except OperationFailure:
+        print "{} is OK".format(test_name)
+        return True
+    print "{} returned a result bigger than a reply can hold".format(test_name)
+    return False
+
+
+tests = [locals()[attr] for attr in dir() if attr.startswith("test_")]
+
+#### `test_all()` is needed by the testing framework
+
+
+def test_all(collection1, collection2):
+    print "Aggregate tests only use first collection specified"
+    okay = True
+    client = collection1.database.client
+    tmp_db = client["aggregate_tests_tmp_db"]
+    for t in tests:
+        tmp_db.drop_collection("aggregate_tests_tmp_collection")
+        okay = t(tmp_db["aggregate_tests_tmp_collection"]) and okay
+        if okay:
+            print util.alert("PASS", "okgreen")
+        else:
+            print util.alert("FAIL", "fail")
+    client.drop_database("aggregate_tests_tmp_db")
+    return okay
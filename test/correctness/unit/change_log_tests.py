@@ -0,0 +1,203 @@
+#
+# change_log_tests.py
+#
+# This source file is part of the FoundationDB open source project
+#
+# Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# MongoDB is a registered trademark of MongoDB, Inc.
+#
+
+
+import threading
+import time
+
+from pymongo.cursor import CursorType
+from pymongo.errors import OperationFailure
+import util
+
+# Seconds a read waits for events that should already be there, or arrive shortly
+WAIT_TIMEOUT = 10
+
+
+def _create(collection):
+    collection.database.command('create', collection.name, changeLog=True)
+
+
+def _watch(collection, resume_after=None, max_await_time_ms=0):
+    args = {'maxAwaitTimeMS': max_await_time_ms}
+    if resume_after is not None:
+        args['resumeAfter'] = resume_after
+    return collection.database.command('watch', collection.name, **args)
+
+
+def _present(collection):
+    # A token for the present: the watch command starts there without one, and returns where to continue
+    return _watch(collection)['resumeAfter']
+
+
+def _write_some(collection):
+    collection.insert_one({'_id': 1, 'n': 1})
+    collection.update_one({'_id': 1}, {'$set': {'n': 2}})
+    collection.insert_many([{'_id': 2}, {'_id': 3}])
+    collection.delete_one({'_id': 1})
+    collection.replace_one({'_id': 2}, {'n': 3})
+
+
+# The events _write_some() records, in commit order
+EXPECTED = [('write', 1), ('write', 1), ('write', 2), ('write', 3), ('delete', 1), ('write', 2)]
+
+
+def _summary(events):
+    return [(event['op'], event['documentKey']['_id']) for event in events]
+
+
+def test_watch_returns_writes_in_order(collection):
+    test_name = "test_watch_returns_writes_in_order"
+    _create(collection)
+    start = _present(collection)
+    _write_some(collection)
+    reply = _watch(collection, start)
+    if _summary(reply['events']) != EXPECTED:
+        print "{} returned {}, expected {}".format(test_name, _summary(reply['events']), EXPECTED)
+        return False
+    # Each event's _id resumes right after it, as does the token of the batch
+    rest = _watch(collection, reply['events'][2]['_id'])['events']
+    if _summary(rest) != EXPECTED[3:]:
+        print "{} resumed after the third event with {}".format(test_name, _summary(rest))
+        return False
+    if _watch(collection, reply['resumeAfter'])['events']:
+        print "{} returned events after the last one".format(test_name)
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_watch_batch_size(collection):
+    test_name = "test_watch_batch_size"
+    _create(collection)
+    start = _present(collection)
+    _write_some(collection)
+    events = []
+    token = start
+    for _ in range(len(EXPECTED)):
+        reply = collection.database.command('watch', collection.name, resumeAfter=token, batchSize=2,
+                                            maxAwaitTimeMS=0)
+        if len(reply['events']) > 2:
+            print "{} returned a batch of {} events".format(test_name, len(reply['events']))
+            return False
+        events += reply['events']
+        token = reply['resumeAfter']
+    if _summary(events) != EXPECTED:
+        print "{} returned {} in batches, expected {}".format(test_name, _summary(events), EXPECTED)
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_watch_wakes_on_write(collection):
+    test_name = "test_watch_wakes_on_write"
+    _create(collection)
+    start = _present(collection)
+
+    def write_later():
+        time.sleep(1)
+        collection.insert_one({'_id': 'late'})
+
+    writer = threading.Thread(target=write_later)
+    writer.start()
+    began = time.time()
+    reply = _watch(collection, start, max_await_time_ms=WAIT_TIMEOUT * 1000)
+    elapsed = time.time() - began
+    writer.join()
+    if _summary(reply['events']) != [('write', 'late')]:
+        print "{} returned {}".format(test_name, _summary(reply['events']))
+        return False
+    if elapsed >= WAIT_TIMEOUT:
+        print "{} waited out maxAwaitTimeMS instead of waking on the write".format(test_name)
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_tailable_cursor(collection):
+    test_name = "test_tailable_cursor"
+    _create(collection)
+    start = _present(collection)
+    _write_some(collection)
+    cursor = collection.find({'resumeAfter': start}, cursor_type=CursorType.TAILABLE_AWAIT)
+    events = []
+    deadline = time.time() + WAIT_TIMEOUT
+    while len(events) < len(EXPECTED) and cursor.alive and time.time() < deadline:
+        for event in cursor:
+            events.append(event)
+            if len(events) == len(EXPECTED):
+                break
+    if _summary(events) != EXPECTED:
+        print "{} returned {}, expected {}".format(test_name, _summary(events), EXPECTED)
+        return False
+
+    # The cursor stays open, and returns writes made after it was opened
+    collection.insert_one({'_id': 'later'})
+    later = []
+    deadline = time.time() + WAIT_TIMEOUT
+    while not later and cursor.alive and time.time() < deadline:
+        later = [event for event in cursor]
+    cursor.close()
+    if _summary(later) != [('write', 'later')]:
+        print "{} returned {} for a later write".format(test_name, _summary(later))
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_needs_change_log(collection):
+    test_name = "test_needs_change_log"
+    collection.insert_one({'_id': 1})
+    try:
+        _watch(collection)
+        print "{} watched a collection without a change log".format(test_name)
+        return False
+    except OperationFailure:
+        pass
+    try:
+        list(collection.find({}, cursor_type=CursorType.TAILABLE))
+        print "{} opened a tailable cursor on a collection without a change log".format(test_name)
+        return False
+    except OperationFailure:
+        pass
+    print "{} is OK".format(test_name)
+    return True
+
+
+tests = [locals()[attr] for attr in dir() if attr.startswith("test_")]
+
+#### `test_all()` is needed by the testing framework
+
+
+def test_all(collection1, collection2):
+    print "Change log tests only use first collection specified"
+    okay = True
+    client = collection1.database.client
+    tmp_db = client["change_log_tests_tmp_db"]
+    for t in tests:
+        tmp_db.drop_collection("change_log_tests_tmp_collection")
+        okay = t(tmp_db["change_log_tests_tmp_collection"]) and okay
+        if okay:
+            print util.alert("PASS", "okgreen")
+        else:
+            print util.alert("FAIL", "fail")
+    client.drop_database("change_log_tests_tmp_db")
+    return okay
@@ -0,0 +1,177 @@
+#
+# collection_stats_tests.py
+#
+# This source file is part of the FoundationDB open source project
+#
+# Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# MongoDB is a registered trademark of MongoDB, Inc.
+#
+
+
+import threading
+
+from pymongo import MongoClient
+from pymongo.errors import DuplicateKeyError
+import util
+
+
+def _stats(collection):
+    return collection.database.command('collStats', collection.name)
+
+
+def _check(test_name, collection, expected_count):
+    """
+    Checks collStats against `expected_count` and against a rescan of the collection. validate recounts the documents
+    and resets the stats to what it found, so stats that were right come through it unchanged and without a warning.
+    Then checks that dbStats and listDatabases agree with collStats, as this is the only collection in its database.
+    """
+    before = _stats(collection)
+    validated = collection.database.command('validate', collection.name)
+    after = _stats(collection)
+    if before['count'] != expected_count or validated['nrecords'] != expected_count:
+        print "{} counted {} documents, validate found {}, expected {}".format(test_name, before['count'],
+                                                                             validated['nrecords'], expected_count)
+        return False
+    if validated['warnings'] or before['size'] != after['size']:
+        print "{} had drifted stats: {} -> {}, warnings {}".format(test_name, before, after, validated['warnings'])
+        return False
+    if (expected_count == 0) != (before['size'] == 0):
+        print "{} reported size {} for {} documents".format(test_name, before['size'], expected_count)
+        return False
+
+    db_stats = collection.database.command('dbStats')
+    if db_stats['objects'] != before['count'] or db_stats['dataSize'] != before['size']:
+        print "{} dbStats {} doesn't match collStats {}".format(test_name, db_stats, before)
+        return False
+    listed = [db for db in collection.database.client.admin.command('listDatabases')['databases']
+              if db['name'] == collection.database.name]
+    if len(listed) != 1 or listed[0]['sizeOnDisk'] != before['size']:
+        print "{} listDatabases reported {}, expected size {}".format(test_name, listed, before['size'])
+        return False
+    return True
+
+
+def test_stats_follow_writes(collection):
+    test_name = "test_stats_follow_writes"
+    collection.insert_many([{'_id': i, 'v': 'x'} for i in range(10)])
+    if not _check(test_name, collection, 10):
+        return False
+    inserted = _stats(collection)['size']
+
+    collection.replace_one({'_id': 0}, {'v': 'x' * 1000})
+    if not _check(test_name, collection, 10):
+        return False
+    replaced = _stats(collection)['size']
+    if replaced <= inserted:
+        print "{} size didn't grow with a bigger replacement: {} -> {}".format(test_name, inserted, replaced)
+        return False
+
+    collection.update_one({'_id': 0}, {'$set': {'v': 'x'}})
+    if not _check(test_name, collection, 10):
+        return False
+    if _stats(collection)['size'] != inserted:
+        print "{} size didn't return to {} after $set undid the replace".format(test_name, inserted)
+        return False
+
+    collection.update_many({}, {'$set': {'w': 1}})
+    if not _check(test_name, collection, 10):
+        return False
+
+    collection.delete_one({'_id': 0})
+    if not _check(test_name, collection, 9):
+        return False
+    collection.delete_many({})
+    if not _check(test_name, collection, 0):
+        return False
+
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_stats_ignore_rejected_insert(collection):
+    test_name = "test_stats_ignore_rejected_insert"
+    collection.insert_one({'_id': 1, 'v': 'x'})
+    # A client retrying an insert that already committed gets a duplicate key error, which must not count twice
+    try:
+        collection.insert_one({'_id': 1, 'v': 'x'})
+        print "{} inserted a duplicate _id".format(test_name)
+        return False
+    except DuplicateKeyError:
+        pass
+    if not _check(test_name, collection, 1):
+        return False
+
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_stats_survive_conflicting_writers(collection):
+    test_name = "test_stats_survive_conflicting_writers"
+    collection.insert_many([{'_id': i, 'n': 0} for i in range(5)])
+
+    # Writers on their own connections update the same documents and insert new ones, so their transactions conflict
+    # and retry; a retried transaction must not apply its stats changes twice.
+    host, port = collection.database.client.address
+    writers = 4
+    rounds = 25
+    errors = []
+
+    def write(w):
+        client = MongoClient(host, port)
+        try:
+            c = client[collection.database.name][collection.name]
+            for r in range(rounds):
+                c.update_many({}, {'$inc': {'n': 1}, '$set': {'pad': 'x' * (r % 7)}})
+                c.insert_one({'_id': 'w{}r{}'.format(w, r)})
+        except Exception as e:
+            errors.append(e)
+        finally:
+            client.close()
+
+    threads = [threading.Thread(target=write, args=(w,)) for w in range(writers)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    if errors:
+        print "{} writer failed: {}".format(test_name, errors[0])
+        return False
+    if not _check(test_name, collection, 5 + writers * rounds):
+        return False
+
+    print "{} is OK".format(test_name)
+    return True
+
+
+tests = [locals()[attr] for attr in dir() if attr.startswith("test_")]
+
+#### `test_all()` is needed by the testing framework
+
+
+def test_all(collection1, collection2):
+    print "Collection stats tests only use first collection specified"
+    okay = True
+    client = collection1.database.client
+    tmp_db = client["collection_stats_tests_tmp_db"]
+    for t in tests:
+        client.drop_database("collection_stats_tests_tmp_db")
+        okay = t(tmp_db["collection_stats_tests_tmp_collection"]) and okay
+        if okay:
+            print util.alert("PASS", "okgreen")
+        else:
+            print util.alert("FAIL", "fail")
+    client.drop_database("collection_stats_tests_tmp_db")
+    return okay
@@ -199,6 +199,11 @@ def test_dict3():
     return ("Dict Test #2", {'_id': 'A', 'B': d}, [{'B': e}])
 
 
+def test_max_time_ms_field():
+    # An unwrapped query is only a filter, so these match the field rather than setting a time limit
+    return ("Field named maxTimeMS", {'_id': 1, 'maxTimeMS': 'soon'}, [{'maxTimeMS': 'soon'}, {'maxTimeMS': 'later'}])
+
+
 tests = [globals()[f] for f in dir() if f.startswith("test_")]
 
 
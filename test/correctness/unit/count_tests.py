@@ -0,0 +1,148 @@
+#
+# count_tests.py
+#
+# This source file is part of the FoundationDB open source project
+#
+# Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# MongoDB is a registered trademark of MongoDB, Inc.
+#
+
+
+import struct
+
+import util
+
+# The Doc Layer's root directory in FoundationDB, unless it was started with --root
+ROOT_DIRECTORY = 'document'
+
+DOCUMENTS = 10
+
+
+def _count(collection, query=None, **kwargs):
+    # The count command itself, as pymongo's count() drops a limit of 0 before sending it
+    args = {'query': query or {}}
+    args.update(kwargs)
+    return int(collection.database.command('count', collection.name, **args)['n'])
+
+
+def test_unfiltered_count_skip_and_limit(collection):
+    test_name = "test_unfiltered_count_skip_and_limit"
+    collection.insert_many([{'_id': i} for i in range(DOCUMENTS)])
+
+    # An empty query is answered from the document counter, and a query every document matches by a scan, so the two
+    # must agree on how skip and limit apply
+    scanned = {'_id': {'$exists': True}}
+    cases = [
+        ({}, DOCUMENTS),
+        ({'skip': 3}, DOCUMENTS - 3),
+        ({'skip': DOCUMENTS + 5}, 0),
+        ({'limit': 0}, DOCUMENTS),
+        ({'limit': 4}, 4),
+        ({'limit': -4}, 4),
+        ({'limit': DOCUMENTS + 5}, DOCUMENTS),
+        ({'skip': 3, 'limit': 0}, DOCUMENTS - 3),
+        ({'skip': 3, 'limit': 4}, 4),
+        ({'skip': 3, 'limit': -4}, 4),
+        ({'skip': 8, 'limit': 4}, 2),
+    ]
+    for args, expected in cases:
+        unfiltered = _count(collection, **args)
+        filtered = _count(collection, scanned, **args)
+        if unfiltered != expected or filtered != expected:
+            print "{} counted {} unfiltered and {} filtered with {}, expected {}".format(
+                test_name, unfiltered, filtered, args, expected)
+            return False
+
+    print "{} is OK".format(test_name)
+    return True
+
+
+def _open_fdb():
+    try:
+        import fdb
+        fdb.api_version(600)
+        return fdb, fdb.open()
+    except Exception as e:
+        return None, e
+
+
+def _document_count_key(fdb, db, collection):
+    metadata = fdb.directory.open(db, (ROOT_DIRECTORY, collection.database.name, collection.name, 'metadata'))
+    # As UnboundCollectionContext::getDocumentCountKey() encodes it: a string DataValue, as a key part
+    return metadata.key() + '\x28document count\x00'
+
+
+def test_validate_corrects_drifted_count(collection):
+    test_name = "test_validate_corrects_drifted_count"
+    fdb, db = _open_fdb()
+    if fdb is None:
+        print "{} skipped, FoundationDB isn't reachable from the test: {}".format(test_name, db)
+        return True
+    collection.insert_many([{'_id': i} for i in range(DOCUMENTS)])
+    validated = collection.database.command('validate', collection.name)
+    if validated['warnings'] or validated['nrecords'] != DOCUMENTS:
+        print "{} found a collection that was already off: {}".format(test_name, validated)
+        return False
+
+    # Make the counter drift, as it could for a collection written before it was maintained
+    @fdb.transactional
+    def drift(tr):
+        tr.add(_document_count_key(fdb, tr, collection), struct.pack('<q', 5))
+
+    drift(db)
+    if _count(collection) != DOCUMENTS + 5:
+        print "{} didn't read the drifted counter".format(test_name)
+        return False
+
+    validated = collection.database.command('validate', collection.name)
+    expected = "document count was {}, corrected to {}".format(DOCUMENTS + 5, DOCUMENTS)
+    if validated['nrecords'] != DOCUMENTS or list(validated['warnings']) != [expected]:
+        print "{} validate returned {}".format(test_name, validated)
+        return False
+    stats = collection.database.command('collStats', collection.name)
+    if _count(collection) != DOCUMENTS or stats['count'] != DOCUMENTS:
+        print "{} count stayed off after validate".format(test_name)
+        return False
+
+    # The corrected counter keeps following writes
+    collection.delete_one({'_id': 0})
+    if _count(collection) != DOCUMENTS - 1:
+        print "{} count didn't follow a delete after validate".format(test_name)
+        return False
+
+    print "{} is OK".format(test_name)
+    return True
+
+
+tests = [locals()[attr] for attr in dir() if attr.startswith("test_")]
+
+#### `test_all()` is needed by the testing framework
+
+
+def test_all(collection1, collection2):
+    print "Count tests only use first collection specified"
+    okay = True
+    client = collection1.database.client
+    tmp_db = client["count_tests_tmp_db"]
+    for t in tests:
+        tmp_db.drop_collection("count_tests_tmp_collection")
+        okay = t(tmp_db["count_tests_tmp_collection"]) and okay
+        if okay:
+            print util.alert("PASS", "okgreen")
+        else:
+            print util.alert("FAIL", "fail")
+    client.drop_database("count_tests_tmp_db")
+    return okay
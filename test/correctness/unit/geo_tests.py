@@ -0,0 +1,166 @@
+#
+# geo_tests.py
+#
+# This source file is part of the FoundationDB open source project
+#
+# Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# MongoDB is a registered trademark of MongoDB, Inc.
+#
+
+import pymongo
+from pymongo.errors import OperationFailure
+import util
+
+DOCUMENTS = [
+    {'_id': 1, 'loc': [0, 0]},
+    {'_id': 2, 'loc': [0.001, 0.001]},
+    {'_id': 3, 'loc': [1, 1]},
+    {'_id': 4, 'loc': [10, 10]},
+    # Arrays of points, only some of them near the origin
+    {'_id': 5, 'loc': [[10, 10], [0.0005, 0]]},
+    {'_id': 6, 'loc': {'type': 'Point', 'coordinates': [-0.001, 0]}},
+    {'_id': 7, 'loc': 'nowhere'},
+    {'_id': 8},
+    # Several points in the same regions, in different cells
+    {'_id': 9, 'loc': [[0.3, 0.3], [0.4, 0.2], [-0.5, -0.5]]},
+    # Either side of the antimeridian
+    {'_id': 10, 'loc': [179.999, 0]},
+    {'_id': 11, 'loc': [-179.999, 0]},
+]
+
+# Each query and the documents it matches
+QUERIES = [
+    ({'$geoWithin': {'$centerSphere': [[0, 0], 0.01]}}, [1, 2, 5, 6, 9]),
+    ({'$geoWithin': {'$center': [[0, 0], 2]}}, [1, 2, 3, 5, 6, 9]),
+    ({'$geoWithin': {'$box': [[-0.01, -0.01], [2, 2]]}}, [1, 2, 3, 5, 6, 9]),
+    ({'$geoWithin': {'$polygon': [[-1, -1], [2, -1], [-1, 2]]}}, [1, 2, 5, 6, 9]),
+    ({'$geoWithin': {'$geometry': {'type': 'Polygon', 'coordinates': [[[-1, -1], [2, -1], [-1, 2], [-1, -1]]]}}},
+     [1, 2, 5, 6, 9]),
+    ({'$geoWithin': {'$box': [[-180, -90], [180, 90]]}}, [1, 2, 3, 4, 5, 6, 9, 10, 11]),
+    ({'$geoWithin': {'$centerSphere': [[180, 0], 0.001]}}, [10, 11]),
+    ({'$near': {'$geometry': {'type': 'Point', 'coordinates': [0, 0]}, '$maxDistance': 1000}}, [1, 2, 5, 6]),
+    ({'$nearSphere': [0, 0], '$maxDistance': 0.001}, [1, 2, 5, 6]),
+    ({'$near': [0, 0], '$maxDistance': 1.5}, [1, 2, 3, 5, 6, 9]),
+]
+
+
+def _uses_geo_index(explanation):
+    if explanation['type'] == 'geo scan':
+        return explanation['index name'] == 'loc'
+    if 'source_plan' in explanation:
+        return _uses_geo_index(explanation['source_plan'])
+    return False
+
+
+def _check(test_name, collection, operand, expected_ids):
+    query = {'loc': operand}
+    # Sorted rather than made a set, so a document returned twice fails the check
+    ids = sorted(doc['_id'] for doc in collection.find(query))
+    if ids != sorted(expected_ids):
+        print "{} {} returned {}, expected {}".format(test_name, query, ids, sorted(expected_ids))
+        return False
+    return True
+
+
+def test_queries_with_index(collection):
+    test_name = "test_queries_with_index"
+    collection.create_index([('loc', pymongo.GEOSPHERE)], name='loc')
+    collection.insert_many(DOCUMENTS)
+    for operand, expected_ids in QUERIES:
+        if not _check(test_name, collection, operand, expected_ids):
+            return False
+        explanation = collection.find({'loc': operand}).explain()['explanation']
+        if not _uses_geo_index(explanation):
+            print "{} {} didn't use the geo index: {}".format(test_name, operand, explanation)
+            return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_queries_without_index(collection):
+    test_name = "test_queries_without_index"
+    collection.insert_many(DOCUMENTS)
+    for operand, expected_ids in QUERIES:
+        if not _check(test_name, collection, operand, expected_ids):
+            return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_index_follows_updates(collection):
+    test_name = "test_index_follows_updates"
+    collection.create_index([('loc', pymongo.GEOSPHERE)], name='loc')
+    collection.insert_many(DOCUMENTS)
+    collection.update_one({'_id': 4}, {'$set': {'loc': [0.0001, 0.0001]}})
+    collection.update_one({'_id': 5}, {'$set': {'loc': [[10, 10], [20, 20]]}})
+    collection.delete_one({'_id': 2})
+    if not _check(test_name, collection, {'$geoWithin': {'$centerSphere': [[0, 0], 0.01]}}, [1, 4, 6, 9]):
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_index_built_on_existing_documents(collection):
+    test_name = "test_index_built_on_existing_documents"
+    collection.insert_many(DOCUMENTS)
+    collection.create_index([('loc', pymongo.GEOSPHERE)], name='loc')
+    for operand, expected_ids in QUERIES:
+        if not _check(test_name, collection, operand, expected_ids):
+            return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_rejected_queries(collection):
+    test_name = "test_rejected_queries"
+    collection.create_index([('loc', pymongo.GEOSPHERE)], name='loc')
+    collection.insert_many(DOCUMENTS)
+    bad = [
+        ({'$near': [0, 0]}, "$near without $maxDistance"),
+        ({'$near': {'$geometry': {'type': 'Point', 'coordinates': [0, 0]}}}, "$near $geometry without $maxDistance"),
+        ({'$geoWithin': {'$centerSphere': [[0, 0], -1]}}, "a negative radius"),
+        ({'$geoWithin': {'$box': [[0, 0]]}}, "a box with one corner"),
+    ]
+    for operand, description in bad:
+        try:
+            list(collection.find({'loc': operand}))
+            print "{} accepted {}".format(test_name, description)
+            return False
+        except OperationFailure:
+            pass
+    print "{} is OK".format(test_name)
+    return True
+
+
+tests = [locals()[attr] for attr in dir() if attr.startswith("test_")]
+
+#### `test_all()` is needed by the testing framework
+
+
+def test_all(collection1, collection2):
+    print "Geo tests only use first collection specified"
+    okay = True
+    client = collection1.database.client
+    tmp_db = client["geo_tests_tmp_db"]
+    for t in tests:
+        tmp_db.drop_collection("geo_tests_tmp_collection")
+        okay = t(tmp_db["geo_tests_tmp_collection"]) and okay
+        if okay:
+            print util.alert("PASS", "okgreen")
+        else:
+            print util.alert("FAIL", "fail")
+    client.drop_database("geo_tests_tmp_db")
+    return okay
@@ -0,0 +1,149 @@
+#
+# index_key_filter_tests.py
+#
+# This source file is part of the FoundationDB open source project
+#
+# Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# MongoDB is a registered trademark of MongoDB, Inc.
+#
+
+
+from bson.int64 import Int64
+import pymongo
+import util
+
+# Documents with the fields of the compound index ('a', 'b', 'c'); queries fix `a` and filter on `c`, which the index
+# can only check from its keys
+DOCUMENTS = [
+    {'_id': 1, 'a': 1, 'c': 5},
+    {'_id': 2, 'a': 1, 'c': 5.0},
+    {'_id': 3, 'a': 1, 'c': Int64(5)},
+    {'_id': 4, 'a': 1, 'c': 4.5},
+    {'_id': 5, 'a': 1, 'c': 5.5},
+    {'_id': 6, 'a': 1, 'c': 6},
+    {'_id': 7, 'a': 1, 'c': None},
+    {'_id': 8, 'a': 1},
+    {'_id': 9, 'a': 1, 'b': 2, 'c': 3},
+    {'_id': 10, 'a': 1, 'c': 'five'},
+    {'_id': 11, 'a': 2, 'c': 5},
+]
+
+QUERIES = [
+    {'a': 1, 'c': 5},
+    {'a': 1, 'c': 4.5},
+    {'a': 1, 'c': {'$gt': 5}},
+    {'a': 1, 'c': {'$gte': 5}},
+    {'a': 1, 'c': {'$lte': 5}},
+    {'a': 1, 'c': {'$lt': 5.5}},
+    {'a': 1, 'c': {'$gt': 4.5, '$lte': 5}},
+    {'a': 1, 'c': None},
+    {'a': 1, 'c': {'$exists': False}},
+    {'a': 1, 'b': 2, 'c': {'$gt': 2}},
+    {'a': 1, 'c': 'five'},
+]
+
+
+def _has_key_filter(explanation):
+    if 'key filter' in explanation:
+        return True
+    if 'source_plan' in explanation:
+        return _has_key_filter(explanation['source_plan'])
+    return any(_has_key_filter(p) for p in explanation.get('plans', []))
+
+
+def _setup(indexed, plain, documents):
+    indexed.create_index([('a', pymongo.ASCENDING), ('b', pymongo.ASCENDING), ('c', pymongo.ASCENDING)], name='abc')
+    indexed.insert_many(documents)
+    plain.insert_many(documents)
+
+
+def _check(test_name, indexed, plain, query):
+    # The collection without indexes is answered by a table scan
+    ids = sorted(doc['_id'] for doc in indexed.find(query))
+    expected_ids = sorted(doc['_id'] for doc in plain.find(query))
+    if ids != expected_ids:
+        print "{} {} returned {}, a table scan returned {}".format(test_name, query, ids, expected_ids)
+        return False
+    return True
+
+
+def test_matches_table_scan(indexed, plain):
+    test_name = "test_matches_table_scan"
+    _setup(indexed, plain, DOCUMENTS)
+    for query in QUERIES:
+        if not _check(test_name, indexed, plain, query):
+            return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_explain_shows_key_filter(indexed, plain):
+    test_name = "test_explain_shows_key_filter"
+    _setup(indexed, plain, DOCUMENTS)
+    explanation = indexed.find({'a': 1, 'c': {'$gt': 4}}).explain()['explanation']
+    if not _has_key_filter(explanation):
+        print "{} index scan has no key filter: {}".format(test_name, explanation)
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_single_element_arrays(indexed, plain):
+    test_name = "test_single_element_arrays"
+    # An array makes the index multikey, where a key part is an element rather than the value, so nothing may be
+    # dropped on its key
+    _setup(indexed, plain, DOCUMENTS + [{'_id': 12, 'a': 1, 'c': [5]}, {'_id': 13, 'a': 1, 'c': [[5]]}])
+    for query in QUERIES + [{'a': 1, 'c': [5]}, {'a': 1, 'c': {'$gt': [4]}}]:
+        if not _check(test_name, indexed, plain, query):
+            return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_follows_updates(indexed, plain):
+    test_name = "test_follows_updates"
+    _setup(indexed, plain, DOCUMENTS)
+    for collection in (indexed, plain):
+        collection.update_one({'_id': 1}, {'$set': {'c': 7}})
+        collection.update_one({'_id': 8}, {'$set': {'c': 5}})
+        collection.update_one({'_id': 7}, {'$unset': {'c': 1}})
+    for query in QUERIES:
+        if not _check(test_name, indexed, plain, query):
+            return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+tests = [locals()[attr] for attr in dir() if attr.startswith("test_")]
+
+#### `test_all()` is needed by the testing framework
+
+
+def test_all(collection1, collection2):
+    print "Index key filter tests only use first collection specified"
+    okay = True
+    client = collection1.database.client
+    tmp_db = client["index_key_filter_tests_tmp_db"]
+    for t in tests:
+        tmp_db.drop_collection("index_key_filter_tests_indexed")
+        tmp_db.drop_collection("index_key_filter_tests_plain")
+        okay = t(tmp_db["index_key_filter_tests_indexed"], tmp_db["index_key_filter_tests_plain"]) and okay
+        if okay:
+            print util.alert("PASS", "okgreen")
+        else:
+            print util.alert("FAIL", "fail")
+    client.drop_database("index_key_filter_tests_tmp_db")
+    return okay
@@ -0,0 +1,109 @@
+#
+# max_time_ms_tests.py
+#
+# This source file is part of the FoundationDB open source project
+#
+# Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# MongoDB is a registered trademark of MongoDB, Inc.
+#
+
+
+from pymongo.errors import OperationFailure
+import util
+
+# Enough documents that no write of all of them finishes within a millisecond
+DOCUMENTS = 20000
+MAX_TIME_MS_EXPIRED = 50
+
+
+def _setup(collection):
+    collection.insert_many([{'_id': i, 'n': 0} for i in range(DOCUMENTS)])
+
+
+def _error_codes(func):
+    # Write commands report failures per statement in writeErrors, other failures fail the whole command
+    try:
+        reply = func()
+    except OperationFailure as e:
+        return [e.code]
+    return [error['code'] for error in reply.get('writeErrors', [])]
+
+
+def test_update_command_expires(collection):
+    test_name = "test_update_command_expires"
+    _setup(collection)
+    db = collection.database
+    codes = _error_codes(lambda: db.command(
+        'update', collection.name, updates=[{'q': {}, 'u': {'$inc': {'n': 1}}, 'multi': True}], maxTimeMS=1))
+    if codes != [MAX_TIME_MS_EXPIRED]:
+        print "{} update past its maxTimeMS returned errors {}".format(test_name, codes)
+        return False
+    if collection.find({'n': 1}).count() == DOCUMENTS:
+        print "{} update kept going past its maxTimeMS".format(test_name)
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_delete_command_expires(collection):
+    test_name = "test_delete_command_expires"
+    _setup(collection)
+    db = collection.database
+    codes = _error_codes(lambda: db.command('delete', collection.name, deletes=[{'q': {}, 'limit': 0}], maxTimeMS=1))
+    if codes != [MAX_TIME_MS_EXPIRED]:
+        print "{} delete past its maxTimeMS returned errors {}".format(test_name, codes)
+        return False
+    if collection.find().count() == 0:
+        print "{} delete kept going past its maxTimeMS".format(test_name)
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_writes_without_limit_finish(collection):
+    test_name = "test_writes_without_limit_finish"
+    _setup(collection)
+    db = collection.database
+    codes = _error_codes(lambda: db.command(
+        'update', collection.name, updates=[{'q': {}, 'u': {'$inc': {'n': 1}}, 'multi': True}], maxTimeMS=0))
+    codes += _error_codes(lambda: db.command('delete', collection.name, deletes=[{'q': {'n': 1}, 'limit': 0}]))
+    if codes or collection.find().count() != 0:
+        print "{} writes without a limit returned errors {}, left {} documents".format(
+            test_name, codes, collection.find().count())
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+tests = [locals()[attr] for attr in dir() if attr.startswith("test_")]
+
+#### `test_all()` is needed by the testing framework
+
+
+def test_all(collection1, collection2):
+    print "maxTimeMS tests only use first collection specified"
+    okay = True
+    client = collection1.database.client
+    tmp_db = client["max_time_ms_tests_tmp_db"]
+    for t in tests:
+        tmp_db.drop_collection("max_time_ms_tests_tmp_collection")
+        okay = t(tmp_db["max_time_ms_tests_tmp_collection"]) and okay
+        if okay:
+            print util.alert("PASS", "okgreen")
+        else:
+            print util.alert("FAIL", "fail")
+    client.drop_database("max_time_ms_tests_tmp_db")
+    return okay
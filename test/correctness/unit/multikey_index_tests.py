@@ -0,0 +1,139 @@
+#
+# multikey_index_tests.py
+#
+# This source file is part of the FoundationDB open source project
+#
+# Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# MongoDB is a registered trademark of MongoDB, Inc.
+#
+
+
+import pymongo
+import util
+
+# More documents than a multikey index scan remembers the ids of (INDEX_SCAN_DEDUP_MAX_DOCS), after which it reads
+# each document to tell whether it was already returned
+MANY_DOCUMENTS = 10100
+
+
+def _has_key_filter(explanation):
+    if 'key filter' in explanation:
+        return True
+    if 'source_plan' in explanation:
+        return _has_key_filter(explanation['source_plan'])
+    return any(_has_key_filter(p) for p in explanation.get('plans', []))
+
+
+def _check_ids(test_name, collection, query, expected_ids):
+    # Not made a set, so that a document returned twice fails the check
+    ids = sorted(doc['_id'] for doc in collection.find(query))
+    if ids != sorted(expected_ids):
+        if len(ids) != len(set(ids)):
+            print "{} {} returned duplicates".format(test_name, query)
+        else:
+            print "{} {} returned {}, expected {}".format(test_name, query, ids, sorted(expected_ids))
+        return False
+    return True
+
+
+def test_becomes_multikey(collection):
+    test_name = "test_becomes_multikey"
+    collection.create_index([('a', pymongo.ASCENDING), ('c', pymongo.ASCENDING)], name='ac')
+    collection.insert_many([{'_id': i, 'a': 1, 'c': i} for i in range(10)])
+    # Only a scan of an index that isn't multikey filters entries on their keys
+    query = {'a': 1, 'c': {'$gte': 5}}
+    if not _has_key_filter(collection.find(query).explain()['explanation']):
+        print "{} new index was taken to be multikey".format(test_name)
+        return False
+    # A single element array has one entry, like its element
+    collection.insert_one({'_id': 10, 'a': 1, 'c': [10]})
+    if not _has_key_filter(collection.find(query).explain()['explanation']):
+        print "{} single element array made the index multikey".format(test_name)
+        return False
+    collection.insert_one({'_id': 11, 'a': 1, 'c': [3, 11]})
+    if _has_key_filter(collection.find(query).explain()['explanation']):
+        print "{} array didn't make the index multikey".format(test_name)
+        return False
+    if not _check_ids(test_name, collection, query, [5, 6, 7, 8, 9, 10, 11]):
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_multikey_range_scan(collection):
+    test_name = "test_multikey_range_scan"
+    collection.create_index([('a', pymongo.ASCENDING)], name='a')
+    collection.insert_many([
+        {'_id': 1, 'a': [1, 2, 3]},
+        {'_id': 2, 'a': [3, 3, 4]},
+        {'_id': 3, 'a': 2},
+        {'_id': 4, 'a': [[1, 2], 5]},
+        {'_id': 5, 'a': []},
+    ])
+    checks = [
+        ({'a': {'$gte': 1}}, [1, 2, 3, 4]),
+        ({'a': {'$gt': 2, '$lte': 4}}, [1, 2]),
+        ({'a': {'$lt': 3}}, [1, 3]),
+        ({'a': 3}, [1, 2]),
+    ]
+    for query, expected_ids in checks:
+        if not _check_ids(test_name, collection, query, expected_ids):
+            return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_multikey_range_scan_past_remembered_ids(collection):
+    test_name = "test_multikey_range_scan_past_remembered_ids"
+    collection.create_index([('a', pymongo.ASCENDING)], name='a')
+    collection.insert_many([{'_id': i, 'a': [i, i + 1, MANY_DOCUMENTS * 2]} for i in range(MANY_DOCUMENTS)])
+    if not _check_ids(test_name, collection, {'a': {'$gte': 0}}, range(MANY_DOCUMENTS)):
+        return False
+    if not _check_ids(test_name, collection, {'a': {'$gte': MANY_DOCUMENTS - 10}}, range(MANY_DOCUMENTS)):
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_non_multikey_range_scan(collection):
+    test_name = "test_non_multikey_range_scan"
+    collection.create_index([('a', pymongo.ASCENDING)], name='a')
+    collection.insert_many([{'_id': i, 'a': i % 10} for i in range(100)])
+    if not _check_ids(test_name, collection, {'a': {'$gte': 3, '$lt': 5}}, [i for i in range(100) if 3 <= i % 10 < 5]):
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+tests = [locals()[attr] for attr in dir() if attr.startswith("test_")]
+
+#### `test_all()` is needed by the testing framework
+
+
+def test_all(collection1, collection2):
+    print "Multikey index tests only use first collection specified"
+    okay = True
+    client = collection1.database.client
+    tmp_db = client["multikey_index_tests_tmp_db"]
+    for t in tests:
+        tmp_db.drop_collection("multikey_index_tests_tmp_collection")
+        okay = t(tmp_db["multikey_index_tests_tmp_collection"]) and okay
+        if okay:
+            print util.alert("PASS", "okgreen")
+        else:
+            print util.alert("FAIL", "fail")
+    client.drop_database("multikey_index_tests_tmp_db")
+    return okay
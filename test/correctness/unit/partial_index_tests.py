@@ -0,0 +1,127 @@
+#
+# partial_index_tests.py
+#
+# This source file is part of the FoundationDB open source project
+#
+# Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# MongoDB is a registered trademark of MongoDB, Inc.
+#
+
+import pymongo
+import util
+from unit.planner_tests import Predicates
+
+
+def _check(test_name, collection, query, expected_ids, uses_index):
+    ids = sorted(doc['_id'] for doc in collection.find(query))
+    if ids != sorted(expected_ids):
+        print "{} {} returned {}, expected {}".format(test_name, query, ids, sorted(expected_ids))
+        return False
+    explanation = collection.find(query).explain()['explanation']
+    if Predicates.only_index_named('partial', explanation) != uses_index:
+        print "{} {} {} the partial index: {}".format(test_name, query, "didn't use" if uses_index else "used",
+                                                     explanation)
+        return False
+    return True
+
+
+def _setup(collection):
+    collection.create_index([('a', pymongo.ASCENDING)], name='partial', partialFilterExpression={'b': {'$gt': 5}})
+    collection.insert_many([
+        {'_id': 1, 'a': 1, 'b': 1},
+        {'_id': 2, 'a': 1, 'b': 6},
+        {'_id': 3, 'a': 1, 'b': 20},
+        {'_id': 4, 'a': 2, 'b': 20},
+        {'_id': 5, 'a': 1},
+    ])
+
+
+def test_query_implying_filter(collection):
+    test_name = "test_query_implying_filter"
+    _setup(collection)
+    if not _check(test_name, collection, {'a': 1, 'b': {'$gt': 5}}, [2, 3], True):
+        return False
+    if not _check(test_name, collection, {'a': 1, 'b': {'$gte': 10}}, [3], True):
+        return False
+    if not _check(test_name, collection, {'a': 1, 'b': 20}, [3], True):
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_query_not_implying_filter(collection):
+    test_name = "test_query_not_implying_filter"
+    _setup(collection)
+    # The index holds no entries for documents 1 and 5, so it can't answer these
+    if not _check(test_name, collection, {'a': 1}, [1, 2, 3, 5], False):
+        return False
+    if not _check(test_name, collection, {'a': 1, 'b': {'$gt': 0}}, [1, 2, 3], False):
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_update_into_and_out_of_filter(collection):
+    test_name = "test_update_into_and_out_of_filter"
+    _setup(collection)
+    collection.update_one({'_id': 1}, {'$set': {'b': 30}})
+    collection.update_one({'_id': 3}, {'$set': {'b': 0}})
+    if not _check(test_name, collection, {'a': 1, 'b': {'$gt': 5}}, [1, 2], True):
+        return False
+    collection.delete_one({'_id': 2})
+    if not _check(test_name, collection, {'a': 1, 'b': {'$gt': 5}}, [1], True):
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_reject_bad_partial_indexes(collection):
+    test_name = "test_reject_bad_partial_indexes"
+    bad = [
+        ({'partialFilterExpression': 5}, "a non-object filter"),
+        ({'partialFilterExpression': {'b': {'$bogus': 1}}}, "an invalid filter"),
+        ({'partialFilterExpression': {'b': {'$gt': 5}}, 'sparse': True}, "a sparse partial index"),
+    ]
+    for options, description in bad:
+        try:
+            collection.create_index([('a', pymongo.ASCENDING)], name='bad', **options)
+            print "{} accepted {}".format(test_name, description)
+            return False
+        except Exception:
+            pass
+    print "{} is OK".format(test_name)
+    return True
+
+
+tests = [locals()[attr] for attr in dir() if attr.startswith("test_")]
+
+#### `test_all()` is needed by the testing framework
+
+
+def test_all(collection1, collection2):
+    print "Partial index tests only use first collection specified"
+    okay = True
+    client = collection1.database.client
+    tmp_db = client["partial_index_tests_tmp_db"]
+    for t in tests:
+        tmp_db.drop_collection("partial_index_tests_tmp_collection")
+        okay = t(tmp_db["partial_index_tests_tmp_collection"]) and okay
+        if okay:
+            print util.alert("PASS", "okgreen")
+        else:
+            print util.alert("FAIL", "fail")
+    client.drop_database("partial_index_tests_tmp_db")
+    return okay
@@ -0,0 +1,174 @@
+#
+# pipelining_tests.py
+#
+# This source file is part of the FoundationDB open source project
+#
+# Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# MongoDB is a registered trademark of MongoDB, Inc.
+#
+
+
+import socket
+import struct
+
+import bson
+import util
+
+# Reads only run concurrently on a connection if the Doc Layer was started with
+# --knob_connection_max_read_pipeline_depth above 1, as run-tests.bash does. The answers must be the same either way.
+
+OP_REPLY = 1
+OP_INSERT = 2002
+OP_QUERY = 2004
+
+SLOW_DOCUMENTS = 3000
+
+
+class RawConnection(object):
+    """
+    A connection that sends requests without waiting for the replies to earlier ones, as a driver pipelining them
+    would, which pymongo doesn't do.
+    """
+
+    def __init__(self, collection):
+        self.sock = socket.create_connection(collection.database.client.address)
+        self.ns = collection.full_name
+        self.cmd_ns = collection.database.name + '.$cmd'
+        self.next_id = 1000
+
+    def close(self):
+        self.sock.close()
+
+    def _send(self, op_code, body):
+        self.next_id += 1
+        self.sock.sendall(struct.pack('<iiii', 16 + len(body), self.next_id, 0, op_code) + body)
+        return self.next_id
+
+    def query(self, query, ns=None):
+        body = struct.pack('<i', 0) + (ns or self.ns) + '\x00' + struct.pack('<ii', 0, 0) + bson.BSON.encode(query)
+        return self._send(OP_QUERY, body)
+
+    def get_last_error(self):
+        return self.query({'getLastError': 1}, self.cmd_ns)
+
+    def insert(self, document):
+        # Legacy inserts have no reply
+        return self._send(OP_INSERT, struct.pack('<i', 0) + self.ns + '\x00' + bson.BSON.encode(document))
+
+    def _recv(self, size):
+        data = ''
+        while len(data) < size:
+            chunk = self.sock.recv(size - len(data))
+            if not chunk:
+                raise IOError("connection closed")
+            data += chunk
+        return data
+
+    def reply(self):
+        """Returns the request id the next reply answers, and its documents."""
+        length, _, response_to, op_code = struct.unpack('<iiii', self._recv(16))
+        body = self._recv(length - 16)
+        if op_code != OP_REPLY:
+            raise IOError("unexpected op code {}".format(op_code))
+        return response_to, bson.decode_all(body[20:])
+
+
+def _setup(collection):
+    collection.insert_many([{'_id': i, 'pad': 'x' * 100} for i in range(SLOW_DOCUMENTS)])
+
+
+def test_replies_keep_request_order(collection):
+    test_name = "test_replies_keep_request_order"
+    _setup(collection)
+    conn = RawConnection(collection)
+    try:
+        # Scans of the whole collection alternate with lookups that would finish long before them if run alone
+        sent = []
+        for i in range(10):
+            if i % 2 == 0:
+                sent.append((conn.query({'pad': {'$regex': 'nomatch'}}), []))
+            else:
+                sent.append((conn.query({'_id': i}), [i]))
+        for request_id, expected in sent:
+            response_to, documents = conn.reply()
+            ids = [doc['_id'] for doc in documents]
+            if response_to != request_id or ids != expected:
+                print "{} got a reply to {} with {}, expected one to {} with {}".format(
+                    test_name, response_to, ids, request_id, expected)
+                return False
+    finally:
+        conn.close()
+
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_get_last_error_after_pipelined_reads(collection):
+    test_name = "test_get_last_error_after_pipelined_reads"
+    _setup(collection)
+    conn = RawConnection(collection)
+    try:
+        conn.insert({'_id': 0})  # A duplicate, which getLastError must report despite the reads sent after it
+        first = [conn.query({'pad': {'$regex': 'nomatch'}}), conn.query({'_id': 1})]
+        duplicate_error = conn.get_last_error()
+        conn.insert({'_id': 'new'})
+        inserted = conn.get_last_error()
+        found = conn.query({'_id': 'new'})
+
+        for request_id in first:
+            response_to, _ = conn.reply()
+            if response_to != request_id:
+                print "{} got a reply to {} before the one to {}".format(test_name, response_to, request_id)
+                return False
+        response_to, documents = conn.reply()
+        if response_to != duplicate_error or documents[0].get('err') is None:
+            print "{} getLastError after a duplicate insert returned {}".format(test_name, documents)
+            return False
+        response_to, documents = conn.reply()
+        if response_to != inserted or documents[0].get('err') is not None:
+            print "{} getLastError after an insert returned {}".format(test_name, documents)
+            return False
+        # A read after getLastError sees the write it acknowledged
+        response_to, documents = conn.reply()
+        if response_to != found or [doc['_id'] for doc in documents] != ['new']:
+            print "{} read after getLastError returned {}".format(test_name, documents)
+            return False
+    finally:
+        conn.close()
+
+    print "{} is OK".format(test_name)
+    return True
+
+
+tests = [locals()[attr] for attr in dir() if attr.startswith("test_")]
+
+#### `test_all()` is needed by the testing framework
+
+
+def test_all(collection1, collection2):
+    print "Pipelining tests only use first collection specified"
+    okay = True
+    client = collection1.database.client
+    tmp_db = client["pipelining_tests_tmp_db"]
+    for t in tests:
+        tmp_db.drop_collection("pipelining_tests_tmp_collection")
+        okay = t(tmp_db["pipelining_tests_tmp_collection"]) and okay
+        if okay:
+            print util.alert("PASS", "okgreen")
+        else:
+            print util.alert("FAIL", "fail")
+    client.drop_database("pipelining_tests_tmp_db")
+    return okay
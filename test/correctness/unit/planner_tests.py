@@ -38,7 +38,7 @@ class Predicates(object):
     @staticmethod
     def only_index_named(index_name, explanation):
         this_type = explanation['type']
-        if this_type == 'index scan' and explanation['index name'] == index_name:
+        if this_type in ('index scan', 'skip scan') and explanation['index name'] == index_name:
             return True
         elif this_type == 'union':
             return all([Predicates.only_index_named(index_name, p) for p in explanation['plans']])
@@ -136,13 +136,13 @@ def test_simple_5():
 
 
 def test_simple_6():
-    return ("Planner is greedy", [Index("one", [("a", 1)]), Index("two", [("b", 1)])], {
+    return ("Planner ignores term order", [Index("one", [("a", 1)]), Index("two", [("b", 1)])], {
         '$and': [{
             'b': 1
         }, {
             'a': 1
         }]
-    }, lambda e: Predicates.only_index_named("two", e))
+    }, lambda e: Predicates.only_index_named("one", e))
 
 
 def test_simple_7():
@@ -172,6 +172,16 @@ def test_simple_8():
     }, Predicates.no_table_scan)
 
 
+def test_simple_9():
+    return ("Planner ignores term order reversed", [Index("one", [("a", 1)]), Index("two", [("b", 1)])], {
+        '$and': [{
+            'a': 1
+        }, {
+            'b': 1
+        }]
+    }, lambda e: Predicates.only_index_named("one", e))
+
+
 ### Compound Index Tests ###
 
 
@@ -254,7 +264,7 @@ def test_compound_5():
                  }, {
                      'c': 1
                  }]
-             }, lambda e: Predicates.only_index_named("simple", e))
+             }, lambda e: Predicates.only_index_named("compound", e))
 
 
 def test_compound_6():
@@ -274,7 +284,7 @@ def test_compound_6():
 
 
 def test_compound_7():
-    return ("Planner is greedy to a fault",
+    return ("Planner ignores term order with compound indexes",
             [Index("long", [("d", 1), ("b", 1), ("c", 1)]),
              Index("short", [("b", 1), ("c", 1)])], {
                  '$and': [{
@@ -287,6 +297,26 @@ def test_compound_7():
              }, lambda e: Predicates.only_index_named("short", e))
 
 
+def test_compound_8():
+    return ("Compound Index Skip Scan", [Index("compound", [("a", 1), ("b", 1)])], {
+        "b": 1
+    }, lambda e: Predicates.only_index_named("compound", e))
+
+
+def test_compound_9():
+    return ("Planner ignores term order with compound indexes reversed",
+            [Index("long", [("d", 1), ("b", 1), ("c", 1)]),
+             Index("short", [("b", 1), ("c", 1)])], {
+                 '$and': [{
+                     'd': 1
+                 }, {
+                     'c': 1
+                 }, {
+                     'b': 1
+                 }]
+             }, lambda e: Predicates.only_index_named("short", e))
+
+
 tests = [globals()[f] for f in dir() if f.startswith("test_")]
 
 
@@ -308,9 +338,32 @@ def test(collection, t):
         return False
 
 
+def race_picks_later_candidate(collection):
+    # Without a winner for the shape the first candidate, for `a`, answers the query, but the one for `b` only has one
+    # document to look at and wins the race, so later queries of the shape use it
+    sys.stdout.write("Testing Race winner is used for later queries...")
+    collection.ensure_index([("a", 1)], name="one")
+    collection.ensure_index([("b", 1)], name="two")
+    collection.insert_many([{'_id': i, 'a': 1, 'b': i} for i in range(3000)])
+    query = {'a': 1, 'b': 5}
+    before = collection.find(query).explain()['explanation']
+    ids = [doc['_id'] for doc in collection.find(query)]
+    after = collection.find(query).explain()['explanation']
+    if ids == [5] and Predicates.only_index_named("one", before) and Predicates.only_index_named("two", after):
+        print util.alert('PASS', 'okgreen')
+        return True
+    print util.alert('FAIL', 'fail')
+    print ids, before, after
+    return False
+
+
 def test_all(collection1, collection2):
     print "Planner tests only use first collection specified"
     okay = True
     for t in tests:
         okay = test(collection1, t()) and okay
+    client = collection1.database.client
+    client.drop_database("planner_tests_tmp_db")
+    okay = race_picks_later_candidate(client["planner_tests_tmp_db"]["planner_tests_tmp_collection"]) and okay
+    client.drop_database("planner_tests_tmp_db")
     return okay
@@ -0,0 +1,134 @@
+#
+# query_cache_tests.py
+#
+# This source file is part of the FoundationDB open source project
+#
+# Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# MongoDB is a registered trademark of MongoDB, Inc.
+#
+
+
+from pymongo import MongoClient
+import util
+
+# The result cache is off by default; run the Doc Layer with --knob_query_cache_max_bytes 65536 to cover the
+# enabled half of these tests. Each half reports itself skipped on a server configured the other way.
+
+QUERY = {'a': 1}
+
+
+def _cache_stats(collection):
+    return collection.database.command('serverStatus')['queryCache']
+
+
+def _ids(collection):
+    return sorted(doc['_id'] for doc in collection.find(QUERY))
+
+
+def _other_connection(collection):
+    # A second client, so the write reaches the server on a connection that never ran the cached query
+    host, port = collection.database.client.address
+    return MongoClient(host, port)
+
+
+def test_invalidated_by_write_from_other_connection(collection):
+    test_name = "test_invalidated_by_write_from_other_connection"
+    if not _cache_stats(collection)['enabled']:
+        print "{} skipped, the query cache is disabled".format(test_name)
+        return True
+    collection.insert_many([{'_id': 1, 'a': 1}, {'_id': 2, 'a': 2}])
+
+    _ids(collection)
+    before = _cache_stats(collection)
+    if _ids(collection) != [1]:
+        print "{} returned the wrong documents before the write".format(test_name)
+        return False
+    after = _cache_stats(collection)
+    if after['hits'] != before['hits'] + 1:
+        print "{} did not answer the repeated query from the cache: {} -> {}".format(test_name, before, after)
+        return False
+
+    other = _other_connection(collection)
+    try:
+        other[collection.database.name][collection.name].insert_one({'_id': 3, 'a': 1})
+    finally:
+        other.close()
+
+    result = _ids(collection)
+    final = _cache_stats(collection)
+    if result != [1, 3]:
+        print "{} returned {} after a write from another connection, expected [1, 3]".format(test_name, result)
+        return False
+    if final['stale'] != after['stale'] + 1 or final['hits'] != after['hits']:
+        print "{} served a stale entry: {} -> {}".format(test_name, after, final)
+        return False
+
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_disabled_cache_is_bypassed(collection):
+    test_name = "test_disabled_cache_is_bypassed"
+    if _cache_stats(collection)['enabled']:
+        print "{} skipped, the query cache is enabled".format(test_name)
+        return True
+    collection.insert_many([{'_id': 1, 'a': 1}, {'_id': 2, 'a': 2}])
+
+    before = _cache_stats(collection)
+    first = _ids(collection)
+    second = _ids(collection)
+    other = _other_connection(collection)
+    try:
+        other[collection.database.name][collection.name].insert_one({'_id': 3, 'a': 1})
+    finally:
+        other.close()
+    third = _ids(collection)
+    after = _cache_stats(collection)
+
+    if (first, second, third) != ([1], [1], [1, 3]):
+        print "{} returned {}, {} and {}".format(test_name, first, second, third)
+        return False
+    for counter in ['hits', 'misses', 'inserts']:
+        if after[counter] != before[counter]:
+            print "{} changed the {} counter: {} -> {}".format(test_name, counter, before, after)
+            return False
+    if after['entries'] != 0 or after['bytes'] != 0:
+        print "{} left entries in a disabled cache: {}".format(test_name, after)
+        return False
+
+    print "{} is OK".format(test_name)
+    return True
+
+
+tests = [locals()[attr] for attr in dir() if attr.startswith("test_")]
+
+#### `test_all()` is needed by the testing framework
+
+
+def test_all(collection1, collection2):
+    print "Query cache tests only use first collection specified"
+    okay = True
+    client = collection1.database.client
+    tmp_db = client["query_cache_tests_tmp_db"]
+    for t in tests:
+        tmp_db.drop_collection("query_cache_tests_tmp_collection")
+        okay = t(tmp_db["query_cache_tests_tmp_collection"]) and okay
+        if okay:
+            print util.alert("PASS", "okgreen")
+        else:
+            print util.alert("FAIL", "fail")
+    client.drop_database("query_cache_tests_tmp_db")
+    return okay
@@ -0,0 +1,176 @@
+#
+# regex_index_tests.py
+#
+# This source file is part of the FoundationDB open source project
+#
+# Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# MongoDB is a registered trademark of MongoDB, Inc.
+#
+
+
+import util
+
+DOCUMENTS = [
+    {'_id': 1, 's': 'acme'},
+    {'_id': 2, 's': 'ACME corp'},
+    {'_id': 3, 's': 'Acme'},
+    {'_id': 4, 's': 'acmex'},
+    {'_id': 5, 's': 'acmme'},
+    {'_id': 6, 's': 'xacme'},
+    {'_id': 7, 's': 'ac'},
+    {'_id': 8, 's': 'bar'},
+    {'_id': 9, 's': 'foobar'},
+    {'_id': 10, 's': 'xbar\n'},
+    {'_id': 11, 's': 'bar\n\n'},
+    {'_id': 12, 's': 'bar\nx'},
+    {'_id': 13, 's': 'barx'},
+    {'_id': 14, 's': 'br'},
+    {'_id': 15, 's': 'baar'},
+    {'_id': 16, 's': 'barr'},
+    {'_id': 17, 's': 'FOOBAR'},
+    {'_id': 18, 's': 'example.com'},
+    {'_id': 19, 's': 'examplecom'},
+    {'_id': 20, 's': 5},
+    {'_id': 21},
+    {'_id': 22, 's': ['zz', 'Acme inc']},
+    {'_id': 23, 's': ['foobar', 'zz']},
+]
+
+
+def _regex(pattern, options=''):
+    return {'s': {'$regex': pattern, '$options': options}}
+
+
+# Queries either index answers with a range scan, and the index each should use
+INDEXED_QUERIES = [
+    (_regex('^acme', 'i'), 's_folded'),
+    (_regex('^acme'), 's_folded'),
+    (_regex('\\Aacme', 'i'), 's_folded'),
+    (_regex('^acme c', 'i'), 's_folded'),
+    (_regex('^acmex?', 'i'), 's_folded'),
+    (_regex('^acm*e', 'i'), 's_folded'),
+    (_regex('^acme+', 'i'), 's_folded'),
+    (_regex('^acm{2}e', 'i'), 's_folded'),
+    (_regex('bar$'), 's_reversed'),
+    (_regex('foobar$'), 's_reversed'),
+    (_regex('ba?r$'), 's_reversed'),
+    (_regex('ba*r$'), 's_reversed'),
+    (_regex('a{2}r$'), 's_reversed'),
+    (_regex('\\.com$'), 's_reversed'),
+]
+
+# Queries neither index can answer, which must still return the right documents
+OTHER_QUERIES = [
+    _regex('acme', 'i'),
+    _regex('^acme', 'm'),
+    _regex('bar$', 'i'),
+    _regex('bar$', 'm'),
+    _regex('bar+$'),
+    _regex('bar|acme'),
+    _regex('(?i)bar$'),
+]
+
+
+def _index_names(explanation):
+    names = []
+    if explanation.get('type') == 'index scan':
+        names.append(explanation['index name'])
+    if 'source_plan' in explanation:
+        names += _index_names(explanation['source_plan'])
+    for p in explanation.get('plans', []):
+        names += _index_names(p)
+    return names
+
+
+def _setup(indexed, plain):
+    indexed.create_index([('s', 'folded')], name='s_folded')
+    indexed.create_index([('s', 'reversed')], name='s_reversed')
+    indexed.insert_many(DOCUMENTS)
+    plain.insert_many(DOCUMENTS)
+
+
+def _check(test_name, indexed, plain, query):
+    # The collection without indexes is answered by a table scan
+    ids = sorted(doc['_id'] for doc in indexed.find(query))
+    expected_ids = sorted(doc['_id'] for doc in plain.find(query))
+    if ids != expected_ids:
+        print "{} {} returned {}, a table scan returned {}".format(test_name, query, ids, expected_ids)
+        return False
+    return True
+
+
+def test_indexed_regex_matches_table_scan(indexed, plain):
+    test_name = "test_indexed_regex_matches_table_scan"
+    _setup(indexed, plain)
+    for query, index in INDEXED_QUERIES:
+        names = _index_names(indexed.find(query).explain()['explanation'])
+        if names != [index]:
+            print "{} {} scanned {}, expected {}".format(test_name, query, names, index)
+            return False
+        if not _check(test_name, indexed, plain, query):
+            return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_other_regex_matches_table_scan(indexed, plain):
+    test_name = "test_other_regex_matches_table_scan"
+    _setup(indexed, plain)
+    for query in OTHER_QUERIES:
+        names = _index_names(indexed.find(query).explain()['explanation'])
+        if names:
+            print "{} {} scanned {}, which can't answer it".format(test_name, query, names)
+            return False
+        if not _check(test_name, indexed, plain, query):
+            return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_indexed_regex_follows_updates(indexed, plain):
+    test_name = "test_indexed_regex_follows_updates"
+    _setup(indexed, plain)
+    for c in [indexed, plain]:
+        c.update_one({'_id': 1}, {'$set': {'s': 'zzz'}})
+        c.update_one({'_id': 8}, {'$set': {'s': 'ACME bar\n'}})
+        c.delete_one({'_id': 9})
+    for query, _ in INDEXED_QUERIES:
+        if not _check(test_name, indexed, plain, query):
+            return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+tests = [locals()[attr] for attr in dir() if attr.startswith("test_")]
+
+#### `test_all()` is needed by the testing framework
+
+
+def test_all(collection1, collection2):
+    print "Regex index tests only use first collection specified"
+    okay = True
+    client = collection1.database.client
+    tmp_db = client["regex_index_tests_tmp_db"]
+    for t in tests:
+        tmp_db.drop_collection("regex_index_tests_indexed")
+        tmp_db.drop_collection("regex_index_tests_plain")
+        okay = t(tmp_db["regex_index_tests_indexed"], tmp_db["regex_index_tests_plain"]) and okay
+        if okay:
+            print util.alert("PASS", "okgreen")
+        else:
+            print util.alert("FAIL", "fail")
+    client.drop_database("regex_index_tests_tmp_db")
+    return okay
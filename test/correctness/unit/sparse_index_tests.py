@@ -0,0 +1,131 @@
+#
+# sparse_index_tests.py
+#
+# This source file is part of the FoundationDB open source project
+#
+# Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# MongoDB is a registered trademark of MongoDB, Inc.
+#
+
+import pymongo
+import util
+from unit.planner_tests import Predicates
+
+
+def _check(test_name, collection, query, expected_ids, uses_index):
+    ids = sorted(doc['_id'] for doc in collection.find(query))
+    if ids != sorted(expected_ids):
+        print "{} {} returned {}, expected {}".format(test_name, query, ids, sorted(expected_ids))
+        return False
+    explanation = collection.find(query).explain()['explanation']
+    if Predicates.only_index_named('sparse', explanation) != uses_index:
+        print "{} {} {} the sparse index: {}".format(test_name, query, "didn't use" if uses_index else "used",
+                                                    explanation)
+        return False
+    return True
+
+
+def _setup(collection):
+    collection.create_index([('a', pymongo.ASCENDING)], name='sparse', sparse=True)
+    collection.insert_many([
+        {'_id': 1, 'a': 1},
+        {'_id': 2, 'a': None},
+        {'_id': 3},
+        {'_id': 4, 'a': [1, 2]},
+        {'_id': 5, 'b': 1},
+    ])
+
+
+def test_query_excluding_null(collection):
+    test_name = "test_query_excluding_null"
+    _setup(collection)
+    if not _check(test_name, collection, {'a': 1}, [1, 4], True):
+        return False
+    if not _check(test_name, collection, {'a': {'$gt': 0}}, [1, 4], True):
+        return False
+    if not _check(test_name, collection, {'a': 2, 'b': {'$exists': False}}, [4], True):
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_query_matching_null(collection):
+    test_name = "test_query_matching_null"
+    _setup(collection)
+    # The index holds no entries for documents 3 and 5, so it can't answer queries that match a missing field
+    if not _check(test_name, collection, {'a': None}, [2, 3, 5], False):
+        return False
+    if not _check(test_name, collection, {'$or': [{'a': None}, {'a': 1}]}, [1, 2, 3, 4, 5], False):
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_update_adding_and_removing_field(collection):
+    test_name = "test_update_adding_and_removing_field"
+    _setup(collection)
+    collection.update_one({'_id': 1}, {'$unset': {'a': 1}})
+    collection.update_one({'_id': 3}, {'$set': {'a': 1}})
+    if not _check(test_name, collection, {'a': 1}, [3, 4], True):
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_compound_sparse_index(collection):
+    test_name = "test_compound_sparse_index"
+    collection.create_index([('a', pymongo.ASCENDING), ('b', pymongo.ASCENDING)], name='sparse', sparse=True)
+    collection.insert_many([{'_id': 1, 'a': 1}, {'_id': 2, 'b': 1}, {'_id': 3}])
+    # Documents with either field are indexed
+    if not _check(test_name, collection, {'a': 1}, [1], True):
+        return False
+    if not _check(test_name, collection, {'a': None}, [2, 3], False):
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_reject_bad_sparse_indexes(collection):
+    test_name = "test_reject_bad_sparse_indexes"
+    try:
+        collection.create_index([('a', pymongo.ASCENDING)], name='bad', sparse='yes')
+        print "{} accepted a non-boolean sparse option".format(test_name)
+        return False
+    except Exception:
+        pass
+    print "{} is OK".format(test_name)
+    return True
+
+
+tests = [locals()[attr] for attr in dir() if attr.startswith("test_")]
+
+#### `test_all()` is needed by the testing framework
+
+
+def test_all(collection1, collection2):
+    print "Sparse index tests only use first collection specified"
+    okay = True
+    client = collection1.database.client
+    tmp_db = client["sparse_index_tests_tmp_db"]
+    for t in tests:
+        tmp_db.drop_collection("sparse_index_tests_tmp_collection")
+        okay = t(tmp_db["sparse_index_tests_tmp_collection"]) and okay
+        if okay:
+            print util.alert("PASS", "okgreen")
+        else:
+            print util.alert("FAIL", "fail")
+    client.drop_database("sparse_index_tests_tmp_db")
+    return okay
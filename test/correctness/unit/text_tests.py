@@ -0,0 +1,158 @@
+#
+# text_tests.py
+#
+# This source file is part of the FoundationDB open source project
+#
+# Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# MongoDB is a registered trademark of MongoDB, Inc.
+#
+
+import pymongo
+from pymongo.errors import OperationFailure
+import util
+
+
+def _setup(collection):
+    collection.create_index([('title', pymongo.TEXT), ('tags', pymongo.TEXT)], name='text')
+    collection.insert_many([
+        {'_id': 1, 'title': 'Running with the Wolves', 'tags': ['nature']},
+        {'_id': 2, 'title': 'She runs, he walked.', 'tags': []},
+        {'_id': 3, 'title': 'Ponies and a pony', 'tags': ['Nature', 'farm']},
+        {'_id': 4, 'title': 'walking-tour of the FARM'},
+        {'_id': 5, 'title': 42, 'tags': 'run'},
+    ])
+
+
+def _check(test_name, collection, search, expected_ids):
+    ids = sorted(doc['_id'] for doc in collection.find({'$text': {'$search': search}}))
+    if ids != sorted(expected_ids):
+        print "{} {!r} returned {}, expected {}".format(test_name, search, ids, sorted(expected_ids))
+        return False
+    return True
+
+
+def test_tokenizing(collection):
+    test_name = "test_tokenizing"
+    _setup(collection)
+    # Case and punctuation don't matter, plurals and verb endings are stemmed, and arrays and other fields count too
+    checks = [
+        ('wolves', [1]),
+        ('RUN', [1, 2, 5]),
+        ('walk', [2, 4]),
+        ('pony', [3]),
+        ('farm', [3, 4]),
+        ('nature', [1, 3]),
+        ('tour', [4]),
+    ]
+    for search, expected_ids in checks:
+        if not _check(test_name, collection, search, expected_ids):
+            return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_all_terms(collection):
+    test_name = "test_all_terms"
+    _setup(collection)
+    # Every term must be present, and stop words are dropped rather than required
+    if not _check(test_name, collection, 'run nature', [1]):
+        return False
+    if not _check(test_name, collection, 'the walking', [2, 4]):
+        return False
+    if not _check(test_name, collection, 'the and of', []):
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_negation(collection):
+    test_name = "test_negation"
+    _setup(collection)
+    if not _check(test_name, collection, 'run -nature', [2, 5]):
+        return False
+    if not _check(test_name, collection, 'farm -walking', [3]):
+        return False
+    # A search of only negated terms matches nothing, as in MongoDB
+    if not _check(test_name, collection, '-nature', []):
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_follows_updates(collection):
+    test_name = "test_follows_updates"
+    _setup(collection)
+    collection.update_one({'_id': 2}, {'$set': {'title': 'A quiet farm'}})
+    collection.delete_one({'_id': 4})
+    if not _check(test_name, collection, 'farm', [2, 3]):
+        return False
+    if not _check(test_name, collection, 'walk', []):
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_rejected_searches(collection):
+    test_name = "test_rejected_searches"
+    _setup(collection)
+    bad = [
+        ({'$text': {'$search': '"walking tour"'}}, "a quoted phrase"),
+        ({'$text': {'$search': 'run', '$language': 'french'}}, "another language"),
+        ({'$text': {'$search': 'run', '$caseSensitive': True}}, "a case sensitive search"),
+    ]
+    for query, description in bad:
+        try:
+            list(collection.find(query))
+            print "{} accepted {}".format(test_name, description)
+            return False
+        except OperationFailure:
+            pass
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_needs_text_index(collection):
+    test_name = "test_needs_text_index"
+    collection.insert_one({'_id': 1, 'title': 'run'})
+    try:
+        list(collection.find({'$text': {'$search': 'run'}}))
+        print "{} searched a collection without a text index".format(test_name)
+        return False
+    except OperationFailure:
+        pass
+    print "{} is OK".format(test_name)
+    return True
+
+
+tests = [locals()[attr] for attr in dir() if attr.startswith("test_")]
+
+#### `test_all()` is needed by the testing framework
+
+
+def test_all(collection1, collection2):
+    print "Text tests only use first collection specified"
+    okay = True
+    client = collection1.database.client
+    tmp_db = client["text_tests_tmp_db"]
+    for t in tests:
+        tmp_db.drop_collection("text_tests_tmp_collection")
+        okay = t(tmp_db["text_tests_tmp_collection"]) and okay
+        if okay:
+            print util.alert("PASS", "okgreen")
+        else:
+            print util.alert("FAIL", "fail")
+    client.drop_database("text_tests_tmp_db")
+    return okay
@@ -0,0 +1,117 @@
+#
+# ttl_tests.py
+#
+# This source file is part of the FoundationDB open source project
+#
+# Copyright 2013-2018 Apple Inc. and the FoundationDB project authors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# MongoDB is a registered trademark of MongoDB, Inc.
+#
+
+import datetime
+import pymongo
+import time
+import util
+
+# run-tests.bash starts the Doc Layer with the TTL monitor waking up every second (--knob_ttl_monitor_interval 1) and
+# a 5 second lease, so an instance left holding the lease by an earlier run loses it quickly. Allow for the lease to
+# run out, a few passes and some slack.
+EXPIRY_TIMEOUT = 15
+
+
+def _expect_failure(func, args, kwargs, msg_on_error):
+    try:
+        func(*args, **kwargs)
+        print msg_on_error
+        return False
+    except Exception:
+        return True
+
+
+def test_create_ttl_index(collection):
+    test_name = "test_create_ttl_index"
+    collection.create_index([('at', pymongo.ASCENDING)], expireAfterSeconds=3600)
+    info = collection.index_information()
+    if 'at_1' not in info or info['at_1'].get('expireAfterSeconds') != 3600:
+        print "{} index was not listed with expireAfterSeconds: {}".format(test_name, info)
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_reject_bad_ttl_indexes(collection):
+    test_name = "test_reject_bad_ttl_indexes"
+    bad = [
+        ([('at', pymongo.ASCENDING)], {'expireAfterSeconds': -1}, "negative expireAfterSeconds"),
+        ([('at', pymongo.ASCENDING)], {'expireAfterSeconds': 'soon'}, "non-numeric expireAfterSeconds"),
+        ([('at', pymongo.ASCENDING), ('b', pymongo.ASCENDING)], {'expireAfterSeconds': 10}, "compound TTL index"),
+        ([('_id', pymongo.ASCENDING)], {'expireAfterSeconds': 10}, "TTL index on _id"),
+        ([('at', pymongo.HASHED)], {'expireAfterSeconds': 10}, "hashed TTL index"),
+    ]
+    for keys, options, description in bad:
+        if not _expect_failure(collection.create_index, (keys, ), options, "{} accepted {}".format(
+                test_name, description)):
+            return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_expire_documents(collection):
+    test_name = "test_expire_documents"
+    now = datetime.datetime.utcnow()
+    collection.insert_many([
+        {'_id': 'expired', 'at': now - datetime.timedelta(days=2)},
+        {'_id': 'expired in array', 'at': [now - datetime.timedelta(days=2), now + datetime.timedelta(days=2)]},
+        {'_id': 'fresh', 'at': now},
+        {'_id': 'not a date', 'at': 'yesterday'},
+        {'_id': 'no date'},
+    ])
+    collection.create_index([('at', pymongo.ASCENDING)], expireAfterSeconds=3600)
+
+    deadline = time.time() + EXPIRY_TIMEOUT
+    while collection.find({'_id': 'expired'}).count() > 0:
+        if time.time() > deadline:
+            print "{} expired document was not deleted within {} seconds".format(test_name, EXPIRY_TIMEOUT)
+            return False
+        time.sleep(1)
+
+    # An array expires with its earliest date
+    remaining = sorted(doc['_id'] for doc in collection.find())
+    if remaining != ['fresh', 'no date', 'not a date']:
+        print "{} wrong documents left: {}".format(test_name, remaining)
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+tests = [locals()[attr] for attr in dir() if attr.startswith("test_")]
+
+#### `test_all()` is needed by the testing framework
+
+
+def test_all(collection1, collection2):
+    print "TTL tests only use first collection specified"
+    okay = True
+    client = collection1.database.client
+    tmp_db = client["ttl_tests_tmp_db"]
+    for t in tests:
+        tmp_db.drop_collection("ttl_tests_tmp_collection")
+        okay = t(tmp_db["ttl_tests_tmp_collection"]) and okay
+        if okay:
+            print util.alert("PASS", "okgreen")
+        else:
+            print util.alert("FAIL", "fail")
+    client.drop_database("ttl_tests_tmp_db")
+    return okay
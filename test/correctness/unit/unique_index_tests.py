@@ -27,6 +27,7 @@ import itertools
 import pprint
 import pymongo
 import sys
+import threading
 import util
 from util import MongoModelException
 
@@ -281,6 +282,117 @@ def test_create_compound_unique_index(collection):
     return True
 
 
+def _run_concurrently(funcs):
+    # Runs each function in a thread of its own, and returns whether each succeeded
+    results = [None] * len(funcs)
+
+    def run(i):
+        try:
+            funcs[i]()
+            results[i] = True
+        except Exception:
+            results[i] = False
+
+    threads = [threading.Thread(target=run, args=(i, )) for i in range(len(funcs))]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    return results
+
+
+def _check_no_duplicates(test_name, collection, key):
+    values = [doc[key] for doc in collection.find({key: {'$exists': True}})]
+    if len(values) != len(set(values)):
+        print "{} found duplicated values of a unique index: {}".format(test_name, sorted(values))
+        return False
+    return True
+
+
+def test_insert_batch_unique_index(collection):
+    test_name = "test_insert_batch_unique_index"
+    random_key = "key-{}".format(random.randint(0, sys.maxint))
+    collection.create_index([(random_key, pymongo.ASCENDING)], unique=True)
+    if not _wrap(collection.insert_many, ([{random_key: i} for i in range(200)], ), {}, False,
+                 "{} non-colliding batch failed".format(test_name)):
+        return False
+    if collection.count() != 200:
+        print "{} non-colliding batch inserted {} documents".format(test_name, collection.count())
+        return False
+    # Values collide within the batch, and with what is already there
+    for batch in ([{random_key: i} for i in range(200, 300)] + [{random_key: 250}],
+                  [{random_key: i} for i in range(300, 400)] + [{random_key: 100}]):
+        try:
+            collection.insert_many(batch)
+            print "{} colliding batch was inserted".format(test_name)
+            return False
+        except Exception:
+            pass
+        if not _check_no_duplicates(test_name, collection, random_key):
+            return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_concurrent_inserts_unique_index(collection):
+    test_name = "test_concurrent_inserts_unique_index"
+    random_key = "key-{}".format(random.randint(0, sys.maxint))
+    collection.create_index([(random_key, pymongo.ASCENDING)], unique=True)
+
+    # Writers with values of their own all succeed
+    results = _run_concurrently(
+        [lambda i=i: collection.insert_many([{random_key: i * 100 + j} for j in range(100)]) for i in range(8)])
+    if not all(results) or collection.count() != 800:
+        print "{} non-colliding writers failed: {}, {} documents".format(test_name, results, collection.count())
+        return False
+
+    # Of writers inserting the same value, exactly one succeeds
+    for value in range(1000, 1010):
+        results = _run_concurrently([lambda v=value: collection.insert_one({random_key: v}) for _ in range(8)])
+        if results.count(True) != 1:
+            print "{} {} writers of value {} succeeded".format(test_name, results.count(True), value)
+            return False
+    if not _check_no_duplicates(test_name, collection, random_key):
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
+def test_inserts_during_unique_index_build(collection):
+    test_name = "test_inserts_during_unique_index_build"
+    random_key = "key-{}".format(random.randint(0, sys.maxint))
+    collection.insert_many([{random_key: i} for i in range(2000)])
+
+    # New values written while the index builds end up in it, and the build succeeds
+    results = _run_concurrently([
+        lambda: collection.create_index([(random_key, pymongo.ASCENDING)], unique=True),
+        lambda: collection.insert_many([{random_key: i} for i in range(2000, 2200)])
+    ])
+    if not all(results):
+        print "{} non-colliding inserts during the build failed: {}".format(test_name, results)
+        return False
+    if collection.find({random_key: {'$gte': 2000}}).count() != 200:
+        print "{} index is missing documents inserted during the build".format(test_name)
+        return False
+    if not _wrap(collection.insert, ({random_key: 2100}, ), {}, True,
+                 "{} duplicate of a value inserted during the build was accepted".format(test_name)):
+        return False
+    collection.drop_indexes()
+
+    # A duplicate written while the index builds either fails, or makes the build fail
+    results = _run_concurrently([
+        lambda: collection.create_index([(random_key, pymongo.ASCENDING)], unique=True),
+        lambda: collection.insert_one({random_key: 1500})
+    ])
+    if all(results):
+        print "{} both the build and a colliding insert succeeded".format(test_name)
+        return False
+    if results[0] and not _check_no_duplicates(test_name, collection, random_key):
+        return False
+    print "{} is OK".format(test_name)
+    return True
+
+
 def test_unique_index_backgroud_build_request(collection):
     test_name = 'test_unique_index_backgroud_build_request'
     random_key = "key-{}".format(random.randint(0, sys.maxint))